@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_ACTOR_H
+#define K2_ACTOR_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_SMALL_ALLOC_H
+#   include <k2/small_alloc.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   define  K2_STD_H_NEW
+#   include <new>
+#endif
+#ifndef K2_STD_H_CSTDDEF
+#   define  K2_STD_H_CSTDDEF
+#   include <cstddef>
+#endif
+
+namespace k2
+{
+
+    class actor_base;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct actor_system_impl;
+
+        //  Node of a mailbox. m_deliver() hands the message to the
+        //  actor, or only destroys it if the actor is 0, then returns
+        //  its storage to small_free().
+        struct actor_message
+        {
+            actor_message* volatile m_pnext;
+            void    (*m_deliver)(actor_base* pactor, actor_message* pmsg);
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Runs actors on a fixed set of threads.
+    *
+    *   An actor with pending messages is queued for the threads. An
+    *   activation delivers up to \a batch messages, then the actor goes
+    *   behind the others if more are pending, so one busy actor cannot
+    *   hold a thread.
+    */
+    class actor_system
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \param      thread_cnt  Number of threads, at least 1.
+        *   \param      batch       Messages delivered per activation, at
+        *                           least 1.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC explicit actor_system (size_t thread_cnt, size_t batch = 64);
+        /**
+        *   \brief      shutdown(), then discards messages sent since,
+        *               without delivering them.
+        */
+        K2_DLSPEC ~actor_system ();
+
+        /**
+        *   \brief      Delivers messages until none is pending, then
+        *               joins the threads.
+        *
+        *   Actors sending to each other without end keep it from
+        *   returning.
+        */
+        K2_DLSPEC void      shutdown ();
+
+        K2_DLSPEC size_t    size () const;
+
+    private:
+        friend class actor_base;
+
+        nonpublic::actor_system_impl*   m_pimpl;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Mailbox and scheduling state of an actor, see actor<>.
+    *
+    *   The mailbox is an intrusive multi-producer single-consumer queue,
+    *   a send is an exchange, a store and an increment; the first
+    *   message of an idle actor also queues it for the threads.
+    *
+    *   Actors are allocated by new and owned by actor_ptr<>. One being
+    *   activated stays alive until the activation ends, even if its last
+    *   actor_ptr<> is gone.
+    */
+    class actor_base
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Discards pending messages, without delivering
+        *               them.
+        */
+        K2_DLSPEC virtual ~actor_base ();
+
+        actor_system&   system () const
+        {
+            return  *m_psystem;
+        }
+
+    protected:
+        K2_DLSPEC explicit actor_base (actor_system& system);
+
+        K2_DLSPEC void  post_impl (nonpublic::actor_message* pmsg) throw ();
+
+    private:
+        template <typename ActorT> friend class actor_ptr;
+        friend struct nonpublic::actor_system_impl;
+
+        void    add_ref () throw ()
+        {
+            atomic_increase(m_refs);
+        }
+        void    release () throw ()
+        {
+            if (!atomic_decrease(m_refs))
+                delete  this;
+        }
+
+        nonpublic::actor_message*   pop () throw ();
+
+        actor_system*                       m_psystem;
+        //  Producers exchange the head; only the running activation
+        //  touches the tail.
+        nonpublic::actor_message* volatile  m_phead;
+        atomic_long_t                       m_pending;
+        atomic_int_t                        m_refs;
+        nonpublic::actor_message*           m_ptail;
+        nonpublic::actor_message            m_stub;
+        actor_base*                         m_pnext_ready;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      An actor receiving messages of MessageT.
+    *
+    *   receive() is called on a thread of the actor_system, one message
+    *   at a time and in the order sent by each sender. Exceptions from
+    *   it are discarded, as the sender is long gone.
+    *
+    *   Messages of up to 512 bytes, with the mailbox link, come from
+    *   per-thread pools; no lock is taken on sending or delivery unless
+    *   the pool of the thread runs dry or overflows.
+    */
+    template <typename MessageT>
+    class actor
+    :   public actor_base
+    {
+    public:
+        typedef MessageT    message_type;
+
+        /**
+        *   \brief      Queues a copy of \a msg. Thread safe.
+        *   \throw      bad_resource_alloc
+        */
+        void    send (const MessageT& msg)
+        {
+            void*   p = nonpublic::small_alloc(sizeof(envelope));
+            envelope*   penv;
+            try
+            {
+                //  If you get a compile error here, note that MessageT
+                //  has to be copy constructable.
+                penv = new (p) envelope(msg);
+            }
+            catch (...)
+            {
+                nonpublic::small_free(p, sizeof(envelope));
+                throw;
+            }
+            this->post_impl(penv);
+        }
+
+    protected:
+        explicit actor (actor_system& system)
+        :   actor_base(system)
+        {
+        }
+
+        virtual void    receive (MessageT& msg) = 0;
+
+    private:
+        struct envelope
+        :   public nonpublic::actor_message
+        {
+            MessageT    m_msg;
+
+            explicit envelope (const MessageT& msg)
+            :   m_msg(msg)
+            {
+                m_deliver = &envelope::deliver;
+            }
+
+            static void deliver (actor_base* pactor, nonpublic::actor_message* pmsg)
+            {
+                struct disposer
+                {
+                    envelope*   m_penv;
+
+                    ~disposer ()
+                    {
+                        m_penv->~envelope();
+                        nonpublic::small_free(m_penv, sizeof(envelope));
+                    }
+                }   guard = { static_cast<envelope*>(pmsg) };
+
+                if (pactor)
+                    static_cast<actor*>(pactor)->receive(guard.m_penv->m_msg);
+            }
+        };
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Reference counted handle of an actor.
+    */
+    template <typename ActorT>
+    class actor_ptr
+    {
+    public:
+        actor_ptr ()
+        :   m_pactor(0)
+        {
+        }
+        /**
+        *   \brief      Takes ownership of \a pactor, allocated by new.
+        */
+        explicit actor_ptr (ActorT* pactor)
+        :   m_pactor(pactor)
+        {
+            if (m_pactor)
+                m_pactor->add_ref();
+        }
+        actor_ptr (const actor_ptr& rhs)
+        :   m_pactor(rhs.m_pactor)
+        {
+            if (m_pactor)
+                m_pactor->add_ref();
+        }
+        template <typename OtherT>
+        actor_ptr (const actor_ptr<OtherT>& rhs)
+        :   m_pactor(rhs.get())
+        {
+            if (m_pactor)
+                m_pactor->add_ref();
+        }
+        ~actor_ptr ()
+        {
+            if (m_pactor)
+                m_pactor->release();
+        }
+
+        actor_ptr&  operator= (const actor_ptr& rhs)
+        {
+            actor_ptr(rhs).swap(*this);
+            return  *this;
+        }
+
+        void    reset (ActorT* pactor = 0)
+        {
+            actor_ptr(pactor).swap(*this);
+        }
+        void    swap (actor_ptr& rhs) throw ()
+        {
+            ActorT* ptmp = m_pactor;
+            m_pactor = rhs.m_pactor;
+            rhs.m_pactor = ptmp;
+        }
+
+        ActorT* get () const
+        {
+            return  m_pactor;
+        }
+        ActorT* operator-> () const
+        {
+            return  m_pactor;
+        }
+        ActorT& operator* () const
+        {
+            return  *m_pactor;
+        }
+
+    private:
+        ActorT* m_pactor;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_ACTOR_H
@@ -37,19 +37,28 @@ namespace k2
 {
 
 //  !kh!
-//  There are only two functions and a typedef in <bits/atomicity.h>.
-//  They are not typically used in user code. It's not likely to break anything.
+//  GCC versions are implemented with __sync_xxx() builtins, all
+//  read-modify-write operations imply a full memory barrier.
+//  On IA-32 and x86-64, aligned loads have acquire and aligned stores
+//  have release semantic, only compiler reordering needs to be prevented.
 #if defined(__GNUC__)
-    namespace nonpublic
-    {
-#       include <bits/atomicity.h>
-    }
+#   if defined(__i386__) || defined(__x86_64__)
+#       define  K2_ATOMIC_ACQUIRE_BARRIER() __asm__ __volatile__("" ::: "memory")
+#       define  K2_ATOMIC_RELEASE_BARRIER() __asm__ __volatile__("" ::: "memory")
+#   else
+#       define  K2_ATOMIC_ACQUIRE_BARRIER() __sync_synchronize()
+#       define  K2_ATOMIC_RELEASE_BARRIER() __sync_synchronize()
+#   endif
 #endif
 
     /**
     *   \brief  Typedef for atomic arithmetic type.
     */
     typedef volatile int    atomic_int_t;
+    /**
+    *   \brief  Typedef for pointer-width atomic arithmetic type.
+    */
+    typedef volatile long   atomic_long_t;
 
     /**
     *   \relates atomic_int_t
@@ -59,8 +68,7 @@ namespace k2
 #if defined(__GNUC__)
     inline bool atomic_increase (atomic_int_t& value) throw ()
     {
-        nonpublic::__exchange_and_add(&value, 1);
-        return  nonpublic::__exchange_and_add(&value, 0);
+        return  __sync_add_and_fetch(&value, 1) != 0;
     }
 #else
     K2_DLSPEC bool atomic_increase (atomic_int_t& value) throw ();
@@ -75,12 +83,221 @@ namespace k2
 #if defined(__GNUC__)
     inline bool atomic_decrease (atomic_int_t& value) throw ()
     {
-        nonpublic::__exchange_and_add(&value, -1);
-        return  i386_glibcxx::__exchange_and_add(&value, 0);
+        return  __sync_sub_and_fetch(&value, 1) != 0;
     }
 #else
     K2_DLSPEC bool atomic_decrease (atomic_int_t& value) throw ();
 #endif
+
+    /**
+    *   \relates atomic_int_t
+    *   \brief  Adds \a delta to \a value atomically.
+    *   \return The new value.
+    */
+#if defined(__GNUC__)
+    inline int atomic_add (atomic_int_t& value, int delta) throw ()
+    {
+        return  __sync_add_and_fetch(&value, delta);
+    }
+    inline long atomic_add (atomic_long_t& value, long delta) throw ()
+    {
+        return  __sync_add_and_fetch(&value, delta);
+    }
+#else
+    K2_DLSPEC int atomic_add (atomic_int_t& value, int delta) throw ();
+    K2_DLSPEC long atomic_add (atomic_long_t& value, long delta) throw ();
+#endif
+
+    /**
+    *   \relates atomic_int_t
+    *   \brief  Replaces \a value with \a desired atomically, if \a value
+    *           equals \a expected.
+    *   \return true, if replaced.
+    */
+#if defined(__GNUC__)
+    inline bool atomic_cas (
+        atomic_int_t& value, int expected, int desired) throw ()
+    {
+        return  __sync_bool_compare_and_swap(&value, expected, desired);
+    }
+    inline bool atomic_cas (
+        atomic_long_t& value, long expected, long desired) throw ()
+    {
+        return  __sync_bool_compare_and_swap(&value, expected, desired);
+    }
+#else
+    K2_DLSPEC bool atomic_cas (
+        atomic_int_t& value, int expected, int desired) throw ();
+    K2_DLSPEC bool atomic_cas (
+        atomic_long_t& value, long expected, long desired) throw ();
+#endif
+
+    /**
+    *   \relates atomic_int_t
+    *   \brief  Replaces \a value with \a desired atomically.
+    *   \return The original value.
+    */
+#if defined(__GNUC__)
+    inline int atomic_exchange (atomic_int_t& value, int desired) throw ()
+    {
+        //  __sync_lock_test_and_set() is only an acquire barrier.
+        __sync_synchronize();
+        return  __sync_lock_test_and_set(&value, desired);
+    }
+    inline long atomic_exchange (atomic_long_t& value, long desired) throw ()
+    {
+        __sync_synchronize();
+        return  __sync_lock_test_and_set(&value, desired);
+    }
+#else
+    K2_DLSPEC int atomic_exchange (atomic_int_t& value, int desired) throw ();
+    K2_DLSPEC long atomic_exchange (atomic_long_t& value, long desired) throw ();
+#endif
+
+    /**
+    *   \relates atomic_int_t
+    *   \brief  Loads \a value, with acquire semantic.
+    */
+#if defined(__GNUC__)
+    inline int atomic_load (const atomic_int_t& value) throw ()
+    {
+        int     ret = value;
+        K2_ATOMIC_ACQUIRE_BARRIER();
+        return  ret;
+    }
+    inline long atomic_load (const atomic_long_t& value) throw ()
+    {
+        long    ret = value;
+        K2_ATOMIC_ACQUIRE_BARRIER();
+        return  ret;
+    }
+#else
+    K2_DLSPEC int atomic_load (const atomic_int_t& value) throw ();
+    K2_DLSPEC long atomic_load (const atomic_long_t& value) throw ();
+#endif
+
+    /**
+    *   \relates atomic_int_t
+    *   \brief  Stores \a desired to \a value, with release semantic.
+    */
+#if defined(__GNUC__)
+    inline void atomic_store (atomic_int_t& value, int desired) throw ()
+    {
+        K2_ATOMIC_RELEASE_BARRIER();
+        value = desired;
+    }
+    inline void atomic_store (atomic_long_t& value, long desired) throw ()
+    {
+        K2_ATOMIC_RELEASE_BARRIER();
+        value = desired;
+    }
+#else
+    K2_DLSPEC void atomic_store (atomic_int_t& value, int desired) throw ();
+    K2_DLSPEC void atomic_store (atomic_long_t& value, long desired) throw ();
+#endif
+
+    /**
+    *   \brief  Full memory barrier, neither loads nor stores are reordered
+    *           across it.
+    */
+#if defined(__GNUC__)
+    inline void memory_barrier () throw ()
+    {
+        __sync_synchronize();
+    }
+#else
+    K2_DLSPEC void  memory_barrier () throw ();
+#endif
+
+    /**
+    *   \brief  Hints the processor that calling thread is spin-waiting.
+    */
+#if defined(__GNUC__)
+    inline void cpu_relax () throw ()
+    {
+#   if defined(__i386__) || defined(__x86_64__)
+        __asm__ __volatile__("pause" ::: "memory");
+#   else
+        __asm__ __volatile__("" ::: "memory");
+#   endif
+    }
+#else
+    K2_DLSPEC void  cpu_relax () throw ();
+#endif
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+#   if defined(__GNUC__)
+        inline bool atomic_cas_ptr (
+            void* volatile& ptr, void* expected, void* desired) throw ()
+        {
+            return  __sync_bool_compare_and_swap(&ptr, expected, desired);
+        }
+        inline void* atomic_exchange_ptr (
+            void* volatile& ptr, void* desired) throw ()
+        {
+            __sync_synchronize();
+            return  __sync_lock_test_and_set(&ptr, desired);
+        }
+#   else
+        K2_DLSPEC bool  atomic_cas_ptr (
+            void* volatile& ptr, void* expected, void* desired) throw ();
+        K2_DLSPEC void* atomic_exchange_ptr (
+            void* volatile& ptr, void* desired) throw ();
+#   endif
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \brief  Pointer version of atomic_cas().
+    */
+    template <typename T>
+    inline bool atomic_cas (T* volatile& ptr, T* expected, T* desired) throw ()
+    {
+        return  nonpublic::atomic_cas_ptr(
+            reinterpret_cast<void* volatile&>(ptr),
+            const_cast<void*>(static_cast<const volatile void*>(expected)),
+            const_cast<void*>(static_cast<const volatile void*>(desired)));
+    }
+    /**
+    *   \brief  Pointer version of atomic_exchange().
+    */
+    template <typename T>
+    inline T* atomic_exchange (T* volatile& ptr, T* desired) throw ()
+    {
+        return  static_cast<T*>(nonpublic::atomic_exchange_ptr(
+            reinterpret_cast<void* volatile&>(ptr),
+            const_cast<void*>(static_cast<const volatile void*>(desired))));
+    }
+    /**
+    *   \brief  Pointer version of atomic_load().
+    */
+    template <typename T>
+    inline T* atomic_load (T* volatile const& ptr) throw ()
+    {
+        T*  ret = ptr;
+#if defined(__GNUC__)
+        K2_ATOMIC_ACQUIRE_BARRIER();
+#else
+        memory_barrier();
+#endif
+        return  ret;
+    }
+    /**
+    *   \brief  Pointer version of atomic_store().
+    */
+    template <typename T>
+    inline void atomic_store (T* volatile& ptr, T* desired) throw ()
+    {
+#if defined(__GNUC__)
+        K2_ATOMIC_RELEASE_BARRIER();
+#else
+        memory_barrier();
+#endif
+        ptr = desired;
+    }
+
 }   //  namespace k2
 
 #endif  //  !K2_ATOMIC_H
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_BARRIER_H
+#define K2_BARRIER_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Reusable barrier for a fixed number of threads.
+    *
+    *   Each phase completes when \a parties threads have arrived, the
+    *   last one to arrive unblocks the others and starts the next phase.
+    *   At most 65535 parties.
+    *   \relates    timestamp
+    */
+    class barrier
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        explicit barrier (int parties)
+        :   m_parties(parties)
+        ,   m_state(0)
+        ,   m_waiters(0)
+        {
+        }
+
+        /**
+        *   \brief      Arrives at the current phase, blocks calling thread
+        *               until it completes.
+        *   \return     true, for the thread that completed the phase.
+        */
+        bool arrive_and_wait ()
+        {
+            return  this->arrive_and_wait_impl(0) > 0;
+        }
+        /**
+        *   \brief      Arrives at the current phase, blocks calling thread
+        *               until it completes, or until timed-out.
+        *
+        *   A timed-out thread withdraws its arrival, so it may arrive
+        *   again at the same phase.
+        *
+        *   \return     false, if timed-out.
+        */
+        bool arrive_and_wait (const timestamp& timer)
+        {
+            return  this->arrive_and_wait_impl(&timer) >= 0;
+        }
+
+        int parties () const
+        {
+            return  m_parties;
+        }
+
+    private:
+        //  1 if completed the phase, 0 if waited, -1 if timed-out.
+        K2_DLSPEC int   arrive_and_wait_impl (const timestamp* ptimer);
+
+        const int       m_parties;
+        //  Phase in the high 16 bits, threads arrived at it in the low
+        //  16 bits, so that a withdrawal never crosses a phase.
+        atomic_int_t    m_state;
+        atomic_int_t    m_waiters;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_BARRIER_H
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_CANCELLATION_H
+#define K2_CANCELLATION_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /**
+    *   \ingroup    Exception
+    *   \brief      Thrown by waits given a cancel_token, once the token
+    *               is cancelled.
+    */
+    struct cancelled_error : exception
+    {
+        explicit cancelled_error (const char* what = "cancelled_error") throw ()
+            :   exception(what) {};
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct cancel_state;
+
+        //  Leading part of cancel_state, polled inline.
+        struct cancel_state_head
+        {
+            //  Futex word, non-zero once cancelled.
+            atomic_int_t    m_cancelled;
+            atomic_int_t    m_refs;
+        };
+
+        //  Node of the intrusive callback list of a cancel_state.
+        struct cancel_callback
+        {
+            void            (*m_fire)(void*);
+            void*           m_arg;
+            cancel_callback*    m_pprev;
+            cancel_callback*    m_pnext;
+            bool            m_linked;
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Shared, one-shot cancellation request.
+    *
+    *   Copies of a cancel_token refer to the same state. cancelled() is a
+    *   lock-free load, cancel() wakes every wait given the token at once:
+    *   futex waits, cond_var::wait() and socket waits alike, the latter
+    *   through an eventfd (a self-pipe on other POSIX systems) created on
+    *   first use of wait_desc().
+    *
+    *   Every k2 thread owns one, see thread::this_cancel_token().
+    */
+    class cancel_token
+    {
+    public:
+        /**
+        *   \brief      Constructs a new, not cancelled, state.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC cancel_token ();
+        K2_DLSPEC cancel_token (const cancel_token& rhs);
+        K2_DLSPEC ~cancel_token ();
+        K2_DLSPEC cancel_token& operator= (const cancel_token& rhs);
+
+        /**
+        *   \brief      Requests cancellation.
+        *
+        *   Idempotent. The first call wakes all waits given *this, then
+        *   runs the registered callbacks on the calling thread. Must not
+        *   be called with a mutex held that a registered callback acquires,
+        *   e.g. the one of a cond_var waited with *this.
+        *
+        *   A callback that throws does not stop the others, the first
+        *   exception is rethrown once all have run.
+        */
+        K2_DLSPEC void  cancel ();
+
+        /**
+        *   \brief      Returns true once cancel() has been called.
+        */
+        bool    cancelled () const
+        {
+            return  atomic_load(m_pstate->m_cancelled) != 0;
+        }
+
+        /**
+        *   \brief      Throws cancelled_error if cancelled.
+        */
+        void    throw_if_cancelled () const
+        {
+            if (this->cancelled())
+                throw   cancelled_error();
+        }
+
+        /**
+        *   \brief      Blocks calling thread until cancelled.
+        */
+        K2_DLSPEC void  wait () const;
+        /**
+        *   \brief      Blocks calling thread until cancelled or \a timer.
+        *   \return     true if cancelled.
+        */
+        K2_DLSPEC bool  wait (const timestamp& timer) const;
+
+        /**
+        *   \brief      Returns a descriptor that becomes readable once
+        *               cancelled, for use with select() or poll().
+        *
+        *   Created on first call and owned by the state. Returns -1 where
+        *   not supported; waits then fall back to short time slices.
+        *
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC int   wait_desc () const;
+
+        bool    operator== (const cancel_token& rhs) const
+        {
+            return  m_pstate == rhs.m_pstate;
+        }
+        bool    operator!= (const cancel_token& rhs) const
+        {
+            return  m_pstate != rhs.m_pstate;
+        }
+
+        /**
+        *   \brief      Runs a callback on cancellation, for as long as
+        *               *this lives.
+        *
+        *   The callback runs on the thread calling cancel_token::cancel(),
+        *   unless the token was already cancelled on construction, in
+        *   which case it never runs; check cancelled() after registering.
+        *   Destruction waits for a callback running on another thread, so
+        *   a callback must not destroy its own registration.
+        */
+        class registration
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            K2_DLSPEC registration (
+                const cancel_token& token, void (*callback)(void*), void* arg);
+            K2_DLSPEC ~registration ();
+
+            /**
+            *   \brief      Unregisters without blocking.
+            *   \return     false if the callback is now running on another
+            *               thread, call release() then.
+            */
+            K2_DLSPEC bool  try_release ();
+            /**
+            *   \brief      Unregisters, waits for a running callback.
+            */
+            K2_DLSPEC void  release ();
+
+        private:
+            nonpublic::cancel_state*    m_pstate;
+            nonpublic::cancel_callback  m_node;
+        };
+
+    private:
+        friend class registration;
+
+        //  Points to a nonpublic::cancel_state.
+        nonpublic::cancel_state_head*   m_pstate;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_CANCELLATION_H
@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_CONCURRENT_HASH_MAP_H
+#define K2_CONCURRENT_HASH_MAP_H
+
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_RECLAIM_H
+#   include <k2/reclaim.h>
+#endif
+#ifndef K2_MUTEX_H
+#   include <k2/mutex.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Hash and equality of keys of concurrent_hash_map<>.
+    *
+    *   Uses the hash() and compare() contract of k2 types, e.g.
+    *   ipv4::transport_addr. Specialize it for other key types. Only the
+    *   low 32 bits of hash() are used.
+    */
+    template <typename KeyT>
+    struct hash_traits
+    {
+        static unsigned int hash (const KeyT& key)
+        {
+            return  static_cast<unsigned int>(key.hash());
+        }
+        static bool equal (const KeyT& lhs, const KeyT& rhs)
+        {
+            return  lhs.compare(rhs) == 0;
+        }
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Hash map that can be read concurrently without locking.
+    *
+    *   Keys are spread over segments, each with its own bucket table and
+    *   its own mutex, which serializes writers of that segment only.
+    *   Readers never lock, they traverse the buckets in an epoch_guard
+    *   critical section.
+    *
+    *   Nodes are never modified after they are published. Updates replace
+    *   a node, and a segment grows by rebuilding its table aside, while
+    *   readers keep using the old one. Replaced nodes and tables are
+    *   retired to epoch_reclaimer.
+    *
+    *   KeyT and MappedT have to be copy-constructable, lookups return
+    *   copies of mapped values.
+    */
+    template <typename KeyT,
+              typename MappedT,
+              typename TraitsT = hash_traits<KeyT> >
+    class concurrent_hash_map
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef KeyT    key_type;
+        typedef MappedT mapped_type;
+
+        /**
+        *   \brief      Allocates resource for *this.
+        *   \param      segments    Number of independently locked
+        *                           segments, rounded up to a power of two,
+        *                           at most 256.
+        *   \param      buckets     Initial number of buckets per segment,
+        *                           rounded up to a power of two.
+        *   \throw      bad_resource_alloc
+        */
+        explicit concurrent_hash_map (size_t segments = 16, size_t buckets = 16)
+        :   m_psegments(0)
+        ,   m_segment_mask(concurrent_hash_map::round_up(
+                segments < 256 ? segments : 256) - 1)
+        {
+            try
+            {
+                m_psegments = new segment[m_segment_mask + 1];
+
+                size_t  idx = 0;
+                for (; idx <= m_segment_mask; ++idx)
+                {
+                    m_psegments[idx].m_ptable =
+                        new table(concurrent_hash_map::round_up(buckets));
+                }
+            }
+            catch (std::bad_alloc& x)
+            {
+                this->destroy();
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+        /**
+        *   \brief      Destroys all nodes, no thread may be accessing
+        *               *this.
+        */
+        ~concurrent_hash_map ()
+        {
+            this->destroy();
+        }
+
+        /**
+        *   \brief      Number of elements, exact only when no write is in
+        *               progress.
+        */
+        size_t  size () const
+        {
+            long    size = 0;
+            size_t  idx = 0;
+            for (; idx <= m_segment_mask; ++idx)
+                size += atomic_load(m_psegments[idx].m_size);
+            return  size_t(size);
+        }
+        bool    empty () const
+        {
+            return  this->size() == 0;
+        }
+
+        /**
+        *   \brief      Copies the value mapped to \a key to \a value,
+        *               without locking.
+        *   \return     true, if \a key was found.
+        */
+        bool find (const KeyT& key, MappedT& value) const
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            const segment&  seg = this->segment_of(hash);
+
+            epoch_guard critical_section;
+            const node* pnode = seg.find(key, hash);
+            if (pnode == 0)
+                return  false;
+            value = pnode->m_value;
+            return  true;
+        }
+        /**
+        *   \brief      Tests if \a key is in *this, without locking.
+        */
+        bool contains (const KeyT& key) const
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            const segment&  seg = this->segment_of(hash);
+
+            epoch_guard critical_section;
+            return  seg.find(key, hash) != 0;
+        }
+
+        /**
+        *   \brief      Maps \a key to \a value, if \a key is not in *this.
+        *   \return     true, if inserted.
+        *   \throw      bad_resource_alloc
+        */
+        bool insert (const KeyT& key, const MappedT& value)
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            segment&    seg = this->segment_of(hash);
+
+            mutex::scoped_guard guard(seg.m_mtx);
+            node* volatile* plink = seg.link_of(key, hash);
+            if (*plink)
+                return  false;
+
+            seg.link(new_node(key, value, hash));
+            return  true;
+        }
+        /**
+        *   \brief      Maps \a key to \a value, replacing the current
+        *               mapping, if any.
+        *   \return     true, if inserted. false, if replaced.
+        *   \throw      bad_resource_alloc
+        */
+        bool insert_or_assign (const KeyT& key, const MappedT& value)
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            segment&    seg = this->segment_of(hash);
+
+            mutex::scoped_guard guard(seg.m_mtx);
+            node* volatile* plink = seg.link_of(key, hash);
+            if (*plink)
+            {
+                seg.replace(plink, new_node(key, value, hash));
+                return  false;
+            }
+
+            seg.link(new_node(key, value, hash));
+            return  true;
+        }
+        /**
+        *   \brief      Maps \a key to \a value, if \a key is not in *this,
+        *               otherwise replaces the mapped value by a copy
+        *               modified by update(copy).
+        *
+        *   update is called with the segment of \a key locked, it should
+        *   be short and must not access *this.
+        *
+        *   \return     true, if inserted. false, if updated.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename UpdateF>
+        bool insert_or_update (
+            const KeyT&     key,
+            const MappedT&  value,
+            UpdateF         update)
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            segment&    seg = this->segment_of(hash);
+
+            mutex::scoped_guard guard(seg.m_mtx);
+            node* volatile* plink = seg.link_of(key, hash);
+            if (*plink)
+            {
+                MappedT updated((*plink)->m_value);
+                update(updated);
+                seg.replace(plink, new_node(key, updated, hash));
+                return  false;
+            }
+
+            seg.link(new_node(key, value, hash));
+            return  true;
+        }
+        /**
+        *   \brief      Removes \a key from *this.
+        *   \return     true, if removed.
+        */
+        bool erase (const KeyT& key)
+        {
+            unsigned int    hash = concurrent_hash_map::mix(TraitsT::hash(key));
+            segment&    seg = this->segment_of(hash);
+
+            mutex::scoped_guard guard(seg.m_mtx);
+            node* volatile* plink = seg.link_of(key, hash);
+            node*           pnode = *plink;
+            if (pnode == 0)
+                return  false;
+
+            atomic_store(*plink, pnode->m_pnext);
+            atomic_add(seg.m_size, -1);
+            epoch_reclaimer::retire(pnode);
+            return  true;
+        }
+        /**
+        *   \brief      Removes all elements.
+        */
+        void clear ()
+        {
+            size_t  idx = 0;
+            for (; idx <= m_segment_mask; ++idx)
+            {
+                segment&    seg = m_psegments[idx];
+                mutex::scoped_guard guard(seg.m_mtx);
+
+                table*  ptable = seg.m_ptable;
+                size_t  bucket = 0;
+                for (; bucket <= ptable->m_mask; ++bucket)
+                {
+                    node*   pnode = atomic_exchange(
+                        ptable->m_pbuckets[bucket], static_cast<node*>(0));
+                    while (pnode)
+                    {
+                        node*   pnext = pnode->m_pnext;
+                        epoch_reclaimer::retire(pnode);
+                        pnode = pnext;
+                    }
+                }
+                atomic_store(seg.m_size, 0L);
+            }
+        }
+
+    private:
+        struct node
+        {
+            const KeyT          m_key;
+            const MappedT       m_value;
+            const unsigned int  m_hash;
+            node* volatile      m_pnext;
+
+            node (const KeyT& key, const MappedT& value, unsigned int hash)
+            :   m_key(key)
+            ,   m_value(value)
+            ,   m_hash(hash)
+            ,   m_pnext(0)
+            {
+            }
+        };
+        struct table
+        {
+            const size_t    m_mask;
+            node* volatile* m_pbuckets;
+
+            explicit table (size_t buckets)
+            :   m_mask(buckets - 1)
+            ,   m_pbuckets(new node* volatile[buckets])
+            {
+                size_t  idx = 0;
+                for (; idx < buckets; ++idx)
+                    m_pbuckets[idx] = 0;
+            }
+            ~table ()
+            {
+                delete [] m_pbuckets;
+            }
+            node* volatile& bucket_of (unsigned int hash) const
+            {
+                //  Segments are chosen by the high bits.
+                return  m_pbuckets[hash & m_mask];
+            }
+        };
+        struct segment
+        {
+            mutex           m_mtx;
+            table* volatile m_ptable;
+            atomic_long_t   m_size;
+            char            m_pad[K2_OPT_CACHE_LINE_BYTES];
+
+            segment ()
+            :   m_ptable(0)
+            ,   m_size(0)
+            {
+            }
+
+            //  Called in an epoch_guard critical section.
+            const node* find (const KeyT& key, unsigned int hash) const
+            {
+                const table*    ptable = atomic_load(m_ptable);
+                const node*     pnode = atomic_load(ptable->bucket_of(hash));
+                for (; pnode; pnode = atomic_load(pnode->m_pnext))
+                {
+                    if (pnode->m_hash == hash &&
+                        TraitsT::equal(pnode->m_key, key))
+                        return  pnode;
+                }
+                return  0;
+            }
+
+            //  Link pointing to the node of key, or the null link at the
+            //  end of its bucket. Called with m_mtx locked.
+            node* volatile* link_of (const KeyT& key, unsigned int hash)
+            {
+                node* volatile* plink = &m_ptable->bucket_of(hash);
+                for (; *plink; plink = &(*plink)->m_pnext)
+                {
+                    node*   pnode = *plink;
+                    if (pnode->m_hash == hash &&
+                        TraitsT::equal(pnode->m_key, key))
+                        break;
+                }
+                return  plink;
+            }
+            //  Called with m_mtx locked.
+            void replace (node* volatile* plink, node* pnode)
+            {
+                node*   pold = *plink;
+                pnode->m_pnext = pold->m_pnext;
+                atomic_store(*plink, pnode);
+                epoch_reclaimer::retire(pold);
+            }
+            //  Called with m_mtx locked.
+            void link (node* pnode)
+            {
+                if (size_t(m_size) > m_ptable->m_mask)
+                    this->grow();
+
+                node* volatile& bucket = m_ptable->bucket_of(pnode->m_hash);
+                pnode->m_pnext = bucket;
+                atomic_store(bucket, pnode);
+                atomic_add(m_size, 1);
+            }
+            //  Rebuilds the table twice as large with copies of all nodes,
+            //  readers may be traversing the current chains meanwhile.
+            //  Called with m_mtx locked.
+            void grow ()
+            {
+                table*  pold = m_ptable;
+                table*  pnew = 0;
+                try
+                {
+                    pnew = new table((pold->m_mask + 1) << 1);
+
+                    size_t  idx = 0;
+                    for (; idx <= pold->m_mask; ++idx)
+                    {
+                        const node* pnode = pold->m_pbuckets[idx];
+                        for (; pnode; pnode = pnode->m_pnext)
+                        {
+                            node*           pcopy = new node(
+                                pnode->m_key, pnode->m_value, pnode->m_hash);
+                            node* volatile& bucket =
+                                pnew->bucket_of(pnode->m_hash);
+                            pcopy->m_pnext = bucket;
+                            bucket = pcopy;
+                        }
+                    }
+                }
+                catch (std::bad_alloc&)
+                {
+                    //  Keeps the current table, with longer chains.
+                    if (pnew)
+                        concurrent_hash_map::destroy(pnew);
+                    return;
+                }
+
+                atomic_store(m_ptable, pnew);
+
+                size_t  idx = 0;
+                for (; idx <= pold->m_mask; ++idx)
+                {
+                    node*   pnode = pold->m_pbuckets[idx];
+                    while (pnode)
+                    {
+                        node*   pnext = pnode->m_pnext;
+                        epoch_reclaimer::retire(pnode);
+                        pnode = pnext;
+                    }
+                }
+                epoch_reclaimer::retire(pold);
+            }
+        };
+
+        static size_t round_up (size_t count)
+        {
+            size_t  rounded = 1;
+            while (rounded < count)
+                rounded <<= 1;
+            return  rounded;
+        }
+        //  Spreads poor hash values, e.g. of addresses in a subnet, over
+        //  all bits.
+        static unsigned int mix (unsigned int hash)
+        {
+            hash ^= hash >> 16;
+            hash *= 0x85ebca6bU;
+            hash ^= hash >> 13;
+            hash *= 0xc2b2ae35U;
+            hash ^= hash >> 16;
+            return  hash;
+        }
+        static node* new_node (const KeyT& key, const MappedT& value, unsigned int hash)
+        {
+            try
+            {
+                return  new node(key, value, hash);
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+        static void destroy (table* ptable)
+        {
+            size_t  idx = 0;
+            for (; idx <= ptable->m_mask; ++idx)
+            {
+                node*   pnode = ptable->m_pbuckets[idx];
+                while (pnode)
+                {
+                    node*   pnext = pnode->m_pnext;
+                    delete  pnode;
+                    pnode = pnext;
+                }
+            }
+            delete  ptable;
+        }
+
+        segment& segment_of (unsigned int hash) const
+        {
+            return  m_psegments[(hash >> 24) & m_segment_mask];
+        }
+        void destroy ()
+        {
+            if (m_psegments == 0)
+                return;
+
+            size_t  idx = 0;
+            for (; idx <= m_segment_mask; ++idx)
+            {
+                if (m_psegments[idx].m_ptable)
+                    concurrent_hash_map::destroy(m_psegments[idx].m_ptable);
+            }
+            delete [] m_psegments;
+            m_psegments = 0;
+        }
+
+        segment*        m_psegments;
+        const size_t    m_segment_mask;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_CONCURRENT_HASH_MAP_H
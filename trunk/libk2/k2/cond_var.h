@@ -32,11 +32,16 @@
 #ifndef K2_DLSPEC_H
 #   include <k2/dlspec.h>
 #endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
 
 namespace k2
 {
 
     class mutex;
+    class timestamp;
+    class cancel_token;
 
     /** \defgroup   Threading
     */
@@ -79,7 +84,7 @@ namespace k2
         {
             while (pred() == false)
             {
-                this->wait(mxg);
+                this->wait();
             }
         }
 
@@ -93,10 +98,29 @@ namespace k2
         {
             while (pred() == false)
             {
-                this->wait(mxg, timer);
+                this->wait(timer);
             }
         }
 
+        /**
+        *   \brief      Waits for *this to be signalled, or \a token to be
+        *               cancelled.
+        *
+        *   \pre        As wait().
+        *   \return     false, if \a token has been cancelled.
+        *
+        *   Cancellation broadcasts *this under the associated mutex, so
+        *   cancel_token::cancel() must not be called holding it.
+        */
+        K2_DLSPEC bool wait (const cancel_token& token);
+        /**
+        *   \brief      Waits for *this to be signalled, \a token to be
+        *               cancelled, or \a timer.
+        *
+        *   \return     false, if timed-out or \a token has been cancelled.
+        */
+        K2_DLSPEC bool wait (const timestamp& timer, const cancel_token& token);
+
         /**
         *   \brief      Signals to one of waiting threads.
         */
@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_COROUTINE_H
+#define K2_COROUTINE_H
+
+//  Stackless counterparts of fiber.h, for C++20 compilers only.
+#if !defined(K2_HAS_COROUTINES)
+#   if (__cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)) \
+        && defined(__cpp_impl_coroutine)
+#       define  K2_HAS_COROUTINES
+#   endif
+#endif
+
+#if defined(K2_HAS_COROUTINES)
+
+#ifndef K2_EVENT_LOOP_H
+#   include <k2/event_loop.h>
+#endif
+#ifndef K2_SMALL_ALLOC_H
+#   include <k2/small_alloc.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+#ifndef K2_IPV4_TCP_H
+#   include <k2/ipv4_tcp.h>
+#endif
+#ifndef K2_IPV4_UDP_H
+#   include <k2/ipv4_udp.h>
+#endif
+
+#ifndef K2_STD_H_COROUTINE
+#   define  K2_STD_H_COROUTINE
+#   include <coroutine>
+#endif
+#ifndef K2_STD_H_EXCEPTION
+#   define  K2_STD_H_EXCEPTION
+#   include <exception>
+#endif
+#ifndef K2_STD_H_MEMORY
+#   define  K2_STD_H_MEMORY
+#   include <memory>
+#endif
+#ifndef K2_STD_H_OPTIONAL
+#   define  K2_STD_H_OPTIONAL
+#   include <optional>
+#endif
+#ifndef K2_STD_H_UTILITY
+#   define  K2_STD_H_UTILITY
+#   include <utility>
+#endif
+
+namespace k2
+{
+
+    template <typename T>
+    class task;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct task_promise_base
+        {
+            //  Resumes the awaiting coroutine, if any, by symmetric
+            //  transfer, leaving the frame to its task.
+            struct final_awaiter
+            {
+                bool    await_ready () const noexcept
+                {
+                    return  false;
+                }
+                template <typename PromiseT>
+                std::coroutine_handle<>
+                    await_suspend (std::coroutine_handle<PromiseT> self) noexcept
+                {
+                    std::coroutine_handle<>  next = self.promise().m_continuation;
+                    return  next ? next : std::noop_coroutine();
+                }
+                void    await_resume () const noexcept
+                {
+                }
+            };
+
+            std::coroutine_handle<>     m_continuation;
+            std::exception_ptr          m_error;
+
+            //  Frames come from small_alloc() size classes, so a
+            //  suspended request costs a pooled block rather than a
+            //  stack.
+            static void*    operator new (size_t bytes)
+            {
+                return  small_alloc(bytes);
+            }
+            static void     operator delete (void* p, size_t bytes)
+            {
+                small_free(p, bytes);
+            }
+
+            std::suspend_always initial_suspend () const noexcept
+            {
+                return  std::suspend_always();
+            }
+            final_awaiter   final_suspend () const noexcept
+            {
+                return  final_awaiter();
+            }
+            void    unhandled_exception () noexcept
+            {
+                m_error = std::current_exception();
+            }
+            void    rethrow () const
+            {
+                if (m_error)
+                    std::rethrow_exception(m_error);
+            }
+        };
+
+        template <typename T>
+        struct task_promise : task_promise_base
+        {
+            std::optional<T>    m_value;
+
+            task<T> get_return_object () noexcept;
+
+            template <typename ValueT>
+            void    return_value (ValueT&& value)
+            {
+                m_value.emplace(std::forward<ValueT>(value));
+            }
+            T       result ()
+            {
+                this->rethrow();
+                return  std::move(*m_value);
+            }
+        };
+
+        template <>
+        struct task_promise<void> : task_promise_base
+        {
+            task<void>  get_return_object () noexcept;
+
+            void    return_void () noexcept
+            {
+            }
+            void    result ()
+            {
+                this->rethrow();
+            }
+        };
+
+        //  Runs on its own, absorbing exceptions, frees its frame once
+        //  done.
+        struct detached_task
+        {
+            struct promise_type
+            {
+                static void*    operator new (size_t bytes)
+                {
+                    return  small_alloc(bytes);
+                }
+                static void     operator delete (void* p, size_t bytes)
+                {
+                    small_free(p, bytes);
+                }
+
+                detached_task   get_return_object () noexcept
+                {
+                    return  detached_task();
+                }
+                std::suspend_never  initial_suspend () const noexcept
+                {
+                    return  std::suspend_never();
+                }
+                std::suspend_never  final_suspend () const noexcept
+                {
+                    return  std::suspend_never();
+                }
+                void    return_void () noexcept
+                {
+                }
+                void    unhandled_exception () noexcept
+                {
+                }
+            };
+        };
+
+        template <typename T>
+        detached_task   run_detached (task<T> work)
+        {
+            co_await std::move(work);
+        }
+
+    }   //  namespace nonpublic
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Networking
+    */
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Lazily started coroutine resolving to a \a T.
+    *
+    *   A task starts once co_await'ed, resuming its awaiter when done
+    *   by symmetric transfer, or by spawn() or sync_wait(). Exceptions
+    *   escaping the coroutine are rethrown to the awaiter. Frames come
+    *   from k2 memory pools.
+    */
+    template <typename T = void>
+    class task
+    {
+    public:
+        typedef nonpublic::task_promise<T>  promise_type;
+
+        task (task&& other) noexcept
+        :   m_handle(std::exchange(other.m_handle, handle_type()))
+        {
+        }
+        task& operator= (task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (m_handle)
+                    m_handle.destroy();
+                m_handle = std::exchange(other.m_handle, handle_type());
+            }
+            return  *this;
+        }
+        ~task ()
+        {
+            if (m_handle)
+                m_handle.destroy();
+        }
+
+        /**
+        *   \brief      true once the coroutine has completed.
+        */
+        bool    done () const noexcept
+        {
+            return  !m_handle || m_handle.done();
+        }
+
+        bool    await_ready () const noexcept
+        {
+            return  false;
+        }
+        std::coroutine_handle<>
+            await_suspend (std::coroutine_handle<> awaiting) noexcept
+        {
+            m_handle.promise().m_continuation = awaiting;
+            return  m_handle;
+        }
+        T       await_resume ()
+        {
+            return  m_handle.promise().result();
+        }
+
+    private:
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+        friend struct nonpublic::task_promise<T>;
+        template <typename ValueT>
+        friend ValueT   sync_wait (event_loop& loop, task<ValueT> work);
+
+        explicit task (handle_type handle) noexcept
+        :   m_handle(handle)
+        {
+        }
+
+        handle_type m_handle;
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        template <typename T>
+        task<T>
+        task_promise<T>::get_return_object () noexcept
+        {
+            return  task<T>(
+                std::coroutine_handle<task_promise>::from_promise(*this));
+        }
+        inline task<void>
+        task_promise<void>::get_return_object () noexcept
+        {
+            return  task<void>(
+                std::coroutine_handle<task_promise>::from_promise(*this));
+        }
+    }   //  namespace nonpublic
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Starts \a work on its own, its result and exceptions
+    *               are discarded.
+    */
+    template <typename T>
+    void    spawn (task<T> work)
+    {
+        nonpublic::run_detached(std::move(work));
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Starts \a work, then runs \a loop until it is done.
+    *   \return     Result of \a work, or rethrows its exception.
+    */
+    template <typename T>
+    T   sync_wait (event_loop& loop, task<T> work)
+    {
+        work.m_handle.resume();
+        while (work.m_handle.done() == false)
+            loop.run_once(time_span(60 * 1000));
+        return  work.m_handle.promise().result();
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Awaits a descriptor becoming ready, see
+    *               event_loop::watch().
+    *
+    *   co_await resolves to false if the timer given expired first.
+    */
+    class io_ready
+    {
+    public:
+        io_ready (
+            event_loop& loop, int desc, bool for_write,
+            const timestamp* ptimer = 0)
+        :   m_loop(loop)
+        ,   m_desc(desc)
+        ,   m_for_write(for_write)
+        ,   m_ptimer(ptimer)
+        ,   m_ready(false)
+        {
+        }
+
+        bool    await_ready () const noexcept
+        {
+            return  false;
+        }
+        /**
+        *   \throw      runtime_error if the descriptor is awaited that
+        *               way already.
+        */
+        void    await_suspend (std::coroutine_handle<> awaiting)
+        {
+            m_awaiting = awaiting;
+            if (m_loop.watch(
+                    m_desc, m_for_write, io_ready::on_event, this,
+                    m_ptimer) == false)
+            {
+                throw   runtime_error("k2::io_ready, awaited already");
+            }
+        }
+        bool    await_resume () const noexcept
+        {
+            return  m_ready;
+        }
+
+    private:
+        static void on_event (void* arg, bool ready)
+        {
+            io_ready*   self = static_cast<io_ready*>(arg);
+            self->m_ready = ready;
+            self->m_awaiting.resume();
+        }
+
+        event_loop&                 m_loop;
+        const int                   m_desc;
+        const bool                  m_for_write;
+        const timestamp*            m_ptimer;
+        bool                        m_ready;
+        std::coroutine_handle<>     m_awaiting;
+    };
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Reads what \a transport has, up to \a bytes, once
+    *               readable.
+    *   \return     Bytes read, 0 if the connection was closed by peer.
+    *   \throw      socket_connection_error
+    */
+    inline task<size_t> async_read (
+        event_loop& loop, ipv4::tcp_transport& transport,
+        char* buf, size_t bytes)
+    {
+        for (;;)
+        {
+            size_t  done = transport.try_read(buf, bytes);
+            if (done != ipv4::tcp_transport::would_block)
+                co_return   done;
+            co_await io_ready(loop, transport.get_desc(), false);
+        }
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Writes all \a bytes, as they fit in \a transport.
+    *   \throw      socket_connection_error
+    */
+    inline task<size_t> async_write (
+        event_loop& loop, ipv4::tcp_transport& transport,
+        const char* buf, size_t bytes)
+    {
+        size_t  bytes_done = 0;
+        while (bytes_done < bytes)
+        {
+            size_t  done = transport.try_write(
+                buf + bytes_done, bytes - bytes_done);
+            if (done == ipv4::tcp_transport::would_block)
+                co_await io_ready(loop, transport.get_desc(), true);
+            else
+                bytes_done += done;
+        }
+        co_return   bytes;
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Accepts the next connection of \a listener.
+    *   \throw      socket_open_error
+    */
+    inline task<std::unique_ptr<ipv4::tcp_transport> > async_accept (
+        event_loop& loop, ipv4::tcp_listener& listener)
+    {
+        for (;;)
+        {
+            std::auto_ptr<ipv4::tcp_transport>  accepted =
+                listener.try_accept();
+            if (accepted.get())
+            {
+                co_return   std::unique_ptr<ipv4::tcp_transport>(
+                    accepted.release());
+            }
+            co_await io_ready(loop, listener.get_desc(), false);
+        }
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Connects to \a remote_addr.
+    *   \throw      socket_open_error, socket_connect_error
+    */
+    inline task<std::unique_ptr<ipv4::tcp_transport> > async_connect (
+        event_loop& loop, const ipv4::transport_addr& remote_addr)
+    {
+        std::unique_ptr<ipv4::tcp_transport>    transport(
+            new ipv4::tcp_transport(
+                remote_addr, ipv4::tcp_transport::connect_deferred));
+        co_await io_ready(loop, transport->get_desc(), true);
+        transport->finish_connect();
+        co_return   std::move(transport);
+    }
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Reads the next datagram of \a transport, up to
+    *               \a bytes.
+    *   \return     Bytes read, or udp_transport::io_error.
+    */
+    inline task<size_t> async_recvfrom (
+        event_loop& loop, ipv4::udp_transport& transport,
+        char* buf, size_t bytes, ipv4::transport_addr& remote_addr)
+    {
+        for (;;)
+        {
+            size_t  done = transport.try_read(buf, bytes, remote_addr);
+            if (done != ipv4::udp_transport::would_block)
+                co_return   done;
+            co_await io_ready(loop, transport.get_desc(), false);
+        }
+    }
+
+}   //  namespace k2
+
+#endif  //  K2_HAS_COROUTINES
+
+#endif  //  !K2_COROUTINE_H
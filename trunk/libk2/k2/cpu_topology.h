@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_CPU_TOPOLOGY_H
+#define K2_CPU_TOPOLOGY_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+
+#ifndef K2_STD_H_CSTDDEF
+#   include <cstddef>
+#   define  K2_STD_H_CSTDDEF
+#endif
+
+#ifndef K2_STD_H_VECTOR
+#   include <vector>
+#   define  K2_STD_H_VECTOR
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Layout of CPUs, physical cores, packages (sockets) and
+    *               shared caches, and which CPUs calling process may use.
+    *
+    *   On Linux it is read from /sys/devices/system/cpu, the affinity mask
+    *   from sched_getaffinity() and the CPU quota from the cgroup (v2
+    *   cpu.max, or v1 cpu.cfs_quota_us). Elsewhere each CPU is taken as a
+    *   core of its own, in a single package.
+    *
+    *   placement() turns a policy into the CPU each thread of a pool, or
+    *   of a server, is to be pinned to, see thread::set_affinity().
+    */
+    class cpu_topology
+    {
+    public:
+        //  Highest cache level described.
+        static const int    max_cache_level = 3;
+
+        struct cpu
+        {
+            int     m_id;
+            //  Package (socket) id.
+            int     m_package;
+            //  Physical core, numbered from 0 across all packages.
+            int     m_core;
+            //  Index of this CPU among the SMT siblings of its core.
+            int     m_smt;
+            //  Lowest CPU sharing the data or unified cache of each
+            //  level, CPUs with the same value share it. -1 if unknown.
+            int     m_cache_group[max_cache_level + 1];
+            size_t  m_cache_bytes[max_cache_level + 1];
+            //  In the affinity mask of calling process.
+            bool    m_allowed;
+        };
+
+        enum policy_enum
+        {
+            //  Fills SMT siblings, then cores, then packages, so that
+            //  neighbouring threads share caches.
+            compact,
+            //  Spreads over packages, then cores, SMT siblings last, for
+            //  the most cache and memory bandwidth per thread.
+            spread,
+            //  One thread per physical core, no SMT sibling shared.
+            one_per_core
+        };
+
+        /**
+        *   \brief      Discovers the topology of the system.
+        */
+        K2_DLSPEC cpu_topology ();
+
+        /**
+        *   \brief      The topology discovered on first reference.
+        */
+        K2_DLSPEC static const cpu_topology&    system ();
+
+        /**
+        *   \brief      Online CPUs, by ascending id.
+        */
+        const std::vector<cpu>& cpus () const
+        {
+            return  m_cpus;
+        }
+        size_t package_count () const
+        {
+            return  m_package_cnt;
+        }
+        size_t core_count () const
+        {
+            return  m_core_cnt;
+        }
+        /**
+        *   \brief      CPU quota of the cgroup of calling process, in
+        *               CPUs, 0 if not limited.
+        */
+        double cpu_quota () const
+        {
+            return  m_quota;
+        }
+
+        /**
+        *   \brief      Ids of CPUs calling process may run on.
+        */
+        K2_DLSPEC std::vector<int>  allowed_cpus () const;
+        /**
+        *   \brief      Number of threads that can run at once: allowed
+        *               CPUs, capped by the cgroup quota. At least 1.
+        */
+        K2_DLSPEC size_t    usable_cpu_count () const;
+        /**
+        *   \brief      Tests if two CPUs share the cache of a level.
+        */
+        K2_DLSPEC bool      shares_cache (int cpu_a, int cpu_b, int level) const;
+
+        /**
+        *   \brief      The allowed CPU for each of thread_cnt threads,
+        *               by policy. Wraps around if threads outnumber the
+        *               CPUs, or the cores for one_per_core.
+        */
+        K2_DLSPEC std::vector<int>  placement (
+            policy_enum policy, size_t thread_cnt) const;
+
+    private:
+        const cpu*  find (int cpu_id) const;
+
+        std::vector<cpu>    m_cpus;
+        size_t              m_package_cnt;
+        size_t              m_core_cnt;
+        double              m_quota;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_CPU_TOPOLOGY_H
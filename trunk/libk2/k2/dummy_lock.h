@@ -50,6 +50,7 @@ namespace k2
 
         void acquire () {}
         bool acquire (const timestamp& timer) {return   true;}
+        bool try_acquire () {return   true;}
         void release () {}
     };
 
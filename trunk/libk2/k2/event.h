@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_EVENT_H
+#define K2_EVENT_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_FUTEX_H
+#   include <k2/futex.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Signalled/non-signalled flag threads can wait for.
+    *
+    *   A manual-reset event stays signalled until reset(), and unblocks
+    *   all waiting threads, e.g. a one-shot "started" or "stopping"
+    *   notification. An auto-reset event is reset by the one thread it
+    *   unblocks.
+    *   \relates    timestamp
+    */
+    class event
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        explicit event (bool auto_reset = false, bool signalled = false)
+        :   m_signalled(signalled ? 1 : 0)
+        ,   m_waiters(0)
+        ,   m_auto_reset(auto_reset)
+        {
+        }
+
+        /**
+        *   \brief      Signals *this, and unblocks all waiting threads,
+        *               or one if *this is auto-reset.
+        */
+        void set ()
+        {
+            //  Orders the flag before reading waiters, see wait_slow().
+            atomic_exchange(m_signalled, 1);
+            memory_barrier();
+            if (K2_OPT_BRANCH_FALSE(atomic_load(m_waiters) != 0))
+            {
+                if (m_auto_reset)
+                    nonpublic::futex_wake(m_signalled, 1);
+                else
+                    nonpublic::futex_wake_all(m_signalled);
+            }
+        }
+        /**
+        *   \brief      Resets *this to non-signalled.
+        */
+        void reset ()
+        {
+            atomic_store(m_signalled, 0);
+        }
+        /**
+        *   \brief      Tests if *this is signalled, resetting it if it is
+        *               auto-reset, never blocks calling thread.
+        */
+        bool try_wait ()
+        {
+            if (m_auto_reset)
+                return  atomic_cas(m_signalled, 1, 0);
+            return  atomic_load(m_signalled) != 0;
+        }
+        /**
+        *   \brief      Blocks calling thread until *this is signalled.
+        */
+        void wait ()
+        {
+            if (K2_OPT_BRANCH_FALSE(this->try_wait() == false))
+                this->wait_slow(0);
+        }
+        /**
+        *   \brief      Blocks calling thread until *this is signalled, or
+        *               until timed-out.
+        *   \return     true, if signalled. false, if timed-out.
+        */
+        bool wait (const timestamp& timer)
+        {
+            if (K2_OPT_BRANCH_TRUE(this->try_wait()))
+                return  true;
+            return  this->wait_slow(&timer);
+        }
+
+    private:
+        K2_DLSPEC bool  wait_slow (const timestamp* ptimer);
+
+        atomic_int_t    m_signalled;
+        atomic_int_t    m_waiters;
+        const bool      m_auto_reset;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_EVENT_H
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_EVENT_LOOP_H
+#define K2_EVENT_LOOP_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_THREAD_POOL_H
+#   include <k2/thread_pool.h>
+#endif
+#ifndef K2_TIMER_WHEEL_H
+#   include <k2/timer_wheel.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+    class time_span;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct event_loop_impl;
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Networking
+    */
+
+    /**
+    *   \ingroup    Networking
+    *   \brief      Single-threaded readiness event loop.
+    *
+    *   Calls a handler once a descriptor becomes readable or writable,
+    *   using epoll on Linux and poll() elsewhere. Each watch is one-shot,
+    *   a handler wanting more events watches again. Watches, timers of
+    *   timers() and tasks given to post() all run on the thread calling
+    *   run() or run_once().
+    *
+    *   Only post() and stop() may be called from other threads. Without
+    *   a wake-up descriptor, on Windows, the loop notices them within
+    *   10 ms.
+    */
+    class event_loop
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Handler of a watch, \a ready is false if the
+        *               watch timed out.
+        */
+        typedef void    (*handler)(void* arg, bool ready);
+
+        /**
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC event_loop ();
+        /**
+        *   \brief      Discards pending watches and tasks, without
+        *               calling them.
+        */
+        K2_DLSPEC ~event_loop ();
+
+        /**
+        *   \brief      Calls \a fn(\a arg, true) once \a desc becomes
+        *               readable, or writable if \a for_write.
+        *
+        *   Hang-ups and errors count as ready, for the following I/O to
+        *   report them. If \a ptimer is given and expires first, calls
+        *   \a fn(\a arg, false) instead. A descriptor has at most one
+        *   watch each way, and has to stay open while watched.
+        *
+        *   \return     false if \a desc is watched that way already.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC bool  watch (
+            int desc, bool for_write, handler fn, void* arg,
+            const timestamp* ptimer = 0);
+        /**
+        *   \brief      Discards the watch of \a desc, if any, without
+        *               calling it.
+        */
+        K2_DLSPEC bool  unwatch (int desc, bool for_write);
+
+        /**
+        *   \brief      Runs a copy of \a task on the loop thread, before
+        *               the loop waits next. Thread safe.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename TaskT>
+        void    post (const TaskT& task)
+        {
+            std::auto_ptr<nonpublic::pool_task>  ptask;
+            try
+            {
+                //  If you get a compile error here, note that task has
+                //  to be copy constructable.
+                ptask.reset(new nonpublic::pool_task(task));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            this->post_impl(ptask.get());
+            ptask.release();
+        }
+
+        /**
+        *   \brief      Timers firing on the loop thread.
+        */
+        K2_DLSPEC timer_wheel&  timers ();
+
+        /**
+        *   \brief      Runs watches, timers and tasks until stop().
+        */
+        K2_DLSPEC void      run ();
+        /**
+        *   \brief      Waits up to \a max_wait for one batch of events,
+        *               then runs it with timers due and tasks posted.
+        *   \return     Number of handlers, timers and tasks run.
+        */
+        K2_DLSPEC size_t    run_once (const time_span& max_wait);
+        /**
+        *   \brief      Makes run() return once the batch running is done.
+        *               Thread safe.
+        */
+        K2_DLSPEC void      stop ();
+
+        /**
+        *   \brief      Number of watches pending.
+        */
+        K2_DLSPEC size_t    watches () const;
+
+    private:
+        K2_DLSPEC void  post_impl (nonpublic::pool_task* ptask);
+
+        nonpublic::event_loop_impl* m_pimpl;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_EVENT_LOOP_H
@@ -56,8 +56,8 @@ namespace k2
 
         explicit exception (const char* what = "exception") throw ()
         {
-            std::strncpy(m_what, what, sizeof(what));
-            m_what[sizeof(what)] = 0;
+            std::strncpy(m_what, what, max_what);
+            m_what[max_what] = 0;
         }
 
         virtual const char* what () const throw ()
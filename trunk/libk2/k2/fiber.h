@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_FIBER_H
+#define K2_FIBER_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_MUTEX_H
+#   include <k2/mutex.h>
+#endif
+#ifndef K2_THREAD_POOL_H
+#   include <k2/thread_pool.h>
+#endif
+#ifndef K2_TIMER_WHEEL_H
+#   include <k2/timer_wheel.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+    class time_span;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct fiber_cntx;
+        struct fiber_scheduler_impl;
+
+        //  A fiber, or a thread, blocked in fiber_mutex or fiber_cond_var.
+        struct fiber_waiter
+        {
+            fiber_cntx*     m_pfiber;
+            uint32_t        m_serial;
+            const timestamp*    m_ptimer;
+            timer_wheel::handle m_timer;
+            //  Set by wake(), for a thread waiter.
+            atomic_int_t    m_ready;
+            fiber_waiter*   m_pnext;
+            fiber_waiter*   m_pprev;
+            bool            m_linked;
+            bool            m_timedout;
+
+            //  Prepares calling fiber, or thread, to block until woken,
+            //  or ptimer if not 0. Call before making *this visible to
+            //  wakers.
+            //  \throw      bad_resource_alloc
+            K2_DLSPEC void  prepare (const timestamp* ptimer);
+            //  Blocks, then sets m_timedout.
+            K2_DLSPEC void  wait ();
+            //  Call with the lock guarding *this held, so that a thread
+            //  waiter can not leave before.
+            //  \return     false, if a fiber waiter has timed-out already.
+            K2_DLSPEC bool  wake ();
+        };
+
+        //  Intrusive FIFO of waiters.
+        struct fiber_wait_queue
+        {
+            fiber_waiter*   m_phead;
+            fiber_waiter*   m_ptail;
+
+            fiber_wait_queue ()
+            :   m_phead(0)
+            ,   m_ptail(0)
+            {
+            }
+            K2_DLSPEC void          push (fiber_waiter* pwaiter);
+            K2_DLSPEC fiber_waiter* pop ();
+            K2_DLSPEC void          remove (fiber_waiter* pwaiter);
+        };
+
+        //  Blocks calling fiber until desc is readable, or writable, or
+        //  timer. Used by k2 sockets.
+        //  \return     1 if ready, 0 if timed-out, -1 if calling thread
+        //              runs no fiber or waiting is not supported; then
+        //              block the thread.
+        K2_DLSPEC int   fiber_wait_desc (
+            int desc, bool for_write, const timestamp* ptimer);
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      M:N scheduler running fibers on a few carrier threads.
+    *
+    *   A fiber is a user-space thread with its own stack. Blocking in
+    *   fiber::sleep(), fiber_mutex, fiber_cond_var or in reads and writes
+    *   of k2 sockets parks the fiber and lets its carrier run others; a
+    *   parked fiber resumes on any carrier. Blocking in anything else,
+    *   e.g. k2::mutex, blocks the carrier.
+    *
+    *   Stacks are mmap()-ed with a guard page below, and pooled.
+    *   Context switches are a few instructions on x86-64 Linux, and
+    *   swapcontext() elsewhere, or if K2_FIBER_USE_UCONTEXT is defined.
+    *   Socket waits park on epoll on Linux, and block the carrier
+    *   elsewhere.
+    *
+    *   Exceptions thrown by fibers are absorbed.
+    */
+    class fiber_scheduler
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Starts \a carrier_cnt carrier threads.
+        *   \param      stack_size  Usable stack bytes of each fiber.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC explicit fiber_scheduler (
+            size_t carrier_cnt, size_t stack_size = 64 * 1024);
+        /**
+        *   \brief      shutdown(), then releases resource.
+        */
+        K2_DLSPEC ~fiber_scheduler ();
+
+        /**
+        *   \brief      Runs a copy of \a entry in a new fiber.
+        *   \return     false, if *this has been shut down.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename FiberEntry>
+        bool    spawn (const FiberEntry& entry)
+        {
+            std::auto_ptr<nonpublic::pool_task>  ptask;
+            try
+            {
+                //  If you get a compile error here, note that entry has
+                //  to be copy constructable.
+                ptask.reset(new nonpublic::pool_task(entry));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            if (this->spawn_impl(ptask.get()) == false)
+                return  false;
+            ptask.release();
+            return  true;
+        }
+
+        /**
+        *   \brief      Waits for all fibers to finish, then joins the
+        *               carriers.
+        *   \pre        Not called from a fiber of *this.
+        */
+        K2_DLSPEC void      shutdown ();
+
+        /**
+        *   \brief      Number of carrier threads.
+        */
+        K2_DLSPEC size_t    size () const;
+        /**
+        *   \brief      Number of fibers spawned and not yet finished.
+        */
+        K2_DLSPEC size_t    fiber_count () const;
+
+    private:
+        K2_DLSPEC bool  spawn_impl (nonpublic::pool_task* ptask);
+
+        nonpublic::fiber_scheduler_impl*    m_pimpl;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Operations on the calling fiber.
+    *
+    *   Called from a thread running no fiber, they act on the thread.
+    */
+    class fiber
+    {
+    public:
+        /**
+        *   \brief      Tests if calling thread is running a fiber.
+        */
+        K2_DLSPEC static bool   on_fiber ();
+        /**
+        *   \brief      Lets other ready fibers run.
+        */
+        K2_DLSPEC static void   yield ();
+        /**
+        *   \brief      Parks calling fiber for \a span.
+        */
+        K2_DLSPEC static void   sleep (const time_span& span);
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Mutex parking fibers, rather than their carriers.
+    *
+    *   Ownership is handed to waiters in FIFO order. Threads running no
+    *   fiber may use it too.
+    */
+    class fiber_mutex
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef scoped_guard<fiber_mutex>   scoped_guard;
+
+        fiber_mutex ()
+        :   m_locked(false)
+        {
+        }
+
+        K2_DLSPEC void  acquire ();
+        K2_DLSPEC bool  try_acquire ();
+        K2_DLSPEC void  release ();
+
+    private:
+        mutex                       m_lock;
+        bool                        m_locked;
+        nonpublic::fiber_wait_queue m_waiters;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Condition variable parking fibers, associated with a
+    *               fiber_mutex.
+    */
+    class fiber_cond_var
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        explicit fiber_cond_var (fiber_mutex& mtx)
+        :   m_mtx(mtx)
+        {
+        }
+
+        /**
+        *   \brief      Waits for *this to be signalled.
+        *   \pre        Calling fiber has acquired the associated mutex.
+        */
+        K2_DLSPEC void  wait ();
+        /**
+        *   \brief      Waits for *this to be signalled, or \a timer.
+        *   \return     false, if timed-out.
+        */
+        K2_DLSPEC bool  wait (const timestamp& timer);
+
+        template <typename pred_t_>
+        void    wait (pred_t_ pred)
+        {
+            while (pred() == false)
+            {
+                this->wait();
+            }
+        }
+
+        K2_DLSPEC void  signal ();
+        K2_DLSPEC void  broadcast ();
+
+    private:
+        fiber_mutex&                m_mtx;
+        mutex                       m_lock;
+        nonpublic::fiber_wait_queue m_waiters;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_FIBER_H
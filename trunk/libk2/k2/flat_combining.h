@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_FLAT_COMBINING_H
+#define K2_FLAT_COMBINING_H
+
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_SPIN_LOCK_H
+#   include <k2/spin_lock.h>
+#endif
+#ifndef K2_TLS_H
+#   include <k2/tls_ptr.h>
+#endif
+#ifndef K2_THREAD_H
+#   include <k2/thread.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+
+#ifndef K2_STD_H_MEMORY
+#   include <memory>
+#   define  K2_STD_H_MEMORY
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Flat-combining wrapper of a sequential object.
+    *
+    *   Instead of each thread locking the object in turn, a thread
+    *   publishes its operation in its own record and tries to become the
+    *   combiner. The combiner applies all published operations in one
+    *   pass, while the others wait for their records to be served. The
+    *   object's cache lines stay with one thread for a whole batch.
+    *
+    *   Operations are functors taking SequentialT&, results are returned
+    *   through their members. Operations should not throw, an operation
+    *   that throws fails with critical_error, in the calling thread.
+    *
+    *   Each object uses a thread-local storage key.
+    */
+    template <typename SequentialT>
+    class flat_combining
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef SequentialT object_type;
+
+        /**
+        *   \throw      bad_resource_alloc
+        */
+        flat_combining ()
+        :   m_precords(0)
+        {
+        }
+        /**
+        *   \throw      bad_resource_alloc
+        */
+        explicit flat_combining (const SequentialT& object)
+        :   m_object(object)
+        ,   m_precords(0)
+        {
+        }
+        /**
+        *   \brief      Releases records, no operation may be in progress.
+        */
+        ~flat_combining ()
+        {
+            record* precord = m_precords;
+            while (precord)
+            {
+                record* pnext = precord->m_pnext;
+                record::release(precord);
+                precord = pnext;
+            }
+        }
+
+        /**
+        *   \brief      Applies operation(object), combined with operations
+        *               of other threads.
+        *   \throw      critical_error, if operation threw.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename OperationT>
+        void apply (OperationT& operation)
+        {
+            record& rec = this->record_of_thread();
+            rec.m_poperation = &operation;
+            rec.m_invoke = flat_combining::invoke<OperationT>;
+            atomic_store(rec.m_state, record::pending);
+
+            size_t  spins = 0;
+            for (;;)
+            {
+                if (m_combiner_lock.try_acquire())
+                {
+                    this->combine();
+                    m_combiner_lock.release();
+                }
+
+                int state = atomic_load(rec.m_state);
+                if (state == record::served)
+                    return;
+                if (K2_OPT_BRANCH_FALSE(state == record::failed))
+                    throw   critical_error("flat_combining: operation threw");
+
+                if (++spins < 64)
+                {
+                    cpu_relax();
+                }
+                else
+                {
+                    spins = 0;
+                    thread::sched_yield();
+                }
+            }
+        }
+
+        /**
+        *   \brief      The wrapped object, for single-threaded use only.
+        */
+        SequentialT&    unsafe_object ()
+        {
+            return  m_object;
+        }
+
+    private:
+        struct record
+        {
+            enum state_enum
+            {
+                served,
+                pending,
+                failed
+            };
+
+            atomic_int_t    m_state;
+            void*           m_poperation;
+            void            (*m_invoke)(void*, SequentialT&);
+            //  Owning thread, if any, plus the list of *this.
+            atomic_int_t    m_refs;
+            atomic_int_t    m_bound;
+            record*         m_pnext;
+            char            m_pad[K2_OPT_CACHE_LINE_BYTES];
+
+            record ()
+            :   m_state(served)
+            ,   m_poperation(0)
+            ,   m_invoke(0)
+            ,   m_refs(2)
+            ,   m_bound(1)
+            ,   m_pnext(0)
+            {
+            }
+
+            static void release (record* precord)
+            {
+                if (atomic_add(precord->m_refs, -1) == 0)
+                    delete  precord;
+            }
+        };
+        //  Stored in thread-local storage, unbinds the record on thread
+        //  exit, it may then be reused by another thread.
+        struct binding
+        {
+            record* m_precord;
+
+            explicit binding (record* precord)
+            :   m_precord(precord)
+            {
+            }
+            ~binding ()
+            {
+                atomic_store(m_precord->m_bound, 0);
+                record::release(m_precord);
+            }
+        };
+
+        template <typename OperationT>
+        static void invoke (void* poperation, SequentialT& object)
+        {
+            (*reinterpret_cast<OperationT*>(poperation))(object);
+        }
+
+        record& record_of_thread ()
+        {
+            binding*    pbinding = m_bindings.get();
+            if (K2_OPT_BRANCH_TRUE(pbinding != 0))
+                return  *pbinding->m_precord;
+
+            try
+            {
+                std::auto_ptr<binding>  guard(new binding(this->bind_record()));
+                m_bindings.reset(guard.get());
+                return  *guard.release()->m_precord;
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+        //  Reuses a record of an exited thread, or publishes a new one.
+        record* bind_record ()
+        {
+            record* precord = atomic_load(m_precords);
+            for (; precord; precord = precord->m_pnext)
+            {
+                if (atomic_load(precord->m_bound) == 0 &&
+                    atomic_cas(precord->m_bound, 0, 1))
+                {
+                    atomic_add(precord->m_refs, 1);
+                    return  precord;
+                }
+            }
+
+            std::auto_ptr<record>   pnew(new record);
+            record*                 phead;
+            do
+            {
+                phead = atomic_load(m_precords);
+                pnew->m_pnext = phead;
+            }
+            while (atomic_cas(m_precords, phead, pnew.get()) == false);
+            return  pnew.release();
+        }
+        //  Called with m_combiner_lock acquired.
+        void combine ()
+        {
+            record* precord = atomic_load(m_precords);
+            for (; precord; precord = precord->m_pnext)
+            {
+                if (atomic_load(precord->m_state) != record::pending)
+                    continue;
+
+                int state = record::served;
+                try
+                {
+                    precord->m_invoke(precord->m_poperation, m_object);
+                }
+                catch (...)
+                {
+                    state = record::failed;
+                }
+                atomic_store(precord->m_state, state);
+            }
+        }
+
+        SequentialT         m_object;
+        spin_lock           m_combiner_lock;
+        record* volatile    m_precords;
+        tls_ptr<binding>    m_bindings;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_FLAT_COMBINING_H
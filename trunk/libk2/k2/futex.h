@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_FUTEX_H
+#define K2_FUTEX_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        /*
+        *   Parking of threads on the address of an atomic word, the slow
+        *   path of semaphore, latch, barrier and event.
+        *
+        *   futex_wait() blocks calling thread only if word still equals
+        *   expected, until woken by futex_wake(), or timed-out. It may
+        *   also return spuriously, callers re-check their condition.
+        *   Returns false only if timed-out.
+        *
+        *   Uses futex(2) on Linux, and a hashed table of mutexes and
+        *   condition variables elsewhere.
+        */
+        K2_DLSPEC bool  futex_wait (
+            atomic_int_t& word, int expected, const timestamp* ptimer);
+        K2_DLSPEC void  futex_wake (atomic_int_t& word, int count);
+        K2_DLSPEC void  futex_wake_all (atomic_int_t& word);
+    }
+#endif  //  !DOXYGEN_BLIND
+
+}   //  namespace k2
+
+#endif  //  !K2_FUTEX_H
@@ -0,0 +1,879 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_FUTURE_H
+#define K2_FUTURE_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+#ifndef K2_THREAD_H
+#   include <k2/thread.h>
+#endif
+
+#ifndef K2_STD_H_VECTOR
+#   include <vector>
+#   define  K2_STD_H_VECTOR
+#endif
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+#ifndef K2_STD_H_ITERATOR
+#   include <iterator>
+#   define  K2_STD_H_ITERATOR
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /**
+    *   \ingroup    Exception
+    *   \brief      Exception class for future<> and promise<>, e.g.
+    *               a promise<> destroyed without being satisfied.
+    */
+    struct future_error : exception
+    {
+        explicit future_error (const char* what = "future_error") throw ()
+            :   exception(what) {};
+    };
+
+    template <typename T>
+    class future;
+    template <typename T>
+    class promise;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct future_access;
+        template <typename T>
+        class promise_base;
+
+        //  Holds an exception caught by catch (...), by its k2 type and
+        //  what(), as C++98 has no exception_ptr. std::exception maps to
+        //  runtime_error, std::bad_alloc to bad_resource_alloc, any other
+        //  type to exception.
+        struct exception_holder
+        {
+            int     m_kind;
+            char    m_what[exception::max_what + 1];
+
+            //  Call in a catch block only.
+            K2_DLSPEC void  capture ();
+            K2_DLSPEC void  rethrow () const;
+        };
+
+        //  A continuation, fired once, when the state it is subscribed to
+        //  becomes ready. m_fire() reclaims the callback.
+        struct future_callback
+        {
+            void                (*m_fire)(future_callback*);
+            future_callback*    m_pnext;
+        };
+
+        class future_state_base
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            future_state_base ()
+            :   m_refs(1)
+            ,   m_promises(1)
+            ,   m_claimed(0)
+            ,   m_done(0)
+            ,   m_pcallbacks(0)
+            ,   m_failed(false)
+            {
+            }
+            virtual ~future_state_base ()
+            {
+            }
+
+            void add_ref ()
+            {
+                atomic_increase(m_refs);
+            }
+            void release ()
+            {
+                if (atomic_decrease(m_refs) == 0)
+                    delete  this;
+            }
+            void add_promise ()
+            {
+                atomic_increase(m_promises);
+            }
+            //  Breaks *this, if the last promise goes unsatisfied.
+            K2_DLSPEC void  release_promise ();
+
+            bool ready () const
+            {
+                return  atomic_load(m_done) == done;
+            }
+            void wait ()
+            {
+                if (this->ready() == false)
+                    this->wait_slow(0);
+            }
+            bool wait (const timestamp& timer)
+            {
+                if (this->ready())
+                    return  true;
+                return  this->wait_slow(&timer);
+            }
+            //  Fires pcallback in calling thread, if ready.
+            K2_DLSPEC void  subscribe (future_callback* pcallback);
+
+            //  Rethrows the exception, if *this has failed.
+            void check () const
+            {
+                if (m_failed)
+                    m_exception.rethrow();
+            }
+
+            //  Entitles calling thread to satisfy *this, once.
+            //  \throw  future_error
+            K2_DLSPEC void  claim ();
+            //  Satisfies *this with the exception now being caught.
+            //  Call in a catch block only, after claim().
+            K2_DLSPEC void  fail_current ();
+
+        protected:
+            //  Publishes the result, wakes waiters then fires callbacks.
+            K2_DLSPEC void  complete ();
+
+        private:
+            enum done_enum
+            {
+                pending,
+                pending_waited,
+                done
+            };
+
+            K2_DLSPEC bool  wait_slow (const timestamp* ptimer);
+
+            atomic_int_t                m_refs;
+            atomic_int_t                m_promises;
+            atomic_int_t                m_claimed;
+            //  A done_enum, futex word of waiting threads.
+            atomic_int_t                m_done;
+            //  Callbacks, or ready_mark() once complete.
+            future_callback* volatile   m_pcallbacks;
+            bool                        m_failed;
+            exception_holder            m_exception;
+        };
+
+        template <typename T>
+        class future_state : public future_state_base
+        {
+        public:
+            typedef const T&    const_reference;
+
+            future_state ()
+            :   m_has_value(false)
+            {
+            }
+            ~future_state ()
+            {
+                if (m_has_value)
+                    this->pvalue()->~T();
+            }
+
+            void set_value (const T& value)
+            {
+                this->claim();
+                try
+                {
+                    new (m_storage.m_buf) T(value);
+                }
+                catch (...)
+                {
+                    this->fail_current();
+                    throw;
+                }
+                m_has_value = true;
+                this->complete();
+            }
+            const T& get () const
+            {
+                this->check();
+                return  *this->pvalue();
+            }
+
+        private:
+            const T* pvalue () const
+            {
+                return  reinterpret_cast<const T*>(m_storage.m_buf);
+            }
+            T* pvalue ()
+            {
+                return  reinterpret_cast<T*>(m_storage.m_buf);
+            }
+
+            union
+            {
+                char        m_buf[sizeof(T)];
+                int64_t     m_align0;
+                long double m_align1;
+                void*       m_align2;
+            }       m_storage;
+            bool    m_has_value;
+        };
+
+        template <>
+        class future_state<void> : public future_state_base
+        {
+        public:
+            typedef void    const_reference;
+
+            void set_value ()
+            {
+                this->claim();
+                this->complete();
+            }
+            void get () const
+            {
+                this->check();
+            }
+        };
+
+        //  Satisfies a promise<R> with f(arg), or with what f throws.
+        template <typename R>
+        struct continuation_invoker
+        {
+            template <typename FunctionT, typename ArgT, typename PromiseT>
+            static void invoke (FunctionT& f, const ArgT& arg, PromiseT& result)
+            {
+                result.set_value(f(arg));
+            }
+        };
+        template <>
+        struct continuation_invoker<void>
+        {
+            template <typename FunctionT, typename ArgT, typename PromiseT>
+            static void invoke (FunctionT& f, const ArgT& arg, PromiseT& result)
+            {
+                f(arg);
+                result.set_value();
+            }
+        };
+
+        template <typename T, typename FunctionT>
+        struct continuation_task
+        {
+            typedef typename FunctionT::result_type     result_type;
+
+            future<T>               m_source;
+            FunctionT               m_function;
+            promise<result_type>    m_result;
+
+            continuation_task (const future<T>& source,
+                const FunctionT& function, const promise<result_type>& result)
+            :   m_source(source)
+            ,   m_function(function)
+            ,   m_result(result)
+            {
+            }
+            void operator() ()
+            {
+                try
+                {
+                    //  If you get a compile error here, note that the
+                    //  continuation has to be a functor taking a
+                    //  const future<T>& argument.
+                    continuation_invoker<result_type>::invoke(
+                        m_function, m_source, m_result);
+                }
+                catch (thread::cancel_signal&)
+                {
+                    //  m_result breaks when the task goes away.
+                    throw;
+                }
+                catch (...)
+                {
+                    m_result.set_current_exception();
+                }
+            }
+        };
+
+        template <typename T, typename FunctionT>
+        struct inline_continuation : future_callback
+        {
+            continuation_task<T, FunctionT> m_task;
+
+            explicit inline_continuation (const continuation_task<T, FunctionT>& task)
+            :   m_task(task)
+            {
+                m_fire = inline_continuation::fire;
+                m_pnext = 0;
+            }
+            static void fire (future_callback* pcallback)
+            {
+                std::auto_ptr<inline_continuation>  guard(
+                    static_cast<inline_continuation*>(pcallback));
+                guard->m_task();
+            }
+        };
+
+        template <typename T, typename FunctionT, typename ExecutorT>
+        struct executor_continuation : future_callback
+        {
+            continuation_task<T, FunctionT> m_task;
+            ExecutorT&                      m_executor;
+
+            executor_continuation (
+                const continuation_task<T, FunctionT>& task, ExecutorT& executor)
+            :   m_task(task)
+            ,   m_executor(executor)
+            {
+                m_fire = executor_continuation::fire;
+                m_pnext = 0;
+            }
+            static void fire (future_callback* pcallback)
+            {
+                std::auto_ptr<executor_continuation>    guard(
+                    static_cast<executor_continuation*>(pcallback));
+                try
+                {
+                    //  If you get a compile error here, note that the
+                    //  executor has to provide bool submit(const TaskT&).
+                    if (guard->m_executor.submit(guard->m_task))
+                        return;
+                    throw   future_error("continuation rejected by executor");
+                }
+                catch (...)
+                {
+                    guard->m_task.m_result.set_current_exception();
+                }
+            }
+        };
+
+        template <typename T>
+        future_state<T>* new_future_state ()
+        {
+            try
+            {
+                return  new future_state<T>;
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+        template <typename CallbackT>
+        CallbackT* new_callback (const CallbackT& callback)
+        {
+            try
+            {
+                return  new CallbackT(callback);
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Result of an asynchronous operation.
+    *
+    *   A future<> is satisfied, once, by its promise<>, with a value or an
+    *   exception. Copies share the same state, like a shared future.
+    *
+    *   Completion takes no lock: an atomic word tells if the result is
+    *   ready and parks waiting threads, continuations are kept in a
+    *   lock-free list, and are fired in the satisfying thread, or in
+    *   then()'s calling thread if *this is already ready.
+    *
+    *   Exceptions are propagated by their k2 type and what(), as C++98
+    *   cannot copy an arbitrary exception: k2 exceptions keep their type,
+    *   std::bad_alloc becomes bad_resource_alloc, other std::exception
+    *   becomes runtime_error, any other type becomes exception.
+    */
+    template <typename T>
+    class future
+    {
+    public:
+        typedef T   value_type;
+
+        /**
+        *   \brief      Constructs an invalid future.
+        */
+        future ()
+        :   m_pstate(0)
+        {
+        }
+        future (const future& rhs)
+        :   m_pstate(rhs.m_pstate)
+        {
+            if (m_pstate)
+                m_pstate->add_ref();
+        }
+        future& operator= (const future& rhs)
+        {
+            future  tmp(rhs);
+            nonpublic::future_state<T>* pstate = m_pstate;
+            m_pstate = tmp.m_pstate;
+            tmp.m_pstate = pstate;
+            return  *this;
+        }
+        ~future ()
+        {
+            if (m_pstate)
+                m_pstate->release();
+        }
+
+        /**
+        *   \brief      Tests if *this refers to a shared state.
+        */
+        bool valid () const
+        {
+            return  m_pstate != 0;
+        }
+        /**
+        *   \brief      Tests if the result is ready, never blocks.
+        */
+        bool ready () const
+        {
+            return  m_pstate->ready();
+        }
+        /**
+        *   \brief      Blocks calling thread until the result is ready.
+        */
+        void wait () const
+        {
+            m_pstate->wait();
+        }
+        /**
+        *   \brief      Blocks calling thread until the result is ready, or
+        *               until timed-out.
+        *   \return     true, if ready. false, if timed-out.
+        */
+        bool wait (const timestamp& timer) const
+        {
+            return  m_pstate->wait(timer);
+        }
+        /**
+        *   \brief      Waits for the result, then returns the value.
+        *   \throw      The exception *this has been satisfied with.
+        */
+        typename nonpublic::future_state<T>::const_reference get () const
+        {
+            m_pstate->wait();
+            return  m_pstate->get();
+        }
+
+        /**
+        *   \brief      Chains f, to be invoked with *this once ready, in
+        *               the satisfying thread.
+        *
+        *   \param      f   Copy-constructable functor taking a const
+        *                   future<T>&, with a result_type typedef.
+        *   \return     The future of f's result, or of f's exception.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename FunctionT>
+        future<typename FunctionT::result_type> then (const FunctionT& f) const
+        {
+            typedef typename FunctionT::result_type         result_type;
+            typedef nonpublic::inline_continuation<T, FunctionT>
+                                                            callback_type;
+            promise<result_type>    result;
+            future<result_type>     result_future(result.get_future());
+            callback_type*  pcallback = nonpublic::new_callback(callback_type(
+                nonpublic::continuation_task<T, FunctionT>(*this, f, result)));
+            m_pstate->subscribe(pcallback);
+            return  result_future;
+        }
+        /**
+        *   \brief      Chains f, to be submitted to executor once *this
+        *               is ready.
+        *
+        *   \param      executor    Provides bool submit(const TaskT&),
+        *                           e.g. thread_pool. Has to outlive the
+        *                           continuation.
+        *   \param      f   See then(const FunctionT&).
+        *   \return     The future of f's result, or of f's exception,
+        *               future_error if executor rejects the continuation.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename ExecutorT, typename FunctionT>
+        future<typename FunctionT::result_type> then (
+            ExecutorT& executor, const FunctionT& f) const
+        {
+            typedef typename FunctionT::result_type         result_type;
+            typedef nonpublic::executor_continuation<T, FunctionT, ExecutorT>
+                                                            callback_type;
+            promise<result_type>    result;
+            future<result_type>     result_future(result.get_future());
+            callback_type*  pcallback = nonpublic::new_callback(callback_type(
+                nonpublic::continuation_task<T, FunctionT>(*this, f, result),
+                executor));
+            m_pstate->subscribe(pcallback);
+            return  result_future;
+        }
+
+    private:
+        template <typename U>
+        friend class nonpublic::promise_base;
+        friend struct nonpublic::future_access;
+
+        //  Takes over a reference.
+        explicit future (nonpublic::future_state<T>* pstate)
+        :   m_pstate(pstate)
+        {
+        }
+
+        nonpublic::future_state<T>*     m_pstate;
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct future_access
+        {
+            template <typename T>
+            static void subscribe (const future<T>& f, future_callback* pcallback)
+            {
+                f.m_pstate->subscribe(pcallback);
+            }
+        };
+
+        template <typename T>
+        class promise_base
+        {
+        public:
+            promise_base ()
+            :   m_pstate(new_future_state<T>())
+            {
+            }
+            promise_base (const promise_base& rhs)
+            :   m_pstate(rhs.m_pstate)
+            {
+                m_pstate->add_ref();
+                m_pstate->add_promise();
+            }
+            ~promise_base ()
+            {
+                m_pstate->release_promise();
+                m_pstate->release();
+            }
+
+            future<T> get_future () const
+            {
+                m_pstate->add_ref();
+                return  future<T>(m_pstate);
+            }
+            template <typename ExceptionT>
+            void set_exception (const ExceptionT& x)
+            {
+                m_pstate->claim();
+                try
+                {
+                    throw   x;
+                }
+                catch (...)
+                {
+                    m_pstate->fail_current();
+                }
+            }
+            void set_current_exception ()
+            {
+                m_pstate->claim();
+                m_pstate->fail_current();
+            }
+
+        protected:
+            future_state<T>*    m_pstate;
+
+        private:
+            promise_base& operator= (const promise_base&);
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Satisfies a future<>, once, with a value or an
+    *               exception.
+    *
+    *   Copies share the same state, and can be handed to the thread that
+    *   produces the result. If the last copy goes away unsatisfied, the
+    *   future is satisfied with future_error("broken promise").
+    *
+    *   set_value(), set_exception() and set_current_exception() throw
+    *   future_error if the future has already been satisfied, and
+    *   bad_resource_alloc if the state can not be allocated.
+    *   set_current_exception() is to be called in a catch block only.
+    */
+    template <typename T>
+    class promise : public nonpublic::promise_base<T>
+    {
+    public:
+        void set_value (const T& value)
+        {
+            this->m_pstate->set_value(value);
+        }
+    };
+
+    template <>
+    class promise<void> : public nonpublic::promise_base<void>
+    {
+    public:
+        void set_value ()
+        {
+            this->m_pstate->set_value();
+        }
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        template <typename T>
+        struct when_all_cntx
+        {
+            std::vector<future<T> >                 m_futures;
+            atomic_int_t                            m_remaining;
+            promise<std::vector<future<T> > >       m_result;
+        };
+
+        template <typename T>
+        struct when_all_callback : future_callback
+        {
+            when_all_cntx<T>*   m_pcntx;
+
+            explicit when_all_callback (when_all_cntx<T>* pcntx)
+            :   m_pcntx(pcntx)
+            {
+                m_fire = when_all_callback::fire;
+                m_pnext = 0;
+            }
+            static void fire (future_callback* pcallback)
+            {
+                std::auto_ptr<when_all_callback>    guard(
+                    static_cast<when_all_callback*>(pcallback));
+                if (atomic_decrease(guard->m_pcntx->m_remaining) != 0)
+                    return;
+
+                std::auto_ptr<when_all_cntx<T> >    pcntx(guard->m_pcntx);
+                try
+                {
+                    pcntx->m_result.set_value(pcntx->m_futures);
+                }
+                catch (...)
+                {
+                    pcntx->m_result.set_current_exception();
+                }
+            }
+        };
+
+        template <typename T>
+        struct when_any_cntx
+        {
+            atomic_int_t    m_refs;
+            atomic_int_t    m_fired;
+            promise<size_t> m_result;
+        };
+
+        template <typename T>
+        struct when_any_callback : future_callback
+        {
+            when_any_cntx<T>*   m_pcntx;
+            size_t              m_idx;
+
+            when_any_callback (when_any_cntx<T>* pcntx, size_t idx)
+            :   m_pcntx(pcntx)
+            ,   m_idx(idx)
+            {
+                m_fire = when_any_callback::fire;
+                m_pnext = 0;
+            }
+            static void fire (future_callback* pcallback)
+            {
+                std::auto_ptr<when_any_callback>    guard(
+                    static_cast<when_any_callback*>(pcallback));
+                when_any_cntx<T>*   pcntx = guard->m_pcntx;
+                if (atomic_cas(pcntx->m_fired, 0, 1))
+                    pcntx->m_result.set_value(guard->m_idx);
+                if (atomic_decrease(pcntx->m_refs) == 0)
+                    delete  pcntx;
+            }
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Future of all futures in [first, last), ready when they
+    *               all are.
+    *
+    *   \return     The futures, ready, each with its own value or
+    *               exception.
+    *   \throw      bad_resource_alloc
+    */
+    template <typename IteratorT>
+    future<std::vector<typename std::iterator_traits<IteratorT>::value_type> >
+    when_all (IteratorT first, IteratorT last)
+    {
+        typedef typename std::iterator_traits<IteratorT>::value_type
+                                                        future_type;
+        typedef typename future_type::value_type        value_type;
+        typedef nonpublic::when_all_cntx<value_type>    cntx_type;
+        typedef nonpublic::when_all_callback<value_type>    callback_type;
+
+        std::auto_ptr<cntx_type>    pcntx;
+        try
+        {
+            pcntx.reset(new cntx_type);
+            pcntx->m_futures.assign(first, last);
+        }
+        catch (std::bad_alloc& x)
+        {
+            throw   bad_resource_alloc(x.what());
+        }
+        future<std::vector<future_type> >   result(pcntx->m_result.get_future());
+
+        size_t  cnt = pcntx->m_futures.size();
+        if (cnt == 0)
+        {
+            pcntx->m_result.set_value(pcntx->m_futures);
+            return  result;
+        }
+
+        //  Allocates all callbacks before subscribing any, the last one
+        //  fired deletes the context.
+        std::vector<callback_type*> callbacks(cnt, 0);
+        try
+        {
+            size_t  idx = 0;
+            for (; idx < cnt; ++idx)
+                callbacks[idx] = nonpublic::new_callback(callback_type(pcntx.get()));
+        }
+        catch (...)
+        {
+            size_t  idx = 0;
+            for (; idx < cnt; ++idx)
+                delete  callbacks[idx];
+            throw;
+        }
+
+        pcntx->m_remaining = int(cnt);
+        cntx_type*  pcntx_shared = pcntx.release();
+        size_t  idx = 0;
+        for (; idx < cnt; ++idx)
+        {
+            nonpublic::future_access::subscribe(
+                pcntx_shared->m_futures[idx], callbacks[idx]);
+        }
+        return  result;
+    }
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Future of the index of the first ready future in
+    *               [first, last).
+    *
+    *   \return     The index, or future_error if [first, last) is empty.
+    *   \throw      bad_resource_alloc
+    */
+    template <typename IteratorT>
+    future<size_t>
+    when_any (IteratorT first, IteratorT last)
+    {
+        typedef typename std::iterator_traits<IteratorT>::value_type
+                                                        future_type;
+        typedef typename future_type::value_type        value_type;
+        typedef nonpublic::when_any_cntx<value_type>    cntx_type;
+        typedef nonpublic::when_any_callback<value_type>    callback_type;
+
+        std::vector<future_type>    futures;
+        std::auto_ptr<cntx_type>    pcntx;
+        try
+        {
+            futures.assign(first, last);
+            pcntx.reset(new cntx_type);
+        }
+        catch (std::bad_alloc& x)
+        {
+            throw   bad_resource_alloc(x.what());
+        }
+        future<size_t>  result(pcntx->m_result.get_future());
+
+        size_t  cnt = futures.size();
+        if (cnt == 0)
+        {
+            pcntx->m_result.set_exception(future_error("when_any of no future"));
+            return  result;
+        }
+
+        std::vector<callback_type*> callbacks(cnt, 0);
+        try
+        {
+            size_t  idx = 0;
+            for (; idx < cnt; ++idx)
+                callbacks[idx] = nonpublic::new_callback(callback_type(pcntx.get(), idx));
+        }
+        catch (...)
+        {
+            size_t  idx = 0;
+            for (; idx < cnt; ++idx)
+                delete  callbacks[idx];
+            throw;
+        }
+
+        pcntx->m_refs = int(cnt);
+        pcntx->m_fired = 0;
+        cntx_type*  pcntx_shared = pcntx.release();
+        size_t  idx = 0;
+        for (; idx < cnt; ++idx)
+            nonpublic::future_access::subscribe(futures[idx], callbacks[idx]);
+        return  result;
+    }
+
+}   //  namespace k2
+
+#endif  //  !K2_FUTURE_H
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_INPLACE_FUNCTION_H
+#define K2_INPLACE_FUNCTION_H
+
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+#ifndef K2_TYPE_MANIP_H
+#   include <k2/type_manip.h>
+#endif
+#ifndef K2_ASSERT_H
+#   include <k2/assert.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   define  K2_STD_H_NEW
+#   include <new>
+#endif
+#ifndef K2_STD_H_CSTDDEF
+#   define  K2_STD_H_CSTDDEF
+#   include <cstddef>
+#endif
+
+namespace k2
+{
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        //  Storage of inplace_function<>, aligned for fundamental types.
+        template <size_t Capacity>
+        union inplace_storage
+        {
+            char        m_bytes[Capacity];
+            long double m_ldbl;
+            double      m_dbl;
+            long        m_long;
+            void*       m_ptr;
+            void        (*m_pfn)();
+        };
+
+        //  Alignment of T, as the padding a struct puts in front of it.
+        template <typename T>
+        struct inplace_alignof
+        {
+            struct probe
+            {
+                char    m_c;
+                T       m_t;
+            };
+            static const size_t value = sizeof(probe) - sizeof(T);
+        };
+
+        //  Holds a functor too large, or too aligned, to be stored in
+        //  place.
+        template <typename FunctorT>
+        class inplace_boxed
+        {
+        public:
+            explicit inplace_boxed (const FunctorT& fn)
+            :   m_pfn(new FunctorT(fn))
+            {
+            }
+            inplace_boxed (const inplace_boxed& rhs)
+            :   m_pfn(new FunctorT(*rhs.m_pfn))
+            {
+            }
+            ~inplace_boxed ()
+            {
+                delete  m_pfn;
+            }
+
+            FunctorT&   target ()
+            {
+                return  *m_pfn;
+            }
+            //  Moves *this to dst, without copying the functor.
+            void    relocate (void* dst)
+            {
+                new (dst) inplace_boxed(m_pfn, 0);
+                m_pfn = 0;
+                this->~inplace_boxed();
+            }
+
+        private:
+            inplace_boxed (FunctorT* pfn, int)
+            :   m_pfn(pfn)
+            {
+            }
+            inplace_boxed& operator= (const inplace_boxed&);
+
+            FunctorT*   m_pfn;
+        };
+
+        template <typename FunctorT>
+        FunctorT&   inplace_target (FunctorT& fn)
+        {
+            return  fn;
+        }
+        template <typename FunctorT>
+        FunctorT&   inplace_target (inplace_boxed<FunctorT>& boxed)
+        {
+            return  boxed.target();
+        }
+
+        template <typename StoredT>
+        void    inplace_relocate (void* dst, StoredT& src)
+        {
+            new (dst) StoredT(src);
+            src.~StoredT();
+        }
+        template <typename FunctorT>
+        void    inplace_relocate (void* dst, inplace_boxed<FunctorT>& src)
+        {
+            src.relocate(dst);
+        }
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Type-erased callable, stored in place.
+    *
+    *   Holds a copy of any copy constructable functor taking no argument,
+    *   in \a Capacity bytes of storage embedded in *this. Copying,
+    *   calling and destroying go through two function pointers, no
+    *   virtual table nor heap block is involved. Functors larger than
+    *   \a Capacity, or aligned stricter than the storage, are copied to
+    *   the heap instead; fits<FunctorT>::value tells at compile time
+    *   which way a functor goes.
+    *
+    *   Only the signature ResultT () is defined.
+    */
+    template <typename SignatureT, size_t Capacity = 4 * sizeof(void*)>
+    class inplace_function;
+
+    template <typename ResultT, size_t Capacity>
+    class inplace_function<ResultT (), Capacity>
+    {
+    public:
+        typedef ResultT result_type;
+
+        static const size_t capacity = Capacity;
+
+        /**
+        *   \brief      Tests if FunctorT is stored in place.
+        */
+        template <typename FunctorT>
+        struct fits
+        {
+            static const bool value = sizeof(FunctorT) <= Capacity
+                && nonpublic::inplace_alignof<
+                    nonpublic::inplace_storage<Capacity> >::value
+                    % nonpublic::inplace_alignof<FunctorT>::value == 0;
+        };
+
+        /**
+        *   \brief      Constructs an empty instance.
+        */
+        inplace_function ()
+        :   m_pinvoke(0)
+        ,   m_pmanage(0)
+        {
+        }
+        /**
+        *   \brief      Stores a copy of \a fn.
+        *   \throw      std::bad_alloc, if \a fn does not fit.
+        */
+        template <typename FunctorT>
+        inplace_function (const FunctorT& fn)
+        :   m_pinvoke(0)
+        ,   m_pmanage(0)
+        {
+            this->construct(fn);
+        }
+        inplace_function (const inplace_function& rhs)
+        :   m_pinvoke(0)
+        ,   m_pmanage(0)
+        {
+            this->construct(rhs);
+        }
+        ~inplace_function ()
+        {
+            this->reset();
+        }
+
+        /**
+        *   \brief      Replaces the functor held. *this is left empty if
+        *               copying throws.
+        */
+        inplace_function&   operator= (const inplace_function& rhs)
+        {
+            if (this != &rhs)
+            {
+                this->reset();
+                this->construct(rhs);
+            }
+            return  *this;
+        }
+        template <typename FunctorT>
+        inplace_function&   operator= (const FunctorT& fn)
+        {
+            this->reset();
+            this->construct(fn);
+            return  *this;
+        }
+
+        /**
+        *   \brief      Exchanges the functors held. Functors on the heap
+        *               are handed over, those in place are copied.
+        *
+        *   If a copy throws, both functors are put back; one is left
+        *   empty only if putting it back throws too.
+        *
+        *   \throw      Only what their copy constructors throw.
+        */
+        void    swap (inplace_function& rhs)
+        {
+            if (this == &rhs)
+                return;
+
+            nonpublic::inplace_storage<Capacity>    temp;
+            if (m_pmanage)
+                m_pmanage(relocate_op, &temp, &m_storage);
+            try
+            {
+                if (rhs.m_pmanage)
+                    rhs.m_pmanage(relocate_op, &m_storage, &rhs.m_storage);
+            }
+            catch (...)
+            {
+                inplace_function::restore(*this, &temp);
+                throw;
+            }
+            try
+            {
+                if (m_pmanage)
+                    m_pmanage(relocate_op, &rhs.m_storage, &temp);
+            }
+            catch (...)
+            {
+                inplace_function::restore(rhs, &m_storage);
+                inplace_function::restore(*this, &temp);
+                throw;
+            }
+
+            ResultT (*pinvoke)(void*) = m_pinvoke;
+            m_pinvoke = rhs.m_pinvoke;
+            rhs.m_pinvoke = pinvoke;
+            void    (*pmanage)(op_enum, void*, void*) = m_pmanage;
+            m_pmanage = rhs.m_pmanage;
+            rhs.m_pmanage = pmanage;
+        }
+
+        /**
+        *   \brief      Calls the functor held.
+        *   \throw      runtime_error, if *this is empty.
+        */
+        ResultT operator() () const
+        {
+            if (m_pinvoke == 0)
+                throw   runtime_error("empty inplace_function");
+            return  m_pinvoke(&m_storage);
+        }
+
+        bool    empty () const
+        {
+            return  m_pinvoke == 0;
+        }
+        /**
+        *   \brief      Destroys the functor held.
+        */
+        void    reset ()
+        {
+            if (m_pmanage)
+            {
+                void    (*pmanage)(op_enum, void*, void*) = m_pmanage;
+                m_pinvoke = 0;
+                m_pmanage = 0;
+                pmanage(destroy_op, &m_storage, 0);
+            }
+        }
+
+    private:
+        enum op_enum
+        {
+            copy_op,
+            relocate_op,
+            destroy_op
+        };
+
+        template <typename StoredT>
+        static void manage (op_enum op, void* dst, void* src)
+        {
+            switch (op)
+            {
+            case copy_op:
+                new (dst) StoredT(*static_cast<const StoredT*>(src));
+                break;
+            case relocate_op:
+                nonpublic::inplace_relocate(dst, *static_cast<StoredT*>(src));
+                break;
+            case destroy_op:
+                static_cast<StoredT*>(dst)->~StoredT();
+                break;
+            }
+        }
+        //  Relocates the functor of fn back from src, fn is left empty,
+        //  and src destroyed, if that throws.
+        static void restore (inplace_function& fn, void* src)
+        {
+            if (fn.m_pmanage == 0)
+                return;
+            try
+            {
+                fn.m_pmanage(relocate_op, &fn.m_storage, src);
+            }
+            catch (...)
+            {
+                fn.m_pmanage(destroy_op, src, 0);
+                fn.m_pinvoke = 0;
+                fn.m_pmanage = 0;
+            }
+        }
+
+        template <typename StoredT>
+        static ResultT invoke (void* pstorage)
+        {
+            //  If you get a compile error here, note that the functor
+            //  has to take no argument (a.k.a generator).
+            return  nonpublic::inplace_target(
+                *static_cast<StoredT*>(pstorage))();
+        }
+
+        template <typename FunctorT>
+        void    construct (const FunctorT& fn)
+        {
+            typedef typename type_select<
+                FunctorT,
+                nonpublic::inplace_boxed<FunctorT>,
+                fits<FunctorT>::value
+            >::type stored_type;
+
+            K2_STATIC_ASSERT(
+                sizeof(stored_type) <= Capacity,
+                inplace_function_capacity_too_small);
+
+            //  If you get a compile error here, note that the functor
+            //  has to be copy constructable.
+            new (&m_storage) stored_type(fn);
+            m_pinvoke = &inplace_function::template invoke<stored_type>;
+            m_pmanage = &inplace_function::template manage<stored_type>;
+        }
+        void    construct (const inplace_function& rhs)
+        {
+            if (rhs.m_pmanage)
+            {
+                rhs.m_pmanage(copy_op, &m_storage, &rhs.m_storage);
+                m_pinvoke = rhs.m_pinvoke;
+                m_pmanage = rhs.m_pmanage;
+            }
+        }
+
+        ResultT (*m_pinvoke)(void*);
+        void    (*m_pmanage)(op_enum, void*, void*);
+        mutable nonpublic::inplace_storage<Capacity>    m_storage;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_INPLACE_FUNCTION_H
@@ -47,6 +47,8 @@
 namespace k2
 {
 
+    class cancel_token;
+
     /** \defgroup   Networking
     */
 
@@ -102,6 +104,14 @@ namespace k2
                 accept ();
             K2_DLSPEC std::auto_ptr<tcp_transport>
                 accept (const time_span& timeout);
+            /*  Returns 0 if timed-out, or once token is cancelled.
+            */
+            K2_DLSPEC std::auto_ptr<tcp_transport>
+                accept (const time_span& timeout, const cancel_token& token);
+            /*  Returns 0 rather than blocking if no connection is pending.
+            */
+            K2_DLSPEC std::auto_ptr<tcp_transport>
+                try_accept ();
 
         protected:
             friend class tcp_transport;
@@ -119,6 +129,13 @@ namespace k2
         public:
             K2_INJECT_COPY_BOUNCER();
 
+            enum connect_opt
+            {
+                connect_deferred
+            };
+
+            static const size_t would_block = size_t(-1);
+
             K2_DLSPEC explicit tcp_transport (const transport_addr& remote_addr);
             K2_DLSPEC explicit tcp_transport (const transport_addr& remote_addr, const time_span& timeout);
             K2_DLSPEC tcp_transport (const transport_addr& local_addr, const transport_addr& remote_addr);
@@ -126,8 +143,16 @@ namespace k2
             K2_DLSPEC explicit tcp_transport (tcp_listener& listener);
             K2_DLSPEC tcp_transport (tcp_listener& listener, const time_span& timeout);
             K2_DLSPEC tcp_transport (int tcp_desc, bool own);
+            /*  Starts connecting without waiting, call finish_connect()
+                once get_desc() becomes writable.
+            */
+            K2_DLSPEC tcp_transport (const transport_addr& remote_addr, connect_opt);
             K2_DLSPEC ~tcp_transport ();
 
+            /*  Throws socket_connect_error if connecting failed.
+            */
+            K2_DLSPEC void  finish_connect ();
+
             K2_DLSPEC int   get_desc () const;
             K2_DLSPEC const transport_addr local_addr () const;
             K2_DLSPEC const transport_addr remote_addr () const;
@@ -135,8 +160,18 @@ namespace k2
             K2_DLSPEC size_t write (const char* buf, size_t bytes);
             K2_DLSPEC size_t write_all (const char* buf, size_t bytes);
             K2_DLSPEC size_t write_all (const char* buf, size_t bytes, const time_span& timeout);
+            /*  As write(), but returns would_block rather than blocking.
+            */
+            K2_DLSPEC size_t try_write (const char* buf, size_t bytes);
 
             K2_DLSPEC size_t read (char* buf, size_t bytes);
+            /*  Blocks until readable, or throws cancelled_error once
+                token is cancelled.
+            */
+            K2_DLSPEC size_t read (char* buf, size_t bytes, const cancel_token& token);
+            /*  As read(), but returns would_block rather than blocking.
+            */
+            K2_DLSPEC size_t try_read (char* buf, size_t bytes);
             K2_DLSPEC size_t read_all (char* buf, size_t bytes);
             K2_DLSPEC size_t read_all (char* buf, size_t bytes, const time_span& timeout);
 
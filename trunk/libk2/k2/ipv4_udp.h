@@ -55,6 +55,7 @@ namespace k2
             K2_INJECT_COPY_BOUNCER();
 
             static const size_t io_error = size_t(-1);
+            static const size_t would_block = size_t(-2);
 
             K2_DLSPEC explicit udp_transport ();
             K2_DLSPEC explicit udp_transport (const transport_addr& local_addr);
@@ -69,6 +70,9 @@ namespace k2
 
             K2_DLSPEC size_t    read (char* buf, size_t bytes, transport_addr& remote_addr);
             K2_DLSPEC size_t    read (char* buf, size_t bytes, transport_addr& remote_addr, const time_span& timeout);
+            /*  As read(), but returns would_block rather than blocking.
+            */
+            K2_DLSPEC size_t    try_read (char* buf, size_t bytes, transport_addr& remote_addr);
 
 
         private:
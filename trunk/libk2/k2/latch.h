@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_LATCH_H
+#define K2_LATCH_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_FUTEX_H
+#   include <k2/futex.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Single-use count down latch.
+    *
+    *   Threads waiting on *this are unblocked once the count reaches zero,
+    *   e.g. when all workers of a batch have finished, or have started.
+    *   \relates    timestamp
+    */
+    class latch
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        explicit latch (int count)
+        :   m_count(count)
+        ,   m_waiters(0)
+        {
+        }
+
+        /**
+        *   \brief      Decrements the count by \a count, and unblocks all
+        *               waiting threads if it reaches zero.
+        */
+        void count_down (int count = 1)
+        {
+            if (atomic_add(m_count, -count) <= 0 &&
+                K2_OPT_BRANCH_FALSE(atomic_load(m_waiters) != 0))
+                nonpublic::futex_wake_all(m_count);
+        }
+        /**
+        *   \brief      Tests if the count has reached zero, never blocks
+        *               calling thread.
+        */
+        bool try_wait () const
+        {
+            return  atomic_load(m_count) <= 0;
+        }
+        /**
+        *   \brief      Blocks calling thread until the count reaches zero.
+        */
+        void wait ()
+        {
+            if (K2_OPT_BRANCH_FALSE(this->try_wait() == false))
+                this->wait_slow(0);
+        }
+        /**
+        *   \brief      Blocks calling thread until the count reaches zero,
+        *               or until timed-out.
+        *   \return     true, if the count reached zero. false, if timed-out.
+        */
+        bool wait (const timestamp& timer)
+        {
+            if (K2_OPT_BRANCH_TRUE(this->try_wait()))
+                return  true;
+            return  this->wait_slow(&timer);
+        }
+        /**
+        *   \brief      count_down(), then wait().
+        */
+        void arrive_and_wait ()
+        {
+            this->count_down();
+            this->wait();
+        }
+
+    private:
+        K2_DLSPEC bool  wait_slow (const timestamp* ptimer);
+
+        atomic_int_t    m_count;
+        atomic_int_t    m_waiters;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_LATCH_H
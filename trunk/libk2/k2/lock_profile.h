@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_LOCK_PROFILE_H
+#define K2_LOCK_PROFILE_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_SCOPE_GUARD_H
+#   include <k2/scoped_guard.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+
+#if defined(K2_LOCK_PROFILING)
+#   ifndef K2_ATOMIC_H
+#       include <k2/atomic.h>
+#   endif
+#   ifndef K2_THREAD_ONCE_H
+#       include <k2/thread_once.h>
+#   endif
+#   ifndef K2_TIMING_H
+#       include <k2/timing.h>
+#   endif
+#endif
+
+#ifndef K2_STD_H_IOSFWD
+#   include <iosfwd>
+#   define  K2_STD_H_IOSFWD
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+#if defined(K2_LOCK_PROFILING)
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Contention statistics of a lock, or of a call site.
+    *
+    *   A lock_profile enrolls itself to a process wide registry on its
+    *   first recorded acquisition, lock_profile::report() ranks all
+    *   enrolled profiles by total wait time. When K2_LOCK_PROFILING is not
+    *   defined, lock_profile is a stub whose statistics stay zero.
+    *
+    *   Call site profiles are statically initialized with
+    *   K2_LOCK_PROFILE_INIT, see K2_PROFILED_GUARD.
+    *
+    *   \relates    profiled_lock<>
+    *   \relates    profiled_guard<>
+    */
+    struct lock_profile
+    {
+        /**
+        *   \brief  Bucket n of histograms counts durations in
+        *           [2^n, 2^(n+1)) nano-seconds, the last bucket also
+        *           counts all longer durations.
+        */
+        static const size_t histogram_buckets = 40;
+
+        struct stats
+        {
+            uint64_t    acquisitions;
+            uint64_t    contentions;
+            uint64_t    wait_nsec;
+            uint64_t    max_wait_nsec;
+            uint64_t    hold_nsec;
+            uint64_t    max_hold_nsec;
+            uint64_t    wait_histogram[histogram_buckets];
+            uint64_t    hold_histogram[histogram_buckets];
+        };
+
+        /**
+        *   \brief  Records an acquisition, \a contended is true if the
+        *           lock was not immediately available.
+        */
+        void on_acquired (bool contended, uint64_t wait_nsec)
+        {
+            this->enroll();
+
+            update_guard    guard(m_update_lock);
+            ++m_stats.acquisitions;
+            if (contended)
+                ++m_stats.contentions;
+            m_stats.wait_nsec += wait_nsec;
+            if (wait_nsec > m_stats.max_wait_nsec)
+                m_stats.max_wait_nsec = wait_nsec;
+            ++m_stats.wait_histogram[lock_profile::bucket_of(wait_nsec)];
+        }
+        /**
+        *   \brief  Records a release, \a hold_nsec is the time elapsed
+        *           since the matching acquisition.
+        */
+        void on_released (uint64_t hold_nsec)
+        {
+            update_guard    guard(m_update_lock);
+            m_stats.hold_nsec += hold_nsec;
+            if (hold_nsec > m_stats.max_hold_nsec)
+                m_stats.max_hold_nsec = hold_nsec;
+            ++m_stats.hold_histogram[lock_profile::bucket_of(hold_nsec)];
+        }
+
+        const char* name () const
+        {
+            return  m_name;
+        }
+        /**
+        *   \brief  Copies a consistent snapshot of the statistics.
+        */
+        K2_DLSPEC void  snapshot (stats& out) const;
+        /**
+        *   \brief  Clears the statistics.
+        */
+        K2_DLSPEC void  reset ();
+
+        /**
+        *   \brief  Writes statistics of all enrolled profiles to \a os,
+        *           ranked by total wait time, longest first.
+        *   \param  max_entries Maximum number of profiles to report.
+        */
+        K2_DLSPEC static void   report (
+            std::ostream& os, size_t max_entries = size_t(-1));
+        /**
+        *   \brief  Clears the statistics of all enrolled profiles.
+        */
+        K2_DLSPEC static void   reset_all ();
+
+#if !defined(DOXYGEN_BLIND)
+        //  Public for static initialization only, see K2_LOCK_PROFILE_INIT.
+        const char*     m_name;
+        thread_once     m_enrolled;
+        atomic_int_t    m_update_lock;
+        lock_profile*   m_pprev;
+        lock_profile*   m_pnext;
+        stats           m_stats;
+
+        //  Links *this to the registry, undone by leave().
+        void enroll ()
+        {
+            m_enrolled.run(enroll_functor(*this));
+        }
+        K2_DLSPEC void  enroll_impl ();
+        K2_DLSPEC void  leave ();
+
+        struct enroll_functor
+        {
+            lock_profile&   m_profile;
+
+            enroll_functor (lock_profile& profile)
+            :   m_profile(profile)
+            {
+            }
+            void operator() () const
+            {
+                m_profile.enroll_impl();
+            }
+        };
+        //  Serializes updates from different lock instances sharing the
+        //  same call site profile, same protocol as spin_lock.
+        struct update_guard
+        {
+            atomic_int_t&   m_counter;
+
+            update_guard (atomic_int_t& counter)
+            :   m_counter(counter)
+            {
+                while (atomic_increase(m_counter) != 0)
+                    atomic_decrease(m_counter);
+            }
+            ~update_guard ()
+            {
+                atomic_decrease(m_counter);
+            }
+        };
+
+        static size_t bucket_of (uint64_t nsec)
+        {
+            size_t  bucket = 0;
+            while (nsec > 1 && bucket < histogram_buckets - 1)
+            {
+                nsec >>= 1;
+                ++bucket;
+            }
+            return  bucket;
+        }
+#endif  //  !DOXYGEN_BLIND
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      lock_profile static initializer macro.
+    *   \relates    lock_profile
+    */
+#   define K2_LOCK_PROFILE_INIT(name)\
+        {(name), K2_THREAD_ONCE_INIT, -1, 0, 0}
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Lock wrapper that records contention statistics of the
+    *               wrapped lock.
+    *
+    *   Wraps any lock type with acquire(), try_acquire() and release(),
+    *   e.g. mutex and spin_lock. When K2_LOCK_PROFILING is not defined,
+    *   profiled_lock<> forwards directly to the wrapped lock and records
+    *   nothing.
+    *
+    *   \relates    lock_profile
+    */
+    template <typename LockT>
+    class profiled_lock
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef scoped_guard<profiled_lock<LockT> >    scoped_guard;
+
+        /**
+        *   \param  name    Name to report *this with, must outlive *this.
+        */
+        explicit profiled_lock (const char* name = "(unnamed)")
+        {
+            const lock_profile  init = K2_LOCK_PROFILE_INIT(name);
+            m_profile = init;
+        }
+        ~profiled_lock ()
+        {
+            m_profile.leave();
+        }
+
+        void acquire ()
+        {
+            uint64_t    start = hires_clock::now_nsec();
+            bool        contended = false;
+            if (m_lock.try_acquire() == false)
+            {
+                contended = true;
+                m_lock.acquire();
+            }
+            this->on_acquired(contended, start);
+        }
+        bool acquire (const timestamp& timer)
+        {
+            uint64_t    start = hires_clock::now_nsec();
+            bool        contended = false;
+            if (m_lock.try_acquire() == false)
+            {
+                contended = true;
+                if (m_lock.acquire(timer) == false)
+                    return  false;
+            }
+            this->on_acquired(contended, start);
+            return  true;
+        }
+        bool try_acquire ()
+        {
+            uint64_t    start = hires_clock::now_nsec();
+            if (m_lock.try_acquire() == false)
+                return  false;
+            this->on_acquired(false, start);
+            return  true;
+        }
+        void release ()
+        {
+            m_profile.on_released(hires_clock::now_nsec() - m_acquired_nsec);
+            m_lock.release();
+        }
+
+        const lock_profile& profile () const
+        {
+            return  m_profile;
+        }
+
+    private:
+        void on_acquired (bool contended, uint64_t start)
+        {
+            m_acquired_nsec = hires_clock::now_nsec();
+            m_profile.on_acquired(contended, m_acquired_nsec - start);
+        }
+
+        LockT           m_lock;
+        lock_profile    m_profile;
+        //  Only accessed by owner of m_lock.
+        uint64_t        m_acquired_nsec;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      scoped_guard<> variant that records contention
+    *               statistics of a call site.
+    *
+    *   Normally used through K2_PROFILED_GUARD.
+    *
+    *   \relates    lock_profile
+    */
+    template <typename GuardedT>
+    class profiled_guard
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        profiled_guard (GuardedT& guarded, lock_profile& profile)
+        :   m_guarded(guarded)
+        ,   m_profile(profile)
+        {
+            uint64_t    start = hires_clock::now_nsec();
+            bool        contended = false;
+            if (m_guarded.try_acquire() == false)
+            {
+                contended = true;
+                m_guarded.acquire();
+            }
+            m_acquired_nsec = hires_clock::now_nsec();
+            m_profile.on_acquired(contended, m_acquired_nsec - start);
+        }
+        ~profiled_guard ()
+        {
+            m_profile.on_released(hires_clock::now_nsec() - m_acquired_nsec);
+            m_guarded.release();
+        }
+
+    private:
+        GuardedT&       m_guarded;
+        lock_profile&   m_profile;
+        uint64_t        m_acquired_nsec;
+    };
+
+#   define  K2_LOCK_PROFILE_STR_(line)  #line
+#   define  K2_LOCK_PROFILE_STR(line)   K2_LOCK_PROFILE_STR_(line)
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Declares a scoped guard named \a guard that acquires
+    *               \a lock of type \a LockT, profiled by call site.
+    *
+    *   Expands to a plain scoped_guard<> when K2_LOCK_PROFILING is not
+    *   defined.
+    */
+#   define  K2_PROFILED_GUARD(LockT, guard, lock)\
+        static k2::lock_profile guard##_site = K2_LOCK_PROFILE_INIT(\
+            __FILE__ ":" K2_LOCK_PROFILE_STR(__LINE__));\
+        k2::profiled_guard<LockT >  guard(lock, guard##_site)
+
+#else   //  !K2_LOCK_PROFILING
+
+    struct lock_profile
+    {
+        static const size_t histogram_buckets = 40;
+
+        struct stats
+        {
+            uint64_t    acquisitions;
+            uint64_t    contentions;
+            uint64_t    wait_nsec;
+            uint64_t    max_wait_nsec;
+            uint64_t    hold_nsec;
+            uint64_t    max_hold_nsec;
+            uint64_t    wait_histogram[histogram_buckets];
+            uint64_t    hold_histogram[histogram_buckets];
+        };
+
+        const char* name () const
+        {
+            return  m_name;
+        }
+        void    snapshot (stats& out) const
+        {
+            const stats zero = stats();
+            out = zero;
+        }
+        void    reset ()
+        {
+        }
+
+        static void report (std::ostream&, size_t = size_t(-1))
+        {
+        }
+        static void reset_all ()
+        {
+        }
+
+#if !defined(DOXYGEN_BLIND)
+        const char*     m_name;
+#endif  //  !DOXYGEN_BLIND
+    };
+
+    template <typename LockT>
+    class profiled_lock
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef scoped_guard<profiled_lock<LockT> >    scoped_guard;
+
+        explicit profiled_lock (const char* /*name*/ = 0)
+        {
+        }
+
+        void acquire ()
+        {
+            m_lock.acquire();
+        }
+        bool acquire (const timestamp& timer)
+        {
+            return  m_lock.acquire(timer);
+        }
+        bool try_acquire ()
+        {
+            return  m_lock.try_acquire();
+        }
+        void release ()
+        {
+            m_lock.release();
+        }
+
+        const lock_profile& profile () const
+        {
+            static const lock_profile   disabled = { "(disabled)" };
+            return  disabled;
+        }
+
+    private:
+        LockT   m_lock;
+    };
+
+#   define  K2_PROFILED_GUARD(LockT, guard, lock)\
+        k2::scoped_guard<LockT >    guard(lock)
+
+#endif  //  K2_LOCK_PROFILING
+
+}   //  namespace k2
+
+#endif  //  !K2_LOCK_PROFILE_H
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_MPMC_QUEUE_H
+#define K2_MPMC_QUEUE_H
+
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_MUTEX_H
+#   include <k2/mutex.h>
+#endif
+#ifndef K2_COND_VAR_H
+#   include <k2/cond_var.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Bounded multi-producer multi-consumer FIFO queue.
+    *
+    *   An array of cells, each tagged with a sequence number that tells
+    *   whether the cell is ready to be written or read in the current lap.
+    *   Producers and consumers only contend on their own position counter,
+    *   with one compare-and-swap per operation, or per batch.
+    *
+    *   try_xxx() operations never block. push() and pop() block calling
+    *   thread only when *this is full, or empty respectively, parked
+    *   threads are signalled by the operations that unblock them.
+    *
+    *   ValueT has to be copy-constructable and assignable, copy
+    *   operations should not throw.
+    */
+    template <typename ValueT>
+    class mpmc_queue
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef ValueT  value_type;
+
+        /**
+        *   \brief      Allocates resource for *this.
+        *   \param      capacity    Maximum number of values, rounded up to
+        *                           a power of two.
+        *   \throw      bad_resource_alloc
+        */
+        explicit mpmc_queue (size_t capacity)
+        :   m_pcells(0)
+        ,   m_mask(mpmc_queue::round_up(capacity) - 1)
+        ,   m_enqueue_pos(0)
+        ,   m_dequeue_pos(0)
+        ,   m_push_waiters(0)
+        ,   m_pop_waiters(0)
+        ,   m_not_empty(m_waiters_mtx)
+        ,   m_not_full(m_waiters_mtx)
+        {
+            try
+            {
+                m_pcells = new cell[m_mask + 1];
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+
+            size_t  idx = 0;
+            for (; idx <= m_mask; ++idx)
+                m_pcells[idx].seq = long(idx);
+        }
+        /**
+        *   \brief      Destroys remaining values and releases resource.
+        */
+        ~mpmc_queue ()
+        {
+            long    pos = m_dequeue_pos;
+            for (; pos != m_enqueue_pos; ++pos)
+            {
+                cell&   c = m_pcells[pos & m_mask];
+                reinterpret_cast<ValueT*>(c.storage.bytes)->~ValueT();
+            }
+            delete [] m_pcells;
+        }
+
+        size_t  capacity () const
+        {
+            return  m_mask + 1;
+        }
+        /**
+        *   \brief      Number of values in *this, exact only when no
+        *               operation is in progress.
+        */
+        size_t  size () const
+        {
+            long    size =
+                atomic_load(m_enqueue_pos) - atomic_load(m_dequeue_pos);
+            return  size < 0 ? 0 : size_t(size);
+        }
+        bool    empty () const
+        {
+            return  this->size() == 0;
+        }
+
+        /**
+        *   \brief      Appends a copy of \a value, if *this is not full.
+        *   \return     true, if appended.
+        */
+        bool try_push (const ValueT& value)
+        {
+            if (this->try_push_n(&value, 1) == 0)
+                return  false;
+            return  true;
+        }
+        /**
+        *   \brief      Appends up to \a count values from \a first with a
+        *               single reservation.
+        *   \return     Number of values appended, less than \a count if
+        *               *this became full.
+        */
+        template <typename InputIt>
+        size_t try_push_n (InputIt first, size_t count)
+        {
+            long    pos;
+            size_t  reserved = this->reserve(
+                m_enqueue_pos, 0, count, pos);
+
+            size_t  idx = 0;
+            for (; idx < reserved; ++idx, ++first)
+            {
+                cell&   c = m_pcells[(pos + idx) & m_mask];
+                new (c.storage.bytes) ValueT(*first);
+                atomic_store(c.seq, long(pos + idx + 1));
+            }
+
+            if (reserved != 0)
+                this->wake(m_pop_waiters, m_not_empty, reserved);
+            return  reserved;
+        }
+        /**
+        *   \brief      Removes the first value and assigns it to \a value,
+        *               if *this is not empty.
+        *   \return     true, if removed.
+        */
+        bool try_pop (ValueT& value)
+        {
+            if (this->try_pop_n(&value, 1) == 0)
+                return  false;
+            return  true;
+        }
+        /**
+        *   \brief      Removes up to \a count values to \a out with a
+        *               single reservation.
+        *   \return     Number of values removed, less than \a count if
+        *               *this became empty.
+        */
+        template <typename OutputIt>
+        size_t try_pop_n (OutputIt out, size_t count)
+        {
+            long    pos;
+            size_t  reserved = this->reserve(
+                m_dequeue_pos, 1, count, pos);
+
+            size_t  idx = 0;
+            for (; idx < reserved; ++idx, ++out)
+            {
+                cell&   c = m_pcells[(pos + idx) & m_mask];
+                ValueT* pvalue = reinterpret_cast<ValueT*>(c.storage.bytes);
+                *out = *pvalue;
+                pvalue->~ValueT();
+                atomic_store(c.seq, long(pos + idx + m_mask + 1));
+            }
+
+            if (reserved != 0)
+                this->wake(m_push_waiters, m_not_full, reserved);
+            return  reserved;
+        }
+
+        /**
+        *   \brief      Appends a copy of \a value, blocks calling thread
+        *               while *this is full.
+        */
+        void push (const ValueT& value)
+        {
+            while (this->try_push(value) == false)
+            {
+                this->park(m_push_waiters, m_not_full, &mpmc_queue::full, 0);
+            }
+        }
+        /**
+        *   \brief      Appends a copy of \a value, blocks calling thread
+        *               while *this is full, or until timed-out.
+        *   \return     true, if appended. false, if timed-out.
+        */
+        bool push (const ValueT& value, const timestamp& timer)
+        {
+            while (this->try_push(value) == false)
+            {
+                if (this->park(m_push_waiters,
+                    m_not_full, &mpmc_queue::full, &timer) == false)
+                {
+                    return  this->try_push(value);
+                }
+            }
+            return  true;
+        }
+        /**
+        *   \brief      Removes the first value and assigns it to \a value,
+        *               blocks calling thread while *this is empty.
+        */
+        void pop (ValueT& value)
+        {
+            while (this->try_pop(value) == false)
+            {
+                this->park(m_pop_waiters, m_not_empty, &mpmc_queue::empty, 0);
+            }
+        }
+        /**
+        *   \brief      Removes the first value and assigns it to \a value,
+        *               blocks calling thread while *this is empty, or until
+        *               timed-out.
+        *   \return     true, if removed. false, if timed-out.
+        */
+        bool pop (ValueT& value, const timestamp& timer)
+        {
+            while (this->try_pop(value) == false)
+            {
+                if (this->park(m_pop_waiters,
+                    m_not_empty, &mpmc_queue::empty, &timer) == false)
+                {
+                    return  this->try_pop(value);
+                }
+            }
+            return  true;
+        }
+
+        bool    full () const
+        {
+            return  this->size() > m_mask;
+        }
+
+    private:
+        struct cell
+        {
+            atomic_long_t   seq;
+            union
+            {
+                char        bytes[sizeof(ValueT)];
+                long double align_long_double;
+                long long   align_long_long;
+                void*       align_pointer;
+            }   storage;
+        };
+        struct padding
+        {
+            char    bytes[K2_OPT_CACHE_LINE_BYTES];
+        };
+
+        static size_t round_up (size_t capacity)
+        {
+            size_t  rounded = 2;
+            while (rounded < capacity)
+                rounded <<= 1;
+            return  rounded;
+        }
+
+        //  Reserves up to count consecutive cells starting at pos, whose
+        //  sequence numbers are pos + lag. Producers use lag 0, consumers
+        //  use lag 1, i.e. cells written in the current lap.
+        size_t reserve (
+            atomic_long_t& position, long lag, size_t count, long& pos)
+        {
+            if (count == 0)
+                return  0;
+
+            pos = atomic_load(position);
+            for (;;)
+            {
+                size_t  ready = 0;
+                for (; ready < count && ready <= m_mask; ++ready)
+                {
+                    long    seq = atomic_load(
+                        m_pcells[(pos + ready) & m_mask].seq);
+                    if (seq != long(pos + ready + lag))
+                        break;
+                }
+
+                if (ready == 0)
+                {
+                    long    seq = atomic_load(m_pcells[pos & m_mask].seq);
+                    //  The cell is a lap behind, *this is full or empty.
+                    if (seq - long(pos + lag) < 0)
+                        return  0;
+                    //  Another thread has reserved it.
+                    pos = atomic_load(position);
+                    continue;
+                }
+
+                if (atomic_cas(position, pos, long(pos + ready)))
+                    return  ready;
+                pos = atomic_load(position);
+            }
+        }
+
+        //  Parks calling thread until signalled, or timed-out, unless an
+        //  operation completes in the mean time.
+        bool park (
+            atomic_int_t&       waiters,
+            cond_var&           cv,
+            bool                (mpmc_queue::*blocked)() const,
+            const timestamp*    ptimer)
+        {
+            mutex::scoped_guard guard(m_waiters_mtx);
+
+            //  Announces before re-checking, see wake().
+            atomic_add(waiters, 1);
+            bool    signalled = true;
+            if ((this->*blocked)())
+            {
+                if (ptimer)
+                    signalled = cv.wait(*ptimer);
+                else
+                    cv.wait();
+            }
+            atomic_add(waiters, -1);
+            return  signalled;
+        }
+        void wake (atomic_int_t& waiters, cond_var& cv, size_t count)
+        {
+            //  Orders publishing of cells before reading waiters.
+            memory_barrier();
+            if (K2_OPT_BRANCH_TRUE(atomic_load(waiters) == 0))
+                return;
+
+            mutex::scoped_guard guard(m_waiters_mtx);
+            if (count == 1)
+                cv.signal();
+            else
+                cv.broadcast();
+        }
+        cell*           m_pcells;
+        const size_t    m_mask;
+        padding         m_pad0;
+        atomic_long_t   m_enqueue_pos;
+        padding         m_pad1;
+        atomic_long_t   m_dequeue_pos;
+        padding         m_pad2;
+        atomic_int_t    m_push_waiters;
+        atomic_int_t    m_pop_waiters;
+        mutex           m_waiters_mtx;
+        cond_var        m_not_empty;
+        cond_var        m_not_full;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_MPMC_QUEUE_H
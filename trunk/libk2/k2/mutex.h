@@ -85,6 +85,13 @@ namespace k2
         *   \throw      thread_error
         */
         K2_DLSPEC bool  acquire (const timestamp& timer) ;
+        /**
+        *   \brief      Acquires ownership of *this if it is not owned,
+        *               never blocks calling thread.
+        *   \return     true, if successfully acquired ownership.
+        *   \throw      thread_error
+        */
+        K2_DLSPEC bool  try_acquire () ;
 
         /**
         *   \brief      Releases ownership of *this.
@@ -42,4 +42,10 @@
 #   define  K2_OPT_BRANCH_FALSE(exp)        (long(exp))
 #endif
 
+//  Bytes in a cache line. Data written by different threads should be at
+//  least this far apart, or they falsely share the line.
+#if !defined(K2_OPT_CACHE_LINE_BYTES)
+#   define  K2_OPT_CACHE_LINE_BYTES         64
+#endif
+
 #endif  //  !K2_OPT_H
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_PARALLEL_H
+#define K2_PARALLEL_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_THREAD_H
+#   include <k2/thread.h>
+#endif
+#ifndef K2_THREAD_POOL_H
+#   include <k2/thread_pool.h>
+#endif
+#ifndef K2_FUTURE_H
+#   include <k2/future.h>
+#endif
+
+#ifndef K2_STD_H_ALGORITHM
+#   include <algorithm>
+#   define  K2_STD_H_ALGORITHM
+#endif
+#ifndef K2_STD_H_FUNCTIONAL
+#   include <functional>
+#   define  K2_STD_H_FUNCTIONAL
+#endif
+#ifndef K2_STD_H_ITERATOR
+#   include <iterator>
+#   define  K2_STD_H_ITERATOR
+#endif
+#ifndef K2_STD_H_VECTOR
+#   include <vector>
+#   define  K2_STD_H_VECTOR
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      The thread_pool parallel algorithms run on unless
+    *               given one, with a worker per usable CPU, see
+    *               cpu_topology::usable_cpu_count().
+    */
+    K2_DLSPEC thread_pool&  parallel_pool ();
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        //  Fork-join control of one parallel algorithm call, lives in
+        //  the calling thread's frame until join() returns.
+        class parallel_cntx
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            explicit parallel_cntx (thread_pool& pool)
+            :   m_pool(pool)
+            ,   m_pending(1)
+            ,   m_stop(0)
+            ,   m_failed(0)
+            {
+            }
+
+            thread_pool& pool () const
+            {
+                return  m_pool;
+            }
+            //  Tests if remaining work is to be skipped, as a task has
+            //  failed or a thread has been cancelled.
+            bool stopped () const
+            {
+                return  atomic_load(m_stop) != 0;
+            }
+            void stop ()
+            {
+                atomic_store(m_stop, 1);
+            }
+
+            //  Runs task in parallel, or in calling thread if the pool
+            //  does not take it.
+            template <typename TaskT>
+            void fork (const TaskT& task)
+            {
+                atomic_increase(m_pending);
+                try
+                {
+                    if (m_pool.submit(task))
+                        return;
+                }
+                catch (bad_resource_alloc&)
+                {
+                }
+                task();
+            }
+
+            //  Keeps the first exception, call in a catch block only.
+            K2_DLSPEC void  fail_current ();
+            K2_DLSPEC void  task_done ();
+            //  Helps running queued tasks until all forked ones are done,
+            //  then rethrows the first exception, if any. Stops and waits
+            //  if calling thread is cancelled.
+            //  \throw  thread::cancel_signal
+            K2_DLSPEC void  join ();
+            //  Waits for forked tasks, without test_cancel().
+            K2_DLSPEC void  abandon ();
+
+        private:
+            void    wait (bool cancellable);
+
+            thread_pool&        m_pool;
+            atomic_int_t        m_pending;
+            atomic_int_t        m_stop;
+            atomic_int_t        m_failed;
+            exception_holder    m_exception;
+        };
+
+        //  A forked piece of work, WorkT::operator()(parallel_cntx&) may
+        //  fork further.
+        template <typename WorkT>
+        struct parallel_task
+        {
+            parallel_cntx*  m_pcntx;
+            WorkT           m_work;
+
+            parallel_task (parallel_cntx& cntx, const WorkT& work)
+            :   m_pcntx(&cntx)
+            ,   m_work(work)
+            {
+            }
+            void operator() () const
+            {
+                struct done_guard
+                {
+                    parallel_cntx*  m_pcntx;
+                    ~done_guard ()
+                    {
+                        m_pcntx->task_done();
+                    }
+                }   guard = { m_pcntx };
+
+                try
+                {
+                    if (m_pcntx->stopped() == false)
+                    {
+                        thread::test_cancel();
+                        m_work(*m_pcntx);
+                    }
+                }
+                catch (thread::cancel_signal&)
+                {
+                    m_pcntx->stop();
+                    throw;
+                }
+                catch (...)
+                {
+                    m_pcntx->fail_current();
+                }
+            }
+        };
+
+        template <typename WorkT>
+        void parallel_run (thread_pool& pool, const WorkT& work)
+        {
+            parallel_cntx   cntx(pool);
+            try
+            {
+                parallel_task<WorkT>(cntx, work)();
+            }
+            catch (thread::cancel_signal&)
+            {
+                cntx.abandon();
+                throw;
+            }
+            cntx.join();
+        }
+
+        inline size_t parallel_grain (
+            thread_pool& pool, size_t cnt, size_t grain)
+        {
+            if (grain)
+                return  grain;
+            //  About 8 pieces per worker leave room for load balancing.
+            grain = cnt / (pool.size() * 8);
+            return  grain ? grain : 1;
+        }
+
+        template <typename IndexT, typename BodyT>
+        struct for_work
+        {
+            IndexT          m_first;
+            IndexT          m_last;
+            size_t          m_grain;
+            const BodyT*    m_pbody;
+
+            void operator() (parallel_cntx& cntx) const
+            {
+                IndexT  first = m_first;
+                IndexT  last = m_last;
+                //  Splits off right halves, keeps the left one.
+                while (size_t(last - first) > m_grain)
+                {
+                    IndexT  middle = first + (last - first) / 2;
+                    for_work    right = { middle, last, m_grain, m_pbody };
+                    cntx.fork(parallel_task<for_work>(cntx, right));
+                    last = middle;
+                }
+                //  If you get a compile error here, note that body has to
+                //  be a functor taking a [first, last) range.
+                (*m_pbody)(first, last);
+            }
+        };
+
+        template <typename InputIteratorT, typename OutputIteratorT,
+            typename FunctionT>
+        struct transform_body
+        {
+            InputIteratorT  m_first;
+            OutputIteratorT m_result;
+            FunctionT       m_function;
+
+            void operator() (size_t first, size_t last) const
+            {
+                std::transform(m_first + first, m_first + last,
+                    m_result + first, m_function);
+            }
+        };
+
+        template <typename T, typename BodyT>
+        struct reduce_body
+        {
+            size_t              m_first;
+            size_t              m_grain;
+            std::vector<T>*     m_ppartials;
+            const BodyT*        m_pbody;
+
+            //  Each index is a grain-sized chunk of the range.
+            void operator() (size_t first, size_t last) const
+            {
+                for (; first < last; ++first)
+                {
+                    size_t  begin = m_first + first * m_grain;
+                    //  If you get a compile error here, note that body
+                    //  has to return the reduction of a [first, last)
+                    //  range.
+                    (*m_ppartials)[first] = (*m_pbody)(begin, begin + m_grain);
+                }
+            }
+        };
+
+        template <typename IteratorT, typename CompareT>
+        struct sort_work
+        {
+            IteratorT       m_first;
+            IteratorT       m_last;
+            size_t          m_grain;
+            CompareT        m_compare;
+
+            void operator() (parallel_cntx& cntx) const
+            {
+                IteratorT   first = m_first;
+                IteratorT   last = m_last;
+                while (size_t(last - first) > m_grain)
+                {
+                    IteratorT   middle = first + (last - first) / 2;
+                    value_type  pivot = median(*first, *middle, *(last - 1));
+
+                    //  Three-way partition, equal elements are left out of
+                    //  both sides, so runs of equal keys do not recurse.
+                    IteratorT   lower = std::partition(first, last,
+                        less_than(m_compare, pivot));
+                    IteratorT   upper = std::partition(lower, last,
+                        not_greater_than(m_compare, pivot));
+
+                    //  Forks the larger side, keeps the smaller one.
+                    if (lower - first < last - upper)
+                    {
+                        sort_work   larger = { upper, last, m_grain, m_compare };
+                        cntx.fork(parallel_task<sort_work>(cntx, larger));
+                        last = lower;
+                    }
+                    else
+                    {
+                        sort_work   larger = { first, lower, m_grain, m_compare };
+                        cntx.fork(parallel_task<sort_work>(cntx, larger));
+                        first = upper;
+                    }
+                }
+                std::sort(first, last, m_compare);
+            }
+
+        private:
+            typedef typename std::iterator_traits<IteratorT>::value_type
+                                                        value_type;
+
+            struct less_than
+            {
+                CompareT            m_compare;
+                const value_type&   m_pivot;
+
+                less_than (const CompareT& compare, const value_type& pivot)
+                :   m_compare(compare)
+                ,   m_pivot(pivot)
+                {
+                }
+                bool operator() (const value_type& value) const
+                {
+                    return  m_compare(value, m_pivot);
+                }
+            };
+            struct not_greater_than
+            {
+                CompareT            m_compare;
+                const value_type&   m_pivot;
+
+                not_greater_than (const CompareT& compare, const value_type& pivot)
+                :   m_compare(compare)
+                ,   m_pivot(pivot)
+                {
+                }
+                bool operator() (const value_type& value) const
+                {
+                    return  m_compare(m_pivot, value) == false;
+                }
+            };
+
+            const value_type& median (const value_type& a,
+                const value_type& b, const value_type& c) const
+            {
+                if (m_compare(a, b))
+                {
+                    if (m_compare(b, c))
+                        return  b;
+                    return  m_compare(a, c) ? c : a;
+                }
+                if (m_compare(a, c))
+                    return  a;
+                return  m_compare(b, c) ? c : b;
+            }
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Invokes body over [first, last), split recursively into
+    *               ranges of at most grain indices, run on pool.
+    *
+    *   Calling thread runs pieces too, and so helps with other queued
+    *   tasks while waiting. Each piece calls thread::test_cancel() first;
+    *   once a piece throws, or calling thread is cancelled, pieces not
+    *   yet started are skipped.
+    *
+    *   \param      body    Functor invoked as body(IndexT first, IndexT
+    *                       last), concurrently.
+    *   \param      grain   Largest piece, 0 picks one from the size of
+    *                       pool.
+    *   \throw      The first exception thrown by body, converted as by
+    *               future<>::get(), or thread::cancel_signal.
+    */
+    template <typename IndexT, typename BodyT>
+    void parallel_for (thread_pool& pool,
+        IndexT first, IndexT last, const BodyT& body, size_t grain = 0)
+    {
+        if (first >= last)
+            return;
+        grain = nonpublic::parallel_grain(pool, size_t(last - first), grain);
+
+        nonpublic::for_work<IndexT, BodyT>  work =
+            { first, last, grain, &body };
+        nonpublic::parallel_run(pool, work);
+    }
+    template <typename IndexT, typename BodyT>
+    void parallel_for (
+        IndexT first, IndexT last, const BodyT& body, size_t grain = 0)
+    {
+        parallel_for(parallel_pool(), first, last, body, grain);
+    }
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Parallel std::transform() over random access iterators.
+    *
+    *   See parallel_for() for grain, cancellation and exceptions.
+    */
+    template <typename InputIteratorT, typename OutputIteratorT,
+        typename FunctionT>
+    OutputIteratorT parallel_transform (thread_pool& pool,
+        InputIteratorT first, InputIteratorT last, OutputIteratorT result,
+        const FunctionT& function, size_t grain = 0)
+    {
+        typedef nonpublic::transform_body<
+            InputIteratorT, OutputIteratorT, FunctionT> body_type;
+
+        size_t      cnt = size_t(last - first);
+        body_type   body = { first, result, function };
+        parallel_for(pool, size_t(0), cnt, body, grain);
+        return  result + cnt;
+    }
+    template <typename InputIteratorT, typename OutputIteratorT,
+        typename FunctionT>
+    OutputIteratorT parallel_transform (
+        InputIteratorT first, InputIteratorT last, OutputIteratorT result,
+        const FunctionT& function, size_t grain = 0)
+    {
+        return  parallel_transform(
+            parallel_pool(), first, last, result, function, grain);
+    }
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Reduces [first, last) with body over grain-sized
+    *               chunks in parallel, then folds the partial results
+    *               with combine, left to right.
+    *
+    *   Partial results are combined in index order, so combine needs to
+    *   be associative, not commutative.
+    *
+    *   \param      body    Functor returning the reduction of
+    *                       [size_t first, size_t last), concurrently.
+    *   \param      combine Functor returning combine(T lhs, T rhs).
+    *   See parallel_for() for grain, cancellation and exceptions.
+    */
+    template <typename T, typename BodyT, typename CombineT>
+    T parallel_reduce (thread_pool& pool, size_t first, size_t last,
+        const T& identity, const BodyT& body, const CombineT& combine,
+        size_t grain = 0)
+    {
+        if (first >= last)
+            return  identity;
+        size_t  cnt = last - first;
+        grain = nonpublic::parallel_grain(pool, cnt, grain);
+
+        size_t          chunks = cnt / grain;
+        std::vector<T>  partials(chunks, identity);
+        nonpublic::reduce_body<T, BodyT>    chunk_body =
+            { first, grain, &partials, &body };
+        parallel_for(pool, size_t(0), chunks, chunk_body, 1);
+
+        T       result(identity);
+        size_t  idx = 0;
+        for (; idx < chunks; ++idx)
+            result = combine(result, partials[idx]);
+        //  The remainder, shorter than a chunk.
+        if (first + chunks * grain < last)
+            result = combine(result, body(first + chunks * grain, last));
+        return  result;
+    }
+    template <typename T, typename BodyT, typename CombineT>
+    T parallel_reduce (size_t first, size_t last, const T& identity,
+        const BodyT& body, const CombineT& combine, size_t grain = 0)
+    {
+        return  parallel_reduce(parallel_pool(),
+            first, last, identity, body, combine, grain);
+    }
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Parallel quick sort over random access iterators, not
+    *               stable. Ranges of at most grain elements are sorted by
+    *               std::sort().
+    *
+    *   See parallel_for() for grain, cancellation and exceptions. If an
+    *   exception is thrown, [first, last) is left in an unspecified order.
+    */
+    template <typename IteratorT, typename CompareT>
+    void parallel_sort (thread_pool& pool, IteratorT first, IteratorT last,
+        const CompareT& compare, size_t grain = 0)
+    {
+        if (last - first < 2)
+            return;
+        grain = nonpublic::parallel_grain(pool, size_t(last - first), grain);
+
+        nonpublic::sort_work<IteratorT, CompareT>   work =
+            { first, last, grain, compare };
+        nonpublic::parallel_run(pool, work);
+    }
+    template <typename IteratorT, typename CompareT>
+    void parallel_sort (IteratorT first, IteratorT last,
+        const CompareT& compare, size_t grain = 0)
+    {
+        parallel_sort(parallel_pool(), first, last, compare, grain);
+    }
+    template <typename IteratorT>
+    void parallel_sort (IteratorT first, IteratorT last)
+    {
+        typedef typename std::iterator_traits<IteratorT>::value_type
+                                                        value_type;
+        parallel_sort(parallel_pool(), first, last, std::less<value_type>());
+    }
+
+}   //  namespace k2
+
+#endif  //  !K2_PARALLEL_H
@@ -0,0 +1,688 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_PIPELINE_H
+#define K2_PIPELINE_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_MPMC_QUEUE_H
+#   include <k2/mpmc_queue.h>
+#endif
+#ifndef K2_TIMING_H
+#   include <k2/timing.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+
+#ifndef K2_STD_H_MEMORY
+#   define  K2_STD_H_MEMORY
+#   include <memory>
+#endif
+#ifndef K2_STD_H_VECTOR
+#   define  K2_STD_H_VECTOR
+#   include <vector>
+#endif
+#ifndef K2_STD_H_IOSFWD
+#   include <iosfwd>
+#   define  K2_STD_H_IOSFWD
+#endif
+
+namespace k2
+{
+
+    class pipeline;
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Statistics of a stage of a pipeline, see
+    *               pipeline::stats().
+    *
+    *   Counters are updated once per batch by each worker, they lag
+    *   behind by at most a batch while the pipeline runs.
+    */
+    struct pipeline_stage_stats
+    {
+        const char* name;
+        size_t      workers;
+        uint64_t    items_in;
+        uint64_t    items_out;
+        uint64_t    batches;
+        /**
+        *   \brief  Time spent in the stage function, summed over workers.
+        */
+        uint64_t    busy_nsec;
+        /**
+        *   \brief  Time spent blocked on a full output channel, summed
+        *           over workers. A stage stalling on its output waits for
+        *           a slower stage downstream.
+        */
+        uint64_t    stall_nsec;
+        uint64_t    errors;
+        size_t      queue_depth;
+        size_t      queue_capacity;
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct pipeline_impl;
+        template <typename FnT> class pipeline_stage;
+
+        class pipeline_channel_base
+        {
+        public:
+            virtual ~pipeline_channel_base ()
+            {
+            }
+
+            virtual size_t  size () const = 0;
+            virtual size_t  capacity () const = 0;
+
+            void    add_producer ()
+            {
+                atomic_increase(m_producers);
+            }
+            //  The last producer closes *this.
+            void    remove_producer ()
+            {
+                if (atomic_decrease(m_producers) == false)
+                {
+                    mutex::scoped_guard guard(m_mtx);
+                    m_cv.broadcast();
+                }
+            }
+
+        protected:
+            pipeline_channel_base ()
+            :   m_producers(0)
+            ,   m_waiters(0)
+            ,   m_cv(m_mtx)
+            {
+            }
+
+            void    wake (size_t count)
+            {
+                //  Orders publishing of values before reading waiters.
+                memory_barrier();
+                if (K2_OPT_BRANCH_TRUE(atomic_load(m_waiters) == 0))
+                    return;
+
+                mutex::scoped_guard guard(m_mtx);
+                if (count == 1)
+                    m_cv.signal();
+                else
+                    m_cv.broadcast();
+            }
+
+            atomic_int_t    m_producers;
+            atomic_int_t    m_waiters;
+            mutex           m_mtx;
+            cond_var        m_cv;
+        };
+
+        //  A bounded queue closed once its producers are gone.
+        template <typename ValueT>
+        class pipeline_channel
+        :   public pipeline_channel_base
+        {
+        public:
+            explicit pipeline_channel (size_t capacity)
+            :   m_queue(capacity)
+            {
+            }
+
+            virtual size_t  size () const
+            {
+                return  m_queue.size();
+            }
+            virtual size_t  capacity () const
+            {
+                return  m_queue.capacity();
+            }
+
+            //  Appends cnt values, blocking while *this is full.
+            //  Returns nano-seconds blocked.
+            uint64_t    push_n (const ValueT* pvalues, size_t cnt)
+            {
+                uint64_t    stalled = 0;
+                while (cnt)
+                {
+                    size_t  pushed = m_queue.try_push_n(pvalues, cnt);
+                    if (pushed == 0)
+                    {
+                        uint64_t    start = hires_clock::now_nsec();
+                        m_queue.push(*pvalues);
+                        stalled += hires_clock::now_nsec() - start;
+                        pushed = 1;
+                    }
+                    pvalues += pushed;
+                    cnt -= pushed;
+                    this->wake(pushed);
+                }
+                return  stalled;
+            }
+            bool    try_push (const ValueT& value)
+            {
+                if (m_queue.try_push(value) == false)
+                    return  false;
+                this->wake(1);
+                return  true;
+            }
+
+            //  Removes up to cnt values, blocking while *this is empty.
+            //  Returns 0 once *this is closed and drained.
+            size_t  pop_n (ValueT* pvalues, size_t cnt)
+            {
+                for (;;)
+                {
+                    size_t  popped = m_queue.try_pop_n(pvalues, cnt);
+                    if (popped)
+                        return  popped;
+
+                    mutex::scoped_guard guard(m_mtx);
+                    //  Announces before re-checking, see wake().
+                    atomic_add(m_waiters, 1);
+                    bool    closed = false;
+                    if (m_queue.empty())
+                    {
+                        if (atomic_load(m_producers) == 0)
+                            closed = true;
+                        else
+                            m_cv.wait();
+                    }
+                    atomic_add(m_waiters, -1);
+                    if (closed && m_queue.empty())
+                        return  0;
+                }
+            }
+
+        private:
+            mpmc_queue<ValueT>  m_queue;
+        };
+
+        //  Counters of one worker, each on a cache line of its own.
+        struct pipeline_counters
+        {
+            uint64_t    items_in;
+            uint64_t    items_out;
+            uint64_t    batches;
+            uint64_t    busy_nsec;
+            uint64_t    stall_nsec;
+            uint64_t    errors;
+            char        pad[K2_OPT_CACHE_LINE_BYTES];
+        };
+
+        class pipeline_stage_base
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            virtual ~pipeline_stage_base ()
+            {
+            }
+
+            //  Body of worker idx.
+            virtual void    run (size_t idx) = 0;
+            //  Adds or removes a producer of the output channel, if any.
+            virtual void    add_producer () = 0;
+            virtual void    remove_producer () = 0;
+
+            const char*                     m_name;
+            pipeline_channel_base*          m_pinput;
+            std::vector<pipeline_counters>  m_counters;
+
+        protected:
+            pipeline_stage_base (const char* name, pipeline_channel_base* pinput)
+            :   m_name(name)
+            ,   m_pinput(pinput)
+            {
+            }
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Collects the values emitted by a stage function.
+    *
+    *   Values are handed to the next stage in batches, after each input
+    *   batch or once a batch is full.
+    */
+    template <typename ValueT>
+    class pipeline_output
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        void    push (const ValueT& value)
+        {
+            m_values.push_back(value);
+            if (m_values.size() >= m_batch)
+                this->flush();
+        }
+
+    private:
+        template <typename FnT> friend class nonpublic::pipeline_stage;
+
+        pipeline_output (
+            nonpublic::pipeline_channel<ValueT>& channel,
+            nonpublic::pipeline_counters& counters, size_t batch)
+        :   m_channel(channel)
+        ,   m_counters(counters)
+        ,   m_batch(batch)
+        {
+            m_values.reserve(batch);
+        }
+
+        void    flush ()
+        {
+            if (m_values.empty())
+                return;
+            m_counters.stall_nsec +=
+                m_channel.push_n(&m_values[0], m_values.size());
+            m_counters.items_out += m_values.size();
+            m_values.clear();
+        }
+
+        nonpublic::pipeline_channel<ValueT>&    m_channel;
+        nonpublic::pipeline_counters&           m_counters;
+        const size_t                            m_batch;
+        std::vector<ValueT>                     m_values;
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        template <typename FnT>
+        class pipeline_stage
+        :   public pipeline_stage_base
+        {
+        public:
+            typedef typename FnT::input_type    in_type;
+            typedef typename FnT::output_type   out_type;
+
+            pipeline_stage (const char* name,
+                pipeline_channel<in_type>* pinput,
+                pipeline_channel<out_type>* poutput,
+                const FnT& fn, size_t batch)
+            :   pipeline_stage_base(name, pinput)
+            ,   m_pin(pinput)
+            ,   m_pout(poutput)
+            ,   m_fn(fn)
+            ,   m_batch(batch)
+            {
+            }
+
+            virtual void    add_producer ()
+            {
+                m_pout->add_producer();
+            }
+            virtual void    remove_producer ()
+            {
+                m_pout->remove_producer();
+            }
+            virtual void    run (size_t idx)
+            {
+                //  Closes the output once the last worker is gone.
+                struct closer
+                {
+                    pipeline_channel_base*  m_pchannel;
+
+                    ~closer ()
+                    {
+                        m_pchannel->remove_producer();
+                    }
+                }   guard = { m_pout };
+
+                pipeline_counters&          counters = m_counters[idx];
+                FnT                         fn(m_fn);
+                std::vector<in_type>        values(m_batch);
+                pipeline_output<out_type>   out(*m_pout, counters, m_batch);
+
+                size_t  cnt;
+                while ((cnt = m_pin->pop_n(&values[0], m_batch)) != 0)
+                {
+                    uint64_t    start = hires_clock::now_nsec();
+                    uint64_t    stalled = counters.stall_nsec;
+                    size_t  pos = 0;
+                    for (; pos < cnt; ++pos)
+                    {
+                        try
+                        {
+                            fn(values[pos], out);
+                        }
+                        catch (...)
+                        {
+                            ++counters.errors;
+                        }
+                    }
+                    out.flush();
+                    counters.items_in += cnt;
+                    ++counters.batches;
+                    counters.busy_nsec += hires_clock::now_nsec() - start -
+                        (counters.stall_nsec - stalled);
+                }
+            }
+
+        private:
+            pipeline_channel<in_type>*  m_pin;
+            pipeline_channel<out_type>* m_pout;
+            const FnT                   m_fn;
+            const size_t                m_batch;
+        };
+
+        template <typename FnT>
+        class pipeline_sink
+        :   public pipeline_stage_base
+        {
+        public:
+            typedef typename FnT::input_type    in_type;
+
+            pipeline_sink (const char* name,
+                pipeline_channel<in_type>* pinput,
+                const FnT& fn, size_t batch)
+            :   pipeline_stage_base(name, pinput)
+            ,   m_pin(pinput)
+            ,   m_fn(fn)
+            ,   m_batch(batch)
+            {
+            }
+
+            virtual void    add_producer ()
+            {
+            }
+            virtual void    remove_producer ()
+            {
+            }
+            virtual void    run (size_t idx)
+            {
+                pipeline_counters&      counters = m_counters[idx];
+                FnT                     fn(m_fn);
+                std::vector<in_type>    values(m_batch);
+
+                size_t  cnt;
+                while ((cnt = m_pin->pop_n(&values[0], m_batch)) != 0)
+                {
+                    uint64_t    start = hires_clock::now_nsec();
+                    size_t  pos = 0;
+                    for (; pos < cnt; ++pos)
+                    {
+                        try
+                        {
+                            fn(values[pos]);
+                        }
+                        catch (...)
+                        {
+                            ++counters.errors;
+                        }
+                    }
+                    counters.items_in += cnt;
+                    ++counters.batches;
+                    counters.busy_nsec += hires_clock::now_nsec() - start;
+                }
+            }
+
+        private:
+            pipeline_channel<in_type>*  m_pin;
+            const FnT                   m_fn;
+            const size_t                m_batch;
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Handle of a channel of a pipeline.
+    *
+    *   A port returned by pipeline::input() feeds the pipeline, one
+    *   returned by pipeline::stage() is read either by the next stage or
+    *   with pop(), not both. An output left unread fills up, and stalls
+    *   the stages before it.
+    */
+    template <typename ValueT>
+    class pipeline_port
+    {
+    public:
+        typedef ValueT  value_type;
+
+        pipeline_port ()
+        :   m_pchannel(0)
+        {
+        }
+
+        /**
+        *   \brief      Appends a copy of \a value, blocks calling thread
+        *               while the channel is full.
+        */
+        void    push (const ValueT& value)
+        {
+            m_pchannel->push_n(&value, 1);
+        }
+        /**
+        *   \return     false if the channel is full.
+        */
+        bool    try_push (const ValueT& value)
+        {
+            return  m_pchannel->try_push(value);
+        }
+        /**
+        *   \brief      Removes the first value and assigns it to \a value,
+        *               blocks calling thread while the channel is empty.
+        *   \return     false once the channel is closed and drained.
+        */
+        bool    pop (ValueT& value)
+        {
+            return  m_pchannel->pop_n(&value, 1) == 1;
+        }
+
+        size_t  size () const
+        {
+            return  m_pchannel->size();
+        }
+        size_t  capacity () const
+        {
+            return  m_pchannel->capacity();
+        }
+
+    private:
+        friend class pipeline;
+
+        explicit pipeline_port (nonpublic::pipeline_channel<ValueT>* pchannel)
+        :   m_pchannel(pchannel)
+        {
+        }
+
+        nonpublic::pipeline_channel<ValueT>*    m_pchannel;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Stages connected by bounded channels, each run by its
+    *               own threads.
+    *
+    *   A stage function is a class with typedefs input_type and
+    *   output_type, and a call operator
+    *
+    *       void operator() (input_type& in, pipeline_output<output_type>& out);
+    *
+    *   emitting any number of values to \a out. A sink, the last stage,
+    *   has no output_type and a call operator taking \a in only. Each
+    *   worker calls a copy of the function of its stage, so the function
+    *   may keep state of its own.
+    *
+    *   Workers take their input in batches, and hand their output on in
+    *   batches, from and to lock-free channels. A full channel blocks the
+    *   stage writing to it, so a slow stage holds back the stages before
+    *   it, up to the producers pushing to input(). Values keep their order
+    *   through stages of one worker only.
+    *
+    *   Values have to be default constructable and assignable. Exceptions
+    *   from stage functions drop the value and are counted as errors.
+    */
+    class pipeline
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \param      capacity    Capacity of each channel, rounded up to
+        *                           a power of two.
+        *   \param      batch       Maximum number of values taken, or
+        *                           handed on, at once.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC explicit pipeline (size_t capacity = 1024, size_t batch = 32);
+        /**
+        *   \brief      close(), then wait().
+        */
+        K2_DLSPEC ~pipeline ();
+
+        /**
+        *   \brief      Creates a channel fed by the caller, closed by
+        *               close().
+        *   \throw      bad_resource_alloc
+        */
+        template <typename ValueT>
+        pipeline_port<ValueT>   input ()
+        {
+            nonpublic::pipeline_channel<ValueT>*    pchannel =
+                this->new_channel<ValueT>();
+            pchannel->add_producer();
+            this->add_input(pchannel);
+            return  pipeline_port<ValueT>(pchannel);
+        }
+
+        /**
+        *   \brief      Runs copies of \a fn on \a workers threads, reading
+        *               \a from.
+        *   \return     The port of the output of the stage.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename FnT>
+        pipeline_port<typename FnT::output_type>    stage (
+            pipeline_port<typename FnT::input_type> from,
+            const FnT& fn, size_t workers = 1, const char* name = "")
+        {
+            typedef typename FnT::output_type   out_type;
+
+            nonpublic::pipeline_channel<out_type>*  pchannel =
+                this->new_channel<out_type>();
+            std::auto_ptr<nonpublic::pipeline_stage_base>   pstage;
+            try
+            {
+                pstage.reset(new nonpublic::pipeline_stage<FnT>(
+                    name, from.m_pchannel, pchannel, fn, m_batch));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            this->add_stage(pstage, workers);
+            return  pipeline_port<out_type>(pchannel);
+        }
+        /**
+        *   \brief      Runs copies of \a fn on \a workers threads, reading
+        *               \a from, as the last stage.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename FnT>
+        void    sink (
+            pipeline_port<typename FnT::input_type> from,
+            const FnT& fn, size_t workers = 1, const char* name = "")
+        {
+            std::auto_ptr<nonpublic::pipeline_stage_base>   pstage;
+            try
+            {
+                pstage.reset(new nonpublic::pipeline_sink<FnT>(
+                    name, from.m_pchannel, fn, m_batch));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            this->add_stage(pstage, workers);
+        }
+
+        /**
+        *   \brief      Closes the ports returned by input(). Stages finish
+        *               the values queued, then exit.
+        */
+        K2_DLSPEC void  close ();
+        /**
+        *   \brief      Waits for all stages to exit.
+        *   \pre        close() has been called, or the inputs would be
+        *               waited for forever.
+        */
+        K2_DLSPEC void  wait ();
+
+        /**
+        *   \brief      Statistics of all stages, in the order added.
+        */
+        K2_DLSPEC void  stats (std::vector<pipeline_stage_stats>& out) const;
+        /**
+        *   \brief      Writes stats() to \a os, one line per stage.
+        */
+        K2_DLSPEC void  report (std::ostream& os) const;
+
+    private:
+        template <typename ValueT>
+        nonpublic::pipeline_channel<ValueT>*    new_channel ()
+        {
+            std::auto_ptr<nonpublic::pipeline_channel<ValueT> > pchannel;
+            try
+            {
+                pchannel.reset(new nonpublic::pipeline_channel<ValueT>(m_capacity));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            this->add_channel(pchannel.get());
+            return  pchannel.release();
+        }
+        K2_DLSPEC void  add_channel (nonpublic::pipeline_channel_base* pchannel);
+        K2_DLSPEC void  add_input (nonpublic::pipeline_channel_base* pchannel);
+        //  Takes ownership of *pstage and starts its workers.
+        K2_DLSPEC void  add_stage (
+            std::auto_ptr<nonpublic::pipeline_stage_base>& pstage,
+            size_t workers);
+
+        nonpublic::pipeline_impl*   m_pimpl;
+        const size_t                m_capacity;
+        const size_t                m_batch;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_PIPELINE_H
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_RECLAIM_H
+#define K2_RECLAIM_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+
+#ifndef K2_STD_H_CSTDDEF
+#   define  K2_STD_H_CSTDDEF
+#   include <cstddef>
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct retired_node
+        {
+            void*   p;
+            void    (*reclaim)(void*);
+        };
+
+        template <typename T>
+        void reclaim_delete (void* p)
+        {
+            delete  reinterpret_cast<T*>(p);
+        }
+        template <typename T, typename AllocT>
+        void reclaim_dealloc (void* p)
+        {
+            typedef typename AllocT::template rebind<T>::other  alloc_type;
+
+            alloc_type  alloc;
+            T*          pt = reinterpret_cast<T*>(p);
+            alloc.destroy(pt);
+            alloc.deallocate(pt, 1);
+        }
+
+        struct hazard_record;
+        struct epoch_record;
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Hazard pointer, protects a node of a lock-free structure
+    *               from being reclaimed while calling thread accesses it.
+    *
+    *   Each thread owns hazard_guard::max_per_thread hazard slots, a
+    *   hazard_guard occupies one slot during its lifetime. Nodes unlinked
+    *   from a structure are handed to hazard_reclaimer::retire(), they are
+    *   reclaimed once no hazard slot points at them.
+    *
+    *   Calling thread is registered on first use, and unregistered when it
+    *   exits.
+    *
+    *   \relates    hazard_reclaimer
+    */
+    class hazard_guard
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        static const size_t max_per_thread = 8;
+
+        /**
+        *   \brief      Occupies a hazard slot of calling thread.
+        *   \throw      bad_resource_alloc, if all slots of calling thread
+        *               are occupied.
+        */
+        K2_DLSPEC hazard_guard ();
+        /**
+        *   \brief      Clears and frees the occupied hazard slot.
+        */
+        K2_DLSPEC ~hazard_guard ();
+
+        /**
+        *   \brief      Loads \a src and protects the loaded pointer.
+        *
+        *   The returned pointer remains valid until *this protects
+        *   another pointer, is reset or destroyed, provided that nodes are
+        *   retired only after being unlinked from \a src.
+        */
+        template <typename T>
+        T* protect (T* volatile const& src)
+        {
+            T*  p = atomic_load(src);
+            for (;;)
+            {
+                this->set(p);
+                //  Publishes the hazard before validating it.
+                memory_barrier();
+
+                T*  validated = atomic_load(src);
+                if (validated == p)
+                    return  p;
+                p = validated;
+            }
+        }
+        /**
+        *   \brief      Protects \a p, which caller has to validate.
+        */
+        void set (const volatile void* p)
+        {
+            atomic_store(*m_pslot, const_cast<void*>(p));
+        }
+        /**
+        *   \brief      Protects nothing.
+        */
+        void reset ()
+        {
+            atomic_store(*m_pslot, static_cast<void*>(0));
+        }
+
+    private:
+        nonpublic::hazard_record*   m_precord;
+        void* volatile*             m_pslot;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Deferred reclamation of nodes protected by hazard_guard.
+    *
+    *   Retired nodes are batched per thread. A batch is scanned against all
+    *   hazard slots when it grows past twice the number of slots, unless
+    *   collect() is called. Nodes retired by exited threads are adopted by
+    *   the next scan of any thread.
+    *
+    *   \relates    hazard_guard
+    */
+    struct hazard_reclaimer
+    {
+        /**
+        *   \brief      Retires \a p, which will be released by delete.
+        */
+        template <typename T>
+        static void retire (T* p)
+        {
+            hazard_reclaimer::retire(
+                reinterpret_cast<void*>(p), nonpublic::reclaim_delete<T>);
+        }
+        /**
+        *   \brief      Retires \a p, which will be destroyed and deallocated
+        *               by an AllocT object.
+        *
+        *   AllocT is a Standard Allocator-compliant type whose objects
+        *   compare equal, e.g. shared_pool_allocator<>.
+        */
+        template <typename T, typename AllocT>
+        static void retire (T* p, const AllocT&)
+        {
+            hazard_reclaimer::retire(
+                reinterpret_cast<void*>(p),
+                nonpublic::reclaim_dealloc<T, AllocT>);
+        }
+        /**
+        *   \brief      Retires \a p, which will be released by reclaim(p).
+        */
+        K2_DLSPEC static void   retire (void* p, void (*reclaim)(void*));
+        /**
+        *   \brief      Reclaims all nodes retired by calling thread, and
+        *               by exited threads, that are not protected.
+        */
+        K2_DLSPEC static void   collect ();
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Epoch-based reclamation critical section.
+    *
+    *   Nodes retired by epoch_reclaimer::retire() are reclaimed only after
+    *   all threads that might have observed them have left their critical
+    *   sections. Critical sections nest, and must not block for long,
+    *   as they hold back reclamation of all threads.
+    *
+    *   Calling thread is registered on first use, and unregistered when it
+    *   exits.
+    *
+    *   \relates    epoch_reclaimer
+    */
+    class epoch_guard
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Enters a critical section.
+        */
+        K2_DLSPEC epoch_guard ();
+        /**
+        *   \brief      Leaves the critical section.
+        */
+        K2_DLSPEC ~epoch_guard ();
+
+    private:
+        nonpublic::epoch_record*    m_precord;
+    };
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Deferred reclamation of nodes accessed in epoch_guard
+    *               critical sections.
+    *
+    *   Retired nodes are batched per thread and per epoch. The global epoch
+    *   advances when every thread inside a critical section has observed
+    *   it, a batch is reclaimed two epochs after it was retired.
+    *
+    *   \relates    epoch_guard
+    */
+    struct epoch_reclaimer
+    {
+        /**
+        *   \brief      Retires \a p, which will be released by delete.
+        */
+        template <typename T>
+        static void retire (T* p)
+        {
+            epoch_reclaimer::retire(
+                reinterpret_cast<void*>(p), nonpublic::reclaim_delete<T>);
+        }
+        /**
+        *   \brief      Retires \a p, which will be destroyed and deallocated
+        *               by an AllocT object.
+        *
+        *   AllocT is a Standard Allocator-compliant type whose objects
+        *   compare equal, e.g. shared_pool_allocator<>.
+        */
+        template <typename T, typename AllocT>
+        static void retire (T* p, const AllocT&)
+        {
+            epoch_reclaimer::retire(
+                reinterpret_cast<void*>(p),
+                nonpublic::reclaim_dealloc<T, AllocT>);
+        }
+        /**
+        *   \brief      Retires \a p, which will be released by reclaim(p).
+        */
+        K2_DLSPEC static void   retire (void* p, void (*reclaim)(void*));
+        /**
+        *   \brief      Tries to advance the global epoch, then reclaims all
+        *               nodes retired by calling thread, and by exited
+        *               threads, that are no longer reachable.
+        *
+        *   Must not be called inside a critical section.
+        */
+        K2_DLSPEC static void   collect ();
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_RECLAIM_H
@@ -32,6 +32,9 @@
 #ifndef K2_DLSPEC_H
 #   include <k2/dlspec.h>
 #endif
+#ifndef K2_INPLACE_FUNCTION_H
+#   include <k2/inplace_function.h>
+#endif
 
 #ifndef K2_STD_H_CLIMITS
 #   include <climits>
@@ -61,19 +64,13 @@ namespace k2
         template <typename FuntionT>
         static void atexit (FuntionT func, prio_t pri = prio_default)
         {
-            FuntionT* arg = new FuntionT(func);
-            void(*adapter)(void*) = runtime::adapter<FuntionT>;
-            runtime::atexit_impl(adapter, (void*)arg, pri);
+            inplace_function<void ()>   function0(func);
+            runtime::atexit_impl(function0, pri);
         }
 
     private:
-        K2_DLSPEC static void atexit_impl (void (*adapter)(void*), void* function0, prio_t pri);
-        template <typename FuntionT>
-        static void adapter (void* function0)
-        {
-            std::auto_ptr<FuntionT> functor0(reinterpret_cast<FuntionT*>(function0));
-            (*functor0)();
-        }
+        //  Takes function0 over, leaving it empty.
+        K2_DLSPEC static void atexit_impl (inplace_function<void ()>& function0, prio_t pri);
     };
 
 }   //  namespace k2
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_SEMAPHORE_H
+#define K2_SEMAPHORE_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_FUTEX_H
+#   include <k2/futex.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Counting semaphore.
+    *
+    *   acquire() and release() only touch an atomic counter unless a
+    *   thread has to block, blocked threads are parked on the counter.
+    *   \relates    timestamp
+    */
+    class semaphore
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        explicit semaphore (int count = 0)
+        :   m_count(count)
+        ,   m_waiters(0)
+        {
+        }
+
+        /**
+        *   \brief      Decrements the count, if it is positive, never
+        *               blocks calling thread.
+        *   \return     true, if decremented.
+        */
+        bool try_acquire ()
+        {
+            int count = atomic_load(m_count);
+            while (count > 0)
+            {
+                if (atomic_cas(m_count, count, count - 1))
+                    return  true;
+                count = atomic_load(m_count);
+            }
+            return  false;
+        }
+        /**
+        *   \brief      Decrements the count, blocks calling thread while
+        *               it is not positive.
+        */
+        void acquire ()
+        {
+            if (K2_OPT_BRANCH_FALSE(this->try_acquire() == false))
+                this->acquire_slow(0);
+        }
+        /**
+        *   \brief      Decrements the count, blocks calling thread while
+        *               it is not positive, or until timed-out.
+        *   \return     true, if decremented. false, if timed-out.
+        */
+        bool acquire (const timestamp& timer)
+        {
+            if (K2_OPT_BRANCH_TRUE(this->try_acquire()))
+                return  true;
+            return  this->acquire_slow(&timer);
+        }
+        /**
+        *   \brief      Increments the count by \a count, and unblocks up
+        *               to as many threads.
+        */
+        void release (int count = 1)
+        {
+            //  atomic_add() is a full barrier, orders the count before
+            //  reading waiters, see acquire_slow().
+            atomic_add(m_count, count);
+            if (K2_OPT_BRANCH_FALSE(atomic_load(m_waiters) != 0))
+                nonpublic::futex_wake(m_count, count);
+        }
+
+        int count () const
+        {
+            return  atomic_load(m_count);
+        }
+
+    private:
+        K2_DLSPEC bool  acquire_slow (const timestamp* ptimer);
+
+        atomic_int_t    m_count;
+        atomic_int_t    m_waiters;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_SEMAPHORE_H
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_SHARDED_COUNTER_H
+#define K2_SHARDED_COUNTER_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Counter for hot statistics, updated from many threads.
+    *
+    *   The value is split over slots, each on its own cache line. A thread
+    *   adds to the slot of the cpu it runs on (Linux), or to a slot it was
+    *   assigned on first use (elsewhere), so concurrent updates rarely
+    *   touch the same line. Reading sums all slots.
+    *
+    *   fold() periodically moves the slots into a single total, e.g. to
+    *   report per-interval deltas.
+    *
+    *   read() and fold() are exact only when no add() is in progress.
+    */
+    class sharded_counter
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Allocates resource for *this.
+        *   \param      shards  Number of slots, rounded up to a power of
+        *                       two. 0 for one slot per configured cpu.
+        *   \throw      bad_resource_alloc
+        */
+        explicit sharded_counter (size_t shards = 0)
+        :   m_pslots(0)
+        ,   m_mask(sharded_counter::round_up(
+                shards ? shards : sharded_counter::cpu_count()) - 1)
+        ,   m_folded(0)
+        {
+            try
+            {
+                m_pslots = new slot[m_mask + 1];
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+        ~sharded_counter ()
+        {
+            delete [] m_pslots;
+        }
+
+        /**
+        *   \brief      Adds \a delta to *this.
+        */
+        void add (long delta)
+        {
+            atomic_add(
+                m_pslots[sharded_counter::shard_hint() & m_mask].m_value,
+                delta);
+        }
+        void increase ()
+        {
+            this->add(1);
+        }
+        void decrease ()
+        {
+            this->add(-1);
+        }
+
+        /**
+        *   \brief      Sum of all slots and the folded total.
+        */
+        long read () const
+        {
+            long    sum = atomic_load(m_folded);
+            size_t  idx = 0;
+            for (; idx <= m_mask; ++idx)
+                sum += atomic_load(m_pslots[idx].m_value);
+            return  sum;
+        }
+        /**
+        *   \brief      Moves the values of all slots to the folded total.
+        *   \return     The value moved, i.e. added since last fold().
+        */
+        long fold ()
+        {
+            long    delta = 0;
+            size_t  idx = 0;
+            for (; idx <= m_mask; ++idx)
+                delta += atomic_exchange(m_pslots[idx].m_value, 0L);
+            atomic_add(m_folded, delta);
+            return  delta;
+        }
+        /**
+        *   \brief      Resets *this to zero.
+        *   \return     The value before reset.
+        */
+        long reset ()
+        {
+            this->fold();
+            return  atomic_exchange(m_folded, 0L);
+        }
+
+        size_t  shards () const
+        {
+            return  m_mask + 1;
+        }
+
+        /**
+        *   \brief      Index of the slot calling thread should update,
+        *               callers mask it with their number of slots.
+        */
+        K2_DLSPEC static size_t shard_hint ();
+        /**
+        *   \brief      Number of configured cpus, at least 1.
+        */
+        K2_DLSPEC static size_t cpu_count ();
+
+    private:
+        struct slot
+        {
+            atomic_long_t   m_value;
+            char            m_pad[K2_OPT_CACHE_LINE_BYTES - sizeof(atomic_long_t)];
+
+            slot ()
+            :   m_value(0)
+            {
+            }
+        };
+
+        static size_t round_up (size_t count)
+        {
+            size_t  rounded = 1;
+            while (rounded < count)
+                rounded <<= 1;
+            return  rounded;
+        }
+
+        slot*           m_pslots;
+        const size_t    m_mask;
+        atomic_long_t   m_folded;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_SHARDED_COUNTER_H
@@ -33,6 +33,10 @@
 #   define  K2_STD_H_LIMITS
 #   include <climits>
 #endif
+#ifndef K2_STD_H_MEMORY
+#   define  K2_STD_H_MEMORY
+#   include <memory>
+#endif
 #ifndef K2_RUNTIME_H
 #   include <k2/runtime.h>
 #endif
@@ -42,6 +46,12 @@
 #ifndef K2_EXCEPTION_H
 #   include <k2/exception.h>
 #endif
+#ifndef K2_TLS_H
+#   include <k2/tls_ptr.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
 
 namespace k2
 {
@@ -158,6 +168,46 @@ namespace k2
     >
     char singleton<InstanceT, InstanceTagT, Lifetime>::s_instance_holder[sizeof(InstanceT)];
 
+    /**
+    *   \ingroup    Singleton
+    *   \brief      A singleton class template with one controlled
+    *               instance per thread.
+    *
+    *               The instance of a thread is default constructed on its
+    *               first reference, and deleted when the thread exits.
+    *               Once constructed, instance() is a single load of
+    *               thread local storage, see static_tls_ptr<>.
+    *
+    *               Instances of the main thread are not deleted.
+    */
+    template <
+        typename    InstanceT
+    ,   typename    InstanceTagT = void
+    >
+    class thread_local_singleton
+    {
+    private:
+        typedef thread_local_singleton<InstanceT, InstanceTagT> self_type;
+        typedef static_tls_ptr<InstanceT, self_type>            tls_type;
+
+    public:
+        static InstanceT&   instance ()
+        {
+            InstanceT*  instance_ptr = tls_type::get();
+            if (K2_OPT_BRANCH_TRUE(instance_ptr != 0))
+                return  *instance_ptr;
+            return  self_type::instance_init();
+        }
+
+    private:
+        static InstanceT&   instance_init ()
+        {
+            std::auto_ptr<InstanceT>    guard(new InstanceT());
+            tls_type::reset(guard.get());
+            return  *guard.release();
+        }
+    };
+
 }   //  namespace k2
 
 #endif  //  K2_SINGLETON_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_SNAPSHOT_PTR_H
+#define K2_SNAPSHOT_PTR_H
+
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_RECLAIM_H
+#   include <k2/reclaim.h>
+#endif
+#ifndef K2_MUTEX_H
+#   include <k2/mutex.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+
+#ifndef K2_STD_H_MEMORY
+#   include <memory>
+#   define  K2_STD_H_MEMORY
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Read-copy-update publisher of immutable snapshots.
+    *
+    *   Writers publish a new version of T with one atomic pointer swap.
+    *   Readers access the current version through a read_guard, which
+    *   never blocks nor locks. Replaced versions are retired to
+    *   epoch_reclaimer, and deleted only after every read_guard that
+    *   might have observed them has been destroyed.
+    *
+    *   Suits read-mostly data, e.g. routing tables and configurations,
+    *   read on every request and replaced a few times a minute.
+    */
+    template <typename T>
+    class snapshot_ptr
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef T   element_type;
+
+        /**
+        *   \ingroup    Threading
+        *   \brief      Read access to the snapshot current at construction.
+        *
+        *   The snapshot stays valid, and unchanged, as long as *this
+        *   exists. Keep it short lived, as it holds back reclamation of
+        *   all retired nodes.
+        */
+        class read_guard
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            explicit read_guard (const snapshot_ptr& snapshot)
+            :   m_p(atomic_load(snapshot.m_p))
+            {
+            }
+
+            const T*    get () const
+            {
+                return  m_p;
+            }
+            const T*    operator-> () const
+            {
+                return  m_p;
+            }
+            const T&    operator* () const
+            {
+                return  *m_p;
+            }
+
+        private:
+            //  Entered before m_p is loaded.
+            epoch_guard m_critical_section;
+            const T*    m_p;
+        };
+
+        /**
+        *   \brief      Takes ownership of \a pinitial as the first
+        *               snapshot.
+        */
+        explicit snapshot_ptr (std::auto_ptr<T> pinitial)
+        :   m_p(pinitial.release())
+        {
+        }
+        /**
+        *   \brief      Deletes the current snapshot, no thread may be
+        *               accessing *this.
+        */
+        ~snapshot_ptr ()
+        {
+            delete  m_p;
+        }
+
+        /**
+        *   \brief      Publishes \a pnew, and retires the replaced
+        *               snapshot.
+        */
+        void publish (std::auto_ptr<T> pnew)
+        {
+            mutex::scoped_guard guard(m_writer_mtx);
+            this->replace(pnew);
+        }
+        /**
+        *   \brief      Publishes a copy of the current snapshot, modified
+        *               by update(copy).
+        *
+        *   Concurrent update() and publish() calls are serialized, none
+        *   is lost. *this must hold a snapshot.
+        *
+        *   \throw      bad_resource_alloc
+        */
+        template <typename UpdateF>
+        void update (UpdateF update)
+        {
+            mutex::scoped_guard guard(m_writer_mtx);
+
+            std::auto_ptr<T>    pnew;
+            try
+            {
+                pnew.reset(new T(*m_p));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+            update(*pnew);
+            this->replace(pnew);
+        }
+
+    private:
+        //  Only called with m_writer_mtx locked, so the snapshot a
+        //  writer reads is never retired under it.
+        void replace (std::auto_ptr<T> pnew)
+        {
+            T*  pold = atomic_exchange(m_p, pnew.release());
+            if (pold)
+                epoch_reclaimer::retire(pold);
+        }
+
+        T* volatile m_p;
+        mutex       m_writer_mtx;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_SNAPSHOT_PTR_H
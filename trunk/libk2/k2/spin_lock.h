@@ -85,6 +85,14 @@ namespace k2
 
             return  true;
         }
+        bool try_acquire ()
+        {
+            if (atomic_increase(m_counter) == 0)
+                return  true;
+
+            atomic_decrease(m_counter);
+            return  false;
+        }
         void release ()
         {
             atomic_decrease(m_counter);
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_SPSC_RING_H
+#define K2_SPSC_RING_H
+
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_ATOMIC_H
+#   include <k2/atomic.h>
+#endif
+#ifndef K2_ASSERT_H
+#   include <k2/assert.h>
+#endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+#ifndef K2_STD_H_CSTDDEF
+#   define  K2_STD_H_CSTDDEF
+#   include <cstddef>
+#endif
+
+namespace k2
+{
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Wait-free single-producer single-consumer FIFO ring.
+    *
+    *   Exactly one thread may push into, and exactly one other thread may
+    *   pop from *this. Each side owns its index on a separate cache line
+    *   and keeps a cached copy of the opposite index, so the shared line
+    *   of the other side is only read when the cached copy says the ring
+    *   is full or empty.
+    *
+    *   Capacity has to be a power of two. ValueT has to be
+    *   copy-constructable and assignable, copy operations should not
+    *   throw.
+    */
+    template <typename ValueT, size_t Capacity>
+    class spsc_ring
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        typedef ValueT  value_type;
+
+        spsc_ring ()
+        :   m_tail(0)
+        ,   m_cached_head(0)
+        ,   m_head(0)
+        ,   m_cached_tail(0)
+        {
+            K2_STATIC_ASSERT(
+                Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                template_parameter_Capacity_is_not_power_of_two);
+        }
+        /**
+        *   \brief      Destroys remaining values.
+        */
+        ~spsc_ring ()
+        {
+            long    pos = m_head;
+            for (; pos != m_tail; ++pos)
+                this->at(pos)->~ValueT();
+        }
+
+        static size_t capacity ()
+        {
+            return  Capacity;
+        }
+        /**
+        *   \brief      Number of values in *this, exact only when called
+        *               by the producer or the consumer.
+        */
+        size_t  size () const
+        {
+            return  size_t(atomic_load(m_tail) - atomic_load(m_head));
+        }
+        bool    empty () const
+        {
+            return  this->size() == 0;
+        }
+
+        /**
+        *   \brief      Appends a copy of \a value, if *this is not full.
+        *               Called by the producer only.
+        *   \return     true, if appended.
+        */
+        bool try_push (const ValueT& value)
+        {
+            long    tail = m_tail;
+            if (K2_OPT_BRANCH_FALSE(tail - m_cached_head == long(Capacity)))
+            {
+                m_cached_head = atomic_load(m_head);
+                if (tail - m_cached_head == long(Capacity))
+                    return  false;
+            }
+
+            new (this->at(tail)) ValueT(value);
+            atomic_store(m_tail, tail + 1);
+            return  true;
+        }
+        /**
+        *   \brief      Appends up to \a count values from \a first, and
+        *               publishes them at once. Called by the producer only.
+        *   \return     Number of values appended, less than \a count if
+        *               *this became full.
+        */
+        template <typename InputIt>
+        size_t try_push_n (InputIt first, size_t count)
+        {
+            long    tail = m_tail;
+            size_t  room = size_t(long(Capacity) - (tail - m_cached_head));
+            if (room < count)
+            {
+                m_cached_head = atomic_load(m_head);
+                room = size_t(long(Capacity) - (tail - m_cached_head));
+            }
+            if (count > room)
+                count = room;
+
+            size_t  idx = 0;
+            for (; idx < count; ++idx, ++first)
+                new (this->at(tail + long(idx))) ValueT(*first);
+
+            if (count != 0)
+                atomic_store(m_tail, tail + long(count));
+            return  count;
+        }
+
+        /**
+        *   \brief      Removes the first value and assigns it to \a value,
+        *               if *this is not empty. Called by the consumer only.
+        *   \return     true, if removed.
+        */
+        bool try_pop (ValueT& value)
+        {
+            long    head = m_head;
+            if (K2_OPT_BRANCH_FALSE(head == m_cached_tail))
+            {
+                m_cached_tail = atomic_load(m_tail);
+                if (head == m_cached_tail)
+                    return  false;
+            }
+
+            ValueT* pvalue = this->at(head);
+            value = *pvalue;
+            pvalue->~ValueT();
+            atomic_store(m_head, head + 1);
+            return  true;
+        }
+        /**
+        *   \brief      Removes up to \a count values to \a out, and
+        *               releases their slots at once. Called by the
+        *               consumer only.
+        *   \return     Number of values removed, less than \a count if
+        *               *this became empty.
+        */
+        template <typename OutputIt>
+        size_t try_pop_n (OutputIt out, size_t count)
+        {
+            long    head = m_head;
+            size_t  ready = size_t(m_cached_tail - head);
+            if (ready < count)
+            {
+                m_cached_tail = atomic_load(m_tail);
+                ready = size_t(m_cached_tail - head);
+            }
+            if (count > ready)
+                count = ready;
+
+            size_t  idx = 0;
+            for (; idx < count; ++idx, ++out)
+            {
+                ValueT* pvalue = this->at(head + long(idx));
+                *out = *pvalue;
+                pvalue->~ValueT();
+            }
+
+            if (count != 0)
+                atomic_store(m_head, head + long(count));
+            return  count;
+        }
+
+    private:
+        struct padding
+        {
+            char    bytes[K2_OPT_CACHE_LINE_BYTES];
+        };
+        union cell
+        {
+            char        bytes[sizeof(ValueT)];
+            long double align_long_double;
+            long long   align_long_long;
+            void*       align_pointer;
+        };
+
+        ValueT* at (long pos)
+        {
+            return  reinterpret_cast<ValueT*>(
+                m_cells[size_t(pos) & (Capacity - 1)].bytes);
+        }
+
+        padding         m_pad0;
+        //  Written by the producer.
+        atomic_long_t   m_tail;
+        long            m_cached_head;
+        padding         m_pad1;
+        //  Written by the consumer.
+        atomic_long_t   m_head;
+        long            m_cached_tail;
+        padding         m_pad2;
+        cell            m_cells[Capacity];
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_SPSC_RING_H
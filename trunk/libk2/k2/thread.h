@@ -38,6 +38,20 @@
 #ifndef K2_STDINT_H
 #   include <k2/stdint.h>
 #endif
+#ifndef K2_SINGLETON_H
+#   include <k2/singleton.h>
+#endif
+#ifndef K2_CANCELLATION_H
+#   include <k2/cancellation.h>
+#endif
+#ifndef K2_INPLACE_FUNCTION_H
+#   include <k2/inplace_function.h>
+#endif
+
+#ifndef K2_STD_H_VECTOR
+#   include <vector>
+#   define  K2_STD_H_VECTOR
+#endif
 
 namespace k2
 {
@@ -52,25 +66,17 @@ namespace k2
     namespace nonpublic
     {
         struct thread_cntx;
+        class thread_reserve;
+
+        //  Copy of a thread entry, kept in its thread_cntx. Entries up
+        //  to 64 bytes take no heap block of their own.
+        typedef inplace_function<void (), 64>   thread_function;
     }
 #endif  //  !DOXYGEN_BLIND
 
-#if(0)
     template <size_t Size, typename PoolTag>
-    class pooled_thread
-    {
-    public:
-        template <typename ThreadEntry>
-        explicit pooled_thread (ThreadEntry thread_entry);
-        ~pooled_thread ();
-
-        template <typename ThreadEntry>
-        static std::auto_ptr<thread_cntx>   spawn (ThreadEntry thread_entry);
-        static void                         join (std::auto_ptr<thread_cntx>);
-
-        static void                         spawn_detached (ThreadEntry thread_entry);
-    };
-#endif
+    class pooled_thread;
+    class thread_stack_pool;
 
     /**
     *   \ingroup    Threading
@@ -89,6 +95,68 @@ namespace k2
         */
         struct cancel_signal {};
 
+        /**
+        *   \brief      Attributes of a thread to create.
+        *
+        *   The defaults are the system's, usually a stack reservation of
+        *   megabytes, which limits how many threads a process can have.
+        *   Only the stack pages touched count in the resident size, so
+        *   a stack of some tens of KiB suits threads that mostly block
+        *   in I/O or on locks.
+        */
+        struct spawn_options
+        {
+            enum sched_policy
+            {
+                sched_inherit,
+                sched_other,
+                sched_fifo,
+                sched_rr
+            };
+
+            /**
+            *   \brief  Stack size in bytes, 0 for the default. Rounded up
+            *           to the page size and the system minimum.
+            */
+            size_t              stack_size;
+            /**
+            *   \brief  Guard area below the stack, size_t(-1) for the
+            *           default, 0 for none. Not applied to a given stack.
+            */
+            size_t              guard_size;
+            /**
+            *   \brief  Caller's stack of stack_size bytes, used until
+            *           the thread is joined.
+            */
+            void*               stack;
+            /**
+            *   \brief  Pool to take the stack from, overriding stack
+            *           and stack_size. The stack returns to it when the
+            *           thread is joined.
+            */
+            thread_stack_pool*  stack_pool;
+            /**
+            *   \brief  Scheduling policy, sched_inherit for that of the
+            *           spawning thread.
+            */
+            sched_policy        policy;
+            /**
+            *   \brief  Priority within policy, e.g. 1 to 99 for sched_fifo
+            *           on Linux.
+            */
+            int                 priority;
+
+            spawn_options ()
+            :   stack_size(0)
+            ,   guard_size(size_t(-1))
+            ,   stack(0)
+            ,   stack_pool(0)
+            ,   policy(sched_inherit)
+            ,   priority(0)
+            {
+            }
+        };
+
         /**
         *   Allocates resource for *this and invokes thread_entry in parallel.
         *
@@ -97,7 +165,20 @@ namespace k2
         */
         template <typename ThreadEntry>
         thread (ThreadEntry thread_entry)
-        :   m_pcntx(thread::spawn(thread_entry, false))
+        :   m_pcntx(thread::spawn(thread_entry, false, spawn_options()))
+        {
+        }
+        /**
+        *   Allocates resource for *this and invokes thread_entry in parallel,
+        *   in a thread with the attributes of options.
+        *
+        *   \param  thread_entry    A copy-constructable generator functor.
+        *   \throw  bad_resource_alloc, also if an attribute is not valid or
+        *           not permitted, e.g. a real-time policy without privilege.
+        */
+        template <typename ThreadEntry>
+        thread (ThreadEntry thread_entry, const spawn_options& options)
+        :   m_pcntx(thread::spawn(thread_entry, false, options))
         {
         }
 
@@ -111,7 +192,24 @@ namespace k2
         template <typename ThreadEntry>
         static void spawn_detached (ThreadEntry thread_entry)
         {
-            thread::spawn(thread_entry, true);
+            thread::spawn(thread_entry, true, spawn_options());
+        }
+        /**
+        *   Creates a thread object with the attributes of options, that
+        *   reclaims its resource when thread_entry finishes.
+        *
+        *   A detached thread is never joined, so it gets a stack of the
+        *   system instead of options.stack or one of options.stack_pool,
+        *   of the same size.
+        *
+        *   \param  thread_entry    A copy-constructable generator functor.
+        *   \throw  bad_resource_alloc
+        */
+        template <typename ThreadEntry>
+        static void spawn_detached (
+            ThreadEntry thread_entry, const spawn_options& options)
+        {
+            thread::spawn(thread_entry, true, options);
         }
 
         /**
@@ -121,7 +219,12 @@ namespace k2
         K2_DLSPEC ~thread ();
 
         /**
-        *   Sets the cancelled flag in *this.
+        *   Sets the cancelled flag in *this, waking it from thread::sleep()
+        *   and from waits given its thread::this_cancel_token().
+        *
+        *   Runs the wake-ups on the calling thread, and a cond_var wait
+        *   is woken with its mutex locked: calling cancel() with the
+        *   mutex of a cond_var *this may be waiting on deadlocks.
         */
         K2_DLSPEC void      cancel () ;
 
@@ -138,9 +241,38 @@ namespace k2
         */
         K2_DLSPEC static bool   cancel_enabled (bool value) ;
 
+        /**
+        *   Restricts *this to run on the CPUs listed, e.g. as given by
+        *   cpu_topology::placement().
+        *
+        *   \return false, if not supported, or none of the CPUs is
+        *           allowed.
+        */
+        K2_DLSPEC bool          set_affinity (const std::vector<int>& cpus);
+        /**
+        *   Restricts now thread to run on the CPUs listed.
+        *
+        *   \return false, if not supported, or none of the CPUs is
+        *           allowed.
+        */
+        K2_DLSPEC static bool   set_this_affinity (const std::vector<int>& cpus);
+        /**
+        *   CPUs now thread may run on, empty if not supported.
+        */
+        K2_DLSPEC static std::vector<int>   this_affinity ();
+
+        /**
+        *   Token cancelled by thread::cancel() on now thread, e.g. to pass
+        *   to cond_var::wait() or tcp_listener::accept(). A thread not
+        *   spawned by k2 gets a token nobody else holds.
+        *
+        *   \throw  bad_resource_alloc
+        */
+        K2_DLSPEC static cancel_token   this_cancel_token ();
+
         /**
         *   Tests if *this's cancelled flag has been set, if true, terminates
-        *   calling thread by throwing thread::cancel_signal.
+        *   calling thread by throwing thread::cancel_signal. Lock-free.
         *   Does nothing if now thread's cancelled flag has not been set.
         *   Does nothing if now thread's cancel-enabled flag is not set.
         *   Do NOT catch thread::cancel_signal.
@@ -192,37 +324,254 @@ namespace k2
 
         /**
         *   Puts now thread to sleep.
+        *
+        *   A cancellation point, if now thread's cancel-enabled flag is set:
+        *   thread::cancel() ends the sleep at once.
+        *
+        *   \throw      thread::cancel_signal
         */
         K2_DLSPEC static void sleep (const time_span& span);
         K2_DLSPEC static void sleep (size_t msec);
 
     private:
+        template <size_t Size, typename PoolTag>
+        friend class pooled_thread;
+        friend class nonpublic::thread_reserve;
+
         template <typename ThreadEntry>
-        static void thread_entry_wrapper (void* arg)
+        static nonpublic::thread_cntx* spawn (const
+            ThreadEntry& thread_entry, bool detached,
+            const spawn_options& options)
         {
-            std::auto_ptr<ThreadEntry>
-                pthread_entry(reinterpret_cast<ThreadEntry*>(arg));
-
             //  If you get a compile error here, note that thread_entry
-            //  has to be a functor taking no argument (a.k.a generator).
-            (*pthread_entry)();
+            //  has to be a copy constructable functor taking no argument
+            //  (a.k.a generator).
+            nonpublic::thread_function  entry(thread_entry);
+            return  spawn_impl(entry, detached, options);
+        }
+        //  Takes thread_entry over, leaving it empty.
+        K2_DLSPEC static nonpublic::thread_cntx* spawn_impl (
+            nonpublic::thread_function& thread_entry, bool detached,
+            const spawn_options& options);
+        K2_DLSPEC static void*  pthread_entry_wrapper (void*);
+
+        K2_DLSPEC static void   cancel_impl (nonpublic::thread_cntx* pcntx);
+        K2_DLSPEC static void   join_impl (nonpublic::thread_cntx* pcntx);
+        K2_DLSPEC static bool   join_impl (nonpublic::thread_cntx* pcntx,
+            const timestamp& timer);
+
+        nonpublic::thread_cntx*     m_pcntx;
+    };  //  class thread
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct thread_stack_pool_impl;
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Stacks of one size, each with a guard page, reused by
+    *               the threads given them through
+    *               thread::spawn_options::stack_pool.
+    *
+    *   A stack returns to the pool when its thread is joined, with the
+    *   pages the thread touched still resident, so a reused stack costs
+    *   neither a mapping nor page faults. Stacks beyond capacity are
+    *   unmapped on return instead.
+    *
+    *   On Windows stacks can not be given to threads; the pool only sets
+    *   their size.
+    */
+    class thread_stack_pool
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \param  stack_size  Size of each stack, rounded up to the page
+        *                       size and the system minimum.
+        *   \param  capacity    Maximum number of free stacks kept.
+        *   \throw  bad_resource_alloc
+        */
+        K2_DLSPEC explicit thread_stack_pool (
+            size_t stack_size, size_t capacity = 1024);
+        /**
+        *   \brief  Unmaps the free stacks.
+        *   \pre    Threads given stacks of *this have been joined.
+        */
+        K2_DLSPEC ~thread_stack_pool ();
+
+        /**
+        *   \brief  Maps stacks until \a cnt are free, up to capacity.
+        *   \throw  bad_resource_alloc
+        */
+        K2_DLSPEC void      reserve (size_t cnt);
+
+        K2_DLSPEC size_t    stack_size () const;
+        K2_DLSPEC size_t    free_stacks () const;
+
+    private:
+        friend class thread;
+        friend struct nonpublic::thread_cntx;
+
+        //  Returns 0 if stacks can not be given to threads.
+        K2_DLSPEC void*     acquire ();
+        K2_DLSPEC void      release (void* stack) throw ();
+
+        nonpublic::thread_stack_pool_impl*  m_pimpl;
+    };
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct thread_reserve_impl;
+
+        //  Parked OS threads, and their contexts, shared by all
+        //  pooled_thread<> of the same Size and PoolTag.
+        class thread_reserve
+        {
+        public:
+            K2_INJECT_COPY_BOUNCER();
+
+            K2_DLSPEC explicit thread_reserve (size_t capacity);
+            //  Retires parked threads, busy ones retire when they finish.
+            K2_DLSPEC ~thread_reserve ();
+
+            //  Resumes a parked thread, or creates one, to run
+            //  thread_entry, which is taken over. Returns 0 if detached.
+            K2_DLSPEC thread_cntx*  spawn (
+                thread_function& thread_entry, bool detached);
+            //  Joins *pcntx, then parks its thread, or retires it if the
+            //  reserve is full.
+            K2_DLSPEC static void   reclaim (thread_cntx* pcntx);
+
+            K2_DLSPEC size_t        parked () const;
+
+        private:
+            thread_reserve_impl*    m_pimpl;
+        };
+
+        template <size_t Capacity>
+        struct sized_thread_reserve : thread_reserve
+        {
+            sized_thread_reserve ()
+            :   thread_reserve(Capacity)
+            {
+            }
+        };
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Concurrent excecution construct that reuses OS threads.
+    *
+    *   Works like thread, but a finished thread is parked instead of being
+    *   destroyed, and is resumed by the next pooled_thread of the same
+    *   Size and PoolTag. Spawning a parked thread costs a context update
+    *   and a wake-up, no thread creation and no start-up handshake.
+    *   Up to Size threads are kept parked, the rest exit when they finish.
+    *
+    *   thread::test_cancel() and thread::cancel_enabled() work as in
+    *   threads created by thread.
+    */
+    template <size_t Size, typename PoolTag = void>
+    class pooled_thread
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   Invokes thread_entry in parallel, in a parked thread if any.
+        *
+        *   \param  thread_entry    A copy-constructable generator functor.
+        *   \throw  bad_resource_alloc
+        */
+        template <typename ThreadEntry>
+        explicit pooled_thread (ThreadEntry thread_entry)
+        :   m_pcntx(pooled_thread::spawn(thread_entry, false))
+        {
+        }
+
+        /**
+        *   Invokes thread_entry in parallel, in a parked thread if any,
+        *   which parks again when thread_entry finishes.
+        *
+        *   \param  thread_entry    A copy-constructable generator functor.
+        *   \throw  bad_resource_alloc
+        */
+        template <typename ThreadEntry>
+        static void spawn_detached (ThreadEntry thread_entry)
+        {
+            pooled_thread::spawn(thread_entry, true);
+        }
+
+        /**
+        *   Waits for thread_entry to finish execution then parks the
+        *   thread.
+        */
+        ~pooled_thread ()
+        {
+            nonpublic::thread_reserve::reclaim(m_pcntx);
+        }
+
+        /**
+        *   See thread::cancel().
+        */
+        void cancel ()
+        {
+            thread::cancel_impl(m_pcntx);
         }
+
+        /**
+        *   Waits *this to stop execution .
+        */
+        void join ()
+        {
+            thread::join_impl(m_pcntx);
+        }
+        bool join (const timestamp& timer)
+        {
+            return  thread::join_impl(m_pcntx, timer);
+        }
+
+        /**
+        *   Number of threads now parked.
+        */
+        static size_t parked ()
+        {
+            return  pooled_thread::reserve().parked();
+        }
+
+    private:
+        typedef singleton<
+            nonpublic::sized_thread_reserve<Size>
+        ,   PoolTag
+            //  Retires parked threads before default-lifetime singletons
+            //  they use are gone.
+        ,   singleton_base::lifetime_default - 1
+        >   reserve_singleton;
+
+        static nonpublic::thread_reserve& reserve ()
+        {
+            return  reserve_singleton::instance();
+        }
+
         template <typename ThreadEntry>
         static nonpublic::thread_cntx* spawn (const
             ThreadEntry& thread_entry, bool detached)
         {
             //  If you get a compile error here, note that thread_entry
-            //  has to be copy constructable.
-            ThreadEntry* pthread_entry = new ThreadEntry(thread_entry);
-            return  spawn_impl(thread_entry_wrapper<ThreadEntry>,
-                reinterpret_cast<void*>(pthread_entry), detached);
+            //  has to be a copy constructable functor taking no argument
+            //  (a.k.a generator).
+            nonpublic::thread_function  entry(thread_entry);
+            return  pooled_thread::reserve().spawn(entry, detached);
         }
-        K2_DLSPEC static nonpublic::thread_cntx* spawn_impl (
-            void (*thread_entry)(void*), void* arg, bool detached);
-        K2_DLSPEC static void*  pthread_entry_wrapper (void*);
 
         nonpublic::thread_cntx*     m_pcntx;
-    };  //  class thread
+    };  //  class pooled_thread
 
 }   //  namespace k2
 
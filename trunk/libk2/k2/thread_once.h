@@ -35,6 +35,9 @@
 #ifndef K2_ATOMIC_H
 #   include <k2/atomic.h>
 #endif
+#ifndef K2_OPT_H
+#   include <k2/opt.h>
+#endif
 
 namespace k2
 {
@@ -60,19 +63,40 @@ namespace k2
     public:
         /**
         *   \brief  Invokes \a once_functor once.
+        *
+        *   Once \a once_functor has returned, costs one acquire load.
+        *   Concurrent callers are blocked until it returns. If it throws,
+        *   the exception is propagated to its caller, and the next call
+        *   retries.
+        *
         *   \param  once_functor    Funtor to invoke.
         */
         template <typename unary_functor_t_>
         void run (unary_functor_t_ once_functor)
         {
+            if (K2_OPT_BRANCH_TRUE(this->done()))
+                return;
             thread_once::run_impl(
                 once_functor_wrapper<unary_functor_t_>,
                 &once_functor);
         }
+        /**
+        *   \brief  Tests if the functor has been invoked and has returned.
+        */
+        bool done () const
+        {
+            return  atomic_load(this->state) == state_done;
+        }
 
 #ifndef DOXYGEN_BLIND
-        atomic_int_t    started;
-        bool            done;
+        enum state_enum
+        {
+            state_idle,
+            state_running,
+            state_contended,
+            state_done
+        };
+        atomic_int_t    state;
 #endif  //  DOXYGEN_BLIND
 
     private:
@@ -91,7 +115,7 @@ namespace k2
     *   thread_once static initializer macro.
     *   \relates    thread_once
     */
-#   define K2_THREAD_ONCE_INIT  {-1, false}
+#   define K2_THREAD_ONCE_INIT  {0}
 
 }   //  namespace k2
 
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_THREAD_POOL_H
+#define K2_THREAD_POOL_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_EXCEPTION_H
+#   include <k2/exception.h>
+#endif
+#ifndef K2_CPU_TOPOLOGY_H
+#   include <k2/cpu_topology.h>
+#endif
+#ifndef K2_INPLACE_FUNCTION_H
+#   include <k2/inplace_function.h>
+#endif
+#ifndef K2_SMALL_ALLOC_H
+#   include <k2/small_alloc.h>
+#endif
+
+#ifndef K2_STD_H_MEMORY
+#   include <memory>
+#   define  K2_STD_H_MEMORY
+#endif
+#ifndef K2_STD_H_NEW
+#   include <new>
+#   define  K2_STD_H_NEW
+#endif
+
+namespace k2
+{
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        //  A queued task. Nodes come from small_alloc(), and task
+        //  functors up to 48 bytes are stored in the node, so queueing
+        //  a small task does not reach the global heap.
+        struct pool_task
+        {
+            inplace_function<void (), 48>   m_task;
+
+            template <typename TaskT>
+            explicit pool_task (const TaskT& task)
+            :   m_task(task)
+            {
+            }
+
+            static void* operator new (size_t bytes)
+            {
+                return  small_alloc(bytes);
+            }
+            static void operator delete (void* p, size_t bytes) throw ()
+            {
+                small_free(p, bytes);
+            }
+
+            //  Runs then deletes the task.
+            static void run (pool_task* ptask)
+            {
+                std::auto_ptr<pool_task>    guard(ptask);
+                guard->m_task();
+            }
+            //  Deletes the task without running it.
+            static void discard (pool_task* ptask)
+            {
+                delete  ptask;
+            }
+        };
+
+        struct thread_pool_impl;
+        struct timer_wheel_impl;
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Work-stealing thread pool.
+    *
+    *   Each worker thread owns a Chase-Lev deque of tasks, it pushes and
+    *   pops at one end, while idle workers steal from the other end of
+    *   randomly chosen victims. Tasks submitted by a worker go to its own
+    *   deque, tasks submitted by other threads go to a shared injection
+    *   queue. Workers that find no task park until a task is submitted.
+    *
+    *   Tasks are copy-constructable functors taking no argument.
+    *   Exceptions thrown by tasks are absorbed, except
+    *   thread::cancel_signal, which stops the worker when the pool is
+    *   cancelled.
+    */
+    class thread_pool
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Starts \a thread_cnt worker threads.
+        *   \param      thread_cnt      Number of workers, at least 1.
+        *   \param      inject_capacity Capacity of the injection queue,
+        *                               submitters from other threads
+        *                               block while it is full.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC explicit thread_pool (
+            size_t thread_cnt, size_t inject_capacity = 4096);
+        /**
+        *   \brief      shutdown(), then releases resource.
+        */
+        K2_DLSPEC ~thread_pool ();
+
+        /**
+        *   \brief      Queues a copy of \a task for execution.
+        *   \return     false, if *this is shutting down.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename TaskT>
+        bool submit (const TaskT& task)
+        {
+            std::auto_ptr<nonpublic::pool_task>  ptask;
+            try
+            {
+                //  If you get a compile error here, note that task has
+                //  to be copy constructable.
+                ptask.reset(new nonpublic::pool_task(task));
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+
+            if (this->submit_impl(ptask.get()) == false)
+                return  false;
+            ptask.release();
+            return  true;
+        }
+
+        /**
+        *   \brief      Runs one queued task in calling thread, if any,
+        *               e.g. while waiting for tasks it has submitted.
+        *   \return     true, if a task has been run.
+        */
+        K2_DLSPEC bool  run_one ();
+
+        /**
+        *   \brief      Stops accepting tasks, lets workers run all queued
+        *               tasks, then joins them.
+        */
+        K2_DLSPEC void  shutdown ();
+        /**
+        *   \brief      Stops accepting tasks, cancels workers with
+        *               thread::cancel(), then joins them. Running tasks
+        *               stop at their next thread::test_cancel(), queued
+        *               tasks are discarded.
+        *
+        *   Must not be called with the mutex of a cond_var a task may be
+        *   waiting on held, see thread::cancel().
+        */
+        K2_DLSPEC void  cancel ();
+
+        /**
+        *   \brief      Pins each worker to a CPU, as placed by policy on
+        *               cpu_topology::system().
+        *   \return     false, if a worker could not be pinned.
+        */
+        K2_DLSPEC bool  place (cpu_topology::policy_enum policy);
+
+        /**
+        *   \brief      Number of worker threads.
+        */
+        K2_DLSPEC size_t    size () const;
+        /**
+        *   \brief      Tests if calling thread is a worker of *this.
+        */
+        K2_DLSPEC bool      on_worker () const;
+
+    private:
+        friend struct nonpublic::timer_wheel_impl;
+
+        K2_DLSPEC bool  submit_impl (nonpublic::pool_task* ptask);
+
+        nonpublic::thread_pool_impl*    m_pimpl;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_THREAD_POOL_H
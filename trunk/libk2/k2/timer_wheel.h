@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef K2_TIMER_WHEEL_H
+#define K2_TIMER_WHEEL_H
+
+#ifndef K2_DLSPEC_H
+#   include <k2/dlspec.h>
+#endif
+#ifndef K2_COPY_BOUNCER_H
+#   include <k2/copy_bouncer.h>
+#endif
+#ifndef K2_STDINT_H
+#   include <k2/stdint.h>
+#endif
+#ifndef K2_THREAD_POOL_H
+#   include <k2/thread_pool.h>
+#endif
+
+namespace k2
+{
+
+    class timestamp;
+    class time_span;
+
+#if !defined(DOXYGEN_BLIND)
+    namespace nonpublic
+    {
+        struct timer_node;
+        struct timer_wheel_impl;
+    }
+#endif  //  !DOXYGEN_BLIND
+
+    /** \defgroup   Threading
+    */
+
+    /**
+    *   \ingroup    Threading
+    *   \brief      Hierarchical timing wheel.
+    *
+    *   Timers are kept in five levels of slots, 256 slots of one tick
+    *   each, then four levels of 64 slots, each covering a slot of the
+    *   level below, so schedule() and cancel() take constant time however
+    *   many timers are pending. Slots of upper levels are cascaded down
+    *   as the wheel turns. Delays beyond 2^32 ticks are clamped.
+    *
+    *   The wheel turns either by advance(), called from an event loop of
+    *   your own, or by a driver thread, see start(). Timers due are
+    *   collected in one batch under the lock, then fired outside it:
+    *   tasks run on the thread advancing the wheel, or are submitted to
+    *   a thread_pool given on schedule(). Exceptions thrown by tasks are
+    *   absorbed, except thread::cancel_signal, which is rethrown once the
+    *   batch is done.
+    */
+    class timer_wheel
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        /**
+        *   \brief      Identifies a scheduled timer, see cancel().
+        */
+        class handle
+        {
+        public:
+            handle ()
+            :   m_pnode(0)
+            ,   m_serial(0)
+            {
+            }
+
+        private:
+            friend class timer_wheel;
+
+            nonpublic::timer_node*  m_pnode;
+            uint32_t                m_serial;
+        };
+
+        /**
+        *   \brief      Constructs a stopped wheel.
+        *   \param      resolution  Length of a tick, at least 1 ms.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC explicit timer_wheel (const time_span& resolution);
+        /**
+        *   \brief      stop(), then discards pending timers.
+        */
+        K2_DLSPEC ~timer_wheel ();
+
+        /**
+        *   \brief      Runs a copy of \a task once \a delay has passed,
+        *               on the thread advancing *this.
+        *   \throw      bad_resource_alloc
+        */
+        template <typename TaskT>
+        handle  schedule (const time_span& delay, const TaskT& task)
+        {
+            return  this->schedule_task(delay, timer_wheel::make_task(task), 0);
+        }
+        /**
+        *   \brief      Submits a copy of \a task to \a executor once
+        *               \a delay has passed.
+        *
+        *   The task is discarded if \a executor is shutting down by then.
+        *   \a executor must outlive the timer.
+        *
+        *   \throw      bad_resource_alloc
+        */
+        template <typename TaskT>
+        handle  schedule (
+            const time_span& delay, const TaskT& task, thread_pool& executor)
+        {
+            return  this->schedule_task(
+                delay, timer_wheel::make_task(task), &executor);
+        }
+
+        /**
+        *   \brief      Cancels a pending timer.
+        *   \return     true, if the task has been discarded unfired; false
+        *               if it has fired, is firing, or was cancelled.
+        */
+        K2_DLSPEC bool  cancel (const handle& timer);
+
+        /**
+        *   \brief      Turns *this up to now, firing timers due.
+        *   \return     Number of timers fired.
+        *   \throw      thread::cancel_signal
+        */
+        K2_DLSPEC size_t    advance ();
+        /**
+        *   \brief      Time until advance() may have a timer to fire,
+        *               never later than the earliest timer.
+        *
+        *   For an event loop to bound its wait. Zero if a timer is due.
+        */
+        K2_DLSPEC time_span next_due () const;
+
+        /**
+        *   \brief      Starts a driver thread advancing *this. A no-op if
+        *               already started.
+        *   \throw      bad_resource_alloc
+        */
+        K2_DLSPEC void  start ();
+        /**
+        *   \brief      Cancels and joins the driver thread, if any.
+        *               Pending timers are kept.
+        *
+        *   Must not be called with the mutex of a cond_var a callback may
+        *   be waiting on held, see thread::cancel().
+        */
+        K2_DLSPEC void  stop ();
+
+        /**
+        *   \brief      Number of timers scheduled and not yet fired.
+        */
+        K2_DLSPEC size_t    pending () const;
+
+    private:
+        template <typename TaskT>
+        static nonpublic::pool_task*    make_task (const TaskT& task)
+        {
+            try
+            {
+                //  If you get a compile error here, note that task has
+                //  to be copy constructable.
+                return  new nonpublic::pool_task(task);
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+
+        K2_DLSPEC handle    schedule_task (
+            const time_span& delay,
+            nonpublic::pool_task* ptask,
+            thread_pool* pexecutor);
+
+        nonpublic::timer_wheel_impl*    m_pimpl;
+    };
+
+}   //  namespace k2
+
+#endif  //  !K2_TIMER_WHEEL_H
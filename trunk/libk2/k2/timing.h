@@ -153,6 +153,22 @@ namespace k2
     K2_DLSPEC bool operator> (const time_span& lhs, const time_span& rhs);
     K2_DLSPEC bool operator>= (const time_span& lhs, const time_span& rhs);
 
+    /**
+    *   \ingroup    Timing
+    *   \brief      Monotonic high-resolution clock.
+    *
+    *   Readings are not related to calendar time, they are only meaningful
+    *   when subtracted from one another. Use it to measure short intervals
+    *   where the milli-second resolution of timestamp is too coarse.
+    */
+    struct hires_clock
+    {
+        /**
+        *   \brief  Returns current reading of the clock, in nano-seconds.
+        */
+        K2_DLSPEC static uint64_t   now_nsec ();
+    };
+
     struct time_zone
     {
         typedef int value_type;
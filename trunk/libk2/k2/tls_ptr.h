@@ -35,6 +35,26 @@
 #ifndef K2_COPY_BOUNCER_H
 #   include <k2/copy_bouncer.h>
 #endif
+#ifndef K2_THREAD_ONCE_H
+#   include <k2/thread_once.h>
+#endif
+
+#ifndef K2_STD_H_NEW
+#   define  K2_STD_H_NEW
+#   include <new>
+#endif
+
+//  Storage class of compile-time thread local storage, used by
+//  static_tls_ptr<>. Define K2_NO_STATIC_TLS to fall back to tls_ptr<>.
+#if !defined(K2_STATIC_TLS) && !defined(K2_NO_STATIC_TLS)
+#   if defined(_MSC_VER)
+#       define  K2_STATIC_TLS   __declspec(thread)
+#   elif defined(__GNUC__)
+//  initial-exec, a single load off the thread pointer even in a shared
+//  library, rather than a call to __tls_get_addr().
+#       define  K2_STATIC_TLS   __thread __attribute__((tls_model("initial-exec")))
+#   endif
+#endif
 
 namespace k2
 {
@@ -63,6 +83,54 @@ namespace k2
             void (*m_destroy_routine)(void*);
             handle  m_handle;
         };
+
+        //  Slot of static_tls_ptr<InstanceT, InstanceTagT>. The key only
+        //  deletes the object at thread exit, get() need not reach it.
+        template <typename InstanceT, typename InstanceTagT>
+        struct static_tls_slot
+        {
+#if defined(K2_STATIC_TLS)
+            static K2_STATIC_TLS InstanceT* s_ptr;
+#endif
+            static thread_once  s_once;
+            static char         s_key_holder[sizeof(tls_ptr_impl)];
+
+            static tls_ptr_impl&    key ()
+            {
+                static_tls_slot::s_once.run(static_tls_slot::key_init);
+                return  *reinterpret_cast<tls_ptr_impl*>(
+                    static_tls_slot::s_key_holder);
+            }
+            //  Never destroyed, threads may exit after static objects
+            //  are.
+            static void key_init ()
+            {
+                new (static_tls_slot::s_key_holder)
+                    tls_ptr_impl(static_tls_slot::cleanup);
+            }
+            static void cleanup (void* p)
+            {
+#if defined(K2_STATIC_TLS)
+                static_tls_slot::s_ptr = 0;
+#endif
+                delete  reinterpret_cast<InstanceT*>(p);
+            }
+        };
+
+#if defined(K2_STATIC_TLS)
+        //static
+        template <typename InstanceT, typename InstanceTagT>
+        K2_STATIC_TLS InstanceT*
+            static_tls_slot<InstanceT, InstanceTagT>::s_ptr = 0;
+#endif
+        //static
+        template <typename InstanceT, typename InstanceTagT>
+        thread_once static_tls_slot<InstanceT, InstanceTagT>::s_once =
+            K2_THREAD_ONCE_INIT;
+        //static
+        template <typename InstanceT, typename InstanceTagT>
+        char static_tls_slot<InstanceT, InstanceTagT>::s_key_holder[
+            sizeof(tls_ptr_impl)];
     }
 #endif  //  !DOXYGEN_BLIND
 
@@ -143,6 +211,83 @@ namespace k2
         nonpublic::tls_ptr_impl m_impl;
     };  //  class tls
 
+    /**
+    *   \ingroup    Threading
+    *   \brief      tls_ptr<> kept in compile-time thread local storage.
+    *
+    *   get() is a single load of a \c __thread (or
+    *   \c __declspec(thread)) variable, rather than a call to
+    *   pthread_getspecific(). reset() and release() also maintain a
+    *   thread-specific key, deleting the stored pointer at thread exit
+    *   as tls_ptr<> does. Falls back to such a key alone where
+    *   K2_STATIC_TLS is not defined.
+    *
+    *   The storage is static: all static_tls_ptr<> objects of the same
+    *   \a InstanceT and \a InstanceTagT share one pointer per thread.
+    *   Do not keep get() across a switch of fibers, a fiber may resume
+    *   on another thread.
+    */
+    template <typename InstanceT, typename InstanceTagT = void>
+    class static_tls_ptr
+    {
+    private:
+        typedef nonpublic::static_tls_slot<InstanceT, InstanceTagT> slot;
+
+    public:
+        typedef InstanceT   value_type;
+
+        /**
+        *   Retrieves the stored pointer.
+        */
+        static InstanceT*   get ()
+        {
+#if defined(K2_STATIC_TLS)
+            return  slot::s_ptr;
+#else
+            return  reinterpret_cast<InstanceT*>(slot::key().get());
+#endif
+        }
+        /**
+        *   Returns this->get().
+        */
+        InstanceT*      operator-> () const
+        {
+            return  static_tls_ptr::get();
+        }
+        /**
+        *   Returns *(this->get()).
+        */
+        InstanceT&      operator* () const
+        {
+            return  *static_tls_ptr::get();
+        }
+        /**
+        *   Releases and returns ownership of stored pointer.
+        *
+        *   /throw      bad_resource_alloc, thread_error
+        */
+        static InstanceT*   release ()
+        {
+            InstanceT*  p = reinterpret_cast<InstanceT*>(slot::key().release());
+#if defined(K2_STATIC_TLS)
+            slot::s_ptr = 0;
+#endif
+            return  p;
+        }
+        /**
+        *   Deletes stored pointer then take ownership of p.
+        *
+        *   /throw      bad_resource_alloc, thread_error
+        */
+        static void     reset (InstanceT* p = 0)
+        {
+            slot::key().reset(p);
+#if defined(K2_STATIC_TLS)
+            slot::s_ptr = p;
+#endif
+        }
+    };
+
 }   //  namespace k2
 
 #endif  //  !K2_TLS_H
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/actor.h>
+
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/cond_var.h>
+#include <k2/exception.h>
+#include <k2/opt.h>
+
+#include <vector>
+#include <memory>
+
+namespace k2
+{
+    namespace nonpublic
+    {
+
+struct actor_system_impl
+{
+    mutex                   m_mtx;
+    cond_var                m_cv;
+    actor_base*             m_phead;
+    actor_base*             m_ptail;
+    size_t                  m_batch;
+    size_t                  m_idle;
+    size_t                  m_active;
+    bool                    m_stopping;
+    std::vector<thread*>    m_threads;
+
+    actor_system_impl (size_t batch)
+    :   m_cv(m_mtx)
+    ,   m_phead(0)
+    ,   m_ptail(0)
+    ,   m_batch(batch ? batch : 1)
+    ,   m_idle(0)
+    ,   m_active(0)
+    ,   m_stopping(false)
+    {
+    }
+    ~actor_system_impl ()
+    {
+        while (m_phead)
+        {
+            actor_base* pactor = m_phead;
+            m_phead = pactor->m_pnext_ready;
+            discard(pactor);
+            pactor->release();
+        }
+    }
+
+    struct entry
+    {
+        actor_system_impl*  m_pimpl;
+
+        void operator() () const
+        {
+            m_pimpl->work();
+        }
+    };
+
+    void start (size_t thread_cnt)
+    {
+        m_threads.reserve(thread_cnt);
+        while (m_threads.size() < thread_cnt)
+        {
+            entry   ent = { this };
+            m_threads.push_back(0);
+            m_threads.back() = new thread(ent);
+        }
+    }
+    void join ()
+    {
+        {
+            mutex::scoped_guard guard(m_mtx);
+            m_stopping = true;
+            m_cv.broadcast();
+        }
+        while (m_threads.empty() == false)
+        {
+            if (m_threads.back())
+            {
+                m_threads.back()->join();
+                delete  m_threads.back();
+            }
+            m_threads.pop_back();
+        }
+    }
+
+    static void discard (actor_base* pactor) throw ()
+    {
+        actor_message*  pmsg;
+        while ((pmsg = pactor->pop()) != 0)
+        {
+            try
+            {
+                pmsg->m_deliver(0, pmsg);
+            }
+            catch (...)
+            {
+            }
+        }
+        atomic_store(pactor->m_pending, 0L);
+    }
+
+    void schedule (actor_base* pactor)
+    {
+        pactor->m_pnext_ready = 0;
+
+        mutex::scoped_guard guard(m_mtx);
+        if (m_ptail)
+            m_ptail->m_pnext_ready = pactor;
+        else
+            m_phead = pactor;
+        m_ptail = pactor;
+        if (m_idle)
+            m_cv.signal();
+    }
+
+    //  Delivers up to m_batch messages, then requeues the actor if more
+    //  are pending, or drops the reference taken by post_impl().
+    void activate (actor_base* pactor)
+    {
+        long    done = 0;
+        for (; done < long(m_batch); ++done)
+        {
+            actor_message*  pmsg = pactor->pop();
+            if (pmsg == 0)
+                break;
+            try
+            {
+                pmsg->m_deliver(pactor, pmsg);
+            }
+            catch (...)
+            {
+                //  Absorbs, the message is freed by m_deliver().
+            }
+        }
+
+        //  Counted but not linked yet, lets the sender finish.
+        if (K2_OPT_BRANCH_FALSE(done == 0))
+            thread::sched_yield();
+
+        if (atomic_add(pactor->m_pending, -done) > 0)
+            this->schedule(pactor);
+        else
+            pactor->release();
+    }
+
+    void work ()
+    {
+        bool    ran = false;
+        for (;;)
+        {
+            actor_base* pactor;
+            {
+                mutex::scoped_guard guard(m_mtx);
+                if (ran)
+                    --m_active;
+                while (m_phead == 0)
+                {
+                    if (m_stopping && m_active == 0)
+                    {
+                        m_cv.broadcast();
+                        return;
+                    }
+                    ++m_idle;
+                    m_cv.wait();
+                    --m_idle;
+                }
+                pactor = m_phead;
+                m_phead = pactor->m_pnext_ready;
+                if (m_phead == 0)
+                    m_ptail = 0;
+                ++m_active;
+            }
+            this->activate(pactor);
+            ran = true;
+        }
+    }
+};
+
+    }   //  namespace nonpublic
+}   //  namespace k2
+
+
+k2::actor_system::actor_system (size_t thread_cnt, size_t batch)
+:   m_pimpl(0)
+{
+    std::auto_ptr<nonpublic::actor_system_impl> pimpl;
+    try
+    {
+        pimpl.reset(new nonpublic::actor_system_impl(batch));
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+
+    try
+    {
+        pimpl->start(thread_cnt ? thread_cnt : 1);
+    }
+    catch (...)
+    {
+        pimpl->join();
+        throw   bad_resource_alloc();
+    }
+    m_pimpl = pimpl.release();
+}
+k2::actor_system::~actor_system ()
+{
+    this->shutdown();
+    delete  m_pimpl;
+}
+
+void
+k2::actor_system::shutdown ()
+{
+    m_pimpl->join();
+}
+size_t
+k2::actor_system::size () const
+{
+    return  m_pimpl->m_threads.size();
+}
+
+k2::actor_base::actor_base (actor_system& system)
+:   m_psystem(&system)
+,   m_phead(&m_stub)
+,   m_pending(0)
+,   m_refs(0)
+,   m_ptail(&m_stub)
+,   m_pnext_ready(0)
+{
+    m_stub.m_pnext = 0;
+    m_stub.m_deliver = 0;
+}
+k2::actor_base::~actor_base ()
+{
+    nonpublic::actor_system_impl::discard(this);
+}
+
+void
+k2::actor_base::post_impl (nonpublic::actor_message* pmsg) throw ()
+{
+    pmsg->m_pnext = 0;
+    nonpublic::actor_message*   pprev = atomic_exchange(m_phead, pmsg);
+    atomic_store(pprev->m_pnext, pmsg);
+
+    //  Counted after linking, so an activation never waits on a message
+    //  it was woken for. The first pending message schedules the actor,
+    //  which holds a reference until it goes idle.
+    if (atomic_add(m_pending, 1L) == 1)
+    {
+        this->add_ref();
+        m_psystem->m_pimpl->schedule(this);
+    }
+}
+
+//  Vyukov's intrusive MPSC queue, the stub is requeued whenever the last
+//  message is taken, so that message is never the link of a push.
+k2::nonpublic::actor_message*
+k2::actor_base::pop () throw ()
+{
+    nonpublic::actor_message*   ptail = m_ptail;
+    nonpublic::actor_message*   pnext = atomic_load(ptail->m_pnext);
+    if (ptail == &m_stub)
+    {
+        if (pnext == 0)
+            return  0;
+        m_ptail = ptail = pnext;
+        pnext = atomic_load(ptail->m_pnext);
+    }
+    if (pnext)
+    {
+        m_ptail = pnext;
+        return  ptail;
+    }
+    if (ptail != atomic_load(m_phead))
+        return  0;  //  a push is in flight
+
+    m_stub.m_pnext = 0;
+    nonpublic::actor_message*   pprev = atomic_exchange(m_phead, &m_stub);
+    atomic_store(pprev->m_pnext, &m_stub);
+
+    pnext = atomic_load(ptail->m_pnext);
+    if (pnext)
+    {
+        m_ptail = pnext;
+        return  ptail;
+    }
+    return  0;
+}
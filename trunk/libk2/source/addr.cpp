@@ -52,6 +52,28 @@
     typedef int socklen_t;
 #endif
 
+namespace   //  unnamed
+{
+    //  Four bytes as a 32 bits value, k2::uint32_t may be wider.
+    inline k2::uint32_t load_word (const k2::uint8_t* p)
+    {
+        return  (k2::uint32_t(p[0]) << 24) | (k2::uint32_t(p[1]) << 16)
+            | (k2::uint32_t(p[2]) << 8) | k2::uint32_t(p[3]);
+    }
+    //  -1, 0 or 1, as lhs is ordered before, same as, or after rhs.
+    inline int compare_bytes (
+        const k2::uint8_t* lhs, const k2::uint8_t* rhs, size_t bytes)
+    {
+        for (; bytes; --bytes, ++lhs, ++rhs)
+        {
+            if (*lhs != *rhs)
+                return  *lhs < *rhs ? -1 : 1;
+        }
+        return  0;
+    }
+
+}   //  unnamed namespace
+
 //static
 const k2::ipv4::interface_addr::loopback_tag
     k2::ipv4::interface_addr::loopback;
@@ -101,16 +123,12 @@ k2::ipv4::interface_addr::data () const
 k2::uint32_t
 k2::ipv4::interface_addr::hash () const
 {
-    return *reinterpret_cast<const uint32_t*>(m_data);
+    return  load_word(m_data);
 }
 int
 k2::ipv4::interface_addr::compare (const interface_addr& rhs) const
 {
-    return  std::lexicographical_compare(
-        m_data,
-        m_data + interface_addr::size,
-        rhs.data(),
-        rhs.data() + interface_addr::size);
+    return  compare_bytes(m_data, rhs.data(), interface_addr::size);
 }
 
 
@@ -167,8 +185,8 @@ k2::ipv4::transport_addr::hash () const
         m_if_addr.data() + interface_addr::size,
         hash_buf);
     hash_buf[0] ^= uint8_t(m_port >> 8);
-    hash_buf[interface_addr::size - 1] ^= uint8_t((m_port << 8) >> 8);
-    return  *reinterpret_cast<const uint32_t*>(hash_buf);
+    hash_buf[interface_addr::size - 1] ^= uint8_t(m_port & 0xff);
+    return  load_word(hash_buf);
 }
 int
 k2::ipv4::transport_addr::compare (const transport_addr& rhs) const
@@ -291,17 +309,13 @@ k2::ipv6::interface_addr::data () const
 k2::uint32_t
 k2::ipv6::interface_addr::hash () const
 {
-    const uint32_t* p = reinterpret_cast<const uint32_t*>(m_data);
-    return (p[0] ^ p[1]) + (p[2] ^ p[3]);
+    return  ((load_word(m_data) ^ load_word(m_data + 4))
+        + (load_word(m_data + 8) ^ load_word(m_data + 12))) & 0xffffffffUL;
 }
 int
 k2::ipv6::interface_addr::compare (const interface_addr& rhs) const
 {
-    return  std::lexicographical_compare(
-        m_data,
-        m_data + interface_addr::size,
-        rhs.data(),
-        rhs.data() + interface_addr::size);
+    return  compare_bytes(m_data, rhs.data(), interface_addr::size);
 }
 
 
@@ -384,7 +398,8 @@ k2::ipv6::transport_addr::scope_id ()
 k2::uint32_t
 k2::ipv6::transport_addr::hash () const
 {
-    return  m_if_addr.hash() ^ (((m_flowinfo & 0x000fffff) << 6) ^ m_scope_id);
+    return  (m_if_addr.hash() ^ (uint32_t(m_port) << 16)
+        ^ (((m_flowinfo & 0x000fffff) << 6) ^ m_scope_id)) & 0xffffffffUL;
 }
 int
 k2::ipv6::transport_addr::compare (const transport_addr& rhs) const
@@ -28,32 +28,126 @@
  */
 #include <k2/atomic.h>
 
-#if !defined(__GUNC__)
+#if !defined(__GNUC__)
 
 #   if !defined(WIN32)
 #       include <pthread.h>
     namespace
     {
-        pthread_mutex_t local_mtx = PTHREADS_MUTEX_INITIALIZER;
+        pthread_mutex_t local_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+        struct local_guard
+        {
+            local_guard ()
+            {
+                pthread_mutex_lock(&local_mtx);
+            }
+            ~local_guard ()
+            {
+                pthread_mutex_unlock(&local_mtx);
+            }
+        };
     }
 
 
     bool k2::atomic_increase (k2::atomic_int_t& value) throw ()
     {
-        bool ret;
-        pthread_mutex_lock(&local_mtx);
-        ret = ++value;
-        pthread_mutex_unlock(&local_mtx);
-        return  ret;
+        local_guard guard;
+        return  ++value != 0;
     }
 
     bool k2::atomic_decrease (k2::atomic_int_t& value) throw ()
     {
-        bool ret;
-        pthread_mutex_lock(&local_mtx);
-        ret = --value;
-        pthread_mutex_unlock(&local_mtx);
-        return  ret;
+        local_guard guard;
+        return  --value != 0;
+    }
+
+    int k2::atomic_add (k2::atomic_int_t& value, int delta) throw ()
+    {
+        local_guard guard;
+        return  value += delta;
+    }
+    long k2::atomic_add (k2::atomic_long_t& value, long delta) throw ()
+    {
+        local_guard guard;
+        return  value += delta;
+    }
+    bool k2::atomic_cas (
+        k2::atomic_int_t& value, int expected, int desired) throw ()
+    {
+        local_guard guard;
+        if (value != expected)
+            return  false;
+        value = desired;
+        return  true;
+    }
+    bool k2::atomic_cas (
+        k2::atomic_long_t& value, long expected, long desired) throw ()
+    {
+        local_guard guard;
+        if (value != expected)
+            return  false;
+        value = desired;
+        return  true;
+    }
+    int k2::atomic_exchange (k2::atomic_int_t& value, int desired) throw ()
+    {
+        local_guard guard;
+        int old = value;
+        value = desired;
+        return  old;
+    }
+    long k2::atomic_exchange (k2::atomic_long_t& value, long desired) throw ()
+    {
+        local_guard guard;
+        long    old = value;
+        value = desired;
+        return  old;
+    }
+    int k2::atomic_load (const k2::atomic_int_t& value) throw ()
+    {
+        local_guard guard;
+        return  value;
+    }
+    long k2::atomic_load (const k2::atomic_long_t& value) throw ()
+    {
+        local_guard guard;
+        return  value;
+    }
+    void k2::atomic_store (k2::atomic_int_t& value, int desired) throw ()
+    {
+        local_guard guard;
+        value = desired;
+    }
+    void k2::atomic_store (k2::atomic_long_t& value, long desired) throw ()
+    {
+        local_guard guard;
+        value = desired;
+    }
+    void k2::memory_barrier () throw ()
+    {
+        //  Acquiring and releasing a mutex are both barriers.
+        local_guard guard;
+    }
+    void k2::cpu_relax () throw ()
+    {
+    }
+    bool k2::nonpublic::atomic_cas_ptr (
+        void* volatile& ptr, void* expected, void* desired) throw ()
+    {
+        local_guard guard;
+        if (ptr != expected)
+            return  false;
+        ptr = desired;
+        return  true;
+    }
+    void* k2::nonpublic::atomic_exchange_ptr (
+        void* volatile& ptr, void* desired) throw ()
+    {
+        local_guard guard;
+        void*   old = ptr;
+        ptr = desired;
+        return  old;
     }
 
 #   else
@@ -69,6 +163,77 @@
         return  ::InterlockedDecrement(
             reinterpret_cast<volatile long*>(&value)) == 0 ? false : true;
     }
+
+    //  !kh!
+    //  int and long are both 32 bits wide on Win32.
+    int k2::atomic_add (k2::atomic_int_t& value, int delta) throw ()
+    {
+        return  ::InterlockedExchangeAdd(
+            reinterpret_cast<volatile long*>(&value), delta) + delta;
+    }
+    long k2::atomic_add (k2::atomic_long_t& value, long delta) throw ()
+    {
+        return  ::InterlockedExchangeAdd(&value, delta) + delta;
+    }
+    bool k2::atomic_cas (
+        k2::atomic_int_t& value, int expected, int desired) throw ()
+    {
+        return  ::InterlockedCompareExchange(
+            reinterpret_cast<volatile long*>(&value),
+            desired, expected) == expected;
+    }
+    bool k2::atomic_cas (
+        k2::atomic_long_t& value, long expected, long desired) throw ()
+    {
+        return  ::InterlockedCompareExchange(
+            &value, desired, expected) == expected;
+    }
+    int k2::atomic_exchange (k2::atomic_int_t& value, int desired) throw ()
+    {
+        return  ::InterlockedExchange(
+            reinterpret_cast<volatile long*>(&value), desired);
+    }
+    long k2::atomic_exchange (k2::atomic_long_t& value, long desired) throw ()
+    {
+        return  ::InterlockedExchange(&value, desired);
+    }
+    //  Volatile accesses have acquire/release semantic with VC.net.
+    int k2::atomic_load (const k2::atomic_int_t& value) throw ()
+    {
+        return  value;
+    }
+    long k2::atomic_load (const k2::atomic_long_t& value) throw ()
+    {
+        return  value;
+    }
+    void k2::atomic_store (k2::atomic_int_t& value, int desired) throw ()
+    {
+        value = desired;
+    }
+    void k2::atomic_store (k2::atomic_long_t& value, long desired) throw ()
+    {
+        value = desired;
+    }
+    void k2::memory_barrier () throw ()
+    {
+        long    dummy = 0;
+        ::InterlockedExchange(&dummy, 0);
+    }
+    void k2::cpu_relax () throw ()
+    {
+        YieldProcessor();
+    }
+    bool k2::nonpublic::atomic_cas_ptr (
+        void* volatile& ptr, void* expected, void* desired) throw ()
+    {
+        return  ::InterlockedCompareExchangePointer(
+            &ptr, desired, expected) == expected;
+    }
+    void* k2::nonpublic::atomic_exchange_ptr (
+        void* volatile& ptr, void* desired) throw ()
+    {
+        return  ::InterlockedExchangePointer(&ptr, desired);
+    }
 #   endif
 
 #endif
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/cancellation.h>
+
+#include <k2/mutex.h>
+#include <k2/futex.h>
+#include <k2/thread.h>
+#include <k2/timing.h>
+
+#include <new>
+
+#if defined(__linux__)
+#   include <sys/eventfd.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#elif !defined(WIN32)
+#   include <unistd.h>
+#   include <fcntl.h>
+#endif
+
+struct k2::nonpublic::cancel_state : k2::nonpublic::cancel_state_head
+{
+    typedef k2::nonpublic::cancel_callback  cancel_callback;
+
+    //  Guards the callback list and the wake-up descriptors.
+    k2::mutex           m_mtx;
+    cancel_callback*    m_phead;
+    cancel_callback*    m_ptail;
+    //  Callback cancel() is running now, outside m_mtx.
+    cancel_callback* volatile   m_prunning;
+    //  [0] is read by waiters, [1] written by cancel(); the same
+    //  eventfd on Linux.
+    int                 m_wake_fd[2];
+
+    cancel_state ()
+    :   m_phead(0)
+    ,   m_ptail(0)
+    ,   m_prunning(0)
+    {
+        m_cancelled = 0;
+        m_refs = 1;
+        m_wake_fd[0] = -1;
+        m_wake_fd[1] = -1;
+    }
+    ~cancel_state ()
+    {
+#if !defined(WIN32)
+        if (m_wake_fd[0] != -1)
+            ::close(m_wake_fd[0]);
+        if (m_wake_fd[1] != -1 && m_wake_fd[1] != m_wake_fd[0])
+            ::close(m_wake_fd[1]);
+#endif
+    }
+
+    void    link (cancel_callback* pnode)
+    {
+        pnode->m_pprev = m_ptail;
+        pnode->m_pnext = 0;
+        if (m_ptail)
+            m_ptail->m_pnext = pnode;
+        else
+            m_phead = pnode;
+        m_ptail = pnode;
+        pnode->m_linked = true;
+    }
+    void    unlink (cancel_callback* pnode)
+    {
+        if (pnode->m_pprev)
+            pnode->m_pprev->m_pnext = pnode->m_pnext;
+        else
+            m_phead = pnode->m_pnext;
+        if (pnode->m_pnext)
+            pnode->m_pnext->m_pprev = pnode->m_pprev;
+        else
+            m_ptail = pnode->m_pprev;
+        pnode->m_linked = false;
+    }
+
+    //  Runs the first callback outside m_mtx, so that it may acquire
+    //  locks its registering thread holds while registering. m_mtx held.
+    void    fire_first ()
+    {
+        cancel_callback*    pnode = m_phead;
+        this->unlink(pnode);
+        k2::atomic_store(m_prunning, pnode);
+
+        m_mtx.release();
+        try
+        {
+            pnode->m_fire(pnode->m_arg);
+        }
+        catch (...)
+        {
+            m_mtx.acquire();
+            k2::atomic_store(m_prunning, (cancel_callback*)0);
+            throw;
+        }
+        m_mtx.acquire();
+        k2::atomic_store(m_prunning, (cancel_callback*)0);
+    }
+
+    //  Makes m_wake_fd[0] readable, m_mtx held.
+    void    signal_desc ()
+    {
+#if defined(__linux__)
+        if (m_wake_fd[1] != -1)
+        {
+            uint64_t    one = 1;
+            ssize_t     res = ::write(m_wake_fd[1], &one, sizeof(one));
+            (void)res;
+        }
+#elif !defined(WIN32)
+        if (m_wake_fd[1] != -1)
+        {
+            char        one = 1;
+            ssize_t     res = ::write(m_wake_fd[1], &one, 1);
+            (void)res;
+        }
+#endif
+    }
+};
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::cancel_state     cancel_state;
+    typedef k2::nonpublic::cancel_callback  cancel_callback;
+
+    inline cancel_state*    get_state (k2::nonpublic::cancel_state_head* phead)
+    {
+        return  static_cast<cancel_state*>(phead);
+    }
+    void    add_ref (cancel_state* pstate)
+    {
+        k2::atomic_increase(pstate->m_refs);
+    }
+    void    release_ref (cancel_state* pstate)
+    {
+        if (k2::atomic_add(pstate->m_refs, -1) == 0)
+            delete  pstate;
+    }
+
+}   //  unnamed namespace
+
+
+k2::cancel_token::cancel_token ()
+:   m_pstate(0)
+{
+    try
+    {
+        m_pstate = new nonpublic::cancel_state;
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+k2::cancel_token::cancel_token (const cancel_token& rhs)
+:   m_pstate(rhs.m_pstate)
+{
+    add_ref(get_state(m_pstate));
+}
+k2::cancel_token::~cancel_token ()
+{
+    release_ref(get_state(m_pstate));
+}
+k2::cancel_token&
+k2::cancel_token::operator= (const cancel_token& rhs)
+{
+    add_ref(get_state(rhs.m_pstate));
+    release_ref(get_state(m_pstate));
+    m_pstate = rhs.m_pstate;
+    return  *this;
+}
+void
+k2::cancel_token::cancel ()
+{
+    cancel_state*   pstate = get_state(m_pstate);
+    if (atomic_exchange(pstate->m_cancelled, 1) != 0)
+        return;
+
+    nonpublic::futex_wake_all(pstate->m_cancelled);
+
+    mutex::scoped_guard guard(pstate->m_mtx);
+    pstate->signal_desc();
+
+    while (pstate->m_phead)
+    {
+        try
+        {
+            pstate->fire_first();
+        }
+        catch (...)
+        {
+            //  Runs the rest, then rethrows the first error.
+            while (pstate->m_phead)
+            {
+                try
+                {
+                    pstate->fire_first();
+                }
+                catch (...)
+                {
+                }
+            }
+            throw;
+        }
+    }
+}
+void
+k2::cancel_token::wait () const
+{
+    while (atomic_load(m_pstate->m_cancelled) == 0)
+        nonpublic::futex_wait(m_pstate->m_cancelled, 0, 0);
+}
+bool
+k2::cancel_token::wait (const timestamp& timer) const
+{
+    while (atomic_load(m_pstate->m_cancelled) == 0)
+    {
+        if (nonpublic::futex_wait(m_pstate->m_cancelled, 0, &timer) == false)
+            return  atomic_load(m_pstate->m_cancelled) != 0;
+    }
+    return  true;
+}
+int
+k2::cancel_token::wait_desc () const
+{
+    cancel_state*   pstate = get_state(m_pstate);
+
+    mutex::scoped_guard guard(pstate->m_mtx);
+    if (pstate->m_wake_fd[0] == -1)
+    {
+#if defined(__linux__)
+        int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1)
+            throw   bad_resource_alloc();
+        pstate->m_wake_fd[0] = fd;
+        pstate->m_wake_fd[1] = fd;
+#elif !defined(WIN32)
+        int fds[2];
+        if (::pipe(fds) != 0)
+            throw   bad_resource_alloc();
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        pstate->m_wake_fd[0] = fds[0];
+        pstate->m_wake_fd[1] = fds[1];
+#else
+        return  -1;
+#endif
+        //  cancel() may have passed its signal_desc() already.
+        if (atomic_load(pstate->m_cancelled) != 0)
+            pstate->signal_desc();
+    }
+    return  pstate->m_wake_fd[0];
+}
+
+k2::cancel_token::registration::registration (
+    const cancel_token& token, void (*callback)(void*), void* arg)
+:   m_pstate(get_state(token.m_pstate))
+{
+    m_node.m_fire = callback;
+    m_node.m_arg = arg;
+    m_node.m_pprev = 0;
+    m_node.m_pnext = 0;
+    m_node.m_linked = false;
+
+    add_ref(m_pstate);
+
+    mutex::scoped_guard guard(m_pstate->m_mtx);
+    if (atomic_load(m_pstate->m_cancelled) == 0)
+        m_pstate->link(&m_node);
+}
+k2::cancel_token::registration::~registration ()
+{
+    if (m_pstate)
+        this->release();
+}
+bool
+k2::cancel_token::registration::try_release ()
+{
+    if (m_pstate == 0)
+        return  true;
+    {
+        mutex::scoped_guard guard(m_pstate->m_mtx);
+        if (m_node.m_linked)
+            m_pstate->unlink(&m_node);
+        else if (atomic_load(m_pstate->m_prunning) == &m_node)
+            return  false;
+    }
+    release_ref(m_pstate);
+    m_pstate = 0;
+    return  true;
+}
+void
+k2::cancel_token::registration::release ()
+{
+    while (this->try_release() == false)
+    {
+        thread::sched_yield();
+    }
+}
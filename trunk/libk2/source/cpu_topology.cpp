@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/cpu_topology.h>
+
+#include <k2/singleton.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#endif
+#if !defined(WIN32)
+#   include <unistd.h>
+#else
+#   include <windows.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+
+namespace   //  unnamed
+{
+    typedef k2::cpu_topology::cpu   cpu;
+
+    inline size_t os_cpu_count ()
+#if !defined(WIN32)
+    {
+        long    cnt = sysconf(_SC_NPROCESSORS_CONF);
+        return  cnt > 0 ? size_t(cnt) : 1;
+    }
+#else
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return  info.dwNumberOfProcessors > 0 ?
+            size_t(info.dwNumberOfProcessors) : 1;
+    }
+#endif
+
+    bool read_line (const std::string& path, std::string& line)
+    {
+        std::ifstream   in(path.c_str());
+        if (!in)
+            return  false;
+        std::getline(in, line);
+        return  line.empty() == false;
+    }
+    int read_int (const std::string& path, int fallback)
+    {
+        std::string line;
+        if (read_line(path, line) == false)
+            return  fallback;
+        return  std::atoi(line.c_str());
+    }
+    std::string cpu_path (int cpu_id, const char* leaf)
+    {
+        std::ostringstream  path;
+        path << "/sys/devices/system/cpu/cpu" << cpu_id << '/' << leaf;
+        return  path.str();
+    }
+
+    //  Parses a sysfs CPU list, e.g. "0-3,8,10-11".
+    std::vector<int> parse_cpu_list (const std::string& list)
+    {
+        std::vector<int>    ids;
+        std::istringstream  in(list);
+        std::string         range;
+        while (std::getline(in, range, ','))
+        {
+            int first = std::atoi(range.c_str());
+            int last = first;
+            std::string::size_type  dash = range.find('-');
+            if (dash != std::string::npos)
+                last = std::atoi(range.c_str() + dash + 1);
+            for (; first <= last; ++first)
+                ids.push_back(first);
+        }
+        return  ids;
+    }
+    //  Parses a sysfs cache size, e.g. "32K".
+    size_t parse_size (const std::string& size)
+    {
+        size_t  bytes = size_t(std::atol(size.c_str()));
+        if (size.find('K') != std::string::npos)
+            bytes *= 1024;
+        else if (size.find('M') != std::string::npos)
+            bytes *= 1024 * 1024;
+        return  bytes;
+    }
+
+    //  CPUs worth of quota, 0 if not limited.
+    double cgroup_quota ()
+#if defined(__linux__)
+    {
+        std::string line;
+
+        //  cgroup v2, "quota period" or "max period".
+        std::string     v2_path;
+        std::ifstream   cgroups("/proc/self/cgroup");
+        while (std::getline(cgroups, line))
+        {
+            if (line.compare(0, 3, "0::") == 0)
+                v2_path = "/sys/fs/cgroup" + line.substr(3);
+        }
+        const std::string   v2_files[] =
+        {
+            v2_path + "/cpu.max",
+            "/sys/fs/cgroup/cpu.max"
+        };
+        size_t  idx = v2_path.empty() ? 1 : 0;
+        for (; idx < 2; ++idx)
+        {
+            if (read_line(v2_files[idx], line) == false)
+                continue;
+            if (line.compare(0, 3, "max") == 0)
+                return  0;
+
+            std::istringstream  in(line);
+            double  quota = 0;
+            double  period = 0;
+            if (in >> quota >> period && quota > 0 && period > 0)
+                return  quota / period;
+            return  0;
+        }
+
+        //  cgroup v1, a quota of -1 means not limited.
+        const char* v1_dirs[] =
+        {
+            "/sys/fs/cgroup/cpu,cpuacct/",
+            "/sys/fs/cgroup/cpu/"
+        };
+        for (idx = 0; idx < 2; ++idx)
+        {
+            std::string dir(v1_dirs[idx]);
+            int quota = read_int(dir + "cpu.cfs_quota_us", 0);
+            int period = read_int(dir + "cpu.cfs_period_us", 0);
+            if (quota > 0 && period > 0)
+                return  double(quota) / double(period);
+        }
+        return  0;
+    }
+#else
+    {
+        return  0;
+    }
+#endif
+
+    //  SMT siblings together, then cores, then packages.
+    struct compact_order
+    {
+        bool operator() (const cpu* lhs, const cpu* rhs) const
+        {
+            if (lhs->m_package != rhs->m_package)
+                return  lhs->m_package < rhs->m_package;
+            if (lhs->m_core != rhs->m_core)
+                return  lhs->m_core < rhs->m_core;
+            return  lhs->m_smt < rhs->m_smt;
+        }
+    };
+
+    //  Round-robin over packages, then cores within, SMT siblings last.
+    struct spread_order
+    {
+        //  Rank of each CPU's core within its package.
+        const std::map<int, int>&   m_core_rank;
+
+        explicit spread_order (const std::map<int, int>& core_rank)
+        :   m_core_rank(core_rank)
+        {
+        }
+        bool operator() (const cpu* lhs, const cpu* rhs) const
+        {
+            if (lhs->m_smt != rhs->m_smt)
+                return  lhs->m_smt < rhs->m_smt;
+            int lhs_rank = m_core_rank.find(lhs->m_core)->second;
+            int rhs_rank = m_core_rank.find(rhs->m_core)->second;
+            if (lhs_rank != rhs_rank)
+                return  lhs_rank < rhs_rank;
+            return  lhs->m_package < rhs->m_package;
+        }
+    };
+
+}   //  unnamed namespace
+
+
+k2::cpu_topology::cpu_topology ()
+:   m_package_cnt(0)
+,   m_core_cnt(0)
+,   m_quota(cgroup_quota())
+{
+    std::vector<int>    ids;
+    std::string         line;
+#if defined(__linux__)
+    if (read_line("/sys/devices/system/cpu/online", line))
+        ids = parse_cpu_list(line);
+#endif
+    if (ids.empty())
+    {
+        int id = 0;
+        for (; id < int(os_cpu_count()); ++id)
+            ids.push_back(id);
+    }
+
+#if defined(__linux__)
+    cpu_set_t   mask;
+    CPU_ZERO(&mask);
+    bool        masked = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+#endif
+
+    //  (package, core_id) to core number, and SMT siblings seen so far.
+    std::map<std::pair<int, int>, int>  cores;
+    std::vector<int>                    siblings;
+    std::map<int, bool>                 packages;
+
+    std::vector<int>::const_iterator    it = ids.begin();
+    for (; it != ids.end(); ++it)
+    {
+        cpu info;
+        info.m_id = *it;
+        info.m_package = 0;
+        int core_id = *it;
+        info.m_allowed = true;
+
+        int level = 0;
+        for (; level <= max_cache_level; ++level)
+        {
+            info.m_cache_group[level] = -1;
+            info.m_cache_bytes[level] = 0;
+        }
+
+#if defined(__linux__)
+        info.m_package = read_int(cpu_path(*it, "topology/physical_package_id"), 0);
+        core_id = read_int(cpu_path(*it, "topology/core_id"), *it);
+        if (masked)
+            info.m_allowed = CPU_ISSET(*it, &mask) != 0;
+
+        int idx = 0;
+        for (;; ++idx)
+        {
+            std::ostringstream  dir;
+            dir << "cache/index" << idx << '/';
+            level = read_int(cpu_path(*it, (dir.str() + "level").c_str()), -1);
+            if (level < 0)
+                break;
+            if (level > max_cache_level)
+                continue;
+
+            std::string type;
+            read_line(cpu_path(*it, (dir.str() + "type").c_str()), type);
+            if (type == "Instruction")
+                continue;
+
+            std::string shared;
+            read_line(cpu_path(*it, (dir.str() + "shared_cpu_list").c_str()), shared);
+            std::vector<int>    sharing = parse_cpu_list(shared);
+            info.m_cache_group[level] = sharing.empty() ?
+                *it : *std::min_element(sharing.begin(), sharing.end());
+
+            std::string size;
+            if (read_line(cpu_path(*it, (dir.str() + "size").c_str()), size))
+                info.m_cache_bytes[level] = parse_size(size);
+        }
+#endif
+
+        std::pair<int, int> key(info.m_package, core_id);
+        std::map<std::pair<int, int>, int>::iterator    core = cores.find(key);
+        if (core == cores.end())
+        {
+            core = cores.insert(std::make_pair(key, int(cores.size()))).first;
+            siblings.push_back(0);
+        }
+        info.m_core = core->second;
+        info.m_smt = siblings[info.m_core]++;
+        packages[info.m_package] = true;
+
+        m_cpus.push_back(info);
+    }
+
+    m_package_cnt = packages.size();
+    m_core_cnt = cores.size();
+}
+//  static
+const k2::cpu_topology&
+k2::cpu_topology::system ()
+{
+    return  singleton<cpu_topology>::instance();
+}
+std::vector<int>
+k2::cpu_topology::allowed_cpus () const
+{
+    std::vector<int>    ids;
+    std::vector<cpu>::const_iterator    it = m_cpus.begin();
+    for (; it != m_cpus.end(); ++it)
+    {
+        if (it->m_allowed)
+            ids.push_back(it->m_id);
+    }
+    return  ids;
+}
+size_t
+k2::cpu_topology::usable_cpu_count () const
+{
+    size_t  cnt = this->allowed_cpus().size();
+    if (m_quota > 0)
+        cnt = std::min(cnt, size_t(std::ceil(m_quota)));
+    return  cnt ? cnt : 1;
+}
+bool
+k2::cpu_topology::shares_cache (int cpu_a, int cpu_b, int level) const
+{
+    if (level < 1 || level > max_cache_level)
+        return  false;
+
+    const cpu*  pa = this->find(cpu_a);
+    const cpu*  pb = this->find(cpu_b);
+    if (pa == 0 || pb == 0 || pa->m_cache_group[level] < 0)
+        return  false;
+    return  pa->m_cache_group[level] == pb->m_cache_group[level];
+}
+std::vector<int>
+k2::cpu_topology::placement (policy_enum policy, size_t thread_cnt) const
+{
+    std::vector<const cpu*> order;
+    std::vector<cpu>::const_iterator    it = m_cpus.begin();
+    for (; it != m_cpus.end(); ++it)
+    {
+        if (it->m_allowed)
+            order.push_back(&*it);
+    }
+
+    std::vector<int>    result;
+    if (order.empty())
+        return  result;
+
+    std::sort(order.begin(), order.end(), compact_order());
+    if (policy == spread)
+    {
+        //  Ranks the allowed cores of each package, in compact order.
+        std::map<int, int>  core_rank;
+        std::map<int, int>  next_rank;
+        std::vector<const cpu*>::const_iterator pit = order.begin();
+        for (; pit != order.end(); ++pit)
+        {
+            if (core_rank.find((*pit)->m_core) == core_rank.end())
+                core_rank[(*pit)->m_core] = next_rank[(*pit)->m_package]++;
+        }
+        std::stable_sort(order.begin(), order.end(), spread_order(core_rank));
+    }
+    else if (policy == one_per_core)
+    {
+        //  The first allowed CPU of each core.
+        std::vector<const cpu*> firsts;
+        std::vector<const cpu*>::const_iterator pit = order.begin();
+        for (; pit != order.end(); ++pit)
+        {
+            if (firsts.empty() || firsts.back()->m_core != (*pit)->m_core)
+                firsts.push_back(*pit);
+        }
+        order.swap(firsts);
+    }
+
+    result.reserve(thread_cnt);
+    size_t  idx = 0;
+    for (; idx < thread_cnt; ++idx)
+        result.push_back(order[idx % order.size()]->m_id);
+    return  result;
+}
+const k2::cpu_topology::cpu*
+k2::cpu_topology::find (int cpu_id) const
+{
+    std::vector<cpu>::const_iterator    it = m_cpus.begin();
+    for (; it != m_cpus.end(); ++it)
+    {
+        if (it->m_id == cpu_id)
+            return  &*it;
+    }
+    return  0;
+}
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/event_loop.h>
+
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/timing.h>
+
+#include <vector>
+#include <cerrno>
+
+#if defined(WIN32)
+#   include <winsock2.h>
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <poll.h>
+#endif
+#if defined(__linux__)
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#   define  K2_EVENT_LOOP_EPOLL
+#endif
+
+namespace   //  unnamed
+{
+    enum
+    {
+        way_read,
+        way_write,
+        way_cnt
+    };
+
+    struct watch_op
+    {
+        k2::event_loop::handler m_fn;
+        void*                   m_arg;
+        k2::timer_wheel::handle m_timer;
+        bool                    m_timed;
+        //  Bumped on disarming, outdating timers firing late.
+        k2::uint32_t            m_serial;
+    };
+
+    struct desc_entry
+    {
+        watch_op    m_ops[way_cnt];
+#if defined(K2_EVENT_LOOP_EPOLL)
+        //  Ways the one-shot epoll registration is armed for, 0 once it
+        //  has reported.
+        unsigned    m_registered;
+#endif
+    };
+
+    struct expire_entry
+    {
+        k2::nonpublic::event_loop_impl* m_pimpl;
+        int                             m_desc;
+        int                             m_way;
+        k2::uint32_t                    m_serial;
+
+        void operator() () const;
+    };
+
+    //  Runs a handler or task of a batch, absorbing its exceptions but
+    //  thread::cancel_signal, which is rethrown once the batch is done.
+    template <typename CallT>
+    bool    run_absorbed (const CallT& call)
+    {
+        try
+        {
+            call();
+        }
+        catch (k2::thread::cancel_signal&)
+        {
+            return  true;
+        }
+        catch (...)
+        {
+        }
+        return  false;
+    }
+
+    struct handler_call
+    {
+        k2::event_loop::handler m_fn;
+        void*                   m_arg;
+        bool                    m_ready;
+
+        void operator() () const
+        {
+            m_fn(m_arg, m_ready);
+        }
+    };
+    struct task_call
+    {
+        k2::nonpublic::pool_task*   m_ptask;
+
+        void operator() () const
+        {
+            k2::nonpublic::pool_task::run(m_ptask);
+        }
+    };
+
+#if defined(WIN32)
+    //  No wake-up descriptor, post() and stop() are noticed within.
+    const int   max_wait_msec = 10;
+#else
+    const int   max_wait_msec = 60 * 1000;
+#endif
+
+}   //  unnamed namespace
+
+struct k2::nonpublic::event_loop_impl
+{
+    std::vector<desc_entry> m_entries;
+    size_t                  m_watches;
+    k2::timer_wheel         m_timers;
+
+    //  Guards below, posted by other threads.
+    k2::mutex               m_mtx;
+    std::vector<pool_task*> m_posted;
+    bool                    m_stopping;
+    bool                    m_woken;
+    int                     m_wake_fd[2];
+
+#if defined(K2_EVENT_LOOP_EPOLL)
+    int                     m_epoll;
+#else
+    std::vector<pollfd>     m_polls;
+#endif
+
+    event_loop_impl ()
+    :   m_watches(0)
+    ,   m_timers(k2::time_span(1))
+    ,   m_stopping(false)
+    ,   m_woken(false)
+#if defined(K2_EVENT_LOOP_EPOLL)
+    ,   m_epoll(-1)
+#endif
+    {
+        m_wake_fd[0] = -1;
+        m_wake_fd[1] = -1;
+    }
+    ~event_loop_impl ()
+    {
+        size_t  idx = 0;
+        for (; idx < m_posted.size(); ++idx)
+            pool_task::discard(m_posted[idx]);
+#if defined(K2_EVENT_LOOP_EPOLL)
+        if (m_epoll != -1)
+            ::close(m_epoll);
+        if (m_wake_fd[0] != -1)
+            ::close(m_wake_fd[0]);
+#elif !defined(WIN32)
+        if (m_wake_fd[0] != -1)
+        {
+            ::close(m_wake_fd[0]);
+            ::close(m_wake_fd[1]);
+        }
+#endif
+    }
+
+    void    start ()
+    {
+#if defined(K2_EVENT_LOOP_EPOLL)
+        m_epoll = ::epoll_create(64);
+        if (m_epoll == -1)
+            throw   k2::bad_resource_alloc();
+        int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1)
+            throw   k2::bad_resource_alloc();
+        m_wake_fd[0] = fd;
+        m_wake_fd[1] = fd;
+        //  Level-triggered, stays readable until drained.
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+            throw   k2::bad_resource_alloc();
+#elif !defined(WIN32)
+        int fds[2];
+        if (::pipe(fds) != 0)
+            throw   k2::bad_resource_alloc();
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        ::fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        m_wake_fd[0] = fds[0];
+        m_wake_fd[1] = fds[1];
+#endif
+    }
+
+    //  m_mtx held.
+    void    wake ()
+    {
+        if (m_woken)
+            return;
+        m_woken = true;
+#if defined(K2_EVENT_LOOP_EPOLL)
+        k2::uint64_t    one = 1;
+        ssize_t res = ::write(m_wake_fd[1], &one, sizeof(one));
+        (void)res;
+#elif !defined(WIN32)
+        char    one = 1;
+        ssize_t res = ::write(m_wake_fd[1], &one, 1);
+        (void)res;
+#endif
+    }
+    //  m_mtx held.
+    void    drain ()
+    {
+        if (m_woken == false)
+            return;
+        m_woken = false;
+#if defined(K2_EVENT_LOOP_EPOLL)
+        k2::uint64_t    cnt;
+        ssize_t res = ::read(m_wake_fd[0], &cnt, sizeof(cnt));
+        (void)res;
+#elif !defined(WIN32)
+        char    buf[64];
+        while (::read(m_wake_fd[0], buf, sizeof(buf)) > 0)
+            ;
+#endif
+    }
+
+    desc_entry* find (int desc)
+    {
+        if (desc < 0 || size_t(desc) >= m_entries.size())
+            return  0;
+        return  &m_entries[desc];
+    }
+
+#if defined(K2_EVENT_LOOP_EPOLL)
+    //  One epoll_ctl() per change of the ways armed: a handler watching
+    //  again re-arms the registration the event disabled.
+    void    sync (int desc, desc_entry& entry)
+    {
+        unsigned    want = 0;
+        if (entry.m_ops[way_read].m_fn)
+            want |= EPOLLIN;
+        if (entry.m_ops[way_write].m_fn)
+            want |= EPOLLOUT;
+        if (want == entry.m_registered)
+            return;
+
+        epoll_event ev;
+        ev.data.fd = desc;
+        if (want == 0)
+        {
+            //  Closing desc after unwatch() must not leave it behind.
+            ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, desc, &ev);
+            entry.m_registered = 0;
+            return;
+        }
+        ev.events = want | EPOLLONESHOT;
+        //  A registration disabled by its event is kept, unless desc has
+        //  been closed since, and its number reused.
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_MOD, desc, &ev) != 0)
+        {
+            if (errno != ENOENT
+                || ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, desc, &ev) != 0)
+            {
+                throw   k2::bad_resource_alloc();
+            }
+        }
+        entry.m_registered = want;
+    }
+#endif
+
+    bool    watch (
+        int desc, int way, k2::event_loop::handler fn, void* arg,
+        const k2::timestamp* ptimer)
+    {
+        if (desc < 0)
+            return  false;
+        if (size_t(desc) >= m_entries.size())
+        {
+            desc_entry  blank;
+            blank.m_ops[way_read].m_fn = 0;
+            blank.m_ops[way_read].m_serial = 0;
+            blank.m_ops[way_write] = blank.m_ops[way_read];
+#if defined(K2_EVENT_LOOP_EPOLL)
+            blank.m_registered = 0;
+#endif
+            m_entries.resize(desc + 1, blank);
+        }
+        desc_entry& entry = m_entries[desc];
+        watch_op&   op = entry.m_ops[way];
+        if (op.m_fn)
+            return  false;
+
+        op.m_timed = false;
+        if (ptimer)
+        {
+            k2::time_span   delay(0);
+            if (*ptimer > k2::timestamp::now)
+                delay = *ptimer - k2::timestamp::now;
+            expire_entry    expire = { this, desc, way, op.m_serial };
+            op.m_timer = m_timers.schedule(delay, expire);
+            op.m_timed = true;
+        }
+        op.m_fn = fn;
+        op.m_arg = arg;
+        ++m_watches;
+#if defined(K2_EVENT_LOOP_EPOLL)
+        try
+        {
+            this->sync(desc, entry);
+        }
+        catch (...)
+        {
+            this->disarm(entry, way);
+            throw;
+        }
+#endif
+        return  true;
+    }
+    //  Returns the handler of the watch disarmed, 0 if none.
+    watch_op    disarm (desc_entry& entry, int way)
+    {
+        watch_op&   op = entry.m_ops[way];
+        watch_op    was = op;
+        if (op.m_fn == 0)
+            return  was;
+        if (op.m_timed)
+            m_timers.cancel(op.m_timer);
+        op.m_fn = 0;
+        op.m_timed = false;
+        ++op.m_serial;
+        --m_watches;
+        return  was;
+    }
+    bool    unwatch (int desc, int way)
+    {
+        desc_entry* pentry = this->find(desc);
+        if (pentry == 0 || this->disarm(*pentry, way).m_fn == 0)
+            return  false;
+#if defined(K2_EVENT_LOOP_EPOLL)
+        this->sync(desc, *pentry);
+#endif
+        return  true;
+    }
+    void    expire (int desc, int way, k2::uint32_t serial)
+    {
+        desc_entry* pentry = this->find(desc);
+        if (pentry == 0 || pentry->m_ops[way].m_serial != serial)
+            return;
+        pentry->m_ops[way].m_timed = false;
+        watch_op    was = this->disarm(*pentry, way);
+#if defined(K2_EVENT_LOOP_EPOLL)
+        this->sync(desc, *pentry);
+#endif
+        was.m_fn(was.m_arg, false);
+    }
+
+    //  Fires the watches of desc for the ways ready, counting handlers
+    //  run in ran.
+    bool    fire (int desc, bool readable, bool writable, size_t& ran)
+    {
+        bool    cancelled = false;
+        bool    ready[way_cnt] = { readable, writable };
+        int way = 0;
+        for (; way < way_cnt; ++way)
+        {
+            //  Looked up again, a handler may grow m_entries.
+            desc_entry* pentry = this->find(desc);
+            if (ready[way] == false || pentry == 0
+                || pentry->m_ops[way].m_fn == 0)
+            {
+                continue;
+            }
+            watch_op    was = this->disarm(*pentry, way);
+            handler_call    call = { was.m_fn, was.m_arg, true };
+            cancelled = run_absorbed(call) || cancelled;
+            ++ran;
+        }
+#if defined(K2_EVENT_LOOP_EPOLL)
+        //  The event disarmed the registration, re-arms it for the ways
+        //  still watched.
+        desc_entry* pentry = this->find(desc);
+        if (pentry)
+        {
+            pentry->m_registered = 0;
+            this->sync(desc, *pentry);
+        }
+#endif
+        return  cancelled;
+    }
+
+    bool    poll_events (int wait_msec, size_t& ran)
+    {
+        bool    cancelled = false;
+#if defined(K2_EVENT_LOOP_EPOLL)
+        epoll_event events[64];
+        int cnt = ::epoll_wait(m_epoll, events, 64, wait_msec);
+        int idx = 0;
+        for (; idx < cnt; ++idx)
+        {
+            const int       desc = events[idx].data.fd;
+            const unsigned  got = events[idx].events;
+            if (desc == m_wake_fd[0])
+                continue;
+            const bool  broken = (got & (EPOLLERR | EPOLLHUP)) != 0;
+            cancelled = this->fire(
+                desc,
+                broken || (got & EPOLLIN) != 0,
+                broken || (got & EPOLLOUT) != 0,
+                ran) || cancelled;
+        }
+#else
+        m_polls.clear();
+        if (m_wake_fd[0] != -1)
+        {
+            pollfd  wake = { m_wake_fd[0], POLLIN, 0 };
+            m_polls.push_back(wake);
+        }
+        size_t  desc = 0;
+        for (; m_watches && desc < m_entries.size(); ++desc)
+        {
+            const desc_entry&   entry = m_entries[desc];
+            short   want = 0;
+            if (entry.m_ops[way_read].m_fn)
+                want |= POLLIN;
+            if (entry.m_ops[way_write].m_fn)
+                want |= POLLOUT;
+            if (want)
+            {
+                pollfd  pfd;
+                pfd.fd = desc;
+                pfd.events = want;
+                pfd.revents = 0;
+                m_polls.push_back(pfd);
+            }
+        }
+        if (m_polls.empty())
+        {
+#   if defined(WIN32)
+            ::Sleep(wait_msec);
+#   endif
+            return  false;
+        }
+#   if defined(WIN32)
+        int cnt = ::WSAPoll(&m_polls[0], ULONG(m_polls.size()), wait_msec);
+#   else
+        int cnt = ::poll(&m_polls[0], nfds_t(m_polls.size()), wait_msec);
+#   endif
+        size_t  idx = 0;
+        for (; cnt > 0 && idx < m_polls.size(); ++idx)
+        {
+            const pollfd&   pfd = m_polls[idx];
+            if (pfd.revents == 0)
+                continue;
+            --cnt;
+            if (int(pfd.fd) == m_wake_fd[0])
+                continue;
+            const bool  broken =
+                (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+            cancelled = this->fire(
+                int(pfd.fd),
+                broken || (pfd.revents & POLLIN) != 0,
+                broken || (pfd.revents & POLLOUT) != 0,
+                ran) || cancelled;
+        }
+#endif
+        return  cancelled;
+    }
+
+    size_t  run_once (const k2::time_span& max_wait)
+    {
+        k2::time_span   wait = m_timers.next_due();
+        if (max_wait < wait)
+            wait = max_wait;
+        int wait_msec = int(wait.in_msec());
+        if (wait_msec > max_wait_msec)
+            wait_msec = max_wait_msec;
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            if (m_posted.empty() == false || m_stopping)
+                wait_msec = 0;
+        }
+
+        size_t  ran = 0;
+        bool    cancelled = this->poll_events(wait_msec, ran);
+        ran += m_timers.advance();
+
+        std::vector<pool_task*> posted;
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            this->drain();
+            posted.swap(m_posted);
+        }
+        size_t  idx = 0;
+        for (; idx < posted.size(); ++idx)
+        {
+            task_call   call = { posted[idx] };
+            cancelled = run_absorbed(call) || cancelled;
+            ++ran;
+        }
+        if (cancelled)
+            throw   k2::thread::cancel_signal();
+        return  ran;
+    }
+
+    void    run ()
+    {
+        for (;;)
+        {
+            this->run_once(k2::time_span(max_wait_msec));
+            k2::mutex::scoped_guard guard(m_mtx);
+            if (m_stopping)
+            {
+                m_stopping = false;
+                return;
+            }
+        }
+    }
+};
+
+namespace   //  unnamed
+{
+    void
+    expire_entry::operator() () const
+    {
+        m_pimpl->expire(m_desc, m_way, m_serial);
+    }
+
+}   //  unnamed namespace
+
+k2::event_loop::event_loop ()
+:   m_pimpl(0)
+{
+    std::auto_ptr<nonpublic::event_loop_impl>   pimpl;
+    try
+    {
+        pimpl.reset(new nonpublic::event_loop_impl);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+    pimpl->start();
+    m_pimpl = pimpl.release();
+}
+k2::event_loop::~event_loop ()
+{
+    delete  m_pimpl;
+}
+bool
+k2::event_loop::watch (
+    int desc, bool for_write, handler fn, void* arg, const timestamp* ptimer)
+{
+    return  m_pimpl->watch(
+        desc, for_write ? way_write : way_read, fn, arg, ptimer);
+}
+bool
+k2::event_loop::unwatch (int desc, bool for_write)
+{
+    return  m_pimpl->unwatch(desc, for_write ? way_write : way_read);
+}
+k2::timer_wheel&
+k2::event_loop::timers ()
+{
+    return  m_pimpl->m_timers;
+}
+void
+k2::event_loop::run ()
+{
+    m_pimpl->run();
+}
+size_t
+k2::event_loop::run_once (const time_span& max_wait)
+{
+    return  m_pimpl->run_once(max_wait);
+}
+void
+k2::event_loop::stop ()
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    m_pimpl->m_stopping = true;
+    m_pimpl->wake();
+}
+size_t
+k2::event_loop::watches () const
+{
+    return  m_pimpl->m_watches;
+}
+void
+k2::event_loop::post_impl (nonpublic::pool_task* ptask)
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    try
+    {
+        m_pimpl->m_posted.push_back(ptask);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+    m_pimpl->wake();
+}
@@ -0,0 +1,1136 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/fiber.h>
+
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/cond_var.h>
+#include <k2/cancellation.h>
+#include <k2/futex.h>
+#include <k2/tls_ptr.h>
+#include <k2/singleton.h>
+#include <k2/timing.h>
+
+#include <vector>
+#include <cerrno>
+
+#if defined(WIN32)
+#   define  K2_FIBER_WIN32
+#   include <windows.h>
+#elif defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) \
+    && !defined(K2_FIBER_USE_UCONTEXT)
+#   define  K2_FIBER_ASM_X86_64
+#else
+#   define  K2_FIBER_UCONTEXT
+#   include <ucontext.h>
+#endif
+
+#if !defined(WIN32)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#   include <poll.h>
+#endif
+#if defined(__linux__)
+#   include <sys/epoll.h>
+#   define  K2_FIBER_EPOLL
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) && !defined(K2_FIBER_WIN32)
+#   define  K2_FIBER_ASAN
+#   include <sanitizer/asan_interface.h>
+#   include <sanitizer/common_interface_defs.h>
+#   include <pthread.h>
+#endif
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::fiber_cntx   fiber_cntx;
+    typedef k2::nonpublic::pool_task    pool_task;
+
+    void    fiber_main (void* arg);
+
+#if defined(K2_FIBER_ASM_X86_64)
+
+}   //  unnamed namespace
+
+//  Saves callee-saved registers, the x87 control word and MXCSR on the
+//  calling stack, stores the stack pointer to *psave_sp, then restores
+//  all from load_sp.
+extern "C" void k2_fiber_switch (void** psave_sp, void* load_sp);
+//  First return address of a fiber, calls r13 with r12.
+extern "C" void k2_fiber_trampoline ();
+
+__asm__ (
+    ".text\n"
+    ".globl k2_fiber_switch\n"
+    ".hidden k2_fiber_switch\n"
+    ".type k2_fiber_switch, @function\n"
+    "k2_fiber_switch:\n"
+    "   pushq %rbp\n"
+    "   pushq %rbx\n"
+    "   pushq %r12\n"
+    "   pushq %r13\n"
+    "   pushq %r14\n"
+    "   pushq %r15\n"
+    "   subq $16, %rsp\n"
+    "   stmxcsr 8(%rsp)\n"
+    "   fnstcw (%rsp)\n"
+    "   movq %rsp, (%rdi)\n"
+    "   movq %rsi, %rsp\n"
+    "   ldmxcsr 8(%rsp)\n"
+    "   fldcw (%rsp)\n"
+    "   addq $16, %rsp\n"
+    "   popq %r15\n"
+    "   popq %r14\n"
+    "   popq %r13\n"
+    "   popq %r12\n"
+    "   popq %rbx\n"
+    "   popq %rbp\n"
+    "   ret\n"
+    ".size k2_fiber_switch, .-k2_fiber_switch\n"
+    ".globl k2_fiber_trampoline\n"
+    ".hidden k2_fiber_trampoline\n"
+    ".type k2_fiber_trampoline, @function\n"
+    "k2_fiber_trampoline:\n"
+    "   movq %r12, %rdi\n"
+    "   callq *%r13\n"
+    "   ud2\n"
+    ".size k2_fiber_trampoline, .-k2_fiber_trampoline\n"
+);
+
+namespace   //  unnamed
+{
+    struct fiber_context
+    {
+        void*   m_sp;
+#if defined(K2_FIBER_ASAN)
+        const void* m_pstack;
+        size_t      m_stack_bytes;
+#endif
+    };
+
+    void    context_make (
+        fiber_context& cntx, char* pstack, size_t bytes, void* arg)
+    {
+        //  Mirrors what k2_fiber_switch() pops, returning to the
+        //  trampoline with a 16-byte aligned stack.
+        k2::uint64_t*   ptop = reinterpret_cast<k2::uint64_t*>(
+            (reinterpret_cast<size_t>(pstack + bytes)) & ~size_t(15));
+        k2::uint64_t*   psp = ptop - 9;
+        psp[0] = 0x037f;    //  x87 control word
+        psp[1] = 0x1f80;    //  MXCSR
+        psp[2] = 0;         //  r15
+        psp[3] = 0;         //  r14
+        psp[4] = reinterpret_cast<k2::uint64_t>(&fiber_main);   //  r13
+        psp[5] = reinterpret_cast<k2::uint64_t>(arg);           //  r12
+        psp[6] = 0;         //  rbx
+        psp[7] = 0;         //  rbp
+        psp[8] = reinterpret_cast<k2::uint64_t>(&k2_fiber_trampoline);
+        cntx.m_sp = psp;
+#if defined(K2_FIBER_ASAN)
+        cntx.m_pstack = pstack;
+        cntx.m_stack_bytes = bytes;
+#endif
+    }
+    inline void context_switch (fiber_context& from, fiber_context& to)
+    {
+#if defined(K2_FIBER_ASAN)
+        void*   pfake_stack = 0;
+        __sanitizer_start_switch_fiber(
+            &pfake_stack, to.m_pstack, to.m_stack_bytes);
+#endif
+        k2_fiber_switch(&from.m_sp, to.m_sp);
+#if defined(K2_FIBER_ASAN)
+        __sanitizer_finish_switch_fiber(pfake_stack, 0, 0);
+#endif
+    }
+
+#elif defined(K2_FIBER_UCONTEXT)
+
+    struct fiber_context
+    {
+        ucontext_t  m_uc;
+#if defined(K2_FIBER_ASAN)
+        const void* m_pstack;
+        size_t      m_stack_bytes;
+#endif
+    };
+
+    //  makecontext() passes int arguments only.
+    void    ucontext_entry (unsigned int high, unsigned int low)
+    {
+        size_t  arg = (size_t(high) << 16 << 16) | size_t(low);
+        fiber_main(reinterpret_cast<void*>(arg));
+    }
+    void    context_make (
+        fiber_context& cntx, char* pstack, size_t bytes, void* arg)
+    {
+        if (getcontext(&cntx.m_uc) != 0)
+            throw   k2::bad_resource_alloc();
+        cntx.m_uc.uc_stack.ss_sp = pstack;
+        cntx.m_uc.uc_stack.ss_size = bytes;
+        cntx.m_uc.uc_link = 0;
+        size_t  value = reinterpret_cast<size_t>(arg);
+        makecontext(
+            &cntx.m_uc,
+            reinterpret_cast<void (*)()>(&ucontext_entry),
+            2,
+            (unsigned int)(value >> 16 >> 16),
+            (unsigned int)(value & 0xffffffffu));
+#if defined(K2_FIBER_ASAN)
+        cntx.m_pstack = pstack;
+        cntx.m_stack_bytes = bytes;
+#endif
+    }
+    inline void context_switch (fiber_context& from, fiber_context& to)
+    {
+#if defined(K2_FIBER_ASAN)
+        void*   pfake_stack = 0;
+        __sanitizer_start_switch_fiber(
+            &pfake_stack, to.m_pstack, to.m_stack_bytes);
+#endif
+        swapcontext(&from.m_uc, &to.m_uc);
+#if defined(K2_FIBER_ASAN)
+        __sanitizer_finish_switch_fiber(pfake_stack, 0, 0);
+#endif
+    }
+
+#endif
+
+#if !defined(K2_FIBER_WIN32)
+
+    //  AddressSanitizer is told the stack switched to, a carrier's is the
+    //  one of its thread.
+    inline void context_init_carrier (fiber_context& cntx)
+    {
+#if defined(K2_FIBER_ASAN)
+        cntx.m_pstack = 0;
+        cntx.m_stack_bytes = 0;
+        pthread_attr_t  attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0)
+        {
+            void*   pstack = 0;
+            size_t  bytes = 0;
+            if (pthread_attr_getstack(&attr, &pstack, &bytes) == 0)
+            {
+                cntx.m_pstack = pstack;
+                cntx.m_stack_bytes = bytes;
+            }
+            pthread_attr_destroy(&attr);
+        }
+#else
+        (void)cntx;
+#endif
+    }
+
+#else   //  K2_FIBER_WIN32
+
+    struct fiber_context
+    {
+        void*   m_handle;
+    };
+
+    void WINAPI win32_entry (void* arg)
+    {
+        fiber_main(arg);
+    }
+    void    context_make (
+        fiber_context& cntx, char*, size_t bytes, void* arg)
+    {
+        cntx.m_handle = ::CreateFiberEx(bytes, bytes, 0, win32_entry, arg);
+        if (cntx.m_handle == 0)
+            throw   k2::bad_resource_alloc();
+    }
+    inline void context_switch (fiber_context&, fiber_context& to)
+    {
+        ::SwitchToFiber(to.m_handle);
+    }
+    inline void context_init_carrier (fiber_context& cntx)
+    {
+        cntx.m_handle = ::ConvertThreadToFiber(0);
+    }
+
+#endif
+
+}   //  unnamed namespace
+
+struct k2::nonpublic::fiber_cntx
+{
+    enum state_enum
+    {
+        running,
+        //  Announced to wakers, not yet switched out.
+        parking,
+        parked,
+        //  Woken while parking, its carrier re-queues it.
+        notified
+    };
+
+    fiber_context           m_context;
+    char*                   m_pmap;
+    size_t                  m_map_bytes;
+    pool_task*              m_ptask;
+    fiber_scheduler_impl*   m_psched;
+    //  Links of the ready queue and of the pool.
+    fiber_cntx*             m_pnext;
+
+    k2::mutex               m_lock;
+    state_enum              m_state;
+    //  Identifies a park, only the first waker of which wins.
+    uint32_t                m_serial;
+    //  Set by the winning waker.
+    bool                    m_timedout;
+    //  Serial of the socket wait, read by the epoll thread.
+    k2::atomic_int_t        m_io_serial;
+
+    fiber_cntx (fiber_scheduler_impl* psched, size_t stack_size)
+    :   m_pmap(0)
+    ,   m_map_bytes(0)
+    ,   m_ptask(0)
+    ,   m_psched(psched)
+    ,   m_pnext(0)
+    ,   m_state(running)
+    ,   m_serial(0)
+    ,   m_timedout(false)
+    {
+        m_io_serial = 0;
+#if !defined(WIN32)
+        //  A PROT_NONE guard page below the stack turns an overflow into
+        //  a fault, rather than a silent corruption.
+        size_t  page = size_t(::sysconf(_SC_PAGESIZE));
+        size_t  bytes = (stack_size + page - 1) / page * page;
+        void*   pmap = ::mmap(
+            0, bytes + page,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pmap == MAP_FAILED)
+            throw   k2::bad_resource_alloc();
+        m_pmap = static_cast<char*>(pmap);
+        m_map_bytes = bytes + page;
+        ::mprotect(m_pmap, page, PROT_NONE);
+#if defined(K2_FIBER_ASAN)
+        //  The mapping may reuse addresses of an unmapped stack, whose
+        //  frames are still poisoned.
+        ASAN_UNPOISON_MEMORY_REGION(m_pmap + page, bytes);
+#endif
+        try
+        {
+            context_make(m_context, m_pmap + page, bytes, this);
+        }
+        catch (...)
+        {
+            ::munmap(m_pmap, m_map_bytes);
+            throw;
+        }
+#else
+        context_make(m_context, 0, stack_size, this);
+#endif
+    }
+    ~fiber_cntx ()
+    {
+#if !defined(WIN32)
+        ::munmap(m_pmap, m_map_bytes);
+#else
+        ::DeleteFiber(m_context.m_handle);
+#endif
+    }
+};
+
+namespace   //  unnamed
+{
+    enum action_enum
+    {
+        action_yield,
+        action_park,
+        action_exit
+    };
+
+    struct carrier
+    {
+        k2::nonpublic::fiber_scheduler_impl*    m_psched;
+        fiber_context       m_context;
+        //  Fiber switched to, and what it asks on switching back.
+        fiber_cntx*         m_pcurrent;
+        action_enum         m_action;
+    };
+
+    struct carrier_binding
+    {
+        carrier*    m_pcarrier;
+    };
+
+    //  Not a static_tls_ptr<>: a compiler may keep the address of a
+    //  __thread variable across switch_out(), while the fiber resumes on
+    //  another carrier.
+    k2::tls_ptr<carrier_binding>& get_tls_binding ()
+    {
+        return  k2::singleton<k2::tls_ptr<carrier_binding> >::instance();
+    }
+
+    //  Fiber calling thread runs, 0 if none.
+    fiber_cntx* current_fiber ()
+    {
+        carrier_binding*    pbinding = get_tls_binding().get();
+        return  pbinding ? pbinding->m_pcarrier->m_pcurrent : 0;
+    }
+
+    //  Switches calling fiber back to its carrier. The fiber may resume
+    //  on another carrier, so the carrier is looked up each time.
+    void    switch_out (action_enum action)
+    {
+        carrier*    pcarrier = get_tls_binding().get()->m_pcarrier;
+        pcarrier->m_action = action;
+        context_switch(
+            pcarrier->m_pcurrent->m_context, pcarrier->m_context);
+    }
+
+    void    fiber_main (void* arg)
+    {
+#if defined(K2_FIBER_ASAN)
+        //  Completes the switch started by the first context_switch().
+        __sanitizer_finish_switch_fiber(0, 0, 0);
+#endif
+        fiber_cntx* pfiber = static_cast<fiber_cntx*>(arg);
+        //  Pooled fibers loop, resumed with a new task.
+        for (;;)
+        {
+            pool_task*  ptask = pfiber->m_ptask;
+            pfiber->m_ptask = 0;
+            try
+            {
+                pool_task::run(ptask);
+            }
+            catch (...)
+            {
+                //  Absorbs, the task is deleted by run().
+            }
+            switch_out(action_exit);
+        }
+    }
+
+    struct carrier_entry
+    {
+        k2::nonpublic::fiber_scheduler_impl*    m_psched;
+        carrier*                                m_pcarrier;
+
+        void operator() () const;
+    };
+
+    struct io_entry
+    {
+        k2::nonpublic::fiber_scheduler_impl*    m_psched;
+
+        void operator() () const;
+    };
+
+    struct fiber_timeout
+    {
+        fiber_cntx* m_pfiber;
+        k2::uint32_t    m_serial;
+
+        void operator() () const;
+    };
+
+}   //  unnamed namespace
+
+struct k2::nonpublic::fiber_scheduler_impl
+{
+    const size_t            m_stack_size;
+
+    k2::mutex               m_mtx;
+    k2::cond_var            m_ready_cv;
+    k2::cond_var            m_idle_cv;
+    fiber_cntx*             m_phead;
+    fiber_cntx*             m_ptail;
+    fiber_cntx*             m_pfree;
+    size_t                  m_live;
+    bool                    m_stopping;
+
+    std::vector<carrier*>   m_carriers;
+    std::vector<k2::thread*>    m_threads;
+    k2::timer_wheel         m_wheel;
+#if defined(K2_FIBER_EPOLL)
+    int                     m_epoll;
+    k2::cancel_token        m_io_stop;
+    std::auto_ptr<k2::thread>   m_pio;
+#endif
+
+    fiber_scheduler_impl (size_t stack_size)
+    :   m_stack_size(stack_size)
+    ,   m_ready_cv(m_mtx)
+    ,   m_idle_cv(m_mtx)
+    ,   m_phead(0)
+    ,   m_ptail(0)
+    ,   m_pfree(0)
+    ,   m_live(0)
+    ,   m_stopping(false)
+    ,   m_wheel(k2::time_span(1))
+#if defined(K2_FIBER_EPOLL)
+    ,   m_epoll(-1)
+#endif
+    {
+    }
+    ~fiber_scheduler_impl ()
+    {
+        this->join();
+        while (m_pfree)
+        {
+            fiber_cntx* pnext = m_pfree->m_pnext;
+            delete  m_pfree;
+            m_pfree = pnext;
+        }
+        size_t  idx = 0;
+        for (; idx < m_carriers.size(); ++idx)
+            delete  m_carriers[idx];
+#if defined(K2_FIBER_EPOLL)
+        if (m_epoll != -1)
+            ::close(m_epoll);
+#endif
+    }
+
+    void    start (size_t carrier_cnt)
+    {
+        m_wheel.start();
+#if defined(K2_FIBER_EPOLL)
+        m_epoll = ::epoll_create(64);
+        if (m_epoll == -1)
+            throw   k2::bad_resource_alloc();
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = 0;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_io_stop.wait_desc(), &ev) != 0)
+            throw   k2::bad_resource_alloc();
+        io_entry    io = { this };
+        m_pio.reset(new k2::thread(io));
+#endif
+        m_carriers.reserve(carrier_cnt);
+        m_threads.reserve(carrier_cnt);
+        size_t  idx = 0;
+        for (; idx < carrier_cnt; ++idx)
+        {
+            std::auto_ptr<carrier>  pcarrier(new carrier);
+            pcarrier->m_psched = this;
+            pcarrier->m_pcurrent = 0;
+            pcarrier->m_action = action_yield;
+            m_carriers.push_back(pcarrier.release());
+        }
+        for (idx = 0; idx < carrier_cnt; ++idx)
+        {
+            carrier_entry   entry = { this, m_carriers[idx] };
+            m_threads.push_back(0);
+            m_threads.back() = new k2::thread(entry);
+        }
+    }
+
+    //  Waits for all fibers, then stops all threads.
+    void    join ()
+    {
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            m_stopping = true;
+            while (m_live)
+                m_idle_cv.wait();
+            m_ready_cv.broadcast();
+        }
+        while (m_threads.empty() == false)
+        {
+            delete  m_threads.back();
+            m_threads.pop_back();
+        }
+#if defined(K2_FIBER_EPOLL)
+        if (m_pio.get())
+        {
+            m_io_stop.cancel();
+            m_pio.reset();
+        }
+#endif
+        m_wheel.stop();
+    }
+
+    bool    spawn (pool_task* ptask)
+    {
+        fiber_cntx* pfiber = 0;
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            if (m_stopping && m_live == 0)
+                return  false;
+            ++m_live;
+            if (m_pfree)
+            {
+                pfiber = m_pfree;
+                m_pfree = pfiber->m_pnext;
+            }
+        }
+        if (pfiber == 0)
+        {
+            try
+            {
+                pfiber = new fiber_cntx(this, m_stack_size);
+            }
+            catch (...)
+            {
+                k2::mutex::scoped_guard guard(m_mtx);
+                this->retire();
+                throw   k2::bad_resource_alloc();
+            }
+        }
+        pfiber->m_ptask = ptask;
+        this->push_ready(pfiber);
+        return  true;
+    }
+
+    //  m_mtx held.
+    void    retire ()
+    {
+        if (--m_live == 0)
+        {
+            m_idle_cv.broadcast();
+            if (m_stopping)
+                m_ready_cv.broadcast();
+        }
+    }
+
+    void    push_ready (fiber_cntx* pfiber)
+    {
+        k2::mutex::scoped_guard guard(m_mtx);
+        pfiber->m_pnext = 0;
+        if (m_ptail)
+            m_ptail->m_pnext = pfiber;
+        else
+            m_phead = pfiber;
+        m_ptail = pfiber;
+        m_ready_cv.signal();
+    }
+    //  0 once stopping with no fiber left.
+    fiber_cntx* pop_ready ()
+    {
+        k2::mutex::scoped_guard guard(m_mtx);
+        while (m_phead == 0)
+        {
+            if (m_stopping && m_live == 0)
+                return  0;
+            m_ready_cv.wait();
+        }
+        fiber_cntx* pfiber = m_phead;
+        m_phead = pfiber->m_pnext;
+        if (m_phead == 0)
+            m_ptail = 0;
+        return  pfiber;
+    }
+
+    void    run_carrier (carrier& self)
+    {
+        carrier_binding*    pbinding = new carrier_binding;
+        pbinding->m_pcarrier = &self;
+        get_tls_binding().reset(pbinding);
+        struct unbind
+        {
+            ~unbind ()
+            {
+                get_tls_binding().reset();
+            }
+        }   guard;
+
+        context_init_carrier(self.m_context);
+        while (fiber_cntx* pfiber = this->pop_ready())
+        {
+            self.m_pcurrent = pfiber;
+            context_switch(self.m_context, pfiber->m_context);
+            self.m_pcurrent = 0;
+
+            switch (self.m_action)
+            {
+            case action_yield:
+                this->push_ready(pfiber);
+                break;
+            case action_park:
+                fiber_scheduler_impl::finish_park(pfiber);
+                break;
+            case action_exit:
+                {
+                    k2::mutex::scoped_guard guard(m_mtx);
+                    pfiber->m_pnext = m_pfree;
+                    m_pfree = pfiber;
+                    this->retire();
+                }
+                break;
+            }
+        }
+    }
+
+    //  Parking protocol: a fiber announces itself parking, publishes its
+    //  serial to wakers, then switches out; its carrier completes the
+    //  park, unless woken in between.
+    static uint32_t prepare_park (fiber_cntx* pfiber)
+    {
+        k2::mutex::scoped_guard guard(pfiber->m_lock);
+        pfiber->m_state = fiber_cntx::parking;
+        return  pfiber->m_serial;
+    }
+    static void cancel_park (fiber_cntx* pfiber)
+    {
+        k2::mutex::scoped_guard guard(pfiber->m_lock);
+        ++pfiber->m_serial;
+        pfiber->m_state = fiber_cntx::running;
+    }
+    static void finish_park (fiber_cntx* pfiber)
+    {
+        {
+            k2::mutex::scoped_guard guard(pfiber->m_lock);
+            if (pfiber->m_state == fiber_cntx::parking)
+            {
+                pfiber->m_state = fiber_cntx::parked;
+                return;
+            }
+            pfiber->m_state = fiber_cntx::running;
+        }
+        pfiber->m_psched->push_ready(pfiber);
+    }
+    static bool unpark (fiber_cntx* pfiber, uint32_t serial, bool timedout)
+    {
+        {
+            k2::mutex::scoped_guard guard(pfiber->m_lock);
+            if (pfiber->m_serial != serial)
+                return  false;
+            ++pfiber->m_serial;
+            pfiber->m_timedout = timedout;
+            if (pfiber->m_state != fiber_cntx::parked)
+            {
+                pfiber->m_state = fiber_cntx::notified;
+                return  true;
+            }
+            pfiber->m_state = fiber_cntx::running;
+        }
+        pfiber->m_psched->push_ready(pfiber);
+        return  true;
+    }
+
+#if defined(K2_FIBER_EPOLL)
+    bool    arm (int desc, bool for_write, fiber_cntx* pfiber)
+    {
+        epoll_event ev;
+        ev.events = (for_write ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+        ev.data.ptr = pfiber;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_MOD, desc, &ev) == 0)
+            return  true;
+        if (errno != ENOENT)
+            return  false;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, desc, &ev) == 0)
+            return  true;
+        //  Raced with another fiber adding it.
+        return  errno == EEXIST
+            && ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, desc, &ev) == 0;
+    }
+    void    run_io ()
+    {
+        epoll_event events[64];
+        for (;;)
+        {
+            int cnt = ::epoll_wait(m_epoll, events, 64, -1);
+            int idx = 0;
+            for (; idx < cnt; ++idx)
+            {
+                fiber_cntx* pfiber = static_cast<fiber_cntx*>(events[idx].data.ptr);
+                if (pfiber == 0)
+                    return;
+                fiber_scheduler_impl::unpark(
+                    pfiber, uint32_t(k2::atomic_load(pfiber->m_io_serial)), false);
+            }
+        }
+    }
+#endif
+};
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::fiber_scheduler_impl fiber_scheduler_impl;
+
+    void
+    carrier_entry::operator() () const
+    {
+        m_psched->run_carrier(*m_pcarrier);
+    }
+
+#if defined(K2_FIBER_EPOLL)
+    void
+    io_entry::operator() () const
+    {
+        m_psched->run_io();
+    }
+#endif
+
+    void
+    fiber_timeout::operator() () const
+    {
+        fiber_scheduler_impl::unpark(m_pfiber, m_serial, true);
+    }
+
+    //  Undoes fiber_waiter::prepare() of a fiber that will not park.
+    void    cancel_wait (k2::nonpublic::fiber_waiter& waiter)
+    {
+        if (waiter.m_pfiber == 0)
+            return;
+        if (waiter.m_ptimer)
+            waiter.m_pfiber->m_psched->m_wheel.cancel(waiter.m_timer);
+        fiber_scheduler_impl::cancel_park(waiter.m_pfiber);
+    }
+
+    k2::time_span   time_left (const k2::timestamp& timer)
+    {
+        if (timer.expired())
+            return  k2::time_span(0);
+        return  timer - k2::timestamp::now;
+    }
+
+}   //  unnamed namespace
+
+
+void
+k2::nonpublic::fiber_waiter::prepare (const timestamp* ptimer)
+{
+    m_pfiber = current_fiber();
+    m_ptimer = ptimer;
+    m_ready = 0;
+    m_pnext = 0;
+    m_pprev = 0;
+    m_linked = false;
+    m_timedout = false;
+    if (m_pfiber == 0)
+        return;
+
+    m_serial = fiber_scheduler_impl::prepare_park(m_pfiber);
+    if (ptimer)
+    {
+        fiber_timeout   timeout = { m_pfiber, m_serial };
+        try
+        {
+            m_timer = m_pfiber->m_psched->m_wheel.schedule(
+                time_left(*ptimer), timeout);
+        }
+        catch (...)
+        {
+            fiber_scheduler_impl::cancel_park(m_pfiber);
+            throw;
+        }
+    }
+}
+void
+k2::nonpublic::fiber_waiter::wait ()
+{
+    if (m_pfiber)
+    {
+        switch_out(action_park);
+        if (m_ptimer)
+            m_pfiber->m_psched->m_wheel.cancel(m_timer);
+        m_timedout = m_pfiber->m_timedout;
+        return;
+    }
+
+    while (atomic_load(m_ready) == 0)
+    {
+        if (futex_wait(m_ready, 0, m_ptimer) == false)
+            break;
+    }
+    m_timedout = atomic_load(m_ready) == 0;
+}
+bool
+k2::nonpublic::fiber_waiter::wake ()
+{
+    if (m_pfiber)
+        return  fiber_scheduler_impl::unpark(m_pfiber, m_serial, false);
+
+    atomic_store(m_ready, 1);
+    futex_wake(m_ready, 1);
+    return  true;
+}
+
+void
+k2::nonpublic::fiber_wait_queue::push (fiber_waiter* pwaiter)
+{
+    pwaiter->m_pnext = 0;
+    pwaiter->m_pprev = m_ptail;
+    if (m_ptail)
+        m_ptail->m_pnext = pwaiter;
+    else
+        m_phead = pwaiter;
+    m_ptail = pwaiter;
+    pwaiter->m_linked = true;
+}
+k2::nonpublic::fiber_waiter*
+k2::nonpublic::fiber_wait_queue::pop ()
+{
+    fiber_waiter*   pwaiter = m_phead;
+    if (pwaiter)
+        this->remove(pwaiter);
+    return  pwaiter;
+}
+void
+k2::nonpublic::fiber_wait_queue::remove (fiber_waiter* pwaiter)
+{
+    if (pwaiter->m_pprev)
+        pwaiter->m_pprev->m_pnext = pwaiter->m_pnext;
+    else
+        m_phead = pwaiter->m_pnext;
+    if (pwaiter->m_pnext)
+        pwaiter->m_pnext->m_pprev = pwaiter->m_pprev;
+    else
+        m_ptail = pwaiter->m_pprev;
+    pwaiter->m_linked = false;
+}
+
+int
+k2::nonpublic::fiber_wait_desc (
+    int desc, bool for_write, const timestamp* ptimer)
+{
+#if defined(K2_FIBER_EPOLL)
+    fiber_cntx* pfiber = current_fiber();
+    if (pfiber == 0)
+        return  -1;
+
+    //  Re-checks, a wake-up may be stale: the epoll thread reads the
+    //  serial of the latest socket wait of the fiber.
+    for (;;)
+    {
+        pollfd  poll_desc;
+        poll_desc.fd = desc;
+        poll_desc.events = for_write ? POLLOUT : POLLIN;
+        poll_desc.revents = 0;
+        if (::poll(&poll_desc, 1, 0) != 0)
+            return  1;
+        if (ptimer && ptimer->expired())
+            return  0;
+
+        fiber_waiter    waiter;
+        waiter.prepare(ptimer);
+        atomic_store(pfiber->m_io_serial, int(waiter.m_serial));
+        if (pfiber->m_psched->arm(desc, for_write, pfiber) == false)
+        {
+            cancel_wait(waiter);
+            return  -1;
+        }
+        waiter.wait();
+    }
+#else
+    (void)desc;
+    (void)for_write;
+    (void)ptimer;
+    return  -1;
+#endif
+}
+
+
+k2::fiber_scheduler::fiber_scheduler (size_t carrier_cnt, size_t stack_size)
+:   m_pimpl(0)
+{
+    std::auto_ptr<nonpublic::fiber_scheduler_impl>  pimpl;
+    try
+    {
+        pimpl.reset(new nonpublic::fiber_scheduler_impl(stack_size));
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+
+    try
+    {
+        pimpl->start(carrier_cnt ? carrier_cnt : 1);
+    }
+    catch (...)
+    {
+        //  Joins what has started.
+        pimpl.reset();
+        throw   bad_resource_alloc();
+    }
+    m_pimpl = pimpl.release();
+}
+k2::fiber_scheduler::~fiber_scheduler ()
+{
+    delete  m_pimpl;
+}
+bool
+k2::fiber_scheduler::spawn_impl (nonpublic::pool_task* ptask)
+{
+    return  m_pimpl->spawn(ptask);
+}
+void
+k2::fiber_scheduler::shutdown ()
+{
+    m_pimpl->join();
+}
+size_t
+k2::fiber_scheduler::size () const
+{
+    return  m_pimpl->m_carriers.size();
+}
+size_t
+k2::fiber_scheduler::fiber_count () const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    return  m_pimpl->m_live;
+}
+
+//  static
+bool
+k2::fiber::on_fiber ()
+{
+    return  current_fiber() != 0;
+}
+//  static
+void
+k2::fiber::yield ()
+{
+    if (current_fiber())
+        switch_out(action_yield);
+    else
+        thread::sched_yield();
+}
+//  static
+void
+k2::fiber::sleep (const time_span& span)
+{
+    if (current_fiber() == 0)
+    {
+        thread::sleep(span);
+        return;
+    }
+
+    timestamp   timer(span);
+    nonpublic::fiber_waiter waiter;
+    waiter.prepare(&timer);
+    waiter.wait();
+}
+
+void
+k2::fiber_mutex::acquire ()
+{
+    m_lock.acquire();
+    if (m_locked == false)
+    {
+        m_locked = true;
+        m_lock.release();
+        return;
+    }
+
+    nonpublic::fiber_waiter waiter;
+    try
+    {
+        waiter.prepare(0);
+    }
+    catch (...)
+    {
+        m_lock.release();
+        throw;
+    }
+    m_waiters.push(&waiter);
+    m_lock.release();
+
+    //  Ownership is handed over by release().
+    waiter.wait();
+    mutex::scoped_guard guard(m_lock);
+}
+bool
+k2::fiber_mutex::try_acquire ()
+{
+    mutex::scoped_guard guard(m_lock);
+    if (m_locked)
+        return  false;
+    m_locked = true;
+    return  true;
+}
+void
+k2::fiber_mutex::release ()
+{
+    mutex::scoped_guard guard(m_lock);
+    while (nonpublic::fiber_waiter* pwaiter = m_waiters.pop())
+    {
+        if (pwaiter->wake())
+            return;
+    }
+    m_locked = false;
+}
+
+void
+k2::fiber_cond_var::wait ()
+{
+    nonpublic::fiber_waiter waiter;
+    waiter.prepare(0);
+    {
+        mutex::scoped_guard guard(m_lock);
+        m_waiters.push(&waiter);
+    }
+    m_mtx.release();
+    waiter.wait();
+    {
+        mutex::scoped_guard guard(m_lock);
+        if (waiter.m_linked)
+            m_waiters.remove(&waiter);
+    }
+    m_mtx.acquire();
+}
+bool
+k2::fiber_cond_var::wait (const timestamp& timer)
+{
+    nonpublic::fiber_waiter waiter;
+    waiter.prepare(&timer);
+    {
+        mutex::scoped_guard guard(m_lock);
+        m_waiters.push(&waiter);
+    }
+    m_mtx.release();
+    waiter.wait();
+    bool    signalled = false;
+    {
+        mutex::scoped_guard guard(m_lock);
+        if (waiter.m_linked)
+            m_waiters.remove(&waiter);
+        else
+            signalled = waiter.m_pfiber == 0 || waiter.m_timedout == false;
+    }
+    m_mtx.acquire();
+    return  signalled;
+}
+void
+k2::fiber_cond_var::signal ()
+{
+    mutex::scoped_guard guard(m_lock);
+    while (nonpublic::fiber_waiter* pwaiter = m_waiters.pop())
+    {
+        if (pwaiter->wake())
+            return;
+    }
+}
+void
+k2::fiber_cond_var::broadcast ()
+{
+    mutex::scoped_guard guard(m_lock);
+    while (nonpublic::fiber_waiter* pwaiter = m_waiters.pop())
+    {
+        pwaiter->wake();
+    }
+}
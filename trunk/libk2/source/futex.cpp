@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/futex.h>
+
+#include <k2/timing.h>
+
+#include <climits>
+
+#if defined(__linux__)
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#   include <linux/futex.h>
+#   include <time.h>
+#   include <errno.h>
+#else
+#   include <source/pthread_util.inl>
+#   include <pthread.h>
+#   include <errno.h>
+#endif
+
+namespace   //  unnamed
+{
+    //  Milliseconds left before timer expires, 0 if expired.
+    inline k2::uint64_t msec_left (const k2::timestamp& timer)
+    {
+        k2::uint64_t    now = k2::timestamp().in_msec();
+        k2::uint64_t    end = timer.in_msec();
+        return  end > now ? end - now : 0;
+    }
+
+#if defined(__linux__)
+
+    inline int os_futex (
+        volatile int* addr, int op, int val, const timespec* ts)
+    {
+        return  int(syscall(SYS_futex, addr, op, val, ts, 0, 0));
+    }
+
+#else
+
+    //  Waiters on different words may share a bucket, they are all woken
+    //  and re-check their own word.
+    struct futex_bucket
+    {
+        pthread_mutex_t m_mtx;
+        pthread_cond_t  m_cv;
+    };
+
+#   define  K2_FUTEX_BUCKET_INIT    \
+        { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+#   define  K2_FUTEX_BUCKET_INIT_4  \
+        K2_FUTEX_BUCKET_INIT, K2_FUTEX_BUCKET_INIT, \
+        K2_FUTEX_BUCKET_INIT, K2_FUTEX_BUCKET_INIT
+
+    const size_t    futex_buckets = 16;
+    futex_bucket    futex_table[futex_buckets] =
+    {
+        K2_FUTEX_BUCKET_INIT_4, K2_FUTEX_BUCKET_INIT_4,
+        K2_FUTEX_BUCKET_INIT_4, K2_FUTEX_BUCKET_INIT_4
+    };
+
+    inline futex_bucket& bucket_of (const volatile void* addr)
+    {
+        size_t  key = reinterpret_cast<size_t>(addr);
+        return  futex_table[(key >> 4 ^ key >> 10) % futex_buckets];
+    }
+
+#endif
+
+}   //  unnamed namespace
+
+#if defined(__linux__)
+
+bool
+k2::nonpublic::futex_wait (
+    atomic_int_t& word, int expected, const timestamp* ptimer)
+{
+    timespec    ts;
+    timespec*   pts = 0;
+    if (ptimer)
+    {
+        uint64_t    left = msec_left(*ptimer);
+        if (left == 0)
+            return  false;
+        ts.tv_sec = time_t(left / 1000);
+        ts.tv_nsec = long(left % 1000) * 1000 * 1000;
+        pts = &ts;
+    }
+
+    if (os_futex(&word, FUTEX_WAIT_PRIVATE, expected, pts) != 0 &&
+        errno == ETIMEDOUT)
+        return  false;
+
+    //  Woken, interrupted, or word no longer equals expected.
+    return  true;
+}
+void
+k2::nonpublic::futex_wake (atomic_int_t& word, int count)
+{
+    os_futex(&word, FUTEX_WAKE_PRIVATE, count, 0);
+}
+void
+k2::nonpublic::futex_wake_all (atomic_int_t& word)
+{
+    os_futex(&word, FUTEX_WAKE_PRIVATE, INT_MAX, 0);
+}
+
+#else   //  !__linux__
+
+bool
+k2::nonpublic::futex_wait (
+    atomic_int_t& word, int expected, const timestamp* ptimer)
+{
+    futex_bucket&   bucket = bucket_of(&word);
+    ptmtx_guard     guard(bucket.m_mtx);
+
+    //  futex_wake() locks the bucket after changing word, it can not
+    //  signal between this test and the wait.
+    if (atomic_load(word) != expected)
+        return  true;
+
+    if (ptimer == 0)
+    {
+        pthread_cond_wait(&bucket.m_cv, &bucket.m_mtx);
+        return  true;
+    }
+
+    timespec    ts;
+    ts.tv_sec = ptimer->in_sec();
+    ts.tv_nsec = long(ptimer->msec_of_sec()) * 1000 * 1000;
+    if (pthread_cond_timedwait(&bucket.m_cv, &bucket.m_mtx, &ts) == ETIMEDOUT)
+        return  false;
+    return  true;
+}
+void
+k2::nonpublic::futex_wake (atomic_int_t& word, int)
+{
+    k2::nonpublic::futex_wake_all(word);
+}
+void
+k2::nonpublic::futex_wake_all (atomic_int_t& word)
+{
+    futex_bucket&   bucket = bucket_of(&word);
+    ptmtx_guard     guard(bucket.m_mtx);
+    pthread_cond_broadcast(&bucket.m_cv);
+}
+
+#endif  //  !__linux__
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/future.h>
+
+#include <k2/futex.h>
+#include <k2/opt.h>
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::future_callback  future_callback;
+
+    enum exception_kind_enum
+    {
+        kind_exception,
+        kind_timedout_error,
+        kind_bad_resource_alloc,
+        kind_critical_error,
+        kind_thread_error,
+        kind_runtime_error,
+        kind_future_error
+    };
+
+    //  Marks m_pcallbacks of a completed state.
+    future_callback* ready_mark ()
+    {
+        static future_callback  mark = { 0, 0 };
+        return  &mark;
+    }
+
+    //  Fires all callbacks, in subscription order, even if one throws.
+    void fire (future_callback* pcallback)
+    {
+        while (pcallback)
+        {
+            future_callback*    pnext = pcallback->m_pnext;
+            try
+            {
+                pcallback->m_fire(pcallback);
+            }
+            catch (...)
+            {
+                fire(pnext);
+                throw;
+            }
+            pcallback = pnext;
+        }
+    }
+
+}   //  unnamed namespace
+
+
+void
+k2::nonpublic::exception_holder::capture ()
+{
+    const char* what = 0;
+    try
+    {
+        throw;
+    }
+    catch (timedout_error& x)
+    {
+        m_kind = kind_timedout_error;
+        what = x.what();
+    }
+    catch (bad_resource_alloc& x)
+    {
+        m_kind = kind_bad_resource_alloc;
+        what = x.what();
+    }
+    catch (critical_error& x)
+    {
+        m_kind = kind_critical_error;
+        what = x.what();
+    }
+    catch (thread_error& x)
+    {
+        m_kind = kind_thread_error;
+        what = x.what();
+    }
+    catch (runtime_error& x)
+    {
+        m_kind = kind_runtime_error;
+        what = x.what();
+    }
+    catch (future_error& x)
+    {
+        m_kind = kind_future_error;
+        what = x.what();
+    }
+    catch (exception& x)
+    {
+        m_kind = kind_exception;
+        what = x.what();
+    }
+    catch (std::bad_alloc& x)
+    {
+        m_kind = kind_bad_resource_alloc;
+        what = x.what();
+    }
+    catch (std::exception& x)
+    {
+        m_kind = kind_runtime_error;
+        what = x.what();
+    }
+    catch (...)
+    {
+        m_kind = kind_exception;
+        what = "unknown exception";
+    }
+
+    std::strncpy(m_what, what ? what : "", exception::max_what);
+    m_what[exception::max_what] = 0;
+}
+void
+k2::nonpublic::exception_holder::rethrow () const
+{
+    switch (m_kind)
+    {
+    case kind_timedout_error:
+        throw   timedout_error(m_what);
+    case kind_bad_resource_alloc:
+        throw   bad_resource_alloc(m_what);
+    case kind_critical_error:
+        throw   critical_error(m_what);
+    case kind_thread_error:
+        throw   thread_error(m_what);
+    case kind_runtime_error:
+        throw   runtime_error(m_what);
+    case kind_future_error:
+        throw   future_error(m_what);
+    default:
+        throw   exception(m_what);
+    }
+}
+
+
+void
+k2::nonpublic::future_state_base::release_promise ()
+{
+    if (atomic_decrease(m_promises) != 0)
+        return;
+
+    //  Unsatisfied, unless another thread has claimed it.
+    if (atomic_cas(m_claimed, 0, 1))
+    {
+        try
+        {
+            throw   future_error("broken promise");
+        }
+        catch (...)
+        {
+            this->fail_current();
+        }
+    }
+}
+void
+k2::nonpublic::future_state_base::claim ()
+{
+    if (K2_OPT_BRANCH_FALSE(atomic_cas(m_claimed, 0, 1) == false))
+        throw   future_error("promise already satisfied");
+}
+void
+k2::nonpublic::future_state_base::fail_current ()
+{
+    m_exception.capture();
+    m_failed = true;
+    this->complete();
+}
+void
+k2::nonpublic::future_state_base::complete ()
+{
+    //  Callbacks may release the last reference to *this.
+    this->add_ref();
+
+    //  Publishes the result, then wakes waiters, if any.
+    if (atomic_exchange(m_done, done) == pending_waited)
+        futex_wake_all(m_done);
+
+    future_callback*    plist = atomic_exchange(m_pcallbacks, ready_mark());
+
+    //  Reverses to subscription order.
+    future_callback*    pcallback = 0;
+    while (plist)
+    {
+        future_callback*    pnext = plist->m_pnext;
+        plist->m_pnext = pcallback;
+        pcallback = plist;
+        plist = pnext;
+    }
+
+    try
+    {
+        fire(pcallback);
+    }
+    catch (...)
+    {
+        this->release();
+        throw;
+    }
+    this->release();
+}
+void
+k2::nonpublic::future_state_base::subscribe (future_callback* pcallback)
+{
+    for (;;)
+    {
+        future_callback*    phead = atomic_load(m_pcallbacks);
+        if (phead == ready_mark())
+            break;
+
+        pcallback->m_pnext = phead;
+        if (atomic_cas(m_pcallbacks, phead, pcallback))
+            return;
+    }
+
+    //  Already complete.
+    pcallback->m_pnext = 0;
+    pcallback->m_fire(pcallback);
+}
+bool
+k2::nonpublic::future_state_base::wait_slow (const timestamp* ptimer)
+{
+    for (;;)
+    {
+        int state = atomic_load(m_done);
+        if (state == done)
+            return  true;
+        //  Asks complete() to wake us.
+        if (state == pending
+        &&  atomic_cas(m_done, pending, pending_waited) == false)
+        {
+            continue;
+        }
+        if (futex_wait(m_done, pending_waited, ptimer) == false)
+            return  atomic_load(m_done) == done;
+    }
+}
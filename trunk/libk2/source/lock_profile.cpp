@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/lock_profile.h>
+
+#if defined(K2_LOCK_PROFILING)
+
+#include <source/pthread_util.inl>
+
+#include <algorithm>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+#include <cstring>
+
+namespace   //  unnamed
+{
+    //  Statically initialized, safe to use before and after any
+    //  runtime initialized static objects.
+    pthread_mutex_t     registry_mtx = PTHREAD_MUTEX_INITIALIZER;
+    k2::lock_profile*   registry_head = 0;
+
+    struct entry
+    {
+        const char*                 name;
+        k2::lock_profile::stats     stats;
+    };
+
+    bool longer_wait (const entry& lhs, const entry& rhs)
+    {
+        return  lhs.stats.wait_nsec > rhs.stats.wait_nsec;
+    }
+
+    //  Upper bound of the histogram bucket holding the p-th percentile.
+    k2::uint64_t percentile (
+        const k2::uint64_t* histogram, k2::uint64_t total, unsigned p)
+    {
+        if (total == 0)
+            return  0;
+
+        k2::uint64_t    rank = (total * p + 99) / 100;
+        k2::uint64_t    seen = 0;
+        size_t          bucket = 0;
+        for (; bucket < k2::lock_profile::histogram_buckets; ++bucket)
+        {
+            seen += histogram[bucket];
+            if (seen >= rank)
+                break;
+        }
+        return  k2::uint64_t(2) << bucket;
+    }
+}   //  unnamed namespace
+
+void
+k2::lock_profile::snapshot (stats& out) const
+{
+    lock_profile&   self = const_cast<lock_profile&>(*this);
+    update_guard    guard(self.m_update_lock);
+    out = m_stats;
+}
+void
+k2::lock_profile::reset ()
+{
+    update_guard    guard(m_update_lock);
+    std::memset(&m_stats, 0, sizeof(m_stats));
+}
+void
+k2::lock_profile::enroll_impl ()
+{
+    k2::ptmtx_guard guard(registry_mtx);
+
+    m_pprev = 0;
+    m_pnext = registry_head;
+    if (registry_head)
+        registry_head->m_pprev = this;
+    registry_head = this;
+}
+void
+k2::lock_profile::leave ()
+{
+    k2::ptmtx_guard guard(registry_mtx);
+
+    //  Never enrolled.
+    if (m_pprev == 0 && registry_head != this)
+        return;
+
+    if (m_pprev)
+        m_pprev->m_pnext = m_pnext;
+    else
+        registry_head = m_pnext;
+    if (m_pnext)
+        m_pnext->m_pprev = m_pprev;
+
+    m_pprev = 0;
+    m_pnext = 0;
+}
+//  static
+void
+k2::lock_profile::report (std::ostream& os, size_t max_entries)
+{
+    std::vector<entry>  entries;
+    {
+        k2::ptmtx_guard guard(registry_mtx);
+
+        lock_profile*   p = registry_head;
+        for (; p; p = p->m_pnext)
+        {
+            entry   e;
+            e.name = p->m_name;
+            p->snapshot(e.stats);
+            entries.push_back(e);
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(), longer_wait);
+
+    os  << "lock profile, ranked by total wait (nsec)" << std::endl;
+    os  << std::setw(14) << "wait"
+        << std::setw(12) << "acquired"
+        << std::setw(12) << "contended"
+        << std::setw(10) << "wait-p50"
+        << std::setw(10) << "wait-p99"
+        << std::setw(12) << "wait-max"
+        << std::setw(10) << "hold-avg"
+        << std::setw(10) << "hold-p99"
+        << std::setw(12) << "hold-max"
+        << "  name" << std::endl;
+
+    size_t  idx = 0;
+    for (; idx < entries.size() && idx < max_entries; ++idx)
+    {
+        const stats&    s = entries[idx].stats;
+        uint64_t        hold_avg =
+            s.acquisitions ? s.hold_nsec / s.acquisitions : 0;
+
+        os  << std::setw(14) << s.wait_nsec
+            << std::setw(12) << s.acquisitions
+            << std::setw(12) << s.contentions
+            << std::setw(10) << percentile(s.wait_histogram, s.acquisitions, 50)
+            << std::setw(10) << percentile(s.wait_histogram, s.acquisitions, 99)
+            << std::setw(12) << s.max_wait_nsec
+            << std::setw(10) << hold_avg
+            << std::setw(10) << percentile(s.hold_histogram, s.acquisitions, 99)
+            << std::setw(12) << s.max_hold_nsec
+            << "  " << entries[idx].name << std::endl;
+    }
+}
+//  static
+void
+k2::lock_profile::reset_all ()
+{
+    k2::ptmtx_guard guard(registry_mtx);
+
+    lock_profile*   p = registry_head;
+    for (; p; p = p->m_pnext)
+        p->reset();
+}
+
+#endif  //  K2_LOCK_PROFILING
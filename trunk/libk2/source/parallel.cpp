@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/parallel.h>
+
+#include <k2/cpu_topology.h>
+#include <k2/singleton.h>
+#include <k2/futex.h>
+#include <k2/timing.h>
+
+namespace   //  unnamed
+{
+    struct shared_parallel_pool : k2::thread_pool
+    {
+        shared_parallel_pool ()
+        :   k2::thread_pool(k2::cpu_topology::system().usable_cpu_count())
+        {
+        }
+    };
+
+}   //  unnamed namespace
+
+k2::thread_pool&
+k2::parallel_pool ()
+{
+    return  singleton<shared_parallel_pool>::instance();
+}
+
+
+void
+k2::nonpublic::parallel_cntx::fail_current ()
+{
+    if (atomic_cas(m_failed, 0, 1))
+        m_exception.capture();
+    this->stop();
+}
+void
+k2::nonpublic::parallel_cntx::task_done ()
+{
+    //  The waking thread may outlive *this, futex_wake_all() only uses
+    //  the address of m_pending.
+    if (atomic_decrease(m_pending) == 0)
+        futex_wake_all(m_pending);
+}
+void
+k2::nonpublic::parallel_cntx::join ()
+{
+    try
+    {
+        this->wait(true);
+    }
+    catch (thread::cancel_signal&)
+    {
+        this->abandon();
+        throw;
+    }
+
+    if (atomic_load(m_failed))
+        m_exception.rethrow();
+}
+void
+k2::nonpublic::parallel_cntx::abandon ()
+{
+    this->stop();
+
+    //  Skipped tasks no longer test_cancel(), other queued ones may.
+    bool    enabled = thread::cancel_enabled(false);
+    this->wait(false);
+    thread::cancel_enabled(enabled);
+}
+void
+k2::nonpublic::parallel_cntx::wait (bool cancellable)
+{
+    //  A worker keeps helping, as the tasks it waits for may be queued
+    //  in its own deque. Others sleep once nothing is left to run, and
+    //  wake up now and then to test_cancel().
+    bool    on_worker = m_pool.on_worker();
+    for (;;)
+    {
+        int pending = atomic_load(m_pending);
+        if (pending == 0)
+            return;
+        if (cancellable)
+            thread::test_cancel();
+
+        if (m_pool.run_one())
+            continue;
+        if (on_worker)
+        {
+            thread::sched_yield();
+            continue;
+        }
+        timestamp   timer(time_span(10));
+        futex_wait(m_pending, pending, &timer);
+    }
+}
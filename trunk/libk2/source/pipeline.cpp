@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/pipeline.h>
+
+#include <k2/thread.h>
+#include <k2/exception.h>
+
+#include <vector>
+#include <ostream>
+#include <iomanip>
+
+namespace k2
+{
+    namespace nonpublic
+    {
+
+struct pipeline_impl
+{
+    mutex                               m_mtx;
+    bool                                m_closed;
+    std::vector<pipeline_channel_base*> m_channels;
+    std::vector<pipeline_channel_base*> m_inputs;
+    std::vector<pipeline_stage_base*>   m_stages;
+    std::vector<thread*>                m_threads;
+
+    pipeline_impl ()
+    :   m_closed(false)
+    {
+    }
+    ~pipeline_impl ()
+    {
+        size_t  idx = 0;
+        for (; idx < m_stages.size(); ++idx)
+            delete  m_stages[idx];
+        for (idx = 0; idx < m_channels.size(); ++idx)
+            delete  m_channels[idx];
+    }
+
+    struct worker_entry
+    {
+        pipeline_stage_base*    m_pstage;
+        size_t                  m_idx;
+
+        void operator() () const
+        {
+            m_pstage->run(m_idx);
+        }
+    };
+};
+
+    }   //  namespace nonpublic
+}   //  namespace k2
+
+
+k2::pipeline::pipeline (size_t capacity, size_t batch)
+:   m_pimpl(0)
+,   m_capacity(capacity)
+,   m_batch(batch ? batch : 1)
+{
+    try
+    {
+        m_pimpl = new nonpublic::pipeline_impl;
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+k2::pipeline::~pipeline ()
+{
+    this->close();
+    this->wait();
+    delete  m_pimpl;
+}
+
+void
+k2::pipeline::close ()
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    if (m_pimpl->m_closed)
+        return;
+    m_pimpl->m_closed = true;
+
+    size_t  idx = 0;
+    for (; idx < m_pimpl->m_inputs.size(); ++idx)
+        m_pimpl->m_inputs[idx]->remove_producer();
+}
+void
+k2::pipeline::wait ()
+{
+    std::vector<thread*>    threads;
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        threads.swap(m_pimpl->m_threads);
+    }
+
+    size_t  idx = 0;
+    for (; idx < threads.size(); ++idx)
+    {
+        threads[idx]->join();
+        delete  threads[idx];
+    }
+}
+
+void
+k2::pipeline::stats (std::vector<pipeline_stage_stats>& out) const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+
+    out.clear();
+    out.reserve(m_pimpl->m_stages.size());
+    size_t  idx = 0;
+    for (; idx < m_pimpl->m_stages.size(); ++idx)
+    {
+        const nonpublic::pipeline_stage_base&   stage = *m_pimpl->m_stages[idx];
+
+        pipeline_stage_stats    s = pipeline_stage_stats();
+        s.name = stage.m_name;
+        s.workers = stage.m_counters.size();
+        s.queue_depth = stage.m_pinput->size();
+        s.queue_capacity = stage.m_pinput->capacity();
+
+        //  Read while workers update them, each lags by a batch at most.
+        size_t  worker = 0;
+        for (; worker < stage.m_counters.size(); ++worker)
+        {
+            const volatile nonpublic::pipeline_counters&    c =
+                stage.m_counters[worker];
+            s.items_in += c.items_in;
+            s.items_out += c.items_out;
+            s.batches += c.batches;
+            s.busy_nsec += c.busy_nsec;
+            s.stall_nsec += c.stall_nsec;
+            s.errors += c.errors;
+        }
+        out.push_back(s);
+    }
+}
+void
+k2::pipeline::report (std::ostream& os) const
+{
+    std::vector<pipeline_stage_stats>   entries;
+    this->stats(entries);
+
+    os  << "pipeline stages, times in msec" << std::endl;
+    os  << std::setw(8) << "workers"
+        << std::setw(14) << "in"
+        << std::setw(14) << "out"
+        << std::setw(10) << "per-batch"
+        << std::setw(10) << "busy"
+        << std::setw(10) << "stalled"
+        << std::setw(8) << "errors"
+        << std::setw(14) << "queued"
+        << "  name" << std::endl;
+
+    size_t  idx = 0;
+    for (; idx < entries.size(); ++idx)
+    {
+        const pipeline_stage_stats& s = entries[idx];
+        os  << std::setw(8) << s.workers
+            << std::setw(14) << s.items_in
+            << std::setw(14) << s.items_out
+            << std::setw(10) << (s.batches ? s.items_in / s.batches : 0)
+            << std::setw(10) << s.busy_nsec / 1000000
+            << std::setw(10) << s.stall_nsec / 1000000
+            << std::setw(8) << s.errors
+            << std::setw(7) << s.queue_depth << '/'
+            << std::setw(6) << std::left << s.queue_capacity << std::right
+            << "  " << s.name << std::endl;
+    }
+}
+
+void
+k2::pipeline::add_channel (nonpublic::pipeline_channel_base* pchannel)
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    try
+    {
+        m_pimpl->m_channels.push_back(pchannel);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+void
+k2::pipeline::add_input (nonpublic::pipeline_channel_base* pchannel)
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    if (m_pimpl->m_closed)
+    {
+        pchannel->remove_producer();
+        return;
+    }
+    try
+    {
+        m_pimpl->m_inputs.push_back(pchannel);
+    }
+    catch (std::bad_alloc& x)
+    {
+        pchannel->remove_producer();
+        throw   bad_resource_alloc(x.what());
+    }
+}
+void
+k2::pipeline::add_stage (
+    std::auto_ptr<nonpublic::pipeline_stage_base>& pstage, size_t workers)
+{
+    if (workers == 0)
+        workers = 1;
+
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    try
+    {
+        pstage->m_counters.resize(workers);
+        m_pimpl->m_stages.reserve(m_pimpl->m_stages.size() + 1);
+        m_pimpl->m_threads.reserve(m_pimpl->m_threads.size() + workers);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+    nonpublic::pipeline_stage_base* p = pstage.release();
+    m_pimpl->m_stages.push_back(p);
+
+    //  All producers count before any worker may exit, so the output
+    //  is not closed early.
+    size_t  idx = 0;
+    for (; idx < workers; ++idx)
+        p->add_producer();
+    for (idx = 0; idx < workers; ++idx)
+    {
+        try
+        {
+            nonpublic::pipeline_impl::worker_entry  entry = { p, idx };
+            m_pimpl->m_threads.push_back(new thread(entry));
+        }
+        catch (...)
+        {
+            for (; idx < workers; ++idx)
+                p->remove_producer();
+            throw   bad_resource_alloc();
+        }
+    }
+}
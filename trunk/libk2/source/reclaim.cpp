@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/reclaim.h>
+
+#include <k2/tls_ptr.h>
+#include <k2/exception.h>
+#include <k2/opt.h>
+#include <source/pthread_util.inl>
+
+#include <algorithm>
+#include <vector>
+#include <memory>
+
+namespace   //  unnamed
+{
+    typedef std::vector<k2::nonpublic::retired_node>    retired_list;
+
+    void reclaim_all (retired_list& list)
+    {
+        //  Reclaiming may retire more nodes to list.
+        retired_list    pending;
+        pending.swap(list);
+
+        retired_list::iterator  it = pending.begin();
+        for (; it != pending.end(); ++it)
+            it->reclaim(it->p);
+    }
+
+    //  Acquires a registration record of type RecordT for calling thread,
+    //  records are never freed but reused after their owners exit.
+    template <typename RecordT>
+    RecordT* acquire_record (RecordT* volatile& head)
+    {
+        RecordT*    p = k2::atomic_load(head);
+        for (; p; p = p->pnext)
+        {
+            if (k2::atomic_load(p->in_use) == 0 &&
+                k2::atomic_cas(p->in_use, 0, 1))
+            {
+                return  p;
+            }
+        }
+
+        std::auto_ptr<RecordT>  precord;
+        try
+        {
+            precord.reset(new RecordT);
+        }
+        catch (std::bad_alloc& x)
+        {
+            throw   k2::bad_resource_alloc(x.what());
+        }
+
+        RecordT*    old_head;
+        do
+        {
+            old_head = k2::atomic_load(head);
+            precord->pnext = old_head;
+        }
+        while (k2::atomic_cas(head, old_head, precord.get()) == false);
+
+        return  precord.release();
+    }
+
+    //  Binds a record to the thread-specific data of calling thread,
+    //  ReleaseF is invoked with the record when calling thread exits.
+    template <typename RecordT, void (*ReleaseF)(RecordT&)>
+    struct record_binding
+    {
+        RecordT&    m_record;
+
+        explicit record_binding (RecordT& record)
+        :   m_record(record)
+        {
+        }
+        ~record_binding ()
+        {
+            ReleaseF(m_record);
+        }
+
+        static RecordT& get (RecordT* volatile& head)
+        {
+            typedef k2::static_tls_ptr<record_binding>  tls_type;
+
+            record_binding* pbinding = tls_type::get();
+            if (K2_OPT_BRANCH_FALSE(pbinding == 0))
+            {
+                std::auto_ptr<record_binding>   guard(
+                    new record_binding(*acquire_record(head)));
+                tls_type::reset(guard.get());
+                pbinding = guard.release();
+            }
+            return  pbinding->m_record;
+        }
+    };
+
+}   //  unnamed namespace
+
+
+struct k2::nonpublic::hazard_record
+{
+    void* volatile  slots[hazard_guard::max_per_thread];
+    atomic_int_t    in_use;
+    hazard_record*  pnext;
+
+    //  Members only accessed by the owner thread.
+    unsigned        used_mask;
+    retired_list    retired;
+
+    hazard_record ()
+    :   in_use(1)
+    ,   pnext(0)
+    ,   used_mask(0)
+    {
+        std::fill(slots, slots + hazard_guard::max_per_thread,
+            static_cast<void*>(0));
+        atomic_add(hazard_record::s_cnt, 1);
+    }
+
+    static atomic_long_t    s_cnt;
+};
+
+namespace   //  unnamed
+{
+    using k2::nonpublic::hazard_record;
+
+    hazard_record* volatile hazard_head = 0;
+    pthread_mutex_t         hazard_orphans_mtx = PTHREAD_MUTEX_INITIALIZER;
+    retired_list*           hazard_orphans = 0;
+
+    void hazard_scan (hazard_record& record)
+    {
+        {
+            k2::ptmtx_guard guard(hazard_orphans_mtx);
+            if (hazard_orphans)
+            {
+                record.retired.insert(record.retired.end(),
+                    hazard_orphans->begin(), hazard_orphans->end());
+                hazard_orphans->clear();
+            }
+        }
+
+        std::vector<void*>  hazards;
+        hazards.reserve(size_t(k2::atomic_load(hazard_record::s_cnt)) *
+            k2::hazard_guard::max_per_thread);
+
+        //  Pairs with the barrier in hazard_guard::protect(), nodes
+        //  retired before this point are no longer reachable.
+        k2::memory_barrier();
+
+        hazard_record*  p = k2::atomic_load(hazard_head);
+        for (; p; p = p->pnext)
+        {
+            size_t  idx = 0;
+            for (; idx < k2::hazard_guard::max_per_thread; ++idx)
+            {
+                void*   hazard = k2::atomic_load(p->slots[idx]);
+                if (hazard)
+                    hazards.push_back(hazard);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        retired_list    pending;
+        pending.swap(record.retired);
+
+        retired_list::iterator  it = pending.begin();
+        for (; it != pending.end(); ++it)
+        {
+            if (std::binary_search(hazards.begin(), hazards.end(), it->p))
+                record.retired.push_back(*it);
+            else
+                it->reclaim(it->p);
+        }
+    }
+
+    void hazard_release (hazard_record& record)
+    {
+        hazard_scan(record);
+
+        if (record.retired.empty() == false)
+        {
+            k2::ptmtx_guard guard(hazard_orphans_mtx);
+            if (hazard_orphans == 0)
+                hazard_orphans = new retired_list;
+            hazard_orphans->insert(hazard_orphans->end(),
+                record.retired.begin(), record.retired.end());
+        }
+        retired_list().swap(record.retired);
+
+        record.used_mask = 0;
+        k2::atomic_store(record.in_use, 0);
+    }
+
+    typedef record_binding<hazard_record, hazard_release>   hazard_binding;
+
+}   //  unnamed namespace
+
+//  static
+k2::atomic_long_t   k2::nonpublic::hazard_record::s_cnt = 0;
+
+k2::hazard_guard::hazard_guard ()
+:   m_precord(&hazard_binding::get(hazard_head))
+{
+    size_t  idx = 0;
+    for (; idx < max_per_thread; ++idx)
+    {
+        if ((m_precord->used_mask & (1u << idx)) == 0)
+            break;
+    }
+    if (idx == max_per_thread)
+        throw   bad_resource_alloc("k2::hazard_guard, out of slots");
+
+    m_precord->used_mask |= (1u << idx);
+    m_pslot = &m_precord->slots[idx];
+}
+k2::hazard_guard::~hazard_guard ()
+{
+    this->reset();
+    m_precord->used_mask &=
+        ~(1u << unsigned(m_pslot - m_precord->slots));
+}
+//  static
+void
+k2::hazard_reclaimer::retire (void* p, void (*reclaim)(void*))
+{
+    hazard_record&  record = hazard_binding::get(hazard_head);
+
+    nonpublic::retired_node node = {p, reclaim};
+    record.retired.push_back(node);
+
+    size_t  threshold = 2 * hazard_guard::max_per_thread *
+        size_t(atomic_load(hazard_record::s_cnt));
+    if (record.retired.size() >= threshold)
+        hazard_scan(record);
+}
+//  static
+void
+k2::hazard_reclaimer::collect ()
+{
+    hazard_scan(hazard_binding::get(hazard_head));
+}
+
+
+struct k2::nonpublic::epoch_record
+{
+    static const size_t bins = 3;
+
+    //  (epoch << 1 | 1) inside critical sections, 0 otherwise.
+    atomic_long_t   state;
+    atomic_int_t    in_use;
+    epoch_record*   pnext;
+
+    //  Members only accessed by the owner thread.
+    size_t          nesting;
+    size_t          retired_cnt;
+    unsigned long   bin_epoch[bins];
+    retired_list    bin[bins];
+
+    epoch_record ()
+    :   state(0)
+    ,   in_use(1)
+    ,   pnext(0)
+    ,   nesting(0)
+    ,   retired_cnt(0)
+    {
+        std::fill(bin_epoch, bin_epoch + bins, 0ul);
+    }
+};
+
+namespace   //  unnamed
+{
+    using k2::nonpublic::epoch_record;
+
+    //  Number of retired nodes between attempts to advance the epoch.
+    const size_t            epoch_advance_interval = 64;
+    const unsigned long     epoch_mask = ~0ul >> 1;
+
+    k2::atomic_long_t       epoch_global = 0;
+    epoch_record* volatile  epoch_head = 0;
+
+    struct epoch_orphan
+    {
+        unsigned long               epoch;
+        k2::nonpublic::retired_node node;
+    };
+    pthread_mutex_t             epoch_orphans_mtx = PTHREAD_MUTEX_INITIALIZER;
+    std::vector<epoch_orphan>*  epoch_orphans = 0;
+
+    unsigned long epoch_now ()
+    {
+        return  (unsigned long)(k2::atomic_load(epoch_global));
+    }
+    //  Nodes retired at epoch \a then are unreachable at epoch \a now.
+    bool epoch_expired (unsigned long then, unsigned long now)
+    {
+        return  now - then >= 2;
+    }
+
+    bool epoch_try_advance ()
+    {
+        unsigned long   now = epoch_now();
+        long            announce = long(((now & epoch_mask) << 1) | 1);
+
+        epoch_record*   p = k2::atomic_load(epoch_head);
+        for (; p; p = p->pnext)
+        {
+            long    state = k2::atomic_load(p->state);
+            if (state != 0 && state != announce)
+                return  false;
+        }
+        return  k2::atomic_cas(epoch_global, long(now), long(now + 1));
+    }
+
+    void epoch_reclaim_expired (epoch_record& record, unsigned long now)
+    {
+        size_t  idx = 0;
+        for (; idx < epoch_record::bins; ++idx)
+        {
+            if (record.bin[idx].empty() == false &&
+                epoch_expired(record.bin_epoch[idx], now))
+            {
+                reclaim_all(record.bin[idx]);
+            }
+        }
+
+        std::vector<epoch_orphan>   expired;
+        {
+            k2::ptmtx_guard guard(epoch_orphans_mtx);
+            if (epoch_orphans == 0 || epoch_orphans->empty())
+                return;
+
+            std::vector<epoch_orphan>   remains;
+            std::vector<epoch_orphan>::iterator it = epoch_orphans->begin();
+            for (; it != epoch_orphans->end(); ++it)
+            {
+                if (epoch_expired(it->epoch, now))
+                    expired.push_back(*it);
+                else
+                    remains.push_back(*it);
+            }
+            epoch_orphans->swap(remains);
+        }
+
+        std::vector<epoch_orphan>::iterator it = expired.begin();
+        for (; it != expired.end(); ++it)
+            it->node.reclaim(it->node.p);
+    }
+
+    void epoch_release (epoch_record& record)
+    {
+        epoch_try_advance();
+        epoch_reclaim_expired(record, epoch_now());
+
+        size_t  idx = 0;
+        for (; idx < epoch_record::bins; ++idx)
+        {
+            if (record.bin[idx].empty())
+                continue;
+
+            k2::ptmtx_guard guard(epoch_orphans_mtx);
+            if (epoch_orphans == 0)
+                epoch_orphans = new std::vector<epoch_orphan>;
+
+            retired_list::iterator  it = record.bin[idx].begin();
+            for (; it != record.bin[idx].end(); ++it)
+            {
+                epoch_orphan    orphan = {record.bin_epoch[idx], *it};
+                epoch_orphans->push_back(orphan);
+            }
+            retired_list().swap(record.bin[idx]);
+        }
+
+        record.nesting = 0;
+        record.retired_cnt = 0;
+        k2::atomic_store(record.state, 0l);
+        k2::atomic_store(record.in_use, 0);
+    }
+
+    typedef record_binding<epoch_record, epoch_release> epoch_binding;
+
+}   //  unnamed namespace
+
+k2::epoch_guard::epoch_guard ()
+:   m_precord(&epoch_binding::get(epoch_head))
+{
+    if (m_precord->nesting++ != 0)
+        return;
+
+    //  Announces the epoch, then makes sure it's still current, otherwise
+    //  nodes retired before the announcement might already be reclaimed.
+    unsigned long   now = epoch_now();
+    for (;;)
+    {
+        atomic_store(m_precord->state, long(((now & epoch_mask) << 1) | 1));
+        memory_barrier();
+
+        unsigned long   validated = epoch_now();
+        if (validated == now)
+            break;
+        now = validated;
+    }
+}
+k2::epoch_guard::~epoch_guard ()
+{
+    if (--m_precord->nesting == 0)
+        atomic_store(m_precord->state, 0l);
+}
+//  static
+void
+k2::epoch_reclaimer::retire (void* p, void (*reclaim)(void*))
+{
+    epoch_record&   record = epoch_binding::get(epoch_head);
+    unsigned long   now = epoch_now();
+    size_t          idx = now % epoch_record::bins;
+
+    if (record.bin_epoch[idx] != now)
+    {
+        //  Bin idx holds nodes retired three or more epochs ago.
+        reclaim_all(record.bin[idx]);
+        record.bin_epoch[idx] = now;
+    }
+
+    nonpublic::retired_node node = {p, reclaim};
+    record.bin[idx].push_back(node);
+
+    if (++record.retired_cnt >= epoch_advance_interval)
+    {
+        record.retired_cnt = 0;
+        epoch_try_advance();
+        epoch_reclaim_expired(record, epoch_now());
+    }
+}
+//  static
+void
+k2::epoch_reclaimer::collect ()
+{
+    epoch_record&   record = epoch_binding::get(epoch_head);
+
+    epoch_try_advance();
+    epoch_reclaim_expired(record, epoch_now());
+}
@@ -144,17 +144,15 @@ namespace
 
     struct atexit_task
     {
-        void            (*routine)(void*);
-        void*           arg;
+        k2::inplace_function<void ()>   routine;
         int             prio;
         atexit_task*    pnext;
 
-        atexit_task (void (*routine)(void*), void* arg, int prio)
-        :   routine(routine)
-        ,   arg(arg)
-        ,   prio(prio)
+        atexit_task (k2::inplace_function<void ()>& routine, int prio)
+        :   prio(prio)
         ,   pnext(0)
         {
+            this->routine.swap(routine);
         }
 
         static void exec ()
@@ -165,9 +163,9 @@ namespace
 
     struct atexit_stack
     {
-        static void push (void (*routine)(void*), void* arg, int prio)
+        static void push (k2::inplace_function<void ()>& routine, int prio)
         {
-            atexit_task*    ptask = new atexit_task(routine, arg, prio);
+            atexit_task*    ptask = new atexit_task(routine, prio);
 
             if (pstack == 0 || pstack && prio >= pstack->prio)
             {
@@ -197,7 +195,7 @@ namespace
             while (pstack)
             {
                 atexit_task* pnext = pstack->pnext;
-                pstack->routine(pstack->arg);
+                pstack->routine();
                 delete pstack;
                 pstack = pnext;
             }
@@ -218,11 +216,11 @@ namespace
 
 //static
 void
-k2::runtime::atexit_impl (void (*routine)(void*), void* arg, prio_t prio)
+k2::runtime::atexit_impl (inplace_function<void ()>& routine, prio_t prio)
 {
     spin_lock::scoped_guard guard(atexit_stack::lock);
 
-    atexit_stack::push(routine, arg, prio);
+    atexit_stack::push(routine, prio);
 
     if (atexit_stack::exec_registered == false && runtime::is_dl() == false)
         std::atexit(atexit_stack::exec);
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/sharded_counter.h>
+
+#include <k2/tls_ptr.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#endif
+#if !defined(WIN32)
+#   include <unistd.h>
+#else
+#   include <windows.h>
+#endif
+
+#include <memory>
+
+namespace   //  unnamed
+{
+    inline size_t os_cpu_count ()
+#if !defined(WIN32)
+    {
+        long    cnt = sysconf(_SC_NPROCESSORS_CONF);
+        return  cnt > 0 ? size_t(cnt) : 1;
+    }
+#else
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return  info.dwNumberOfProcessors > 0 ?
+            size_t(info.dwNumberOfProcessors) : 1;
+    }
+#endif
+
+    //  Slot assigned to a thread on first use, round-robin.
+    struct thread_shard
+    {
+        size_t  m_idx;
+
+        thread_shard ()
+        {
+            static k2::atomic_long_t    s_next = 0;
+            m_idx = size_t(k2::atomic_add(s_next, 1L) - 1);
+        }
+
+        static size_t get ()
+        {
+            typedef k2::static_tls_ptr<thread_shard>    tls_type;
+
+            thread_shard*   pshard = tls_type::get();
+            if (K2_OPT_BRANCH_FALSE(pshard == 0))
+            {
+                std::auto_ptr<thread_shard> guard(new thread_shard);
+                tls_type::reset(guard.get());
+                pshard = guard.release();
+            }
+            return  pshard->m_idx;
+        }
+    };
+
+}   //  unnamed namespace
+
+//  static
+size_t
+k2::sharded_counter::shard_hint ()
+{
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (K2_OPT_BRANCH_TRUE(cpu >= 0))
+        return  size_t(cpu);
+#endif
+    return  thread_shard::get();
+}
+//  static
+size_t
+k2::sharded_counter::cpu_count ()
+{
+    static const size_t s_cnt = os_cpu_count();
+    return  s_cnt;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/small_alloc.h>
+
+#include <k2/mutex.h>
+#include <k2/singleton.h>
+#include <k2/tls_ptr.h>
+#include <k2/exception.h>
+#include <k2/opt.h>
+
+#include <vector>
+#include <memory>
+
+namespace   //  unnamed
+{
+    //  Size classes of 64, 128, 256 and 512 bytes; threads trade free
+    //  nodes with the depot a magazine at a time.
+    const size_t    class_cnt = 4;
+    const size_t    class_shift = 6;
+    const size_t    magazine = 32;
+
+    inline size_t size_class (size_t bytes)
+    {
+        size_t  idx = 0;
+        for (; idx < class_cnt; ++idx)
+        {
+            if (bytes <= (size_t(1) << (class_shift + idx)))
+                break;
+        }
+        return  idx;
+    }
+
+    struct free_node
+    {
+        free_node*  m_pnext;
+    };
+
+    //  Shared free lists, and the slabs they are carved from; slabs are
+    //  freed with the depot only.
+    struct small_depot
+    {
+        k2::mutex                   m_mtx;
+        std::vector<free_node*>     m_lists[class_cnt];
+        std::vector<char*>          m_slabs;
+
+        ~small_depot ()
+        {
+            std::vector<char*>::iterator    it = m_slabs.begin();
+            for (; it != m_slabs.end(); ++it)
+                delete [] *it;
+        }
+
+        free_node* get (size_t idx)
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+
+            if (m_lists[idx].empty() == false)
+            {
+                free_node*  plist = m_lists[idx].back();
+                m_lists[idx].pop_back();
+                return  plist;
+            }
+
+            const size_t    bytes = size_t(1) << (class_shift + idx);
+            m_slabs.reserve(m_slabs.size() + 1);
+            char*   pslab = new char[bytes * magazine];
+            m_slabs.push_back(pslab);
+
+            free_node*  plist = 0;
+            size_t  cnt = magazine;
+            while (cnt--)
+            {
+                free_node*  pnode = reinterpret_cast<free_node*>(pslab + cnt * bytes);
+                pnode->m_pnext = plist;
+                plist = pnode;
+            }
+            return  plist;
+        }
+        void put (size_t idx, free_node* plist)
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            m_lists[idx].push_back(plist);
+        }
+    };
+
+    typedef k2::singleton<
+        small_depot, void, k2::singleton_base::lifetime_long
+    >   depot_singleton;
+
+    struct small_cache
+    {
+        small_depot&  m_depot;
+        free_node*      m_plists[class_cnt];
+        size_t          m_cnts[class_cnt];
+
+        small_cache ()
+        :   m_depot(depot_singleton::instance())
+        {
+            size_t  idx = 0;
+            for (; idx < class_cnt; ++idx)
+            {
+                m_plists[idx] = 0;
+                m_cnts[idx] = 0;
+            }
+        }
+        ~small_cache ()
+        {
+            size_t  idx = 0;
+            for (; idx < class_cnt; ++idx)
+            {
+                if (m_plists[idx])
+                    m_depot.put(idx, m_plists[idx]);
+            }
+        }
+
+        void* alloc (size_t idx)
+        {
+            if (K2_OPT_BRANCH_FALSE(m_plists[idx] == 0))
+            {
+                m_plists[idx] = m_depot.get(idx);
+                m_cnts[idx] = magazine;
+            }
+            free_node*  pnode = m_plists[idx];
+            m_plists[idx] = pnode->m_pnext;
+            --m_cnts[idx];
+            return  pnode;
+        }
+        void free (size_t idx, void* p)
+        {
+            free_node*  pnode = static_cast<free_node*>(p);
+            pnode->m_pnext = m_plists[idx];
+            m_plists[idx] = pnode;
+
+            //  Keeps a magazine, gives the next back.
+            if (K2_OPT_BRANCH_FALSE(++m_cnts[idx] == 2 * magazine))
+            {
+                free_node*  plast = pnode;
+                size_t  cnt = magazine;
+                while (--cnt)
+                    plast = plast->m_pnext;
+                m_plists[idx] = plast->m_pnext;
+                plast->m_pnext = 0;
+                m_cnts[idx] = magazine;
+                try
+                {
+                    m_depot.put(idx, pnode);
+                }
+                catch (...)
+                {
+                    //  Leaks the magazine rather than failing a free.
+                }
+            }
+        }
+
+        static small_cache& get ()
+        {
+            typedef k2::static_tls_ptr<small_cache, small_cache>    tls_type;
+
+            small_cache*  pcache = tls_type::get();
+            if (K2_OPT_BRANCH_FALSE(pcache == 0))
+            {
+                std::auto_ptr<small_cache>    guard(new small_cache);
+                tls_type::reset(guard.get());
+                pcache = guard.release();
+            }
+            return  *pcache;
+        }
+    };
+}   //  unnamed namespace
+
+void*
+k2::nonpublic::small_alloc (size_t bytes)
+{
+    size_t  idx = size_class(bytes);
+    try
+    {
+        if (idx == class_cnt)
+            return  ::operator new(bytes);
+        return  small_cache::get().alloc(idx);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+void
+k2::nonpublic::small_free (void* p, size_t bytes) throw ()
+{
+    size_t  idx = size_class(bytes);
+    if (idx == class_cnt)
+    {
+        ::operator delete(p);
+        return;
+    }
+
+    try
+    {
+        small_cache::get().free(idx, p);
+    }
+    catch (...)
+    {
+        //  No cache for this thread, leaks the node.
+    }
+}
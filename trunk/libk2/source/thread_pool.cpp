@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread_pool.h>
+
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/semaphore.h>
+#include <k2/mpmc_queue.h>
+#include <k2/atomic.h>
+#include <k2/tls_ptr.h>
+#include <k2/opt.h>
+
+#include <vector>
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::pool_task    pool_task;
+
+    //  Chase-Lev work-stealing deque. The owner pushes and pops at the
+    //  bottom, thieves steal from the top. Outgrown rings are kept until
+    //  destruction, as thieves may still be reading them.
+    class ws_deque
+    {
+    public:
+        K2_INJECT_COPY_BOUNCER();
+
+        ws_deque ()
+        :   m_top(0)
+        ,   m_bottom(0)
+        ,   m_pring(new ring(256, 0))
+        {
+        }
+        ~ws_deque ()
+        {
+            ring*   pring = m_pring;
+            while (pring)
+            {
+                ring*   pprev = pring->m_pprev;
+                delete  pring;
+                pring = pprev;
+            }
+        }
+
+        //  Called by the owner only.
+        void push (pool_task* ptask)
+        {
+            long    bottom = m_bottom;
+            long    top = k2::atomic_load(m_top);
+            ring*   pring = m_pring;
+            if (bottom - top > pring->m_mask)
+            {
+                pring = pring->grow(top, bottom);
+                k2::atomic_store(m_pring, pring);
+            }
+            pring->put(bottom, ptask);
+            k2::atomic_store(m_bottom, bottom + 1);
+        }
+        //  Called by the owner only.
+        pool_task* pop ()
+        {
+            long    bottom = m_bottom - 1;
+            ring*   pring = m_pring;
+            k2::atomic_store(m_bottom, bottom);
+            //  Orders publishing bottom before reading top, see steal().
+            k2::memory_barrier();
+            long    top = k2::atomic_load(m_top);
+
+            if (top > bottom)
+            {
+                k2::atomic_store(m_bottom, bottom + 1);
+                return  0;
+            }
+
+            pool_task*  ptask = pring->get(bottom);
+            if (top == bottom)
+            {
+                //  The last task, races with thieves.
+                if (k2::atomic_cas(m_top, top, top + 1) == false)
+                    ptask = 0;
+                k2::atomic_store(m_bottom, bottom + 1);
+            }
+            return  ptask;
+        }
+        pool_task* steal ()
+        {
+            long    top = k2::atomic_load(m_top);
+            k2::memory_barrier();
+            long    bottom = k2::atomic_load(m_bottom);
+            if (top >= bottom)
+                return  0;
+
+            ring*       pring = k2::atomic_load(m_pring);
+            pool_task*  ptask = pring->get(top);
+            if (k2::atomic_cas(m_top, top, top + 1) == false)
+                return  0;
+            return  ptask;
+        }
+        bool empty () const
+        {
+            return  k2::atomic_load(m_bottom) - k2::atomic_load(m_top) <= 0;
+        }
+
+    private:
+        struct ring
+        {
+            const long              m_mask;
+            pool_task* volatile*    m_pslots;
+            ring*                   m_pprev;
+
+            ring (long size, ring* pprev)
+            :   m_mask(size - 1)
+            ,   m_pslots(new pool_task* volatile[size])
+            ,   m_pprev(pprev)
+            {
+            }
+            ~ring ()
+            {
+                delete [] m_pslots;
+            }
+            pool_task* get (long idx) const
+            {
+                return  k2::atomic_load(m_pslots[idx & m_mask]);
+            }
+            void put (long idx, pool_task* ptask)
+            {
+                k2::atomic_store(m_pslots[idx & m_mask], ptask);
+            }
+            ring* grow (long top, long bottom)
+            {
+                ring*   pnew = new ring((m_mask + 1) * 2, this);
+                for (; top < bottom; ++top)
+                    pnew->put(top, this->get(top));
+                return  pnew;
+            }
+        };
+
+        char                m_pad0[K2_OPT_CACHE_LINE_BYTES];
+        //  Written by thieves.
+        k2::atomic_long_t   m_top;
+        char                m_pad1[K2_OPT_CACHE_LINE_BYTES];
+        //  Written by the owner.
+        k2::atomic_long_t   m_bottom;
+        ring* volatile      m_pring;
+        char                m_pad2[K2_OPT_CACHE_LINE_BYTES];
+    };
+
+    struct pool_worker
+    {
+        size_t      m_idx;
+        k2::uint32_t    m_random;
+        ws_deque    m_deque;
+
+        explicit pool_worker (size_t idx)
+        :   m_idx(idx)
+        ,   m_random(k2::uint32_t(idx) * 2654435761U + 1)
+        {
+        }
+        size_t next_victim (size_t worker_cnt)
+        {
+            //  xorshift
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 17;
+            m_random ^= m_random << 5;
+            return  m_random % worker_cnt;
+        }
+    };
+
+    //  Identifies the pool and worker of calling thread.
+    struct worker_binding
+    {
+        k2::nonpublic::thread_pool_impl*    m_ppool;
+        pool_worker*                        m_pworker;
+    };
+
+    typedef k2::static_tls_ptr<worker_binding>  tls_binding_ptr;
+
+    tls_binding_ptr get_tls_binding ()
+    {
+        return  tls_binding_ptr();
+    }
+
+}   //  unnamed namespace
+
+
+struct k2::nonpublic::thread_pool_impl
+{
+    enum stopping_enum
+    {
+        running,
+        shutting_down,
+        cancelled
+    };
+
+    std::vector<pool_worker*>   m_workers;
+    std::vector<thread*>        m_threads;
+    mpmc_queue<pool_task*>      m_injection;
+    semaphore                   m_wakeup;
+    atomic_int_t                m_sleepers;
+    atomic_int_t                m_submitters;
+    atomic_int_t                m_stopping;
+    mutex                       m_stop_mtx;
+
+    thread_pool_impl (size_t thread_cnt, size_t inject_capacity)
+    :   m_injection(inject_capacity)
+    ,   m_sleepers(0)
+    ,   m_submitters(0)
+    ,   m_stopping(running)
+    {
+        m_workers.reserve(thread_cnt);
+        m_threads.reserve(thread_cnt);
+
+        size_t  idx = 0;
+        for (; idx < thread_cnt; ++idx)
+            m_workers.push_back(new pool_worker(idx));
+    }
+    ~thread_pool_impl ()
+    {
+        size_t  idx = 0;
+        for (; idx < m_workers.size(); ++idx)
+            delete  m_workers[idx];
+    }
+
+    struct worker_entry
+    {
+        thread_pool_impl*   m_ppool;
+        pool_worker*        m_pworker;
+
+        void operator() () const
+        {
+            worker_binding* pbinding = new worker_binding;
+            pbinding->m_ppool = m_ppool;
+            pbinding->m_pworker = m_pworker;
+            get_tls_binding().reset(pbinding);
+
+            //  Unbinds on exit, cancel_signal included.
+            struct unbind
+            {
+                ~unbind ()
+                {
+                    get_tls_binding().reset();
+                }
+            }   guard;
+
+            m_ppool->work(*m_pworker);
+        }
+    };
+
+    void start ()
+    {
+        size_t  idx = 0;
+        for (; idx < m_workers.size(); ++idx)
+        {
+            worker_entry    entry = { this, m_workers[idx] };
+            m_threads.push_back(0);
+            m_threads.back() = new thread(entry);
+        }
+    }
+
+    pool_worker* worker_of_thread ()
+    {
+        worker_binding* pbinding = get_tls_binding().get();
+        if (pbinding && pbinding->m_ppool == this)
+            return  pbinding->m_pworker;
+        return  0;
+    }
+
+    //  Local deque first, then injected tasks, then steals from random
+    //  victims.
+    pool_task* find_task (pool_worker* pself)
+    {
+        pool_task*  ptask = 0;
+        if (pself && (ptask = pself->m_deque.pop()) != 0)
+            return  ptask;
+        if (m_injection.try_pop(ptask))
+            return  ptask;
+
+        size_t  worker_cnt = m_workers.size();
+        size_t  tries = 0;
+        size_t  victim = pself ? pself->m_idx : 0;
+        for (; tries < worker_cnt * 2; ++tries)
+        {
+            victim = pself ? pself->next_victim(worker_cnt) : (victim + 1) % worker_cnt;
+            if (m_workers[victim] == pself)
+                continue;
+            if ((ptask = m_workers[victim]->m_deque.steal()) != 0)
+                return  ptask;
+        }
+        return  0;
+    }
+    bool has_task () const
+    {
+        if (m_injection.empty() == false)
+            return  true;
+
+        size_t  idx = 0;
+        for (; idx < m_workers.size(); ++idx)
+        {
+            if (m_workers[idx]->m_deque.empty() == false)
+                return  true;
+        }
+        return  false;
+    }
+    static void run (pool_task* ptask)
+    {
+        try
+        {
+            pool_task::run(ptask);
+        }
+        catch (thread::cancel_signal&)
+        {
+            throw;
+        }
+        catch (...)
+        {
+            //  Absorbs, the task is deleted by run().
+        }
+    }
+
+    void work (pool_worker& self)
+    {
+        for (;;)
+        {
+            thread::test_cancel();
+
+            pool_task*  ptask = this->find_task(&self);
+            if (ptask)
+            {
+                thread_pool_impl::run(ptask);
+                continue;
+            }
+
+            if (atomic_load(m_stopping) != running)
+            {
+                if (this->has_task())
+                    continue;
+                return;
+            }
+            this->park();
+        }
+    }
+
+    void park ()
+    {
+        //  Announces before re-checking, see wake_one().
+        atomic_add(m_sleepers, 1);
+        if (this->has_task() || atomic_load(m_stopping) != running)
+        {
+            this->cancel_sleep();
+            return;
+        }
+        m_wakeup.acquire();
+    }
+    void cancel_sleep ()
+    {
+        for (;;)
+        {
+            int sleepers = atomic_load(m_sleepers);
+            if (sleepers <= 0)
+            {
+                //  A waker has counted calling thread out, and released,
+                //  or is releasing, the semaphore for it.
+                m_wakeup.acquire();
+                return;
+            }
+            if (atomic_cas(m_sleepers, sleepers, sleepers - 1))
+                return;
+        }
+    }
+    void wake_one ()
+    {
+        //  Orders publishing the task before reading sleepers.
+        memory_barrier();
+        for (;;)
+        {
+            int sleepers = atomic_load(m_sleepers);
+            if (K2_OPT_BRANCH_TRUE(sleepers <= 0))
+                return;
+            if (atomic_cas(m_sleepers, sleepers, sleepers - 1))
+            {
+                m_wakeup.release();
+                return;
+            }
+        }
+    }
+    void wake_all ()
+    {
+        int sleepers = atomic_exchange(m_sleepers, 0);
+        if (sleepers > 0)
+            m_wakeup.release(sleepers);
+    }
+
+    bool submit (pool_task* ptask)
+    {
+        //  Announces before checking, see stop().
+        atomic_add(m_submitters, 1);
+        if (K2_OPT_BRANCH_FALSE(atomic_load(m_stopping) != running))
+        {
+            atomic_add(m_submitters, -1);
+            return  false;
+        }
+
+        {
+            //  Leaves on exit, std::bad_alloc from the deque included.
+            struct leave
+            {
+                atomic_int_t&   m_submitters;
+
+                ~leave ()
+                {
+                    atomic_add(m_submitters, -1);
+                }
+            }   guard = { m_submitters };
+
+            pool_worker*    pself = this->worker_of_thread();
+            try
+            {
+                if (pself)
+                    pself->m_deque.push(ptask);
+                else
+                    m_injection.push(ptask);
+            }
+            catch (std::bad_alloc& x)
+            {
+                throw   bad_resource_alloc(x.what());
+            }
+        }
+
+        this->wake_one();
+        return  true;
+    }
+
+    //  Rejects further submissions, waits for those in progress.
+    bool stop (stopping_enum how)
+    {
+        if (atomic_cas(m_stopping, running, how) == false)
+            return  false;
+        while (atomic_load(m_submitters) != 0)
+            thread::sched_yield();
+        return  true;
+    }
+    void join ()
+    {
+        size_t  idx = 0;
+        for (; idx < m_threads.size(); ++idx)
+            delete  m_threads[idx];
+        m_threads.clear();
+    }
+    //  Runs, or discards, tasks left after workers have exited.
+    void drain (bool run_tasks)
+    {
+        pool_task*  ptask = 0;
+        while ((ptask = this->find_task(0)) != 0)
+        {
+            if (run_tasks)
+                thread_pool_impl::run(ptask);
+            else
+                pool_task::discard(ptask);
+        }
+    }
+};
+
+
+k2::thread_pool::thread_pool (size_t thread_cnt, size_t inject_capacity)
+:   m_pimpl(0)
+{
+    std::auto_ptr<nonpublic::thread_pool_impl>  pimpl;
+    try
+    {
+        pimpl.reset(new nonpublic::thread_pool_impl(
+            thread_cnt ? thread_cnt : 1, inject_capacity));
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+
+    try
+    {
+        pimpl->start();
+    }
+    catch (...)
+    {
+        m_pimpl = pimpl.release();
+        this->cancel();
+        delete  m_pimpl;
+        throw   bad_resource_alloc();
+    }
+    m_pimpl = pimpl.release();
+}
+k2::thread_pool::~thread_pool ()
+{
+    this->shutdown();
+    delete  m_pimpl;
+}
+bool
+k2::thread_pool::submit_impl (nonpublic::pool_task* ptask)
+{
+    return  m_pimpl->submit(ptask);
+}
+bool
+k2::thread_pool::run_one ()
+{
+    pool_task*  ptask = m_pimpl->find_task(m_pimpl->worker_of_thread());
+    if (ptask == 0)
+        return  false;
+
+    nonpublic::thread_pool_impl::run(ptask);
+    return  true;
+}
+void
+k2::thread_pool::shutdown ()
+{
+    mutex::scoped_guard guard(m_pimpl->m_stop_mtx);
+    if (m_pimpl->stop(nonpublic::thread_pool_impl::shutting_down) == false)
+        return;
+
+    m_pimpl->wake_all();
+    m_pimpl->join();
+    m_pimpl->drain(true);
+}
+void
+k2::thread_pool::cancel ()
+{
+    mutex::scoped_guard guard(m_pimpl->m_stop_mtx);
+    if (m_pimpl->stop(nonpublic::thread_pool_impl::cancelled) == false)
+        return;
+
+    size_t  idx = 0;
+    for (; idx < m_pimpl->m_threads.size(); ++idx)
+    {
+        if (m_pimpl->m_threads[idx])
+            m_pimpl->m_threads[idx]->cancel();
+    }
+    m_pimpl->wake_all();
+    m_pimpl->join();
+    m_pimpl->drain(false);
+}
+bool
+k2::thread_pool::place (cpu_topology::policy_enum policy)
+{
+    mutex::scoped_guard guard(m_pimpl->m_stop_mtx);
+    std::vector<int>    cpus = cpu_topology::system().placement(
+        policy, m_pimpl->m_threads.size());
+    if (cpus.size() != m_pimpl->m_threads.size())
+        return  false;
+
+    bool    placed = true;
+    size_t  idx = 0;
+    for (; idx < cpus.size(); ++idx)
+    {
+        std::vector<int>    cpu(1, cpus[idx]);
+        if (m_pimpl->m_threads[idx]->set_affinity(cpu) == false)
+            placed = false;
+    }
+    return  placed;
+}
+size_t
+k2::thread_pool::size () const
+{
+    return  m_pimpl->m_workers.size();
+}
+bool
+k2::thread_pool::on_worker () const
+{
+    return  m_pimpl->worker_of_thread() != 0;
+}
@@ -32,12 +32,20 @@
 #include <k2/thread_once.h>
 #include <k2/mutex.h>
 #include <k2/cond_var.h>
+#include <k2/cancellation.h>
+#include <k2/semaphore.h>
+#include <k2/latch.h>
+#include <k2/barrier.h>
+#include <k2/event.h>
+#include <k2/futex.h>
 #include <k2/tls_ptr.h>
 #include <k2/singleton.h>
 #include <k2/timing.h>
 #include <k2/assert.h>
 #include <k2/errno.h>
 
+#include <vector>
+
 #if !defined(WIN32)
 #   include <unistd.h>  //  usleep
     namespace
@@ -60,6 +68,10 @@
 
 #include <pthread.h>
 #include <sched.h>
+#include <limits.h>
+#if !defined(WIN32)
+#   include <sys/mman.h>
+#endif
 namespace
 {
     inline void os_sched_yield ()
@@ -67,6 +79,86 @@ namespace
         sched_yield();
     }
 
+    //  Rounds a stack size up to whole pages, and to the system minimum.
+    size_t os_stack_size (size_t bytes)
+    {
+#if defined(PTHREAD_STACK_MIN)
+        if (bytes < size_t(PTHREAD_STACK_MIN))
+            bytes = size_t(PTHREAD_STACK_MIN);
+#endif
+#if !defined(WIN32)
+        size_t  page = size_t(sysconf(_SC_PAGESIZE));
+#else
+        size_t  page = 4096;
+#endif
+        return  (bytes + page - 1) / page * page;
+    }
+
+    //  Maps a stack with a guard page below it, returns its lowest
+    //  usable address, or 0 if stacks can not be given to threads.
+    void* os_map_stack (size_t bytes)
+#if !defined(WIN32)
+    {
+        size_t  guard = size_t(sysconf(_SC_PAGESIZE));
+        void*   base = mmap(0, guard + bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            throw   k2::bad_resource_alloc();
+        if (mprotect(base, guard, PROT_NONE) != 0)
+        {
+            munmap(base, guard + bytes);
+            throw   k2::bad_resource_alloc();
+        }
+        return  static_cast<char*>(base) + guard;
+    }
+#else
+    {
+        return  0;
+    }
+#endif
+    void os_unmap_stack (void* stack, size_t bytes)
+#if !defined(WIN32)
+    {
+        size_t  guard = size_t(sysconf(_SC_PAGESIZE));
+        munmap(static_cast<char*>(stack) - guard, guard + bytes);
+    }
+#else
+    {
+    }
+#endif
+
+    int os_sched_policy (k2::thread::spawn_options::sched_policy policy)
+    {
+        switch (policy)
+        {
+        case k2::thread::spawn_options::sched_fifo:
+            return  SCHED_FIFO;
+        case k2::thread::spawn_options::sched_rr:
+            return  SCHED_RR;
+        default:
+            return  SCHED_OTHER;
+        }
+    }
+
+    bool os_set_affinity (pthread_t handle, const std::vector<int>& cpus)
+#if defined(__linux__)
+    {
+        cpu_set_t   mask;
+        CPU_ZERO(&mask);
+        std::vector<int>::const_iterator    it = cpus.begin();
+        for (; it != cpus.end(); ++it)
+        {
+            if (*it >= 0 && *it < CPU_SETSIZE)
+                CPU_SET(*it, &mask);
+        }
+        return  pthread_setaffinity_np(handle, sizeof(mask), &mask) == 0;
+    }
+#else
+    {
+        return  false;
+    }
+#endif
+
     inline pthread_mutex_t&     get_impl (k2::mutex::handle& handle)
     {
         K2_STATIC_ASSERT(
@@ -103,19 +195,40 @@ k2::thread_once::run_impl (void (*once_routine)(void* arg), void* arg)
 {
     runtime_assert(once_routine != 0);
 
-    if (this->done == false)
+    for (;;)
     {
-        if (atomic_increase(this->started) == false)
+        int current = atomic_load(this->state);
+        switch (current)
         {
-            once_routine(arg);
-            this->done = true;
-        }
-        else
-        {
-            while (this->done == false)
-            {
-                os_sched_yield();
-            }
+            case state_done:
+                return;
+
+            case state_idle:
+                if (atomic_cas(this->state, state_idle, state_running) == false)
+                    break;
+                try
+                {
+                    once_routine(arg);
+                }
+                catch (...)
+                {
+                    //  Lets the next caller retry.
+                    if (atomic_exchange(this->state, state_idle) == state_contended)
+                        nonpublic::futex_wake_all(this->state);
+                    throw;
+                }
+                if (atomic_exchange(this->state, state_done) == state_contended)
+                    nonpublic::futex_wake_all(this->state);
+                return;
+
+            case state_running:
+                //  Tells the running thread somebody has to be woken.
+                if (atomic_cas(this->state, state_running, state_contended) == false)
+                    break;
+                //  Fall through.
+            default:
+                nonpublic::futex_wait(this->state, state_contended, 0);
+                break;
         }
     }
 }
@@ -162,6 +275,19 @@ k2::mutex::acquire (const timestamp& timer)
         }
     }
 }
+bool
+k2::mutex::try_acquire ()
+{
+    switch (pthread_mutex_trylock(&get_impl(m_handle)))
+    {
+        case 0:
+            return  true;
+        case EBUSY:
+            return  false;
+        default:
+            throw   thread_error();
+    }
+}
 void
 k2::mutex::release ()
 {
@@ -210,6 +336,58 @@ k2::cond_var::wait (const timestamp& timer)
         }
     }
 }
+namespace   //  unnamed
+{
+    struct cond_var_waker
+    {
+        k2::cond_var*   m_pcv;
+        k2::mutex*      m_pmtx;
+
+        //  Broadcasts under the mutex, so that it can not slip between
+        //  a waiter's test of the token and its wait.
+        static void wake (void* arg)
+        {
+            cond_var_waker* pwaker = static_cast<cond_var_waker*>(arg);
+            k2::mutex::scoped_guard guard(*pwaker->m_pmtx);
+            pwaker->m_pcv->broadcast();
+        }
+    };
+
+    //  Unregisters with the mutex held, unless the callback is running,
+    //  and waiting on the mutex.
+    void    release_registration (
+        k2::cancel_token::registration& reg, k2::mutex& mtx)
+    {
+        if (reg.try_release() == false)
+        {
+            mtx.release();
+            reg.release();
+            mtx.acquire();
+        }
+    }
+}   //  unnamed namespace
+
+bool
+k2::cond_var::wait (const cancel_token& token)
+{
+    cond_var_waker  waker = { this, &m_mtx };
+    cancel_token::registration  reg(token, cond_var_waker::wake, &waker);
+    if (token.cancelled() == false)
+        this->wait();
+    release_registration(reg, m_mtx);
+    return  token.cancelled() == false;
+}
+bool
+k2::cond_var::wait (const timestamp& timer, const cancel_token& token)
+{
+    cond_var_waker  waker = { this, &m_mtx };
+    cancel_token::registration  reg(token, cond_var_waker::wake, &waker);
+    bool    signalled = false;
+    if (token.cancelled() == false)
+        signalled = this->wait(timer);
+    release_registration(reg, m_mtx);
+    return  signalled && token.cancelled() == false;
+}
 void
 k2::cond_var::signal ()
 {
@@ -222,6 +400,115 @@ k2::cond_var::broadcast ()
     pthread_cond_broadcast(&get_impl(m_handle));
 }
 
+bool
+k2::semaphore::acquire_slow (const timestamp* ptimer)
+{
+    for (;;)
+    {
+        //  Announces before re-checking, see release().
+        atomic_add(m_waiters, 1);
+        int     count = atomic_load(m_count);
+        bool    signalled = true;
+        if (count <= 0)
+            signalled = nonpublic::futex_wait(m_count, count, ptimer);
+        atomic_add(m_waiters, -1);
+
+        if (this->try_acquire())
+            return  true;
+        if (signalled == false)
+            return  false;
+    }
+}
+
+bool
+k2::latch::wait_slow (const timestamp* ptimer)
+{
+    for (;;)
+    {
+        //  Announces before re-checking, see count_down().
+        atomic_add(m_waiters, 1);
+        int     count = atomic_load(m_count);
+        bool    signalled = true;
+        if (count > 0)
+            signalled = nonpublic::futex_wait(m_count, count, ptimer);
+        atomic_add(m_waiters, -1);
+
+        if (this->try_wait())
+            return  true;
+        if (signalled == false)
+            return  false;
+    }
+}
+
+int
+k2::barrier::arrive_and_wait_impl (const timestamp* ptimer)
+{
+    unsigned    phase = 0;
+    for (;;)
+    {
+        int state = atomic_load(m_state);
+        phase = unsigned(state) >> 16;
+        if ((state & 0xffff) + 1 == m_parties)
+        {
+            //  Starts the next phase, with no thread arrived.
+            if (atomic_cas(m_state, state, int((phase + 1) << 16)) == false)
+                continue;
+            if (atomic_load(m_waiters) != 0)
+                nonpublic::futex_wake_all(m_state);
+            return  1;
+        }
+        if (atomic_cas(m_state, state, state + 1))
+            break;
+    }
+
+    for (;;)
+    {
+        atomic_add(m_waiters, 1);
+        bool    signalled = true;
+        int     state = atomic_load(m_state);
+        //  Returns at once if others have arrived meanwhile.
+        if (unsigned(state) >> 16 == phase)
+            signalled = nonpublic::futex_wait(m_state, state, ptimer);
+        atomic_add(m_waiters, -1);
+
+        if (signalled)
+        {
+            if (unsigned(atomic_load(m_state)) >> 16 != phase)
+                return  0;
+            continue;
+        }
+
+        //  Timed-out, withdraws unless the phase has completed.
+        for (;;)
+        {
+            state = atomic_load(m_state);
+            if (unsigned(state) >> 16 != phase)
+                return  0;
+            if (atomic_cas(m_state, state, state - 1))
+                return  -1;
+        }
+    }
+}
+
+bool
+k2::event::wait_slow (const timestamp* ptimer)
+{
+    for (;;)
+    {
+        //  Announces before re-checking, see set().
+        atomic_add(m_waiters, 1);
+        bool    signalled = true;
+        if (atomic_load(m_signalled) == 0)
+            signalled = nonpublic::futex_wait(m_signalled, 0, ptimer);
+        atomic_add(m_waiters, -1);
+
+        if (this->try_wait())
+            return  true;
+        if (signalled == false)
+            return  false;
+    }
+}
+
 k2::nonpublic::tls_ptr_impl::tls_ptr_impl (
     void (*destroy_routine)(void*))
 :   m_destroy_routine(destroy_routine)
@@ -277,31 +564,59 @@ struct k2::nonpublic::thread_cntx
 
     typedef pthread_t   implement_t;
 
-    //  Members don't need synchronizations.
+    //  Members don't need synchronizations, a pooled thread's are set
+    //  before it is resumed.
     implement_t         m_handle;
-    void                (*m_thread_entry)(void*);
-    void*               m_arg;
-    const bool          m_detached;
+    //  Destroyed by the thread once run, so empty while parked.
+    thread_function     m_entry;
+    bool                m_detached;
+    //  Non-zero if the thread is a pooled one.
+    thread_reserve_impl*    m_preserve;
+    k2::semaphore       m_resume;
+    //  Non-zero if the stack is to be returned, once joined.
+    k2::thread_stack_pool*  m_pstack_pool;
+    void*               m_pstack;
 
     //  Members need synchronizations.
     k2::mutex           m_mtx;
     k2::cond_var        m_state_change_cv;
+    k2::event           m_started;
+    //  A detached, not pooled, thread's context is owned by its
+    //  spawner, until its wait on m_started returns, and by the thread.
+    k2::atomic_int_t    m_refs;
     state_enum          m_state;
     exit_cause_enum     m_exit_cause;
+    //  Read by now thread only.
     bool                m_cancel_enabled;
+    //  Cancelled by thread::cancel(), replaced when a pooled thread is
+    //  resumed after one.
+    k2::cancel_token    m_token;
 
-    thread_cntx (void (*thread_entry)(void*), void* arg, bool detached)
-    :   m_thread_entry(thread_entry)
-    ,   m_arg(arg)
-    ,   m_detached(detached)
+    thread_cntx (thread_function& thread_entry, bool detached)
+    :   m_detached(detached)
+    ,   m_preserve(0)
+    ,   m_resume(0)
+    ,   m_pstack_pool(0)
+    ,   m_pstack(0)
     ,   m_state_change_cv(m_mtx)
+    ,   m_refs(detached ? 2 : 1)
     ,   m_state(initializing)
     ,   m_exit_cause(na)
     ,   m_cancel_enabled(true)
     {
+        m_entry.swap(thread_entry);
     }
     ~thread_cntx ()
     {
+        if (m_pstack_pool)
+            m_pstack_pool->release(m_pstack);
+    }
+
+    //  Deletes a detached context, once both owners are done with it.
+    static void release_detached (thread_cntx* pcntx)
+    {
+        if (k2::atomic_add(pcntx->m_refs, -1) == 0)
+            delete  pcntx;
     }
 };
 
@@ -317,62 +632,112 @@ namespace
     }
     */
 
-#define K2_USE_SINGLETON
-#if defined (K2_USE_SINGLETON)
-    k2::tls_ptr<k2::nonpublic::thread_cntx>&
-    get_tls_cntx ()
-    {
-        return  k2::singleton<k2::tls_ptr<k2::nonpublic::thread_cntx> >::instance();
-    }
-#else
-    k2::tls_ptr<k2::nonpublic::thread_cntx>&
+    struct tls_cntx_tag;
+    typedef k2::static_tls_ptr<k2::nonpublic::thread_cntx, tls_cntx_tag>
+        tls_cntx_ptr;
+
+    //  A single TLS load on test_cancel() and other hot paths.
+    tls_cntx_ptr
     get_tls_cntx ()
     {
-        static k2::tls_ptr<k2::nonpublic::thread_cntx>  tls_cntx;
-        return  tls_cntx;
+        return  tls_cntx_ptr();
     }
-#endif
 }   //  namespace
 
 k2::nonpublic::thread_cntx*
 k2::thread::spawn_impl (
-    void (*thread_entry)(void*), void* arg, bool detached)
+    nonpublic::thread_function& thread_entry, bool detached,
+    const spawn_options& options)
 {
     typedef nonpublic::thread_cntx  thread_cntx;
     std::auto_ptr<thread_cntx>  pcntx;
     try
     {
-        pcntx.reset(new thread_cntx(thread_entry, arg, detached));
+        pcntx.reset(new thread_cntx(thread_entry, detached));
     }
     catch (std::bad_alloc& x)
     {
         throw   bad_resource_alloc(x.what());
     }
 
+    struct attr_guard
+    {
+        pthread_attr_t  m_attr;
+
+        attr_guard ()
+        {
+            if (pthread_attr_init(&m_attr) != 0)
+                throw   bad_resource_alloc();
+        }
+        ~attr_guard ()
+        {
+            pthread_attr_destroy(&m_attr);
+        }
+    }   attr;
+
+    void*   stack = detached ? 0 : options.stack;
+    size_t  stack_size = options.stack_size;
+    if (options.stack_pool)
+    {
+        stack_size = options.stack_pool->stack_size();
+        //  Back to the pool with pcntx, once joined.
+        if (detached == false)
+        {
+            stack = options.stack_pool->acquire();
+            if (stack)
+            {
+                pcntx->m_pstack_pool = options.stack_pool;
+                pcntx->m_pstack = stack;
+            }
+        }
+    }
+
+    int err = 0;
+#if !defined(WIN32)
+    if (stack)
+        err = pthread_attr_setstack(&attr.m_attr, stack, stack_size);
+    else
+#endif
+    {
+        if (stack_size)
+            err = pthread_attr_setstacksize(&attr.m_attr, os_stack_size(stack_size));
+#if !defined(WIN32)
+        if (err == 0 && options.guard_size != size_t(-1))
+            err = pthread_attr_setguardsize(&attr.m_attr, options.guard_size);
+#endif
+    }
+    if (err == 0 && options.policy != spawn_options::sched_inherit)
+    {
+        sched_param param;
+        param.sched_priority = options.priority;
+        err = pthread_attr_setinheritsched(&attr.m_attr, PTHREAD_EXPLICIT_SCHED);
+        if (err == 0)
+            err = pthread_attr_setschedpolicy(
+                &attr.m_attr, os_sched_policy(options.policy));
+        if (err == 0)
+            err = pthread_attr_setschedparam(&attr.m_attr, &param);
+    }
+    if (err != 0)
+        throw   bad_resource_alloc();
+
     if (pthread_create(
         &pcntx->m_handle,
-        0,
+        &attr.m_attr,
         pthread_entry_wrapper,
         static_cast<void*>(pcntx.get())) != 0)
     {
         throw   bad_resource_alloc();
     }
 
-    {
-        mutex::scoped_guard guard(pcntx->m_mtx);
-        while (pcntx->m_state == thread_cntx::initializing)
-        {
-            pcntx->m_state_change_cv.wait();
-        }
-    }
+    pcntx->m_started.wait();
 
     //  If the spawn thread is in detached state.
     if (detached == true)
     {
-        //  Release the ownership of the controlled pointer.
-        //  Spawned thread will do the cleanup at the end
-        //  of ThreadEntryWrapper().
-        pcntx.release();
+        //  The spawned thread may have exited already, whichever of
+        //  both is the last one does the cleanup.
+        thread_cntx::release_detached(pcntx.release());
+        return  0;
     }
 
     return  pcntx.release();
@@ -391,12 +756,12 @@ k2::thread::pthread_entry_wrapper (void* arg)
             mutex::scoped_guard guard(pcntx->m_mtx);
 
             pcntx->m_state = thread_cntx::running;
-            pcntx->m_state_change_cv.signal();
 
             get_tls_cntx().reset(pcntx);
         }
+        pcntx->m_started.set();
 
-        pcntx->m_thread_entry(pcntx->m_arg);
+        pcntx->m_entry();
         pcntx->m_exit_cause = thread_cntx::completed;
     }
     catch (thread::cancel_signal&)
@@ -409,27 +774,28 @@ k2::thread::pthread_entry_wrapper (void* arg)
         pcntx->m_exit_cause = thread_cntx::uncaught_exception;
         //  Absorb all exceptions, clean up then exits.
     }
+    pcntx->m_entry.reset();
 
+    bool    detached = false;
     {
         //  no more reference needed.
         get_tls_cntx().release();
 
         mutex::scoped_guard guard(pcntx->m_mtx);
         pcntx->m_state = thread_cntx::exited;
+        detached = pcntx->m_detached;
 
-        //  If this dieing thread is in detached state.
-        if (pcntx->m_detached == true)
-        {
-            //  deletes pcntx when goes out of scope,
-            //  safer than using delete after pthread_detach().
-            std::auto_ptr<thread_cntx>  guard(pcntx);
-            pthread_detach(pcntx->m_handle);
-        }
-        else
-        {
-            //  Signal the CV, thread's destructor might be waiting.
+        //  Signal the CV, thread's destructor might be waiting.
+        if (detached == false)
             pcntx->m_state_change_cv.signal();
-        }
+    }
+
+    //  If this dieing thread is in detached state, its spawner may
+    //  still be returning from the start-up wait.
+    if (detached == true)
+    {
+        pthread_detach(pthread_self());
+        thread_cntx::release_detached(pcntx);
     }
     return  0;
 }
@@ -446,34 +812,56 @@ k2::thread::~thread ()
 }
 void
 k2::thread::cancel ()
+{
+    thread::cancel_impl(m_pcntx);
+}
+void
+k2::thread::join ()
+{
+    thread::join_impl(m_pcntx);
+}
+bool
+k2::thread::join (const timestamp& timer)
+{
+    return  thread::join_impl(m_pcntx, timer);
+}
+//  static
+void
+k2::thread::cancel_impl (nonpublic::thread_cntx* pcntx)
 {
     typedef nonpublic::thread_cntx  thread_cntx;
 
-    mutex::scoped_guard guard(m_pcntx->m_mtx);
+    {
+        mutex::scoped_guard guard(pcntx->m_mtx);
 
-    if (m_pcntx->m_state != thread_cntx::exited)
-        m_pcntx->m_state = thread_cntx::cancel_pending;
+        if (pcntx->m_state != thread_cntx::exited)
+            pcntx->m_state = thread_cntx::cancel_pending;
+    }
+    //  Outside m_mtx, cancel() runs the token's callbacks.
+    pcntx->m_token.cancel();
 }
+//  static
 void
-k2::thread::join ()
+k2::thread::join_impl (nonpublic::thread_cntx* pcntx)
 {
     typedef nonpublic::thread_cntx  thread_cntx;
 
-    mutex::scoped_guard guard(m_pcntx->m_mtx);
-    while (m_pcntx->m_state != thread_cntx::exited)
+    mutex::scoped_guard guard(pcntx->m_mtx);
+    while (pcntx->m_state != thread_cntx::exited)
     {
-        m_pcntx->m_state_change_cv.wait();
+        pcntx->m_state_change_cv.wait();
     }
 }
+//  static
 bool
-k2::thread::join (const timestamp& timer)
+k2::thread::join_impl (nonpublic::thread_cntx* pcntx, const timestamp& timer)
 {
     typedef nonpublic::thread_cntx  thread_cntx;
 
-    mutex::scoped_guard guard(m_pcntx->m_mtx);
-    if (m_pcntx->m_state != thread_cntx::exited)
+    mutex::scoped_guard guard(pcntx->m_mtx);
+    if (pcntx->m_state != thread_cntx::exited)
     {
-        if (m_pcntx->m_state_change_cv.wait(timer) == true)
+        if (pcntx->m_state_change_cv.wait(timer) == true)
             return  true;
         else
             return  false;
@@ -491,7 +879,6 @@ k2::thread::cancel_enabled (bool yesno)
     if (pcntx == 0)
         return  false;
 
-    mutex::scoped_guard guard(pcntx->m_mtx);
     bool last = pcntx->m_cancel_enabled;
     pcntx->m_cancel_enabled = yesno;
     return  last;
@@ -507,10 +894,50 @@ k2::thread::test_cancel ()
     if (pcntx == 0)
         return;
 
-    mutex::scoped_guard guard(pcntx->m_mtx);
-    if (pcntx->m_state == thread_cntx::cancel_pending)
+    if (pcntx->m_token.cancelled() && pcntx->m_cancel_enabled)
         throw   thread::cancel_signal();
 }
+//  static
+k2::cancel_token
+k2::thread::this_cancel_token ()
+{
+    nonpublic::thread_cntx* pcntx = get_tls_cntx().get();
+    if (pcntx == 0)
+        return  cancel_token();
+    return  pcntx->m_token;
+}
+
+bool
+k2::thread::set_affinity (const std::vector<int>& cpus)
+{
+    return  os_set_affinity(m_pcntx->m_handle, cpus);
+}
+//  static
+bool
+k2::thread::set_this_affinity (const std::vector<int>& cpus)
+{
+    return  os_set_affinity(pthread_self(), cpus);
+}
+//  static
+std::vector<int>
+k2::thread::this_affinity ()
+{
+    std::vector<int>    cpus;
+#if defined(__linux__)
+    cpu_set_t   mask;
+    CPU_ZERO(&mask);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0)
+    {
+        int cpu = 0;
+        for (; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &mask))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return  cpus;
+}
 
 //  static
 void
@@ -522,12 +949,370 @@ k2::thread::sched_yield ()
 void
 k2::thread::sleep (const time_span& span)
 {
-    os_msleep(uint32_t(span.in_msec()));
+    nonpublic::thread_cntx* pcntx = get_tls_cntx().get();
+    if (pcntx == 0 || pcntx->m_cancel_enabled == false)
+    {
+        os_msleep(uint32_t(span.in_msec()));
+        return;
+    }
+
+    timestamp   timer(span);
+    pcntx->m_token.wait(timer);
+    thread::test_cancel();
 }
 //  static
 void
 k2::thread::sleep (size_t msec)
 {
-    os_msleep(msec);
+    thread::sleep(time_span(msec));
 }
 
+
+struct k2::nonpublic::thread_reserve_impl
+{
+    k2::mutex                   m_mtx;
+    const size_t                m_capacity;
+    std::vector<thread_cntx*>   m_parked;
+    //  Threads spawned and not yet parked or retired.
+    size_t                      m_busy;
+    //  The owning thread_reserve has been destroyed.
+    bool                        m_closed;
+
+    explicit thread_reserve_impl (size_t capacity)
+    :   m_capacity(capacity)
+    ,   m_busy(0)
+    ,   m_closed(false)
+    {
+    }
+
+    //  Parks *pcntx, returns false if the reserve is full or closed,
+    //  then sets last if *this is no longer referenced.
+    bool park (thread_cntx* pcntx, bool& last)
+    {
+        mutex::scoped_guard guard(m_mtx);
+        --m_busy;
+        last = m_closed && m_busy == 0;
+        if (m_closed || m_parked.size() >= m_capacity)
+            return  false;
+
+        m_parked.push_back(pcntx);
+        return  true;
+    }
+
+    //  Lets a parked thread exit, then reclaims its context.
+    static void retire (thread_cntx* pcntx)
+    {
+        std::auto_ptr<thread_cntx>  guard(pcntx);
+        {
+            mutex::scoped_guard guard(pcntx->m_mtx);
+            pcntx->m_entry.reset();
+        }
+        pcntx->m_resume.release();
+        pthread_join(pcntx->m_handle, 0);
+    }
+
+    static void* pthread_entry_wrapper (void* arg);
+};
+
+//  static
+void*
+k2::nonpublic::thread_reserve_impl::pthread_entry_wrapper (void* arg)
+{
+    thread_cntx*    pcntx(reinterpret_cast<thread_cntx*>(arg));
+    bool            retired = false;
+    bool            last = false;
+
+    get_tls_cntx().reset(pcntx);
+    for (;;)
+    {
+        pcntx->m_resume.acquire();
+        {
+            mutex::scoped_guard guard(pcntx->m_mtx);
+            if (pcntx->m_entry.empty())
+                break;
+        }
+
+        try
+        {
+            pcntx->m_entry();
+            pcntx->m_exit_cause = thread_cntx::completed;
+        }
+        catch (thread::cancel_signal&)
+        {
+            pcntx->m_exit_cause = thread_cntx::cancelled;
+            //  Absorb cancel signal exception.
+        }
+        catch (...)
+        {
+            pcntx->m_exit_cause = thread_cntx::uncaught_exception;
+            //  Absorb all exceptions.
+        }
+        pcntx->m_entry.reset();
+
+        bool    detached = false;
+        {
+            mutex::scoped_guard guard(pcntx->m_mtx);
+            pcntx->m_state = thread_cntx::exited;
+            detached = pcntx->m_detached;
+            if (detached == false)
+            {
+                //  Signal the CV, pooled_thread's destructor might be
+                //  waiting, it parks or retires *pcntx then.
+                pcntx->m_state_change_cv.signal();
+            }
+        }
+
+        if (detached && pcntx->m_preserve->park(pcntx, last) == false)
+        {
+            retired = true;
+            break;
+        }
+    }
+    //  no more reference needed.
+    get_tls_cntx().release();
+
+    if (retired)
+    {
+        thread_reserve_impl*    preserve = pcntx->m_preserve;
+        pthread_detach(pcntx->m_handle);
+        delete  pcntx;
+        if (last)
+            delete  preserve;
+    }
+    return  0;
+}
+
+k2::nonpublic::thread_reserve::thread_reserve (size_t capacity)
+:   m_pimpl(0)
+{
+    try
+    {
+        m_pimpl = new thread_reserve_impl(capacity);
+        m_pimpl->m_parked.reserve(capacity);
+    }
+    catch (std::bad_alloc& x)
+    {
+        delete  m_pimpl;
+        throw   bad_resource_alloc(x.what());
+    }
+}
+k2::nonpublic::thread_reserve::~thread_reserve ()
+{
+    std::vector<thread_cntx*>   parked;
+    bool                        last = false;
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        m_pimpl->m_closed = true;
+        parked.swap(m_pimpl->m_parked);
+        last = m_pimpl->m_busy == 0;
+    }
+
+    std::vector<thread_cntx*>::iterator it = parked.begin();
+    for (; it != parked.end(); ++it)
+        thread_reserve_impl::retire(*it);
+
+    //  Otherwise, the last busy thread deletes it.
+    if (last)
+        delete  m_pimpl;
+}
+k2::nonpublic::thread_cntx*
+k2::nonpublic::thread_reserve::spawn (
+    thread_function& thread_entry, bool detached)
+{
+    thread_cntx*    pcntx = 0;
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        if (m_pimpl->m_parked.empty() == false)
+        {
+            pcntx = m_pimpl->m_parked.back();
+            m_pimpl->m_parked.pop_back();
+        }
+        ++m_pimpl->m_busy;
+    }
+
+    if (pcntx == 0)
+    {
+        std::auto_ptr<thread_cntx>  pnew;
+        try
+        {
+            pnew.reset(new thread_cntx(thread_entry, detached));
+        }
+        catch (std::bad_alloc& x)
+        {
+            mutex::scoped_guard guard(m_pimpl->m_mtx);
+            --m_pimpl->m_busy;
+            throw   bad_resource_alloc(x.what());
+        }
+        pnew->m_preserve = m_pimpl;
+
+        //  No start-up handshake, the new thread parks on m_resume.
+        if (pthread_create(
+            &pnew->m_handle,
+            0,
+            thread_reserve_impl::pthread_entry_wrapper,
+            static_cast<void*>(pnew.get())) != 0)
+        {
+            mutex::scoped_guard guard(m_pimpl->m_mtx);
+            --m_pimpl->m_busy;
+            throw   bad_resource_alloc();
+        }
+        pcntx = pnew.release();
+    }
+    else
+    {
+        //  Parked, its thread doesn't read m_entry before m_resume.
+        try
+        {
+            pcntx->m_entry.swap(thread_entry);
+        }
+        catch (...)
+        {
+            bool    last = false;
+            if (m_pimpl->park(pcntx, last) == false)
+                thread_reserve_impl::retire(pcntx);
+            throw;
+        }
+    }
+
+    {
+        mutex::scoped_guard guard(pcntx->m_mtx);
+        pcntx->m_detached = detached;
+        pcntx->m_state = thread_cntx::running;
+        pcntx->m_exit_cause = thread_cntx::na;
+        pcntx->m_cancel_enabled = true;
+        if (pcntx->m_token.cancelled())
+            pcntx->m_token = cancel_token();
+    }
+    pcntx->m_resume.release();
+
+    return  detached ? 0 : pcntx;
+}
+//  static
+void
+k2::nonpublic::thread_reserve::reclaim (thread_cntx* pcntx)
+{
+    thread::join_impl(pcntx);
+
+    thread_reserve_impl*    preserve = pcntx->m_preserve;
+    bool                    last = false;
+    if (preserve->park(pcntx, last))
+        return;
+
+    thread_reserve_impl::retire(pcntx);
+    if (last)
+        delete  preserve;
+}
+size_t
+k2::nonpublic::thread_reserve::parked () const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    return  m_pimpl->m_parked.size();
+}
+
+
+
+struct k2::nonpublic::thread_stack_pool_impl
+{
+    mutex               m_mtx;
+    const size_t        m_stack_size;
+    const size_t        m_capacity;
+    std::vector<void*>  m_free;
+
+    thread_stack_pool_impl (size_t stack_size, size_t capacity)
+    :   m_stack_size(os_stack_size(stack_size))
+    ,   m_capacity(capacity)
+    {
+    }
+    ~thread_stack_pool_impl ()
+    {
+        std::vector<void*>::iterator    it = m_free.begin();
+        for (; it != m_free.end(); ++it)
+            os_unmap_stack(*it, m_stack_size);
+    }
+};
+
+k2::thread_stack_pool::thread_stack_pool (size_t stack_size, size_t capacity)
+:   m_pimpl(0)
+{
+    try
+    {
+        m_pimpl = new nonpublic::thread_stack_pool_impl(stack_size, capacity);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+k2::thread_stack_pool::~thread_stack_pool ()
+{
+    delete  m_pimpl;
+}
+
+void
+k2::thread_stack_pool::reserve (size_t cnt)
+{
+    if (cnt > m_pimpl->m_capacity)
+        cnt = m_pimpl->m_capacity;
+
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    try
+    {
+        m_pimpl->m_free.reserve(cnt);
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+    while (m_pimpl->m_free.size() < cnt)
+    {
+        void*   stack = os_map_stack(m_pimpl->m_stack_size);
+        if (stack == 0)
+            break;
+        m_pimpl->m_free.push_back(stack);
+    }
+}
+size_t
+k2::thread_stack_pool::stack_size () const
+{
+    return  m_pimpl->m_stack_size;
+}
+size_t
+k2::thread_stack_pool::free_stacks () const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    return  m_pimpl->m_free.size();
+}
+
+void*
+k2::thread_stack_pool::acquire ()
+{
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        if (m_pimpl->m_free.empty() == false)
+        {
+            void*   stack = m_pimpl->m_free.back();
+            m_pimpl->m_free.pop_back();
+            return  stack;
+        }
+    }
+    return  os_map_stack(m_pimpl->m_stack_size);
+}
+void
+k2::thread_stack_pool::release (void* stack) throw ()
+{
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        if (m_pimpl->m_free.size() < m_pimpl->m_capacity)
+        {
+            try
+            {
+                m_pimpl->m_free.push_back(stack);
+                return;
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+    os_unmap_stack(stack, m_pimpl->m_stack_size);
+}
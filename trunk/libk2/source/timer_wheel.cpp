@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/timer_wheel.h>
+
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/cond_var.h>
+#include <k2/cancellation.h>
+#include <k2/timing.h>
+
+#include <memory>
+
+struct k2::nonpublic::timer_node
+{
+    timer_node*     m_pprev;
+    timer_node*     m_pnext;
+    //  Slot linked to, 0 once unlinked.
+    timer_node**    m_pslot;
+    uint64_t        m_expiry;
+    pool_task*      m_ptask;
+    thread_pool*    m_pexecutor;
+    //  Bumped on unlinking, outdating handles.
+    uint32_t        m_serial;
+};
+
+namespace   //  unnamed
+{
+    typedef k2::nonpublic::timer_node   timer_node;
+    typedef k2::nonpublic::pool_task    pool_task;
+
+    struct driver_entry
+    {
+        k2::nonpublic::timer_wheel_impl*    m_pimpl;
+
+        void operator() () const;
+    };
+
+    //  Caps next_due() with nothing pending.
+    const k2::uint64_t  max_due_msec = 60 * 1000;
+
+}   //  unnamed namespace
+
+struct k2::nonpublic::timer_wheel_impl
+{
+    enum
+    {
+        root_bits = 8,
+        root_size = 1 << root_bits,
+        root_mask = root_size - 1,
+        level_bits = 6,
+        level_size = 1 << level_bits,
+        level_mask = level_size - 1,
+        level_cnt = 4
+    };
+
+    mutable k2::mutex   m_mtx;
+    k2::cond_var        m_due_cv;
+    const uint64_t      m_resolution;
+    const uint64_t      m_origin;
+    //  Next tick to collect.
+    uint64_t            m_current;
+    size_t              m_pending;
+    timer_node*         m_root[root_size];
+    timer_node*         m_levels[level_cnt][level_size];
+    timer_node*         m_pfree;
+    //  Tick the driver sleeps until, schedule() wakes it for an earlier
+    //  timer.
+    uint64_t            m_driver_due;
+    std::auto_ptr<k2::thread>   m_pdriver;
+
+    explicit timer_wheel_impl (uint64_t resolution)
+    :   m_due_cv(m_mtx)
+    ,   m_resolution(resolution ? resolution : 1)
+    ,   m_origin(k2::timestamp().in_msec())
+    ,   m_current(0)
+    ,   m_pending(0)
+    ,   m_pfree(0)
+    ,   m_driver_due(uint64_t(-1))
+    {
+        size_t  idx = 0;
+        for (; idx < root_size; ++idx)
+            m_root[idx] = 0;
+        size_t  level = 0;
+        for (; level < level_cnt; ++level)
+        {
+            for (idx = 0; idx < level_size; ++idx)
+                m_levels[level][idx] = 0;
+        }
+    }
+    ~timer_wheel_impl ()
+    {
+        size_t  idx = 0;
+        for (; idx < root_size; ++idx)
+            this->discard_slot(m_root[idx]);
+        size_t  level = 0;
+        for (; level < level_cnt; ++level)
+        {
+            for (idx = 0; idx < level_size; ++idx)
+                this->discard_slot(m_levels[level][idx]);
+        }
+        while (m_pfree)
+        {
+            timer_node* pnext = m_pfree->m_pnext;
+            delete  m_pfree;
+            m_pfree = pnext;
+        }
+    }
+
+    uint64_t    now_msec () const
+    {
+        return  k2::timestamp().in_msec() - m_origin;
+    }
+
+    //  m_mtx held by all below.
+
+    void    link (timer_node* pnode)
+    {
+        uint64_t    distance = pnode->m_expiry - m_current;
+        timer_node**    pslot = 0;
+        if (distance < root_size)
+        {
+            pslot = &m_root[pnode->m_expiry & root_mask];
+        }
+        else
+        {
+            size_t  level = 0;
+            while (level + 1 < level_cnt
+                && distance >= (uint64_t(1) << (root_bits + level_bits * (level + 1))))
+            {
+                ++level;
+            }
+            const uint64_t  range = uint64_t(1) << (root_bits + level_bits * level_cnt);
+            if (distance >= range)
+                pnode->m_expiry = m_current + range - 1;
+            pslot = &m_levels[level][
+                (pnode->m_expiry >> (root_bits + level_bits * level)) & level_mask];
+        }
+
+        pnode->m_pslot = pslot;
+        pnode->m_pprev = 0;
+        pnode->m_pnext = *pslot;
+        if (*pslot)
+            (*pslot)->m_pprev = pnode;
+        *pslot = pnode;
+    }
+    void    unlink (timer_node* pnode)
+    {
+        if (pnode->m_pprev)
+            pnode->m_pprev->m_pnext = pnode->m_pnext;
+        else
+            *pnode->m_pslot = pnode->m_pnext;
+        if (pnode->m_pnext)
+            pnode->m_pnext->m_pprev = pnode->m_pprev;
+        pnode->m_pslot = 0;
+        ++pnode->m_serial;
+    }
+    timer_node* alloc_node ()
+    {
+        if (m_pfree)
+        {
+            timer_node* pnode = m_pfree;
+            m_pfree = pnode->m_pnext;
+            return  pnode;
+        }
+        timer_node* pnode = new timer_node;
+        pnode->m_pslot = 0;
+        pnode->m_serial = 1;
+        return  pnode;
+    }
+    void    free_node (timer_node* pnode)
+    {
+        pnode->m_ptask = 0;
+        pnode->m_pnext = m_pfree;
+        m_pfree = pnode;
+    }
+    void    discard_slot (timer_node*& phead)
+    {
+        while (phead)
+        {
+            timer_node* pnode = phead;
+            phead = pnode->m_pnext;
+            pool_task::discard(pnode->m_ptask);
+            delete  pnode;
+        }
+    }
+
+    //  Re-links the timers of a slot of an upper level, one level down.
+    void    cascade (size_t level)
+    {
+        size_t  idx = size_t(m_current >> (root_bits + level_bits * level)) & level_mask;
+        timer_node* pnode = m_levels[level][idx];
+        m_levels[level][idx] = 0;
+        while (pnode)
+        {
+            timer_node* pnext = pnode->m_pnext;
+            this->link(pnode);
+            pnode = pnext;
+        }
+        if (idx == 0 && level + 1 < level_cnt)
+            this->cascade(level + 1);
+    }
+
+    //  Unlinks timers due by tick into a batch, in expiry order.
+    timer_node* collect (uint64_t tick)
+    {
+        timer_node*     pbatch = 0;
+        timer_node**    ptail = &pbatch;
+        while (m_current <= tick)
+        {
+            if (m_pending == 0)
+            {
+                //  Nothing to cascade, skips idle ticks at once.
+                m_current = tick + 1;
+                break;
+            }
+
+            size_t  idx = size_t(m_current) & root_mask;
+            if (idx == 0)
+                this->cascade(0);
+
+            timer_node* pnode = m_root[idx];
+            while (pnode)
+            {
+                timer_node* pnext = pnode->m_pnext;
+                this->unlink(pnode);
+                --m_pending;
+                pnode->m_pnext = 0;
+                *ptail = pnode;
+                ptail = &pnode->m_pnext;
+                pnode = pnext;
+            }
+            ++m_current;
+        }
+        return  pbatch;
+    }
+
+    //  Lower bound of the next tick with a timer due.
+    uint64_t    next_due_tick () const
+    {
+        if (m_pending == 0)
+            return  uint64_t(-1);
+        uint64_t    tick = m_current;
+        do
+        {
+            if (m_root[tick & root_mask])
+                return  tick;
+            ++tick;
+        }
+        while (tick & root_mask);
+        //  Cascading lands timers at the boundary or later.
+        return  tick;
+    }
+    uint64_t    next_due_msec () const
+    {
+        uint64_t    tick = this->next_due_tick();
+        uint64_t    now = this->now_msec();
+        if (tick == uint64_t(-1))
+            return  max_due_msec;
+        uint64_t    due = tick * m_resolution;
+        if (due <= now)
+            return  0;
+        return  due - now < max_due_msec ? due - now : max_due_msec;
+    }
+
+    //  Fires a batch outside m_mtx, then recycles its nodes.
+    size_t  fire (timer_node* pbatch)
+    {
+        size_t  fired = 0;
+        bool    cancelled = false;
+        timer_node* pnode = pbatch;
+        for (; pnode; pnode = pnode->m_pnext, ++fired)
+        {
+            pool_task*  ptask = pnode->m_ptask;
+            if (pnode->m_pexecutor)
+            {
+                bool    submitted = false;
+                try
+                {
+                    submitted = pnode->m_pexecutor->submit_impl(ptask);
+                }
+                catch (...)
+                {
+                }
+                if (submitted == false)
+                    pool_task::discard(ptask);
+                continue;
+            }
+            try
+            {
+                pool_task::run(ptask);
+            }
+            catch (k2::thread::cancel_signal&)
+            {
+                cancelled = true;
+            }
+            catch (...)
+            {
+                //  Absorbs, the task is deleted by run().
+            }
+        }
+
+        if (pbatch)
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            while (pbatch)
+            {
+                timer_node* pnext = pbatch->m_pnext;
+                this->free_node(pbatch);
+                pbatch = pnext;
+            }
+        }
+        if (cancelled)
+            throw   k2::thread::cancel_signal();
+        return  fired;
+    }
+
+    size_t  advance ()
+    {
+        timer_node* pbatch = 0;
+        {
+            k2::mutex::scoped_guard guard(m_mtx);
+            pbatch = this->collect(this->now_msec() / m_resolution);
+        }
+        return  this->fire(pbatch);
+    }
+
+    void    drive ()
+    {
+        k2::cancel_token    token = k2::thread::this_cancel_token();
+        for (;;)
+        {
+            this->advance();
+
+            k2::mutex::scoped_guard guard(m_mtx);
+            uint64_t    due = this->next_due_msec();
+            if (due)
+            {
+                k2::timestamp   timer((k2::time_span(due)));
+                m_driver_due = this->next_due_tick();
+                m_due_cv.wait(timer, token);
+                m_driver_due = uint64_t(-1);
+            }
+            if (token.cancelled())
+                return;
+        }
+    }
+};
+
+namespace   //  unnamed
+{
+    void
+    driver_entry::operator() () const
+    {
+        m_pimpl->drive();
+    }
+}   //  unnamed namespace
+
+
+k2::timer_wheel::timer_wheel (const time_span& resolution)
+:   m_pimpl(0)
+{
+    try
+    {
+        m_pimpl = new nonpublic::timer_wheel_impl(resolution.in_msec());
+    }
+    catch (std::bad_alloc& x)
+    {
+        throw   bad_resource_alloc(x.what());
+    }
+}
+k2::timer_wheel::~timer_wheel ()
+{
+    this->stop();
+    delete  m_pimpl;
+}
+k2::timer_wheel::handle
+k2::timer_wheel::schedule_task (
+    const time_span& delay,
+    nonpublic::pool_task* ptask,
+    thread_pool* pexecutor)
+{
+    nonpublic::timer_wheel_impl*    pimpl = m_pimpl;
+    handle  timer;
+
+    mutex::scoped_guard guard(pimpl->m_mtx);
+    nonpublic::timer_node*  pnode = 0;
+    try
+    {
+        pnode = pimpl->alloc_node();
+    }
+    catch (std::bad_alloc& x)
+    {
+        nonpublic::pool_task::discard(ptask);
+        throw   bad_resource_alloc(x.what());
+    }
+
+    //  Rounds up, a timer never fires early.
+    uint64_t    expiry = (pimpl->now_msec() + delay.in_msec()
+        + pimpl->m_resolution - 1) / pimpl->m_resolution;
+    pnode->m_expiry = expiry < pimpl->m_current ? pimpl->m_current : expiry;
+    pnode->m_ptask = ptask;
+    pnode->m_pexecutor = pexecutor;
+    pimpl->link(pnode);
+    ++pimpl->m_pending;
+
+    if (pnode->m_expiry < pimpl->m_driver_due)
+        pimpl->m_due_cv.signal();
+
+    timer.m_pnode = pnode;
+    timer.m_serial = pnode->m_serial;
+    return  timer;
+}
+bool
+k2::timer_wheel::cancel (const handle& timer)
+{
+    nonpublic::pool_task*   ptask = 0;
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        nonpublic::timer_node*  pnode = timer.m_pnode;
+        if (pnode == 0
+            || pnode->m_serial != timer.m_serial
+            || pnode->m_pslot == 0)
+        {
+            return  false;
+        }
+        m_pimpl->unlink(pnode);
+        --m_pimpl->m_pending;
+        ptask = pnode->m_ptask;
+        m_pimpl->free_node(pnode);
+    }
+    nonpublic::pool_task::discard(ptask);
+    return  true;
+}
+size_t
+k2::timer_wheel::advance ()
+{
+    return  m_pimpl->advance();
+}
+k2::time_span
+k2::timer_wheel::next_due () const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    return  time_span(m_pimpl->next_due_msec());
+}
+void
+k2::timer_wheel::start ()
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    if (m_pimpl->m_pdriver.get())
+        return;
+    driver_entry    entry = { m_pimpl };
+    m_pimpl->m_pdriver.reset(new thread(entry));
+}
+void
+k2::timer_wheel::stop ()
+{
+    std::auto_ptr<thread>   pdriver;
+    {
+        mutex::scoped_guard guard(m_pimpl->m_mtx);
+        pdriver = m_pimpl->m_pdriver;
+    }
+    if (pdriver.get())
+    {
+        //  Outside m_mtx, cancelling wakes the driver under it.
+        pdriver->cancel();
+        pdriver->join();
+    }
+}
+size_t
+k2::timer_wheel::pending () const
+{
+    mutex::scoped_guard guard(m_pimpl->m_mtx);
+    return  m_pimpl->m_pending;
+}
@@ -32,6 +32,7 @@
 #   include <sys/time.h>
 #else
 #   include <sys/timeb.h>
+#   include <windows.h>
 #endif
 
 #include <source/pthread_util.inl>
@@ -59,11 +60,42 @@ namespace   //  unnamed
     }
 #endif
 
+    inline k2::uint64_t os_hires_nsec ()
+#if !defined(WIN32)
+    {
+        timespec    ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return  (k2::uint64_t(ts.tv_sec) * one_thousand * one_thousand *
+            one_thousand + ts.tv_nsec);
+    }
+#else
+    {
+        LARGE_INTEGER   freq;
+        LARGE_INTEGER   cnt;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&cnt);
+
+        //  Splits to avoid overflowing 64 bits.
+        k2::uint64_t    sec = cnt.QuadPart / freq.QuadPart;
+        k2::uint64_t    rem = cnt.QuadPart % freq.QuadPart;
+        return  sec * one_thousand * one_thousand * one_thousand +
+            rem * one_thousand * one_thousand * one_thousand / freq.QuadPart;
+    }
+#endif
+
 }   //  unnamed namespace
 
 //static
 k2::timestamp::now_tag  k2::timestamp::now;
 
+//static
+k2::uint64_t
+k2::hires_clock::now_nsec ()
+{
+    return  os_hires_nsec();
+}
+
 k2::timestamp::timestamp ()
 :   m_msec(os_timestamp())
 {
@@ -48,6 +48,12 @@
 #ifndef K2_TIMING_H
 #   include <k2/timing.h>
 #endif
+#ifndef K2_CANCELLATION_H
+#   include <k2/cancellation.h>
+#endif
+#ifndef K2_FIBER_H
+#   include <k2/fiber.h>
+#endif
 #ifndef K2_BYTE_MANIP_H
 //#   include <k2/byte_manip.h>
 #endif
@@ -160,8 +166,21 @@ namespace   //  unnamed
         wait_write,
         wait_except
     };
+    //  Parks calling fiber, if any, rather than its carrier thread.
+    //  Returns -1 if calling thread runs no fiber.
+    int fiber_socket_wait (int get, wait_opt opt, const k2::timestamp* ptimer)
+    {
+        if(opt == wait_except)
+            return  -1;
+        return  k2::nonpublic::fiber_wait_desc(get, opt == wait_write, ptimer);
+    }
     bool socket_wait (int get, wait_opt opt, const k2::time_span& timeout)
     {
+        k2::timestamp   timer(timeout);
+        int fiber_res = fiber_socket_wait(get, opt, &timer);
+        if(fiber_res != -1)
+            return  fiber_res == 1;
+
         fd_set  fds;
         FD_ZERO(&fds);
         FD_SET(get, &fds);
@@ -194,6 +213,16 @@ namespace   //  unnamed
     }
     bool socket_wait2 (int get, wait_opt opt, k2::time_span& timeout)
     {
+        {
+            k2::timestamp   timer(timeout);
+            int fiber_res = fiber_socket_wait(get, opt, &timer);
+            if(fiber_res != -1)
+            {
+                timeout = timer.expired()
+                    ? k2::time_span(0) : timer - k2::timestamp::now;
+                return  fiber_res == 1;
+            }
+        }
 #if !defined(__linux__)
         //  See
         //  man 2 select
@@ -249,6 +278,78 @@ namespace   //  unnamed
             return  true;
         }
     }
+    //  As socket_wait(), also returns false once token is cancelled,
+    //  waits without limit if ptimeout is 0.
+    bool socket_wait (
+        int get, wait_opt opt, const k2::time_span* ptimeout,
+        const k2::cancel_token& token)
+    {
+        //  Without a wake-up descriptor, polls token in slices.
+        const int   wake = token.wait_desc();
+        const k2::time_span slice(100);
+
+        k2::timestamp   deadline;
+        if(ptimeout)
+            deadline += *ptimeout;
+
+        for(;;)
+        {
+            if(token.cancelled())
+                return  false;
+
+            fd_set  fds;
+            fd_set  wake_fds;
+            FD_ZERO(&fds);
+            FD_ZERO(&wake_fds);
+            FD_SET(get, &fds);
+            fd_set  *prd_fds = &wake_fds;
+            fd_set  *pwr_fds = 0;
+            fd_set  *pex_fds = 0;
+
+            switch (opt)
+            {
+            case wait_read:
+                prd_fds = &fds;
+                break;
+            case wait_write:
+                pwr_fds = &fds;
+                break;
+            case wait_except:
+                pex_fds = &fds;
+                break;
+            default:
+                k2::runtime_assert(0);
+            }
+            int max_desc = get;
+            if(wake != -1)
+            {
+                FD_SET(wake, prd_fds);
+                if(wake > max_desc)
+                    max_desc = wake;
+            }
+
+            k2::time_span   left = slice;
+            if(ptimeout)
+            {
+                if(deadline <= k2::timestamp::now)
+                    return  false;
+                left = deadline - k2::timestamp::now;
+            }
+            if(wake == -1 && slice < left)
+                left = slice;
+
+            timeval tv;
+            tv.tv_sec   = left.in_sec();
+            tv.tv_usec  = left.msec_of_sec() * 1000;
+            timeval *ptv = (ptimeout || wake == -1) ? &tv : 0;
+
+            int res = ::select(max_desc + 1, prd_fds, pwr_fds, pex_fds, ptv);
+            if(res < 0)
+                return  false;
+            if(res > 0 && FD_ISSET(get, &fds))
+                return  true;
+        }
+    }
     void tcp_listen (int get, size_t back_log)
     {
         if(listen(get, (int)back_log) == -1)
@@ -256,6 +357,7 @@ namespace   //  unnamed
     }
     int tcp_accept_no_throw (int get)
     {
+        fiber_socket_wait(get, wait_read, 0);
         return (int)accept(get, 0, 0);
     }
     int tcp_accept_no_throw (int get, const k2::time_span& timeout)
@@ -265,6 +367,14 @@ namespace   //  unnamed
 
         return  tcp_accept_no_throw(get);
     }
+    int tcp_accept_no_throw (
+        int get, const k2::time_span& timeout, const k2::cancel_token& token)
+    {
+        if(socket_wait(get, wait_read, &timeout, token) == false)
+            return  -1;
+
+        return  tcp_accept_no_throw(get);
+    }
     int tcp_accept (int get)
     {
         int tcp_desc = (int)accept(get, 0, 0);
@@ -342,15 +452,112 @@ namespace   //  unnamed
             }
         }
     }
+    template <typename tp_addr_>
+    void transport_connect_start (int tcp_desc, const tp_addr_& remote_addr)
+    {
+        typedef typename addr_traits<tp_addr_>::mapped_type bsd_tp_addr_t;
+#if defined(K2_HAS_POSIX_API)
+        //  BSD Socket specific
+        static const int connect_in_progress = EINPROGRESS;
+#else
+        //  Windows Socket specific
+        static const int connect_in_progress = EWOULDBLOCK;
+#endif
+        //  Blocking again by transport_connect_finish().
+        socket_set_nb(tcp_desc, true);
+        const bsd_tp_addr_t sa = remote_addr;
+        if(connect(tcp_desc, (const sockaddr*)(&sa), sizeof(sa)) == -1
+            && k2::socket_errno::get_last() != connect_in_progress)
+        {
+            socket_set_nb(tcp_desc, false);
+            throw   k2::socket_connect_error();
+        }
+    }
+    void transport_connect_finish (int tcp_desc)
+    {
+        socket_set_nb(tcp_desc, false);
+
+        int         so_error;
+        socklen_t   len = sizeof(so_error);
+        if(getsockopt(tcp_desc, SOL_SOCKET, SO_ERROR, (char*)&so_error, &len) != 0)
+            throw   k2::socket_connect_error();
+
+        if(so_error != 0)
+            throw   k2::socket_connect_error();
+    }
+
+    //  Makes a single send() or recv() non-blocking, where supported.
+#if defined(MSG_DONTWAIT)
+    const int   dont_wait = MSG_DONTWAIT;
+#else
+    const int   dont_wait = 0;
+#endif
+    //  Without MSG_DONTWAIT, checks readiness first.
+    bool socket_ready (int get, wait_opt opt)
+    {
+        return  dont_wait != 0 || socket_wait(get, opt, k2::time_span(0));
+    }
+    bool socket_would_block ()
+    {
+        int err = k2::socket_errno::get_last();
+        return  err == EAGAIN || err == EWOULDBLOCK;
+    }
+    //  Returns false rather than blocking.
+    bool tcp_try_write (int tcp_desc, const char* buf, size_t bytes, size_t& done)
+    {
+        if(socket_ready(tcp_desc, wait_write) == false)
+            return  false;
+
+        int ret = send(tcp_desc, buf, (socklen_t)bytes, dont_wait);
+        if(ret == -1)
+        {
+            if(socket_would_block())
+                return  false;
+            throw   k2::socket_connection_error();
+        }
+
+        done = ret;
+        return  true;
+    }
+    //  Returns false rather than blocking.
+    bool tcp_try_read (int tcp_desc, char* buf, size_t bytes, size_t& done)
+    {
+        if(socket_ready(tcp_desc, wait_read) == false)
+            return  false;
+
+        int ret = recv(tcp_desc, buf, (socklen_t)bytes, dont_wait);
+        if(ret == -1)
+        {
+            if(socket_would_block())
+                return  false;
+            throw   k2::socket_connection_error();
+        }
+
+        done = ret;
+        return  true;
+    }
     size_t tcp_write (int tcp_desc, const char* buf, size_t bytes)
     {
         //  Works with connected udp socket, too.
         //  But, we just don't use it that way in k2.
-        int ret = send(tcp_desc, buf, (socklen_t)bytes, 0);
-        if(ret == -1)
-            throw   k2::socket_connection_error();
+        for(;;)
+        {
+            //  A fiber sends what fits, rather than blocking its carrier.
+            int flags = 0;
+#if defined(MSG_DONTWAIT)
+            if(fiber_socket_wait(tcp_desc, wait_write, 0) == 1)
+                flags = MSG_DONTWAIT;
+#endif
+            int ret = send(tcp_desc, buf, (socklen_t)bytes, flags);
+            if(ret == -1)
+            {
+                if(flags && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    continue;
+                throw   k2::socket_connection_error();
+            }
 
-        return  ret;
+            return  ret;
+        }
     }
     size_t tcp_write_all (int tcp_desc, const char* buf, size_t bytes)
     {
@@ -392,12 +599,21 @@ namespace   //  unnamed
     }
     size_t tcp_read (int tcp_desc, char* buf, size_t bytes)
     {
+        fiber_socket_wait(tcp_desc, wait_read, 0);
         int ret = recv(tcp_desc, buf, (socklen_t)bytes, 0);
         if(ret == -1)
             throw   k2::socket_connection_error();
 
         return  ret;
     }
+    size_t tcp_read (
+        int tcp_desc, char* buf, size_t bytes, const k2::cancel_token& token)
+    {
+        if(socket_wait(tcp_desc, wait_read, 0, token) == false)
+            throw   k2::cancelled_error();
+
+        return  tcp_read(tcp_desc, buf, bytes);
+    }
     size_t tcp_read_all (int tcp_desc, char* buf, size_t bytes)
     {
         size_t bytes_done = 0;
@@ -503,6 +719,39 @@ namespace   //  unnamed
 
         return  udp_read(udp_desc, buf, bytes, remote_addr);
     }
+    //  Returns false rather than blocking.
+    template <typename tp_addr_>
+    bool udp_try_read (
+        int udp_desc,
+        char* buf,
+        size_t bytes,
+        tp_addr_& remote_addr,
+        size_t& done)
+    {
+        typedef typename addr_traits<tp_addr_>::mapped_type
+            bsd_tp_addr_t;
+        if(socket_ready(udp_desc, wait_read) == false)
+            return  false;
+
+        bsd_tp_addr_t   sa;
+        socklen_t   len = sizeof(sa);
+
+        int ret = recvfrom(
+            udp_desc,
+            buf,
+            (socklen_t)bytes,
+            dont_wait,
+            (sockaddr*)(&sa),
+            &len);
+
+        if(ret == -1 && socket_would_block())
+            return  false;
+        if(ret != -1)
+            remote_addr = sa;
+
+        done = ret;
+        return  true;
+    }
 
     template <typename tp_addr_>
     const tp_addr_ local_tranport_addr (int get)
@@ -569,6 +818,21 @@ k2::ipv4::tcp_listener::accept (const k2::time_span& timeout)
     else
         return  std::auto_ptr<tcp_transport>(new tcp_transport(tcp, true));
 }
+std::auto_ptr<k2::ipv4::tcp_transport>
+k2::ipv4::tcp_listener::accept (
+    const k2::time_span& timeout, const k2::cancel_token& token)
+{
+    int tcp = tcp_accept_no_throw(m_desc.get(), timeout, token);
+    if(tcp == -1)
+        return  std::auto_ptr<tcp_transport>(0);
+    else
+        return  std::auto_ptr<tcp_transport>(new tcp_transport(tcp, true));
+}
+std::auto_ptr<k2::ipv4::tcp_transport>
+k2::ipv4::tcp_listener::try_accept ()
+{
+    return  this->accept(k2::time_span(0));
+}
 int
 k2::ipv4::tcp_listener::accept_desc ()
 {
@@ -629,9 +893,20 @@ k2::ipv4::tcp_transport::tcp_transport (int tcp_desc, bool own)
 :   m_desc(tcp_desc, own)
 {
 }
+k2::ipv4::tcp_transport::tcp_transport (
+    const transport_addr& remote_addr, connect_opt)
+:   m_desc(socket_desc::family_ipv4, socket_desc::type_stream)
+{
+    transport_connect_start(m_desc.get(), remote_addr);
+}
 k2::ipv4::tcp_transport::~tcp_transport ()
 {
 }
+void
+k2::ipv4::tcp_transport::finish_connect ()
+{
+    transport_connect_finish(m_desc.get());
+}
 int
 k2::ipv4::tcp_transport::get_desc () const
 {
@@ -663,11 +938,33 @@ k2::ipv4::tcp_transport::write_all (const char* buf, size_t bytes, const time_sp
     return  tcp_write_all(m_desc.get(), buf, bytes, timeout);
 }
 size_t
+k2::ipv4::tcp_transport::try_write (const char* buf, size_t bytes)
+{
+    size_t  done;
+    if(tcp_try_write(m_desc.get(), buf, bytes, done) == false)
+        return  would_block;
+    return  done;
+}
+size_t
 k2::ipv4::tcp_transport::read (char* buf, size_t bytes)
 {
     return  tcp_read(m_desc.get(), buf, bytes);
 }
 size_t
+k2::ipv4::tcp_transport::read (
+    char* buf, size_t bytes, const k2::cancel_token& token)
+{
+    return  tcp_read(m_desc.get(), buf, bytes, token);
+}
+size_t
+k2::ipv4::tcp_transport::try_read (char* buf, size_t bytes)
+{
+    size_t  done;
+    if(tcp_try_read(m_desc.get(), buf, bytes, done) == false)
+        return  would_block;
+    return  done;
+}
+size_t
 k2::ipv4::tcp_transport::read_all (char* buf, size_t bytes)
 {
     return  tcp_read_all(m_desc.get(), buf, bytes);
@@ -736,3 +1033,14 @@ const time_span& timeout)
 {
     return  udp_read(m_desc.get(), buf, bytes, remote_addr, timeout);
 }
+size_t
+k2::ipv4::udp_transport::try_read (
+    char*           buf,
+    size_t          bytes,
+    transport_addr& remote_addr)
+{
+    size_t  done;
+    if(udp_try_read(m_desc.get(), buf, bytes, remote_addr, done) == false)
+        return  would_block;
+    return  done;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/actor.h>
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_actor [messages] [threads]
+//
+//  Prints nanoseconds per message, from the first send to the last
+//  delivery, for one sender, for a sender per thread, and for two actors
+//  bouncing a message between them.
+
+long    msg_cnt = 10000000;
+size_t  thread_cnt = 4;
+
+class counter
+:   public actor<long>
+{
+public:
+    explicit counter (actor_system& system)
+    :   actor<long>(system)
+    ,   m_sum(0)
+    {
+    }
+
+    long    m_sum;
+
+private:
+    virtual void receive (long& value)
+    {
+        m_sum += value;
+    }
+};
+
+struct sender
+{
+    counter*    m_ptarget;
+    long        m_cnt;
+
+    void operator() () const
+    {
+        long    value = 1;
+        long    cnt = 0;
+        for (; cnt < m_cnt; ++cnt)
+            m_ptarget->send(value);
+    }
+};
+
+struct ball
+{
+    class player*   m_pfrom;
+    long            m_count;
+};
+class player
+:   public actor<ball>
+{
+public:
+    explicit player (actor_system& system)
+    :   actor<ball>(system)
+    {
+    }
+
+private:
+    virtual void receive (ball& msg)
+    {
+        if (msg.m_count == 0)
+            return;
+        ball    back = { this, msg.m_count - 1 };
+        msg.m_pfrom->send(back);
+    }
+};
+
+void report (const char* name, const timestamp& start, long cnt)
+{
+    uint64_t    msec = (timestamp::now - start).in_msec();
+    cout << name << (msec * 1000000.0 / cnt) << " ns/message" << endl;
+}
+
+void one_way (size_t sender_cnt)
+{
+    actor_system        system(thread_cnt);
+    actor_ptr<counter>  ptarget(new counter(system));
+    sender  s = { ptarget.get(), msg_cnt / long(sender_cnt) };
+
+    timestamp   start;
+    {
+        thread**    threads = new thread*[sender_cnt];
+        size_t  idx = 0;
+        for (; idx < sender_cnt; ++idx)
+            threads[idx] = new thread(s);
+        for (idx = 0; idx < sender_cnt; ++idx)
+            delete  threads[idx];
+        delete [] threads;
+    }
+    system.shutdown();
+
+    if (ptarget->m_sum != s.m_cnt * long(sender_cnt))
+    {
+        cerr << "Wrong sum " << ptarget->m_sum << endl;
+        exit(1);
+    }
+    report(sender_cnt == 1 ?
+        "one sender    " : "sender/thread ", start, s.m_cnt * long(sender_cnt));
+}
+
+void ping_pong ()
+{
+    actor_system        system(2);
+    actor_ptr<player>   pping(new player(system));
+    actor_ptr<player>   ppong(new player(system));
+    ball    serve = { ppong.get(), msg_cnt / 10 };
+
+    timestamp   start;
+    pping->send(serve);
+    system.shutdown();
+    report("ping-pong     ", start, msg_cnt / 10 + 1);
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        msg_cnt = atol(argv[1]);
+    if (argc > 2)
+        thread_cnt = size_t(atol(argv[2]));
+
+    one_way(1);
+    one_way(thread_cnt);
+    ping_pong();
+    return  0;
+}
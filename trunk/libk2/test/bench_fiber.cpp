@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/fiber.h>
+#include <k2/thread.h>
+#include <k2/mutex.h>
+#include <k2/cond_var.h>
+#include <k2/timing.h>
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_fiber [round trips]
+//
+//  Prints nanoseconds per context switch of two fibers yielding to each
+//  other on one carrier, then per hand-off of a ping-pong over
+//  fiber_cond_var on one carrier, against one over k2::cond_var between
+//  two threads.
+
+size_t  round_trips = 1000000;
+
+struct yielder
+{
+    void operator() () const
+    {
+        size_t  idx = 0;
+        for (; idx < round_trips; ++idx)
+            fiber::yield();
+    }
+};
+
+template <typename MutexT, typename CondVarT>
+struct ping_pong
+{
+    MutexT      m_mtx;
+    CondVarT    m_cv;
+    size_t      m_turn;
+
+    ping_pong ()
+    :   m_cv(m_mtx)
+    ,   m_turn(0)
+    {
+    }
+};
+
+template <typename MutexT, typename CondVarT>
+struct player
+{
+    ping_pong<MutexT, CondVarT>*    m_pgame;
+    size_t                          m_self;
+
+    void operator() () const
+    {
+        size_t  idx = 0;
+        for (; idx < round_trips; ++idx)
+        {
+            typename MutexT::scoped_guard   guard(m_pgame->m_mtx);
+            while (m_pgame->m_turn % 2 != m_self)
+                m_pgame->m_cv.wait();
+            ++m_pgame->m_turn;
+            m_pgame->m_cv.signal();
+        }
+    }
+};
+
+void report (const char* name, const timestamp& start, size_t switches)
+{
+    uint64_t    msec = (timestamp::now - start).in_msec();
+    cout << name << ": " << msec << " ms, "
+         << (msec * 1000000.0 / switches) << " ns/switch" << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        round_trips = size_t(atol(argv[1]));
+
+    {
+        timestamp   start;
+        fiber_scheduler sched(1);
+        sched.spawn(yielder());
+        sched.spawn(yielder());
+        sched.shutdown();
+        report("fiber::yield        ", start, round_trips * 2);
+    }
+    {
+        typedef player<fiber_mutex, fiber_cond_var> fiber_player;
+        ping_pong<fiber_mutex, fiber_cond_var>  game;
+        fiber_player    first = { &game, 0 };
+        fiber_player    second = { &game, 1 };
+        timestamp   start;
+        fiber_scheduler sched(1);
+        sched.spawn(first);
+        sched.spawn(second);
+        sched.shutdown();
+        report("fiber_cond_var      ", start, round_trips * 2);
+    }
+    {
+        typedef player<mutex, cond_var> thread_player;
+        ping_pong<mutex, cond_var>  game;
+        thread_player   first = { &game, 0 };
+        thread_player   second = { &game, 1 };
+        timestamp   start;
+        {
+            thread  th1(first);
+            thread  th2(second);
+        }
+        report("cond_var, 2 threads ", start, round_trips * 2);
+    }
+    return  0;
+}
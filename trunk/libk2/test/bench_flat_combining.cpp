@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/mutex.h>
+#include <k2/spin_lock.h>
+#include <k2/latch.h>
+#include <k2/flat_combining.h>
+
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_flat_combining [max threads] [operations per thread]
+
+typedef priority_queue<long>    heap_type;
+
+size_t  max_threads = 8;
+long    op_cnt = 200000;
+
+//  A push followed by a pop, the unit of work of all variants.
+struct push_pop
+{
+    long    m_value;
+
+    void operator() (heap_type& heap)
+    {
+        heap.push(m_value);
+        m_value = heap.top();
+        heap.pop();
+    }
+};
+
+template <typename LockT>
+struct locked_heap
+{
+    LockT       m_lock;
+    heap_type   m_heap;
+
+    void apply (push_pop& op)
+    {
+        typename LockT::scoped_guard    guard(m_lock);
+        op(m_heap);
+    }
+};
+
+struct combined_heap
+{
+    flat_combining<heap_type>   m_heap;
+
+    void apply (push_pop& op)
+    {
+        m_heap.apply(op);
+    }
+};
+
+template <typename HeapT>
+struct worker
+{
+    HeapT&  m_heap;
+    latch&  m_start;
+
+    worker (HeapT& heap, latch& start)
+    :   m_heap(heap)
+    ,   m_start(start)
+    {
+    }
+    void operator() () const
+    {
+        m_start.arrive_and_wait();
+
+        long    cnt = 0;
+        for (; cnt < op_cnt; ++cnt)
+        {
+            push_pop    op = { cnt };
+            m_heap.apply(op);
+        }
+    }
+};
+
+template <typename HeapT>
+double run (size_t thread_cnt)
+{
+    HeapT   heap;
+    latch   start(int(thread_cnt + 1));
+
+    //  Some elements, so that operations are not trivial.
+    long    cnt = 0;
+    for (; cnt < 1000; ++cnt)
+    {
+        push_pop    op = { cnt };
+        heap.apply(op);
+    }
+
+    uint64_t    elapsed;
+    {
+        vector<thread*> threads;
+        size_t  idx = 0;
+        for (; idx < thread_cnt; ++idx)
+            threads.push_back(new thread(worker<HeapT>(heap, start)));
+
+        uint64_t    start_nsec = hires_clock::now_nsec();
+        start.arrive_and_wait();
+        for (idx = 0; idx < thread_cnt; ++idx)
+            delete  threads[idx];
+        elapsed = hires_clock::now_nsec() - start_nsec;
+    }
+
+    //  Million operations per second.
+    return  double(op_cnt) * double(thread_cnt) * 1000.0 / double(elapsed);
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        max_threads = size_t(atoi(argv[1]));
+    if (argc > 2)
+        op_cnt = atol(argv[2]);
+
+    cout << "priority_queue push+pop, M ops/s" << endl;
+    cout << "threads       mutex   spin_lock  flat_combining" << endl;
+
+    size_t  thread_cnt = 1;
+    for (; thread_cnt <= max_threads; thread_cnt *= 2)
+    {
+        cout.width(7);
+        cout << thread_cnt;
+        cout.width(12);
+        cout << run<locked_heap<mutex> >(thread_cnt);
+        cout.width(12);
+        cout << run<locked_heap<spin_lock> >(thread_cnt);
+        cout.width(16);
+        cout << run<combined_heap>(thread_cnt) << endl;
+    }
+
+    return  0;
+}
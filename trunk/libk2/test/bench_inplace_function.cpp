@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/thread_pool.h>
+#include <k2/timing.h>
+#include <k2/atomic.h>
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_inplace_function [tasks] [threads]
+//
+//  Prints nanoseconds and heap blocks per task submitted to a
+//  thread_pool, and heap blocks per pooled_thread spawned, for a functor
+//  stored in place and for one too large for it, which is copied to the
+//  heap as every functor was before.
+
+long    task_cnt = 1000000;
+size_t  thread_cnt = 4;
+
+atomic_int_t    heap_blocks = 0;
+
+void* operator new (size_t bytes) throw (std::bad_alloc)
+{
+    atomic_increase(heap_blocks);
+    void*   p = malloc(bytes ? bytes : 1);
+    if (p == 0)
+        throw   std::bad_alloc();
+    return  p;
+}
+void operator delete (void* p) throw ()
+{
+    free(p);
+}
+
+atomic_int_t    sum = 0;
+
+template <size_t Size>
+struct task
+{
+    char    m_pad[Size];
+
+    void operator() () const
+    {
+        atomic_increase(sum);
+    }
+};
+
+template <typename TaskT>
+void submit (const char* name)
+{
+    thread_pool pool(thread_cnt);
+    const TaskT task;
+    //  Warms up the pool's node caches.
+    long    cnt = 0;
+    for (; cnt < 1000; ++cnt)
+        pool.submit(task);
+
+    long        blocks = atomic_load(heap_blocks);
+    timestamp   start;
+    for (cnt = 0; cnt < task_cnt; ++cnt)
+        pool.submit(task);
+    pool.shutdown();
+    uint64_t    msec = (timestamp::now - start).in_msec();
+    blocks = atomic_load(heap_blocks) - blocks;
+
+    cout << name << (msec * 1000000.0 / task_cnt) << " ns/task, "
+         << double(blocks) / task_cnt << " heap blocks/task" << endl;
+}
+
+struct pool_tag;
+
+template <typename TaskT>
+void spawn (const char* name)
+{
+    typedef pooled_thread<4, pool_tag>  pooled;
+    const TaskT task;
+    {
+        pooled  warm(task);
+    }
+
+    const long  spawn_cnt = 10000;
+    long    blocks = atomic_load(heap_blocks);
+    long    cnt = 0;
+    for (; cnt < spawn_cnt; ++cnt)
+    {
+        pooled  th(task);
+    }
+    blocks = atomic_load(heap_blocks) - blocks;
+
+    cout << name << double(blocks) / spawn_cnt << " heap blocks/spawn"
+         << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        task_cnt = atol(argv[1]);
+    if (argc > 2)
+        thread_cnt = size_t(atol(argv[2]));
+
+    submit<task<16> >("submit, in place   ");
+    submit<task<256> >("submit, on heap    ");
+    spawn<task<16> >("pooled, in place   ");
+    spawn<task<256> >("pooled, on heap    ");
+    return  0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/mutex.h>
+#include <k2/cond_var.h>
+#include <k2/spin_lock.h>
+#include <k2/dummy_lock.h>
+#include <k2/atomic.h>
+#include <k2/latch.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_locks [max threads] [msec per run]
+//
+//  Sweeps thread count, critical section length (words touched) and
+//  read ratio for each lock type, then measures atomic_increase() and
+//  cond_var hand-off. For every run it reports:
+//
+//      Mops/s      total operations per second, in millions.
+//      fair        Jain's fairness index of per-thread operation counts,
+//                  1 when all threads got the same share, 1/n when one
+//                  thread got all.
+//      min%/max%   smallest and largest per-thread share.
+//      p50/p99/max acquisition latency in ns, sampled every 16th
+//                  operation.
+
+size_t      max_threads = 8;
+uint64_t    run_msec = 200;
+
+static const size_t shared_words = 512;
+static const size_t sample_every = 16;
+
+struct shared_data
+{
+    char            m_pad0[64];
+    volatile long   m_words[shared_words];
+    char            m_pad1[64];
+};
+
+atomic_int_t    stop_flag = 0;
+
+//  Per-thread results, padded so counting does not falsely share.
+struct thread_result
+{
+    uint64_t            m_ops;
+    vector<uint64_t>    m_latency;
+    char                m_pad[64];
+};
+
+struct run_config
+{
+    size_t  m_threads;
+    size_t  m_cs_words;
+    int     m_read_pct;
+};
+
+//  Cheap per-thread random numbers.
+struct xorshift
+{
+    uint32_t    m_state;
+
+    explicit xorshift (uint32_t seed)
+    :   m_state(seed * 2654435761U + 1)
+    {
+    }
+    uint32_t operator() ()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return  m_state;
+    }
+};
+
+template <typename LockT>
+struct lock_worker
+{
+    LockT&              m_lock;
+    shared_data&        m_data;
+    thread_result&      m_result;
+    latch&              m_start;
+    const run_config&   m_config;
+    uint32_t            m_seed;
+
+    lock_worker (
+        LockT&              lock,
+        shared_data&        data,
+        thread_result&      result,
+        latch&              start,
+        const run_config&   config,
+        uint32_t            seed)
+    :   m_lock(lock)
+    ,   m_data(data)
+    ,   m_result(result)
+    ,   m_start(start)
+    ,   m_config(config)
+    ,   m_seed(seed)
+    {
+    }
+    void operator() () const
+    {
+        xorshift    random(m_seed);
+        uint64_t    ops = 0;
+        long        sink = 0;
+
+        m_result.m_latency.reserve(1 << 16);
+        m_start.arrive_and_wait();
+
+        while (atomic_load(stop_flag) == 0)
+        {
+            bool    read = int(random() % 100) < m_config.m_read_pct;
+            bool    sample = ops % sample_every == 0;
+
+            uint64_t    begin = sample ? hires_clock::now_nsec() : 0;
+            m_lock.acquire();
+            if (sample)
+                m_result.m_latency.push_back(hires_clock::now_nsec() - begin);
+
+            size_t  idx = 0;
+            if (read)
+            {
+                for (; idx < m_config.m_cs_words; ++idx)
+                    sink += m_data.m_words[idx];
+            }
+            else
+            {
+                for (; idx < m_config.m_cs_words; ++idx)
+                    m_data.m_words[idx] = m_data.m_words[idx] + 1;
+            }
+            m_lock.release();
+            ++ops;
+        }
+
+        m_result.m_ops = ops + (sink & 0);
+    }
+};
+
+struct atomic_worker
+{
+    atomic_int_t&   m_counter;
+    thread_result&  m_result;
+    latch&          m_start;
+
+    atomic_worker (atomic_int_t& counter, thread_result& result, latch& start)
+    :   m_counter(counter)
+    ,   m_result(result)
+    ,   m_start(start)
+    {
+    }
+    void operator() () const
+    {
+        uint64_t    ops = 0;
+
+        m_result.m_latency.reserve(1 << 16);
+        m_start.arrive_and_wait();
+
+        while (atomic_load(stop_flag) == 0)
+        {
+            if (ops % sample_every == 0)
+            {
+                uint64_t    begin = hires_clock::now_nsec();
+                atomic_increase(m_counter);
+                m_result.m_latency.push_back(hires_clock::now_nsec() - begin);
+            }
+            else
+            {
+                atomic_increase(m_counter);
+            }
+            ++ops;
+        }
+        m_result.m_ops = ops;
+    }
+};
+
+//  Starts workers created by make(idx), lets them run for run_msec, then
+//  prints the statistics.
+template <typename MakerT>
+void run (const char* name, const run_config& config, MakerT make)
+{
+    vector<thread_result>   results(config.m_threads);
+    latch                   start(int(config.m_threads + 1));
+    uint64_t                elapsed;
+
+    atomic_store(stop_flag, 0);
+    {
+        vector<thread*> threads;
+        size_t  idx = 0;
+        for (; idx < config.m_threads; ++idx)
+            threads.push_back(new thread(make(results[idx], start, idx)));
+
+        uint64_t    begin = hires_clock::now_nsec();
+        start.arrive_and_wait();
+        thread::sleep(size_t(run_msec));
+        atomic_store(stop_flag, 1);
+
+        for (idx = 0; idx < config.m_threads; ++idx)
+            delete  threads[idx];
+        elapsed = hires_clock::now_nsec() - begin;
+    }
+
+    double              total = 0;
+    double              square_sum = 0;
+    uint64_t            min_ops = results[0].m_ops;
+    uint64_t            max_ops = results[0].m_ops;
+    vector<uint64_t>    latency;
+
+    size_t  idx = 0;
+    for (; idx < results.size(); ++idx)
+    {
+        double  ops = double(results[idx].m_ops);
+        total += ops;
+        square_sum += ops * ops;
+        min_ops = min(min_ops, results[idx].m_ops);
+        max_ops = max(max_ops, results[idx].m_ops);
+        latency.insert(latency.end(),
+            results[idx].m_latency.begin(), results[idx].m_latency.end());
+    }
+    sort(latency.begin(), latency.end());
+    if (latency.empty())
+        latency.push_back(0);
+
+    double  fairness = square_sum > 0 ?
+        total * total / (double(results.size()) * square_sum) : 1.0;
+
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout.width(16);
+    cout << left << name << right;
+    cout.width(7);
+    cout << config.m_threads;
+    cout.width(6);
+    cout << config.m_cs_words;
+    cout.width(6);
+    cout << config.m_read_pct;
+    cout.width(10);
+    cout << total * 1000.0 / double(elapsed);
+    cout.width(7);
+    cout << fairness;
+    cout.width(7);
+    cout << (total > 0 ? double(min_ops) * 100.0 / total : 0.0);
+    cout.width(7);
+    cout << (total > 0 ? double(max_ops) * 100.0 / total : 0.0);
+    cout.width(8);
+    cout << latency[latency.size() / 2];
+    cout.width(8);
+    cout << latency[latency.size() * 99 / 100];
+    cout.width(10);
+    cout << latency.back() << endl;
+}
+
+template <typename LockT>
+struct lock_maker
+{
+    LockT&              m_lock;
+    shared_data&        m_data;
+    const run_config&   m_config;
+
+    lock_maker (LockT& lock, shared_data& data, const run_config& config)
+    :   m_lock(lock)
+    ,   m_data(data)
+    ,   m_config(config)
+    {
+    }
+    lock_worker<LockT> operator() (
+        thread_result& result, latch& start, size_t idx) const
+    {
+        return  lock_worker<LockT>(
+            m_lock, m_data, result, start, m_config, uint32_t(idx));
+    }
+};
+
+struct atomic_maker
+{
+    atomic_int_t&   m_counter;
+
+    explicit atomic_maker (atomic_int_t& counter)
+    :   m_counter(counter)
+    {
+    }
+    atomic_worker operator() (
+        thread_result& result, latch& start, size_t) const
+    {
+        return  atomic_worker(m_counter, result, start);
+    }
+};
+
+template <typename LockT>
+void sweep_lock (const char* name, size_t max_thread_cnt)
+{
+    static const size_t cs_words[] = { 0, 16, 256 };
+    static const int    read_pcts[] = { 0, 90 };
+
+    size_t  thread_cnt = 1;
+    for (; thread_cnt <= max_thread_cnt; thread_cnt *= 2)
+    {
+        size_t  cs_idx = 0;
+        for (; cs_idx < sizeof(cs_words) / sizeof(cs_words[0]); ++cs_idx)
+        {
+            size_t  read_idx = 0;
+            for (; read_idx < sizeof(read_pcts) / sizeof(read_pcts[0]); ++read_idx)
+            {
+                LockT       lock;
+                shared_data data;
+                run_config  config = {
+                    thread_cnt, cs_words[cs_idx], read_pcts[read_idx] };
+
+                run(name, config, lock_maker<LockT>(lock, data, config));
+            }
+        }
+    }
+}
+
+//  Round trip of a token passed between two threads through a mutex
+//  guarded flag and cond_var signalling.
+struct handoff
+{
+    mutex       m_mtx;
+    cond_var    m_cv;
+    int         m_turn;
+
+    handoff ()
+    :   m_cv(m_mtx)
+    ,   m_turn(0)
+    {
+    }
+    void pass (int from, int to)
+    {
+        mutex::scoped_guard guard(m_mtx);
+        while (m_turn != from)
+            m_cv.wait();
+        m_turn = to;
+        m_cv.broadcast();
+    }
+};
+
+struct handoff_peer
+{
+    handoff&    m_handoff;
+    long        m_rounds;
+
+    handoff_peer (handoff& h, long rounds)
+    :   m_handoff(h)
+    ,   m_rounds(rounds)
+    {
+    }
+    void operator() () const
+    {
+        long    round = 0;
+        for (; round < m_rounds; ++round)
+            m_handoff.pass(1, 0);
+    }
+};
+
+void bench_cond_var (long rounds)
+{
+    handoff             h;
+    vector<uint64_t>    samples;
+    samples.reserve(size_t(rounds));
+    {
+        handoff_peer    peer(h, rounds);
+        thread          th(peer);
+
+        long    round = 0;
+        for (; round < rounds; ++round)
+        {
+            uint64_t    begin = hires_clock::now_nsec();
+            h.pass(0, 1);
+            {
+                mutex::scoped_guard guard(h.m_mtx);
+                while (h.m_turn != 0)
+                    h.m_cv.wait();
+            }
+            samples.push_back(hires_clock::now_nsec() - begin);
+        }
+    }
+    sort(samples.begin(), samples.end());
+    cout << "cond_var round trip ns: p50 " << samples[samples.size() / 2]
+         << ", p99 " << samples[samples.size() * 99 / 100]
+         << ", max " << samples.back() << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        max_threads = size_t(atoi(argv[1]));
+    if (argc > 2)
+        run_msec = uint64_t(atol(argv[2]));
+
+    cout << "lock            threads    cs read%    Mops/s   fair   min%   max%"
+            "     p50     p99       max" << endl;
+
+    //  dummy_lock does not exclude, only meaningful single-threaded as the
+    //  baseline of the critical section cost.
+    sweep_lock<dummy_lock>("dummy_lock", 1);
+    sweep_lock<spin_lock>("spin_lock", max_threads);
+    sweep_lock<mutex>("mutex", max_threads);
+
+    size_t  thread_cnt = 1;
+    for (; thread_cnt <= max_threads; thread_cnt *= 2)
+    {
+        atomic_int_t    counter = 0;
+        run_config      config = { thread_cnt, 0, 0 };
+        run("atomic_increase", config, atomic_maker(counter));
+    }
+
+    bench_cond_var(20000);
+
+    return  0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread_pool.h>
+#include <k2/parallel.h>
+#include <k2/sharded_counter.h>
+#include <k2/timing.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_parallel [max threads] [elements]
+//
+//  Runs each algorithm on pools of 1, 2, 4 ... max threads (default: CPU
+//  count), and prints milliseconds and the speed-up over the sequential
+//  std:: algorithm.
+
+size_t  max_threads = 0;
+size_t  elem_cnt = 4000000;
+
+//  Some floating point work per element, so that parallel_for is not
+//  bound by memory bandwidth alone.
+struct heavy_body
+{
+    vector<double>& m_values;
+
+    explicit heavy_body (vector<double>& values)
+    :   m_values(values)
+    {
+    }
+    void operator() (size_t first, size_t last) const
+    {
+        for (; first < last; ++first)
+            m_values[first] = std::sqrt(std::exp(m_values[first] * 1e-7));
+    }
+};
+
+struct sum_body
+{
+    const vector<double>&   m_values;
+
+    explicit sum_body (const vector<double>& values)
+    :   m_values(values)
+    {
+    }
+    double operator() (size_t first, size_t last) const
+    {
+        double  sum = 0;
+        for (; first < last; ++first)
+            sum += m_values[first];
+        return  sum;
+    }
+};
+
+struct scale
+{
+    double operator() (double value) const
+    {
+        return  value * 3.0 + 1.0;
+    }
+};
+
+double elapsed_msec (uint64_t start_nsec)
+{
+    return  double(hires_clock::now_nsec() - start_nsec) / 1e6;
+}
+
+void print (const char* name, double msec, double serial_msec)
+{
+    cout.width(20);
+    cout << left << name << right;
+    cout.width(12);
+    cout << msec;
+    cout.width(10);
+    cout << serial_msec / msec << endl;
+}
+
+void run (size_t thread_cnt, const vector<int>& keys)
+{
+    thread_pool     pool(thread_cnt);
+    vector<double>  values(elem_cnt);
+    vector<double>  results(elem_cnt);
+    size_t  idx = 0;
+    for (; idx < elem_cnt; ++idx)
+        values[idx] = double(idx);
+
+    cout << thread_cnt << " thread(s)" << endl;
+
+    heavy_body  body(values);
+    uint64_t    start = hires_clock::now_nsec();
+    body(0, elem_cnt);
+    double      serial = elapsed_msec(start);
+    start = hires_clock::now_nsec();
+    parallel_for(pool, size_t(0), elem_cnt, body);
+    print("parallel_for", elapsed_msec(start), serial);
+
+    start = hires_clock::now_nsec();
+    std::transform(values.begin(), values.end(), results.begin(), scale());
+    serial = elapsed_msec(start);
+    start = hires_clock::now_nsec();
+    parallel_transform(pool, values.begin(), values.end(), results.begin(), scale());
+    print("parallel_transform", elapsed_msec(start), serial);
+
+    start = hires_clock::now_nsec();
+    volatile double sum = sum_body(values)(0, elem_cnt);
+    serial = elapsed_msec(start);
+    start = hires_clock::now_nsec();
+    sum = parallel_reduce(pool, size_t(0), elem_cnt, 0.0,
+        sum_body(values), std::plus<double>());
+    print("parallel_reduce", elapsed_msec(start), serial);
+
+    vector<int> sorted(keys);
+    start = hires_clock::now_nsec();
+    std::sort(sorted.begin(), sorted.end());
+    serial = elapsed_msec(start);
+    sorted = keys;
+    start = hires_clock::now_nsec();
+    parallel_sort(pool, sorted.begin(), sorted.end(), std::less<int>());
+    print("parallel_sort", elapsed_msec(start), serial);
+}
+
+int main (int argc, char* argv[])
+{
+    max_threads = sharded_counter::cpu_count();
+    if (argc > 1)
+        max_threads = size_t(atoi(argv[1]));
+    if (argc > 2)
+        elem_cnt = size_t(atol(argv[2]));
+
+    vector<int> keys(elem_cnt);
+    size_t  idx = 0;
+    for (; idx < elem_cnt; ++idx)
+        keys[idx] = rand();
+
+    cout << "algorithm                   ms   speed-up" << endl;
+    size_t  thread_cnt = 1;
+    for (; thread_cnt <= max_threads; thread_cnt *= 2)
+        run(thread_cnt, keys);
+
+    return  0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/pipeline.h>
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_pipeline [values] [workers]
+//
+//  Pushes values through decode, route and encode stages to a sink, in
+//  batches of 1 and of 32, then prints nanoseconds per value and the
+//  report of the last run. The route stage is made the slowest, the
+//  decode stage feeding it should show the most time stalled.
+
+long    value_cnt = 2000000;
+size_t  worker_cnt = 2;
+
+struct decode
+{
+    typedef long    input_type;
+    typedef long    output_type;
+
+    void operator() (long& in, pipeline_output<long>& out)
+    {
+        out.push(in ^ 0x5a5a);
+    }
+};
+struct route
+{
+    typedef long    input_type;
+    typedef long    output_type;
+
+    void operator() (long& in, pipeline_output<long>& out)
+    {
+        //  Stands for a table lookup, kept by volatile.
+        volatile long   hash = in;
+        int     round = 0;
+        for (; round < 64; ++round)
+            hash = hash * 31 + round;
+        out.push(in);
+    }
+};
+struct encode
+{
+    typedef long    input_type;
+    typedef long    output_type;
+
+    void operator() (long& in, pipeline_output<long>& out)
+    {
+        out.push(in ^ 0x5a5a);
+    }
+};
+struct send
+{
+    typedef long    input_type;
+
+    atomic_long_t*  m_psum;
+
+    void operator() (long& in)
+    {
+        atomic_add(*m_psum, in);
+    }
+};
+
+void run (size_t batch, bool print_report)
+{
+    atomic_long_t   sum = 0;
+    pipeline    pipe(1024, batch);
+    pipeline_port<long> in = pipe.input<long>();
+    pipeline_port<long> decoded = pipe.stage(in, decode(), 1, "decode");
+    pipeline_port<long> routed = pipe.stage(decoded, route(), worker_cnt, "route");
+    pipeline_port<long> encoded = pipe.stage(routed, encode(), 1, "encode");
+    send    s = { &sum };
+    pipe.sink(encoded, s, 1, "send");
+
+    timestamp   start;
+    long    value = 0;
+    for (; value < value_cnt; ++value)
+        in.push(value);
+    pipe.close();
+    pipe.wait();
+    uint64_t    msec = (timestamp::now - start).in_msec();
+
+    if (sum != value_cnt * (value_cnt - 1) / 2)
+    {
+        cerr << "Wrong sum " << sum << endl;
+        exit(1);
+    }
+    cout << "batch " << batch << ": "
+        << (msec * 1000000.0 / value_cnt) << " ns/value" << endl;
+    if (print_report)
+        pipe.report(cout);
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        value_cnt = atol(argv[1]);
+    if (argc > 2)
+        worker_cnt = size_t(atol(argv[2]));
+
+    run(1, false);
+    run(32, true);
+    return  0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/singleton.h>
+#include <k2/latch.h>
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <ctime>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_singleton [threads] [calls per thread]
+
+size_t  thread_cnt = 4;
+long    call_cnt = 10000000;
+
+struct cheap_obj
+{
+    long    m_value;
+
+    cheap_obj ()
+    :   m_value(1)
+    {
+    }
+};
+
+//  Stands for a constructor doing I/O.
+struct slow_obj
+{
+    long    m_value;
+
+    slow_obj ()
+    :   m_value(1)
+    {
+        thread::sleep(200);
+    }
+};
+
+template <typename ObjT>
+struct caller
+{
+    latch&      m_start;
+    long&       m_sum;
+
+    caller (latch& start, long& sum)
+    :   m_start(start)
+    ,   m_sum(sum)
+    {
+    }
+    void operator() () const
+    {
+        m_start.arrive_and_wait();
+
+        long    sum = 0;
+        long    cnt = 0;
+        for (; cnt < call_cnt; ++cnt)
+            sum += singleton<ObjT>::instance().m_value;
+        m_sum = sum;
+    }
+};
+
+template <typename ObjT>
+void run (const char* name)
+{
+    vector<long>    sums(thread_cnt, 0);
+    latch           start(int(thread_cnt + 1));
+
+    clock_t     cpu_start = clock();
+    uint64_t    start_nsec;
+    uint64_t    elapsed;
+    {
+        vector<thread*> threads;
+        size_t  idx = 0;
+        for (; idx < thread_cnt; ++idx)
+            threads.push_back(new thread(caller<ObjT>(start, sums[idx])));
+
+        start_nsec = hires_clock::now_nsec();
+        start.arrive_and_wait();
+
+        for (idx = 0; idx < thread_cnt; ++idx)
+            delete  threads[idx];
+        elapsed = hires_clock::now_nsec() - start_nsec;
+    }
+    double  cpu_msec = double(clock() - cpu_start) * 1000.0 / CLOCKS_PER_SEC;
+
+    size_t  idx = 0;
+    for (; idx < thread_cnt; ++idx)
+    {
+        if (sums[idx] != call_cnt)
+        {
+            cerr << "Wrong sum " << sums[idx] << endl;
+            exit(1);
+        }
+    }
+
+    cout << name << ": "
+         << (double(elapsed) / double(call_cnt)) << " ns/call per thread, "
+         << (double(elapsed) / 1000000.0) << " ms wall, "
+         << cpu_msec << " ms cpu" << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        thread_cnt = size_t(atoi(argv[1]));
+    if (argc > 2)
+        call_cnt = atol(argv[2]);
+
+    cout << thread_cnt << " threads, " << call_cnt
+         << " instance() calls each" << endl;
+
+    //  First calls race with a 200 ms constructor, waiters should not
+    //  burn cpu meanwhile.
+    run<slow_obj>("slow constructor");
+    //  Steady state, every call takes the fast path.
+    run<cheap_obj>("cheap constructor");
+    run<slow_obj>("constructed");
+
+    return  0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/spsc_ring.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_spsc_ring [msg_cnt] [producer cpu] [consumer cpu]
+
+typedef spsc_ring<long, 4096>   ring_type;
+
+long    msg_cnt = 10000000;
+int     producer_cpu = 0;
+int     consumer_cpu = 1;
+
+void pin (int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0)
+        return;
+    cpu_set_t   set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        cerr << "Unable to pin to cpu " << cpu << ", running unpinned." << endl;
+#endif
+}
+
+//  Busy-waits briefly, then gives the cpu away, so that the benchmark
+//  still makes progress when both threads share a cpu.
+struct backoff
+{
+    size_t  m_spins;
+
+    backoff ()
+    :   m_spins(0)
+    {
+    }
+    void operator() ()
+    {
+        if (++m_spins < 128)
+        {
+            cpu_relax();
+        }
+        else
+        {
+            m_spins = 0;
+            thread::sched_yield();
+        }
+    }
+};
+
+struct producer
+{
+    ring_type&  m_ring;
+    size_t      m_batch;
+
+    producer (ring_type& ring, size_t batch)
+    :   m_ring(ring)
+    ,   m_batch(batch)
+    {
+    }
+    void operator() () const
+    {
+        pin(producer_cpu);
+
+        long    batch[64];
+        long    value = 0;
+        backoff wait;
+        while (value < msg_cnt)
+        {
+            size_t  cnt = 0;
+            for (; cnt < m_batch && value + long(cnt) < msg_cnt; ++cnt)
+                batch[cnt] = value + long(cnt);
+
+            size_t  pushed = 0;
+            while (pushed < cnt)
+            {
+                size_t  n = m_ring.try_push_n(batch + pushed, cnt - pushed);
+                if (n == 0)
+                    wait();
+                pushed += n;
+            }
+            value += long(cnt);
+        }
+    }
+};
+
+struct echo
+{
+    ring_type&  m_ping;
+    ring_type&  m_pong;
+    long        m_rounds;
+
+    echo (ring_type& ping, ring_type& pong, long rounds)
+    :   m_ping(ping)
+    ,   m_pong(pong)
+    ,   m_rounds(rounds)
+    {
+    }
+    void operator() () const
+    {
+        pin(consumer_cpu);
+
+        long    value;
+        long    round = 0;
+        backoff wait;
+        for (; round < m_rounds; ++round)
+        {
+            while (m_ping.try_pop(value) == false)
+                wait();
+            while (m_pong.try_push(value) == false)
+                wait();
+        }
+    }
+};
+
+void throughput (size_t batch)
+{
+    auto_ptr<ring_type> pring(new ring_type);
+
+    uint64_t    start = hires_clock::now_nsec();
+    {
+        producer    prod(*pring, batch);
+        thread      th(prod);
+
+        pin(consumer_cpu);
+
+        long    values[64];
+        long    expected = 0;
+        backoff wait;
+        while (expected < msg_cnt)
+        {
+            size_t  n = pring->try_pop_n(values, batch);
+            if (n == 0)
+            {
+                wait();
+                continue;
+            }
+            size_t  idx = 0;
+            for (; idx < n; ++idx, ++expected)
+            {
+                if (values[idx] != expected)
+                {
+                    cerr << "Out of order value " << values[idx]
+                         << ", expected " << expected << endl;
+                    exit(1);
+                }
+            }
+        }
+    }
+    uint64_t    elapsed = hires_clock::now_nsec() - start;
+
+    cout << "batch " << batch << ": "
+         << (double(msg_cnt) * 1000.0 / double(elapsed))
+         << " M msgs/s, "
+         << (double(elapsed) / double(msg_cnt)) << " ns/msg" << endl;
+}
+
+void latency (long rounds)
+{
+    auto_ptr<ring_type> pping(new ring_type);
+    auto_ptr<ring_type> ppong(new ring_type);
+    vector<uint64_t>    samples;
+    samples.reserve(size_t(rounds));
+
+    {
+        echo    peer(*pping, *ppong, rounds);
+        thread  th(peer);
+
+        pin(producer_cpu);
+
+        long    value;
+        long    round = 0;
+        backoff wait;
+        for (; round < rounds; ++round)
+        {
+            uint64_t    start = hires_clock::now_nsec();
+            while (pping->try_push(round) == false)
+                wait();
+            while (ppong->try_pop(value) == false)
+                wait();
+            samples.push_back(hires_clock::now_nsec() - start);
+        }
+    }
+
+    sort(samples.begin(), samples.end());
+    cout << "round trip ns: p50 " << samples[samples.size() / 2]
+         << ", p90 " << samples[samples.size() * 9 / 10]
+         << ", p99 " << samples[samples.size() * 99 / 100]
+         << ", p99.9 " << samples[samples.size() * 999 / 1000]
+         << ", max " << samples.back() << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        msg_cnt = atol(argv[1]);
+    if (argc > 2)
+        producer_cpu = atoi(argv[2]);
+    if (argc > 3)
+        consumer_cpu = atoi(argv[3]);
+
+    cout << "spsc_ring<long, " << ring_type::capacity() << ">, "
+         << msg_cnt << " messages, cpu "
+         << producer_cpu << " -> " << consumer_cpu << endl;
+
+    size_t  batch = 1;
+    for (; batch <= 64; batch *= 4)
+        throughput(batch);
+
+    latency(msg_cnt / 100 < 100000 ? msg_cnt / 100 : 100000);
+
+    return  0;
+}
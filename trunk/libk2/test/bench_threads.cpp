@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/atomic.h>
+#include <k2/event.h>
+#include <k2/exception.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+
+#if !defined(WIN32)
+#   include <unistd.h>
+#endif
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_threads [threads] [stack_kib]
+//
+//  Starts threads that block until all are up, with the default stack,
+//  with small stacks, and with small stacks from a thread_stack_pool,
+//  the latter twice to show the pool reused. Prints the time to start
+//  them, and the growth per thread of the virtual size, mostly stack
+//  reservations, and of the resident size. Sizes are read from /proc on
+//  Linux only.
+
+size_t  thread_cnt = 10000;
+size_t  stack_kib = 64;
+
+struct memory_size
+{
+    size_t  virtual_bytes;
+    size_t  resident_bytes;
+
+    memory_size ()
+    :   virtual_bytes(0)
+    ,   resident_bytes(0)
+    {
+#if defined(__linux__)
+        ifstream    statm("/proc/self/statm");
+        statm >> virtual_bytes >> resident_bytes;
+        virtual_bytes *= size_t(sysconf(_SC_PAGESIZE));
+        resident_bytes *= size_t(sysconf(_SC_PAGESIZE));
+#endif
+    }
+};
+
+double kib_per_thread (size_t before, size_t after, size_t cnt)
+{
+    return  after > before ? (after - before) / 1024.0 / cnt : 0;
+}
+
+struct blocker
+{
+    atomic_int_t*   m_pstarted;
+    event*          m_pgo;
+
+    void operator() () const
+    {
+        //  Touches a little stack, as a blocked worker would.
+        volatile char   frame[1024];
+        frame[0] = 0;
+        atomic_increase(*m_pstarted);
+        m_pgo->wait();
+    }
+};
+
+void run (const char* name, const thread::spawn_options& options)
+{
+    atomic_int_t    started = 0;
+    event           go;
+    blocker         b = { &started, &go };
+
+    vector<thread*> threads;
+    threads.reserve(thread_cnt);
+    memory_size before;
+    timestamp   start;
+    try
+    {
+        while (threads.size() < thread_cnt)
+            threads.push_back(new thread(b, options));
+    }
+    catch (bad_resource_alloc&)
+    {
+        cout << name << "stopped at " << threads.size() << " threads" << endl;
+    }
+    while (size_t(atomic_load(started)) < threads.size())
+        thread::sched_yield();
+    uint64_t    msec = (timestamp::now - start).in_msec();
+    memory_size after;
+
+    go.set();
+    for (size_t idx = 0; idx < threads.size(); ++idx)
+        delete  threads[idx];
+
+    if (threads.empty())
+        return;
+    cout << name << threads.size() << " threads, "
+        << (msec * 1000.0 / threads.size()) << " us/thread to start, KiB/thread "
+        << kib_per_thread(before.virtual_bytes, after.virtual_bytes, threads.size())
+        << " virtual, "
+        << kib_per_thread(before.resident_bytes, after.resident_bytes, threads.size())
+        << " resident" << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        thread_cnt = size_t(atol(argv[1]));
+    if (argc > 2)
+        stack_kib = size_t(atol(argv[2]));
+
+    thread::spawn_options   defaults;
+    run("default stack  ", defaults);
+
+    thread::spawn_options   small;
+    small.stack_size = stack_kib * 1024;
+    run("small stack    ", small);
+
+    thread_stack_pool   pool(stack_kib * 1024, thread_cnt);
+    thread::spawn_options   pooled;
+    pooled.stack_pool = &pool;
+    run("pooled, cold   ", pooled);
+    run("pooled, reused ", pooled);
+    return  0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/timer_wheel.h>
+#include <k2/timing.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_timer_wheel [timers]
+//
+//  Schedules timers with delays of up to a minute, as connection
+//  timeouts, then cancels them all, as most connection timeouts are.
+//  Prints nanoseconds per operation for timer_wheel and for a
+//  std::multimap ordered by expiry, as a heap-like baseline.
+
+size_t  timer_cnt = 1000000;
+
+struct noop
+{
+    void operator() () const
+    {
+    }
+};
+
+void report (const char* name, const char* op, const timestamp& start)
+{
+    uint64_t    msec = (timestamp::now - start).in_msec();
+    cout << name << " " << op << ": " << msec << " ms, "
+         << (msec * 1000000.0 / timer_cnt) << " ns/op" << endl;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        timer_cnt = size_t(atol(argv[1]));
+
+    vector<uint64_t>    delays(timer_cnt);
+    size_t  idx = 0;
+    for (; idx < timer_cnt; ++idx)
+        delays[idx] = uint64_t(rand()) % (60 * 1000);
+
+    {
+        timer_wheel wheel((time_span(1)));
+        vector<timer_wheel::handle> handles(timer_cnt);
+
+        timestamp   start;
+        for (idx = 0; idx < timer_cnt; ++idx)
+            handles[idx] = wheel.schedule(time_span(delays[idx]), noop());
+        report("timer_wheel", "schedule", start);
+
+        start = timestamp();
+        for (idx = 0; idx < timer_cnt; ++idx)
+            wheel.cancel(handles[idx]);
+        report("timer_wheel", "cancel  ", start);
+    }
+    {
+        typedef multimap<uint64_t, noop>    timer_map;
+        timer_map   timers;
+        vector<timer_map::iterator> handles(timer_cnt);
+
+        timestamp   start;
+        uint64_t    now = start.in_msec();
+        for (idx = 0; idx < timer_cnt; ++idx)
+            handles[idx] = timers.insert(make_pair(now + delays[idx], noop()));
+        report("multimap   ", "schedule", start);
+
+        start = timestamp();
+        for (idx = 0; idx < timer_cnt; ++idx)
+            timers.erase(handles[idx]);
+        report("multimap   ", "cancel  ", start);
+    }
+    return  0;
+}
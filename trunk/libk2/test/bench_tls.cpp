@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2003, 2004, 2005,
+ * Kenneth Chang-Hsing Ho <kenho@bluebottle.com> All rights reterved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of k2, libk2, copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * APARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <k2/thread.h>
+#include <k2/timing.h>
+#include <k2/singleton.h>
+#include <k2/tls_ptr.h>
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace k2;
+
+//  Usage: bench_tls [calls]
+//
+//  Prints nanoseconds per lookup of thread local storage, each made
+//  through a function pointer, so that the compiler can not hoist it out
+//  of the loop. The last line is the empty call, for reference.
+
+long    call_cnt = 50000000;
+
+struct obj
+{
+    long    m_value;
+
+    obj ()
+    :   m_value(1)
+    {
+    }
+};
+
+tls_ptr<obj>    dynamic_tls;
+
+long by_tls_ptr ()
+{
+    return  dynamic_tls.get()->m_value;
+}
+long by_static_tls_ptr ()
+{
+    return  static_tls_ptr<obj>::get()->m_value;
+}
+long by_thread_local_singleton ()
+{
+    return  thread_local_singleton<obj>::instance().m_value;
+}
+long by_test_cancel ()
+{
+    thread::test_cancel();
+    return  1;
+}
+long by_nothing ()
+{
+    return  1;
+}
+
+typedef long    (*lookup_fn)();
+
+struct runner
+{
+    const char*         m_name;
+    lookup_fn volatile* m_pfn;
+
+    void operator() () const
+    {
+        dynamic_tls.reset(new obj);
+        static_tls_ptr<obj>::reset(new obj);
+
+        timestamp   start;
+        long        sum = 0;
+        long        cnt = 0;
+        for (; cnt < call_cnt; ++cnt)
+            sum += (*m_pfn)();
+        uint64_t    msec = (timestamp::now - start).in_msec();
+
+        if (sum != call_cnt)
+        {
+            cerr << "Wrong sum " << sum << endl;
+            exit(1);
+        }
+        cout << m_name << (msec * 1000000.0 / call_cnt) << " ns/call" << endl;
+    }
+};
+
+void run (const char* name, lookup_fn fn)
+{
+    static lookup_fn volatile   s_fn;
+    s_fn = fn;
+    runner  r = { name, &s_fn };
+    //  On a thread of its own, to include test_cancel().
+    thread  th(r);
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+        call_cnt = atol(argv[1]);
+
+    run("tls_ptr<>::get()                 ", by_tls_ptr);
+    run("static_tls_ptr<>::get()          ", by_static_tls_ptr);
+    run("thread_local_singleton::instance ", by_thread_local_singleton);
+    run("thread::test_cancel()            ", by_test_cancel);
+    run("empty call                       ", by_nothing);
+    return  0;
+}
@@ -35,6 +35,7 @@
 #include <k2/ipv4_udp.h>
 #include <k2/singleton.h>
 #include <k2/allocator.h>
+#include <k2/atomic.h>
 
 #include <cstddef>
 #include <iostream>
@@ -164,6 +165,20 @@ namespace test_threading
         }
     };
 
+    struct detached_counter
+    {
+        atomic_int_t&   m_runs;
+
+        explicit detached_counter (atomic_int_t& runs)
+        :   m_runs(runs)
+        {
+        }
+        void operator() () const
+        {
+            atomic_increase(m_runs);
+        }
+    };
+
     void test ()
     {
         {
@@ -205,6 +220,18 @@ namespace test_threading
             cout << "Test of thread synchronous cancellation passed." << endl;
             cout << "Test of explicit thread joining passed." << endl;
         }
+
+        {
+            //  Detached threads often exit before their spawner returns.
+            static atomic_int_t runs = 0;
+            static const int    spawns = 20000;
+            int idx = 0;
+            for (; idx < spawns; ++idx)
+                thread::spawn_detached(detached_counter(runs));
+            while (atomic_load(runs) != spawns)
+                thread::sched_yield();
+            cout << "Test of detached threads passed." << endl;
+        }
     }
 }   //  namespace test_threading
 
@@ -517,6 +544,2642 @@ namespace test_thread_local_singleton
 
 }   //  namespace test_thread_local_singleton
 
+#include <k2/lock_profile.h>
+#include <k2/mutex.h>
+
+namespace test_lock_profile
+{
+
+    profiled_lock<mutex>    profiled_mtx("test_lock_profile::profiled_mtx");
+    spin_lock               site_lock;
+    size_t                  guarded_cnt = 0;
+
+    struct contender
+    {
+        static const size_t loops = 10000;
+
+        contender () {}
+        void operator() () const
+        {
+            for (size_t cnt = 0; cnt < loops; ++cnt)
+            {
+                {
+                    profiled_lock<mutex>::scoped_guard  guard(profiled_mtx);
+                    ++guarded_cnt;
+                }
+                {
+                    K2_PROFILED_GUARD(spin_lock, guard, site_lock);
+                    ++guarded_cnt;
+                }
+            }
+        }
+    };
+
+    void test ()
+    {
+        {
+            contender   worker;
+            thread      th(worker);
+            worker();
+        }
+        assert(guarded_cnt == contender::loops * 4);
+        cout << "Test of profiled_lock<> mutual exclusion passed." << endl;
+
+        lock_profile::stats stats;
+        profiled_mtx.profile().snapshot(stats);
+#if defined(K2_LOCK_PROFILING)
+        assert(stats.acquisitions == contender::loops * 2);
+        assert(stats.contentions <= stats.acquisitions);
+        cout << "Test of profiled_lock<> statistics passed." << endl;
+#else
+        assert(stats.acquisitions == 0);
+#endif  //  K2_LOCK_PROFILING
+
+        lock_profile::report(cout);
+    }
+
+}   //  namespace test_lock_profile
+
+#include <k2/reclaim.h>
+#include <k2/atomic.h>
+
+namespace test_reclaim
+{
+
+    atomic_int_t    live_nodes = 0;
+
+    struct node
+    {
+        node*   m_pnext;
+
+        node ()
+        :   m_pnext(0)
+        {
+            atomic_increase(live_nodes);
+        }
+        ~node ()
+        {
+            atomic_decrease(live_nodes);
+        }
+    };
+
+    //  Treiber stack, the simplest structure that needs reclamation.
+    node* volatile  stack_head = 0;
+
+    void push (node* pnode)
+    {
+        node*   old_head;
+        do
+        {
+            old_head = atomic_load(stack_head);
+            pnode->m_pnext = old_head;
+        }
+        while (atomic_cas(stack_head, old_head, pnode) == false);
+    }
+    node* pop_hazard ()
+    {
+        hazard_guard    hazard;
+        for (;;)
+        {
+            node*   old_head = hazard.protect(stack_head);
+            if (old_head == 0)
+                return  0;
+            if (atomic_cas(stack_head, old_head, old_head->m_pnext))
+                return  old_head;
+        }
+    }
+    node* pop_epoch ()
+    {
+        epoch_guard     critical_section;
+        for (;;)
+        {
+            node*   old_head = atomic_load(stack_head);
+            if (old_head == 0)
+                return  0;
+            if (atomic_cas(stack_head, old_head, old_head->m_pnext))
+                return  old_head;
+        }
+    }
+
+    struct pusher_popper
+    {
+        static const size_t loops = 100000;
+        bool    m_hazard;
+
+        pusher_popper (bool hazard)
+        :   m_hazard(hazard)
+        {
+        }
+        void operator() () const
+        {
+            for (size_t cnt = 0; cnt < loops; ++cnt)
+            {
+                push(new node);
+                if (m_hazard)
+                    hazard_reclaimer::retire(pop_hazard());
+                else
+                    epoch_reclaimer::retire(pop_epoch());
+            }
+        }
+    };
+
+    void test ()
+    {
+        {
+            pusher_popper   worker(true);
+            {
+                thread  th(worker);
+                worker();
+            }
+            hazard_reclaimer::collect();
+            assert(live_nodes == 0);
+            cout << "Test of hazard_guard/hazard_reclaimer passed." << endl;
+        }
+        {
+            pusher_popper   worker(false);
+            {
+                thread  th(worker);
+                worker();
+            }
+            epoch_reclaimer::collect();
+            epoch_reclaimer::collect();
+            assert(live_nodes == 0);
+            cout << "Test of epoch_guard/epoch_reclaimer passed." << endl;
+        }
+    }
+
+}   //  namespace test_reclaim
+
+#include <k2/mpmc_queue.h>
+
+namespace test_mpmc_queue
+{
+
+    mpmc_queue<long>    queue(64);
+
+    struct producer
+    {
+        static const long   loops = 100000;
+
+        void operator() () const
+        {
+            long    value = 1;
+            while (value <= loops)
+            {
+                long    batch[4] = { value, value + 1, value + 2, value + 3 };
+                size_t  cnt = size_t(loops - value + 1 < 4 ? loops - value + 1 : 4);
+                size_t  pushed = queue.try_push_n(batch, cnt);
+
+                value += long(pushed);
+                if (pushed == 0)
+                    queue.push(value++);
+            }
+        }
+    };
+
+    void test ()
+    {
+        long    sum = 0;
+        long    value = 0;
+        {
+            producer    prod;
+            thread      th0(prod);
+            thread      th1(prod);
+
+            long    cnt = 0;
+            for (; cnt < producer::loops * 2; ++cnt)
+            {
+                queue.pop(value);
+                sum += value;
+            }
+        }
+        assert(queue.empty());
+        assert(sum == producer::loops * (producer::loops + 1));
+        assert(queue.pop(value, timestamp(time_span(10))) == false);
+        cout << "Test of mpmc_queue<> passed." << endl;
+    }
+
+}   //  namespace test_mpmc_queue
+
+#include <k2/spsc_ring.h>
+
+namespace test_spsc_ring
+{
+
+    //  Counts live values, to check the ring destroys what it holds.
+    struct counted
+    {
+        static long s_live;
+
+        long    m_value;
+
+        counted (long value = 0)
+        :   m_value(value)
+        {
+            ++s_live;
+        }
+        counted (const counted& rhs)
+        :   m_value(rhs.m_value)
+        {
+            ++s_live;
+        }
+        ~counted ()
+        {
+            --s_live;
+        }
+    };
+    long counted::s_live = 0;
+
+    typedef spsc_ring<long, 64> ring_type;
+
+    ring_type   ring;
+
+    struct producer
+    {
+        static const long   loops = 100000;
+
+        void operator() () const
+        {
+            long    value = 0;
+            size_t  batch = 1;
+            while (value < loops)
+            {
+                if (batch == 1)
+                {
+                    while (ring.try_push(value) == false)
+                        thread::sleep(0);
+                    ++value;
+                }
+                else
+                {
+                    long    values[7];
+                    size_t  cnt = 0;
+                    for (; cnt < batch && value + long(cnt) < loops; ++cnt)
+                        values[cnt] = value + long(cnt);
+                    size_t  pushed = ring.try_push_n(values, cnt);
+                    if (pushed == 0)
+                        thread::sleep(0);
+                    value += long(pushed);
+                }
+                batch = batch % 7 + 1;
+            }
+        }
+    };
+
+    void test ()
+    {
+        {
+            //  Full and empty boundaries, across the wraparound.
+            spsc_ring<counted, 8>   small;
+            counted value;
+            assert(small.try_pop(value) == false);
+            assert(small.try_pop_n(&value, 1) == 0);
+
+            long    next_in = 0;
+            long    next_out = 0;
+            int     round = 0;
+            for (; round < 10; ++round)
+            {
+                while (small.try_push(counted(next_in)))
+                    ++next_in;
+                assert(small.size() == small.capacity());
+                assert(small.try_push(counted(next_in)) == false);
+                counted batch[16];
+                for (size_t idx = 0; idx < 16; ++idx)
+                    batch[idx] = counted(next_in + long(idx));
+                assert(small.try_push_n(batch, 16) == 0);
+
+                //  Frees 3 slots, a batch of 5 only takes 3.
+                size_t  idx = 0;
+                for (; idx < 3; ++idx)
+                {
+                    assert(small.try_pop(value));
+                    assert(value.m_value == next_out++);
+                }
+                assert(small.try_push_n(batch, 5) == 3);
+                next_in += 3;
+
+                //  A batch of 16 only gets what is there, in order.
+                counted out[16];
+                size_t  popped = small.try_pop_n(out, 16);
+                assert(popped == small.capacity());
+                for (idx = 0; idx < popped; ++idx)
+                    assert(out[idx].m_value == next_out++);
+                assert(small.empty());
+                assert(small.try_pop_n(out, 16) == 0);
+
+                //  Leaves the indices at a different offset each round.
+                for (idx = 0; idx < size_t(round % 8); ++idx)
+                {
+                    assert(small.try_push(counted(next_in++)));
+                    assert(small.try_pop(value));
+                    assert(value.m_value == next_out++);
+                }
+            }
+            assert(next_in == next_out);
+
+            //  Values left in are destroyed with the ring.
+            const long  live = counted::s_live;
+            assert(small.try_push(counted(1)));
+            assert(small.try_push(counted(2)));
+            assert(counted::s_live == live + 2);
+        }
+        assert(counted::s_live == 0);
+
+        {
+            //  Values come out in the order they went in.
+            producer    prod;
+            thread      th(prod);
+
+            long    expected = 0;
+            size_t  batch = 1;
+            while (expected < producer::loops)
+            {
+                long    values[5];
+                size_t  popped = 0;
+                if (batch == 1)
+                    popped = ring.try_pop(values[0]) ? 1 : 0;
+                else
+                    popped = ring.try_pop_n(values, batch);
+                if (popped == 0)
+                    thread::sleep(0);
+                size_t  idx = 0;
+                for (; idx < popped; ++idx)
+                    assert(values[idx] == expected++);
+                batch = batch % 5 + 1;
+            }
+        }
+        assert(ring.empty());
+        cout << "Test of spsc_ring<> passed." << endl;
+    }
+
+}   //  namespace test_spsc_ring
+
+#include <k2/concurrent_hash_map.h>
+
+namespace test_concurrent_hash_map
+{
+
+    typedef concurrent_hash_map<ipv4::transport_addr, long>   map_type;
+
+    map_type    peers(4, 2);
+
+    ipv4::transport_addr peer (long port)
+    {
+        return  ipv4::transport_addr(
+            ipv4::interface_addr(ipv4::interface_addr::loopback),
+            host16_t(port));
+    }
+
+    struct increase
+    {
+        void operator() (long& value) const
+        {
+            ++value;
+        }
+    };
+
+    struct writer
+    {
+        static const long   ports = 2000;
+
+        void operator() () const
+        {
+            long    port = 0;
+            for (; port < ports; ++port)
+                peers.insert(peer(port), 0);
+            for (port = 0; port < ports; ++port)
+                peers.insert_or_update(peer(port), 0, increase());
+            for (port = 0; port < ports; port += 2)
+                peers.erase(peer(port));
+        }
+    };
+
+    void test ()
+    {
+        {
+            writer  w;
+            thread  th(w);
+
+            //  Reads concurrently with inserts, updates, erases and
+            //  resizes of segments.
+            size_t  loop = 0;
+            for (; loop < 10; ++loop)
+            {
+                long    port = 0;
+                long    value = 0;
+                for (; port < writer::ports; ++port)
+                {
+                    if (peers.find(peer(port), value))
+                        assert(value == 0 || value == 1);
+                }
+            }
+        }
+
+        assert(peers.size() == size_t(writer::ports / 2));
+
+        long    port = 0;
+        long    value = 0;
+        for (; port < writer::ports; ++port)
+        {
+            if (port % 2)
+            {
+                assert(peers.find(peer(port), value) && value == 1);
+            }
+            else
+            {
+                assert(peers.contains(peer(port)) == false);
+            }
+        }
+
+        assert(peers.insert_or_assign(peer(1), 7) == false);
+        assert(peers.find(peer(1), value) && value == 7);
+
+        peers.clear();
+        epoch_reclaimer::collect();
+        assert(peers.empty());
+        cout << "Test of concurrent_hash_map<> passed." << endl;
+    }
+
+}   //  namespace test_concurrent_hash_map
+
+#include <k2/semaphore.h>
+#include <k2/latch.h>
+#include <k2/barrier.h>
+#include <k2/event.h>
+
+namespace test_sync
+{
+
+    static const int    loops = 10000;
+
+    semaphore   items;
+    latch       started(2);
+    barrier     phases(2);
+    event       ping(true);
+    event       pong(true);
+    atomic_int_t    phase_sum = 0;
+
+    struct worker
+    {
+        void operator() () const
+        {
+            started.count_down();
+
+            int cnt = 0;
+            for (; cnt < loops; ++cnt)
+                items.release();
+
+            for (cnt = 0; cnt < 100; ++cnt)
+            {
+                atomic_add(phase_sum, 1);
+                phases.arrive_and_wait();
+                assert(atomic_load(phase_sum) == (cnt + 1) * 2);
+                phases.arrive_and_wait();
+            }
+
+            for (cnt = 0; cnt < loops; ++cnt)
+            {
+                ping.wait();
+                pong.set();
+            }
+        }
+    };
+
+    struct arriver
+    {
+        barrier*    m_pbarrier;
+
+        void operator() () const
+        {
+            m_pbarrier->arrive_and_wait();
+        }
+    };
+
+    void test ()
+    {
+        {
+            worker  w;
+            thread  th0(w);
+            started.count_down();
+            started.wait();
+
+            int cnt = 0;
+            for (; cnt < loops; ++cnt)
+                items.acquire();
+            assert(items.acquire(timestamp(time_span(10))) == false);
+            cout << "Test of semaphore passed." << endl;
+
+            for (cnt = 0; cnt < 100; ++cnt)
+            {
+                atomic_add(phase_sum, 1);
+                phases.arrive_and_wait();
+                assert(atomic_load(phase_sum) == (cnt + 1) * 2);
+                phases.arrive_and_wait();
+            }
+
+            //  A timed-out thread arriving again is counted once.
+            barrier pair(2);
+            assert(pair.arrive_and_wait(timestamp(time_span(10))) == false);
+            assert(pair.arrive_and_wait(timestamp(time_span(10))) == false);
+            {
+                arriver a = { &pair };
+                thread  th1(a);
+                assert(pair.arrive_and_wait(timestamp(time_span(60 * 1000))));
+            }
+            cout << "Test of latch and barrier passed." << endl;
+
+            for (cnt = 0; cnt < loops; ++cnt)
+            {
+                ping.set();
+                pong.wait();
+            }
+            assert(pong.wait(timestamp(time_span(10))) == false);
+            cout << "Test of event passed." << endl;
+        }
+    }
+
+}   //  namespace test_sync
+
+#include <k2/sharded_counter.h>
+
+namespace test_sharded_counter
+{
+
+    sharded_counter requests;
+
+    struct worker
+    {
+        static const long   loops = 100000;
+
+        void operator() () const
+        {
+            long    cnt = 0;
+            for (; cnt < loops; ++cnt)
+                requests.increase();
+        }
+    };
+
+    void test ()
+    {
+        {
+            worker  w;
+            thread  th0(w);
+            thread  th1(w);
+            w();
+        }
+        assert(requests.read() == worker::loops * 3);
+        assert(requests.fold() == worker::loops * 3);
+        assert(requests.fold() == 0);
+
+        requests.add(5);
+        assert(requests.read() == worker::loops * 3 + 5);
+        assert(requests.reset() == worker::loops * 3 + 5);
+        assert(requests.read() == 0);
+        cout << "Test of sharded_counter passed." << endl;
+    }
+
+}   //  namespace test_sharded_counter
+
+#include <k2/thread_once.h>
+
+namespace test_thread_once
+{
+
+    thread_once once = K2_THREAD_ONCE_INIT;
+    atomic_int_t    calls = 0;
+
+    struct failing_once
+    {
+        void operator() () const
+        {
+            atomic_add(calls, 1);
+            throw   std::exception();
+        }
+    };
+    struct slow_once
+    {
+        void operator() () const
+        {
+            thread::sleep(time_span(100));
+            atomic_add(calls, 1);
+        }
+    };
+    struct caller
+    {
+        void operator() () const
+        {
+            once.run(slow_once());
+            assert(atomic_load(calls) == 2);
+        }
+    };
+
+    void test ()
+    {
+        try
+        {
+            once.run(failing_once());
+            assert(false);
+        }
+        catch (std::exception&)
+        {
+        }
+        assert(once.done() == false);
+
+        {
+            caller  c;
+            thread  th0(c);
+            thread  th1(c);
+            c();
+        }
+        assert(once.done() && atomic_load(calls) == 2);
+        cout << "Test of thread_once retry after exception passed." << endl;
+        cout << "Test of thread_once waiters passed." << endl;
+    }
+
+}   //  namespace test_thread_once
+
+#include <k2/flat_combining.h>
+#include <queue>
+
+namespace test_flat_combining
+{
+
+    typedef std::priority_queue<long>   heap_type;
+
+    flat_combining<heap_type>   heap;
+
+    struct push_op
+    {
+        long    m_value;
+
+        void operator() (heap_type& h)
+        {
+            h.push(m_value);
+        }
+    };
+    struct pop_op
+    {
+        long    m_value;
+
+        void operator() (heap_type& h)
+        {
+            m_value = h.top();
+            h.pop();
+        }
+    };
+    struct failing_op
+    {
+        void operator() (heap_type&)
+        {
+            throw   std::exception();
+        }
+    };
+
+    struct worker
+    {
+        static const long   loops = 10000;
+
+        void operator() () const
+        {
+            long    cnt = 0;
+            for (; cnt < loops; ++cnt)
+            {
+                push_op push = { cnt };
+                heap.apply(push);
+            }
+        }
+    };
+
+    void test ()
+    {
+        {
+            worker  w;
+            thread  th0(w);
+            thread  th1(w);
+            w();
+        }
+        assert(heap.unsafe_object().size() == size_t(worker::loops * 3));
+
+        long    last = worker::loops;
+        long    cnt = 0;
+        for (; cnt < worker::loops * 3; ++cnt)
+        {
+            pop_op  pop = { 0 };
+            heap.apply(pop);
+            assert(pop.m_value <= last);
+            last = pop.m_value;
+        }
+
+        try
+        {
+            failing_op  fail;
+            heap.apply(fail);
+            assert(false);
+        }
+        catch (critical_error&)
+        {
+        }
+        cout << "Test of flat_combining<> passed." << endl;
+    }
+
+}   //  namespace test_flat_combining
+
+#include <k2/snapshot_ptr.h>
+
+namespace test_snapshot_ptr
+{
+
+    atomic_int_t    live_configs = 0;
+
+    //  Both members are always equal in a published snapshot.
+    struct config
+    {
+        long    m_version;
+        long    m_copy;
+
+        config ()
+        :   m_version(0)
+        ,   m_copy(0)
+        {
+            atomic_increase(live_configs);
+        }
+        config (const config& rhs)
+        :   m_version(rhs.m_version)
+        ,   m_copy(rhs.m_copy)
+        {
+            atomic_increase(live_configs);
+        }
+        ~config ()
+        {
+            atomic_decrease(live_configs);
+        }
+    };
+
+    struct next_version
+    {
+        void operator() (config& cfg) const
+        {
+            ++cfg.m_version;
+            cfg.m_copy = cfg.m_version;
+        }
+    };
+
+    static const long   versions = 10000;
+
+    struct writer
+    {
+        snapshot_ptr<config>&   m_snapshot;
+
+        explicit writer (snapshot_ptr<config>& snapshot)
+        :   m_snapshot(snapshot)
+        {
+        }
+        void operator() () const
+        {
+            long    cnt = 0;
+            for (; cnt < versions; ++cnt)
+                m_snapshot.update(next_version());
+        }
+    };
+
+    //  Publishes fresh snapshots, versioned below zero, while the
+    //  writer copies the current one.
+    struct publisher
+    {
+        snapshot_ptr<config>&   m_snapshot;
+
+        explicit publisher (snapshot_ptr<config>& snapshot)
+        :   m_snapshot(snapshot)
+        {
+        }
+        void operator() () const
+        {
+            long    cnt = 0;
+            for (; cnt < versions; ++cnt)
+            {
+                std::auto_ptr<config>   pnew(new config);
+                pnew->m_version = pnew->m_copy = -cnt - 1;
+                m_snapshot.publish(pnew);
+            }
+        }
+    };
+
+    void test ()
+    {
+        {
+            snapshot_ptr<config>    snapshot(std::auto_ptr<config>(new config));
+            {
+                writer  w(snapshot);
+                thread  th(w);
+
+                long    last = 0;
+                while (last < versions)
+                {
+                    snapshot_ptr<config>::read_guard    cfg(snapshot);
+                    assert(cfg->m_version == cfg->m_copy);
+                    assert(cfg->m_version >= last);
+                    last = cfg->m_version;
+                }
+            }
+            epoch_reclaimer::collect();
+            epoch_reclaimer::collect();
+            assert(live_configs == 1);
+        }
+        assert(live_configs == 0);
+        {
+            //  publish() and update() mixed.
+            snapshot_ptr<config>    snapshot(std::auto_ptr<config>(new config));
+            {
+                writer      w(snapshot);
+                publisher   pub(snapshot);
+                thread      th1(w);
+                thread      th2(pub);
+
+                long    cnt = 0;
+                for (; cnt < versions; ++cnt)
+                {
+                    snapshot_ptr<config>::read_guard    cfg(snapshot);
+                    assert(cfg->m_version == cfg->m_copy);
+                }
+            }
+            epoch_reclaimer::collect();
+            epoch_reclaimer::collect();
+            assert(live_configs == 1);
+        }
+        assert(live_configs == 0);
+        cout << "Test of snapshot_ptr<> passed." << endl;
+    }
+
+}   //  namespace test_snapshot_ptr
+
+#include <k2/thread_pool.h>
+
+namespace test_thread_pool
+{
+
+    atomic_int_t    nodes_run = 0;
+
+    //  Fans out into a binary tree of tasks, from workers' own deques.
+    struct fan_out
+    {
+        thread_pool*    m_ppool;
+        int             m_depth;
+
+        void operator() () const
+        {
+            atomic_increase(nodes_run);
+            if (m_depth == 0)
+                return;
+
+            fan_out child = { m_ppool, m_depth - 1 };
+            m_ppool->submit(child);
+            m_ppool->submit(child);
+        }
+    };
+
+    atomic_int_t    spinners_live = 0;
+
+    //  Runs until cancelled.
+    struct spinner
+    {
+        spinner ()
+        {
+            atomic_increase(spinners_live);
+        }
+        spinner (const spinner&)
+        {
+            atomic_increase(spinners_live);
+        }
+        ~spinner ()
+        {
+            atomic_decrease(spinners_live);
+        }
+        void operator() () const
+        {
+            for (;;)
+            {
+                thread::test_cancel();
+                thread::sched_yield();
+            }
+        }
+    };
+
+    void test ()
+    {
+        static const int    depth = 14;
+        static const int    nodes = (1 << (depth + 1)) - 1;
+        {
+            thread_pool pool(4);
+            assert(pool.size() == 4);
+            assert(pool.on_worker() == false);
+
+            fan_out root = { &pool, depth };
+            assert(pool.submit(root));
+            while (nodes_run != nodes)
+            {
+                if (pool.run_one() == false)
+                    thread::sched_yield();
+            }
+
+            pool.shutdown();
+            assert(pool.submit(root) == false);
+        }
+        assert(nodes_run == nodes);
+
+        {
+            thread_pool pool(2);
+            int idx = 0;
+            for (; idx < 16; ++idx)
+                assert(pool.submit(spinner()));
+            pool.cancel();
+        }
+        assert(spinners_live == 0);
+        cout << "Test of thread_pool passed." << endl;
+    }
+
+}   //  namespace test_thread_pool
+
+namespace test_pooled_thread
+{
+
+    struct pool_a {};
+
+    atomic_int_t    entries_run = 0;
+
+    struct count_entry
+    {
+        void operator() () const
+        {
+            atomic_increase(entries_run);
+        }
+    };
+
+    struct wait_cancel_entry
+    {
+        void operator() () const
+        {
+            for (;;)
+            {
+                thread::test_cancel();
+                thread::sched_yield();
+            }
+        }
+    };
+
+    void test ()
+    {
+        typedef pooled_thread<4, pool_a>    pooled;
+
+        static const int    loop = 1000;
+        int idx = 0;
+        for (; idx < loop; ++idx)
+        {
+            pooled  th0((count_entry()));
+            pooled  th1((count_entry()));
+        }
+        assert(entries_run == loop * 2);
+        assert(pooled::parked() == 2);
+
+        //  Cancel state does not leak into the next entry.
+        {
+            pooled  th((wait_cancel_entry()));
+            th.cancel();
+        }
+        {
+            pooled  th((count_entry()));
+            th.join();
+        }
+        assert(entries_run == loop * 2 + 1);
+
+        for (idx = 0; idx < loop; ++idx)
+            pooled::spawn_detached(count_entry());
+        while (entries_run != loop * 3 + 1)
+            thread::sched_yield();
+        while (pooled::parked() < 4)
+            thread::sched_yield();
+        assert(pooled::parked() == 4);
+
+        timestamp   start;
+        for (idx = 0; idx < loop; ++idx)
+            thread  th((count_entry()));
+        time_span   spawned(timestamp() - start);
+
+        start = timestamp();
+        for (idx = 0; idx < loop; ++idx)
+            pooled  th((count_entry()));
+        time_span   pooled_spawned(timestamp() - start);
+
+        cout << "Test of pooled_thread<> passed, " << loop
+             << " thread: " << spawned.in_msec()
+             << " ms, pooled_thread<>: " << pooled_spawned.in_msec()
+             << " ms." << endl;
+    }
+
+}   //  namespace test_pooled_thread
+
+#include <k2/future.h>
+#include <stdexcept>
+
+namespace test_future
+{
+
+    struct add_one
+    {
+        typedef int result_type;
+
+        int operator() (const future<int>& f) const
+        {
+            return  f.get() + 1;
+        }
+    };
+
+    struct fail_on_odd
+    {
+        typedef void    result_type;
+
+        void operator() (const future<int>& f) const
+        {
+            if (f.get() % 2)
+                throw   std::logic_error("odd value");
+        }
+    };
+
+    struct produce
+    {
+        promise<int>    m_promise;
+        int             m_value;
+
+        void operator() ()
+        {
+            thread::sleep(10);
+            m_promise.set_value(m_value);
+        }
+    };
+
+    void test ()
+    {
+        //  Continuations chained before and after the value is set.
+        {
+            promise<int>    p;
+            future<int>     f = p.get_future();
+            future<int>     f2 = f.then(add_one()).then(add_one());
+            assert(f.ready() == false && f2.ready() == false);
+            p.set_value(40);
+            assert(f2.ready() && f2.get() == 42);
+            assert(f.then(add_one()).get() == 41);
+        }
+
+        //  std::exception becomes runtime_error, with its what().
+        {
+            promise<int>    p;
+            future<void>    f = p.get_future().then(fail_on_odd());
+            p.set_value(3);
+            bool    caught = false;
+            try
+            {
+                f.get();
+            }
+            catch (k2::runtime_error& x)
+            {
+                caught = std::strcmp(x.what(), "odd value") == 0;
+            }
+            assert(caught);
+        }
+
+        //  Broken promise.
+        {
+            future<int>     f;
+            {
+                promise<int>    p;
+                f = p.get_future();
+            }
+            bool    caught = false;
+            try
+            {
+                f.get();
+            }
+            catch (future_error&)
+            {
+                caught = true;
+            }
+            assert(caught);
+        }
+
+        //  Blocking get(), when_all and when_any, on other threads.
+        {
+            thread_pool pool(2);
+
+            std::vector<future<int> >   futures;
+            std::vector<thread*>        producers;
+            int idx = 0;
+            for (; idx < 4; ++idx)
+            {
+                produce prod;
+                prod.m_value = idx;
+                futures.push_back(prod.m_promise.get_future().then(pool, add_one()));
+                producers.push_back(new thread(prod));
+            }
+
+            future<size_t>  any = when_any(futures.begin(), futures.end());
+            future<std::vector<future<int> > >  all =
+                when_all(futures.begin(), futures.end());
+            assert(any.get() < 4);
+
+            const std::vector<future<int> >&    results = all.get();
+            for (idx = 0; idx < 4; ++idx)
+            {
+                assert(results[idx].ready());
+                assert(results[idx].get() == idx + 1);
+            }
+            for (idx = 0; idx < 4; ++idx)
+                delete  producers[idx];
+        }
+
+        {
+            promise<int>    p;
+            future<int>     f = p.get_future();
+            assert(f.wait(timestamp(time_span(10))) == false);
+            p.set_value(1);
+            assert(f.wait(timestamp(time_span(10))));
+        }
+        cout << "Test of future<> passed." << endl;
+    }
+
+}   //  namespace test_future
+
+#include <k2/parallel.h>
+#include <cstdlib>
+
+namespace test_parallel
+{
+
+    struct square_all
+    {
+        std::vector<long>&  m_values;
+
+        explicit square_all (std::vector<long>& values)
+        :   m_values(values)
+        {
+        }
+        void operator() (size_t first, size_t last) const
+        {
+            for (; first < last; ++first)
+                m_values[first] *= m_values[first];
+        }
+    };
+
+    struct negate
+    {
+        long operator() (long value) const
+        {
+            return  -value;
+        }
+    };
+
+    struct sum_range
+    {
+        const std::vector<long>&    m_values;
+
+        explicit sum_range (const std::vector<long>& values)
+        :   m_values(values)
+        {
+        }
+        long operator() (size_t first, size_t last) const
+        {
+            long    sum = 0;
+            for (; first < last; ++first)
+                sum += m_values[first];
+            return  sum;
+        }
+    };
+
+    struct throw_at
+    {
+        size_t  m_idx;
+
+        void operator() (size_t first, size_t last) const
+        {
+            if (first <= m_idx && m_idx < last)
+                throw   critical_error("throw_at");
+        }
+    };
+
+    //  Parallel algorithms nested in a pool's own task.
+    struct nested_sort
+    {
+        thread_pool*        m_ppool;
+        std::vector<long>*  m_pvalues;
+        atomic_int_t*       m_pdone;
+
+        void operator() () const
+        {
+            parallel_sort(*m_ppool, m_pvalues->begin(), m_pvalues->end(),
+                std::less<long>(), 64);
+            atomic_store(*m_pdone, 1);
+        }
+    };
+
+    void test ()
+    {
+        static const size_t cnt = 100000;
+        thread_pool         pool(4);
+
+        std::vector<long>   values(cnt);
+        size_t  idx = 0;
+        for (; idx < cnt; ++idx)
+            values[idx] = long(idx);
+
+        parallel_for(pool, size_t(0), cnt, square_all(values), 100);
+        for (idx = 0; idx < cnt; ++idx)
+            assert(values[idx] == long(idx * idx));
+
+        std::vector<long>   negated(cnt);
+        parallel_transform(pool, values.begin(), values.end(),
+            negated.begin(), negate());
+        for (idx = 0; idx < cnt; ++idx)
+            assert(negated[idx] == -values[idx]);
+
+        long    sum = parallel_reduce(pool, size_t(0), cnt, 0L,
+            sum_range(negated), std::plus<long>(), 333);
+        assert(sum == -sum_range(values)(0, cnt));
+
+        //  Many duplicates, then all equal.
+        for (idx = 0; idx < cnt; ++idx)
+            values[idx] = std::rand() % 1000;
+        parallel_sort(pool, values.begin(), values.end(), std::less<long>(), 64);
+        for (idx = 1; idx < cnt; ++idx)
+            assert(values[idx - 1] <= values[idx]);
+        std::fill(values.begin(), values.end(), 7L);
+        parallel_sort(pool, values.begin(), values.end(), std::less<long>(), 64);
+
+        for (idx = 0; idx < cnt; ++idx)
+            values[idx] = std::rand();
+        atomic_int_t    done = 0;
+        nested_sort     nested = { &pool, &values, &done };
+        pool.submit(nested);
+        while (atomic_load(done) == 0)
+            thread::sched_yield();
+        for (idx = 1; idx < cnt; ++idx)
+            assert(values[idx - 1] <= values[idx]);
+
+        bool    caught = false;
+        try
+        {
+            throw_at    body = { cnt / 2 };
+            parallel_for(pool, size_t(0), cnt, body, 10);
+        }
+        catch (critical_error&)
+        {
+            caught = true;
+        }
+        assert(caught);
+        cout << "Test of parallel algorithms passed." << endl;
+    }
+
+}   //  namespace test_parallel
+
+#include <k2/cpu_topology.h>
+#include <algorithm>
+
+namespace test_cpu_topology
+{
+
+    struct check_affinity
+    {
+        std::vector<int>    m_cpus;
+
+        void operator() () const
+        {
+            assert(thread::set_this_affinity(m_cpus));
+            assert(thread::this_affinity() == m_cpus);
+        }
+    };
+
+    void test ()
+    {
+        const cpu_topology& topology = cpu_topology::system();
+        const std::vector<cpu_topology::cpu>&   cpus = topology.cpus();
+        assert(cpus.empty() == false);
+        assert(topology.package_count() >= 1);
+        assert(topology.core_count() >= 1);
+        assert(topology.core_count() <= cpus.size());
+
+        std::vector<int>    allowed = topology.allowed_cpus();
+        assert(allowed.empty() == false);
+        assert(topology.usable_cpu_count() >= 1);
+        assert(topology.usable_cpu_count() <= allowed.size());
+
+        size_t  idx = 0;
+        for (; idx < cpus.size(); ++idx)
+        {
+            assert(cpus[idx].m_core < int(topology.core_count()));
+            if (cpus[idx].m_cache_group[1] >= 0)
+                assert(topology.shares_cache(cpus[idx].m_id, cpus[idx].m_id, 1));
+        }
+
+        //  Every placement uses allowed CPUs only, one per core when
+        //  asked to, wrapping around past the CPU count.
+        size_t  thread_cnt = allowed.size() * 2 + 1;
+        std::vector<int>    compact = topology.placement(cpu_topology::compact, thread_cnt);
+        std::vector<int>    spread = topology.placement(cpu_topology::spread, thread_cnt);
+        std::vector<int>    per_core = topology.placement(cpu_topology::one_per_core, thread_cnt);
+        assert(compact.size() == thread_cnt);
+        assert(spread.size() == thread_cnt);
+        assert(per_core.size() == thread_cnt);
+        for (idx = 0; idx < thread_cnt; ++idx)
+        {
+            assert(std::count(allowed.begin(), allowed.end(), compact[idx]) == 1);
+            assert(std::count(allowed.begin(), allowed.end(), spread[idx]) == 1);
+            assert(std::count(allowed.begin(), allowed.end(), per_core[idx]) == 1);
+        }
+        std::vector<int>    distinct(compact.begin(), compact.begin() + allowed.size());
+        std::sort(distinct.begin(), distinct.end());
+        assert(distinct == allowed);
+
+        std::vector<int>    before = thread::this_affinity();
+        if (before.empty() == false)
+        {
+            check_affinity  check;
+            check.m_cpus.push_back(allowed.back());
+            thread  th(check);
+
+            thread_pool pool(2);
+            assert(pool.place(cpu_topology::compact));
+        }
+        cout << "Test of cpu_topology passed, " << cpus.size() << " CPU(s), "
+             << topology.core_count() << " core(s), "
+             << topology.package_count() << " package(s)." << endl;
+    }
+
+}   //  namespace test_cpu_topology
+
+#include <k2/cancellation.h>
+#include <k2/cond_var.h>
+
+namespace test_cancellation
+{
+
+    struct sleeper
+    {
+        atomic_int_t*   m_pwoken;
+
+        void operator() () const
+        {
+            try
+            {
+                thread::sleep(time_span(60 * 1000));
+            }
+            catch (thread::cancel_signal&)
+            {
+                atomic_store(*m_pwoken, 1);
+                throw;
+            }
+        }
+    };
+
+    struct cv_waiter
+    {
+        mutex*          m_pmtx;
+        cond_var*       m_pcv;
+        cancel_token*   m_ptoken;
+        atomic_int_t*   m_presult;
+
+        void operator() () const
+        {
+            mutex::scoped_guard guard(*m_pmtx);
+            timestamp   timer(time_span(60 * 1000));
+            //  false once cancelled, never signalled.
+            bool signalled = m_pcv->wait(timer, *m_ptoken);
+            atomic_store(*m_presult, signalled ? 1 : 2);
+        }
+    };
+
+    void count_fire (void* arg)
+    {
+        atomic_increase(*static_cast<atomic_int_t*>(arg));
+    }
+    void count_throw (void* arg)
+    {
+        atomic_increase(*static_cast<atomic_int_t*>(arg));
+        throw   std::runtime_error("callback");
+    }
+
+    void test ()
+    {
+        {
+            cancel_token    token;
+            cancel_token    copy(token);
+            assert(token == copy);
+            assert(token.cancelled() == false);
+            timestamp   timer(time_span(10));
+            assert(token.wait(timer) == false);
+
+            atomic_int_t    fired = 0;
+            atomic_int_t    unfired = 0;
+            cancel_token::registration  reg(token, count_fire, &fired);
+            {
+                cancel_token::registration  gone(token, count_fire, &unfired);
+            }
+            copy.cancel();
+            copy.cancel();
+            assert(token.cancelled());
+            assert(fired == 1);
+            assert(unfired == 0);
+            token.wait();
+            bool    caught = false;
+            try
+            {
+                token.throw_if_cancelled();
+            }
+            catch (cancelled_error&)
+            {
+                caught = true;
+            }
+            assert(caught);
+
+            //  Registering with a cancelled token never fires.
+            cancel_token::registration  late(token, count_fire, &fired);
+            assert(fired == 1);
+        }
+        {
+            //  Throwing callbacks do not stop the others.
+            cancel_token    token;
+            atomic_int_t    fired = 0;
+            cancel_token::registration  reg1(token, count_throw, &fired);
+            cancel_token::registration  reg2(token, count_fire, &fired);
+            cancel_token::registration  reg3(token, count_throw, &fired);
+            bool    caught = false;
+            try
+            {
+                token.cancel();
+            }
+            catch (std::runtime_error&)
+            {
+                caught = true;
+            }
+            assert(caught);
+            assert(fired == 3);
+            assert(token.cancelled());
+        }
+
+        //  thread::cancel() ends a sleep at once.
+        {
+            atomic_int_t    woken = 0;
+            sleeper     entry = { &woken };
+            timestamp   start;
+            {
+                thread  th(entry);
+                thread::sleep(time_span(20));
+                th.cancel();
+            }
+            assert(woken == 1);
+            assert(timestamp::now - start < time_span(10 * 1000));
+        }
+
+        //  Cancellation wakes a cond_var wait.
+        {
+            mutex           mtx;
+            cond_var        cv(mtx);
+            cancel_token    token;
+            atomic_int_t    result = 0;
+            cv_waiter   entry = { &mtx, &cv, &token, &result };
+            timestamp   start;
+            {
+                thread  th(entry);
+                thread::sleep(time_span(20));
+                token.cancel();
+            }
+            assert(result == 2);
+            assert(timestamp::now - start < time_span(10 * 1000));
+        }
+
+        //  A thread not spawned by k2 is never cancelled.
+        assert(thread::this_cancel_token().cancelled() == false);
+        cout << "Test of cancellation passed." << endl;
+    }
+
+}   //  namespace test_cancellation
+
+#include <k2/timer_wheel.h>
+
+namespace test_timer_wheel
+{
+
+    struct record_fire
+    {
+        atomic_int_t*   m_pcount;
+        uint64_t        m_due;
+        atomic_int_t*   m_pearly;
+
+        void operator() () const
+        {
+            if (timestamp().in_msec() < m_due)
+                atomic_increase(*m_pearly);
+            atomic_increase(*m_pcount);
+        }
+    };
+
+    void wait_count (atomic_int_t& count, int expected)
+    {
+        timestamp   timer(time_span(10 * 1000));
+        while (atomic_load(count) < expected && timer.expired() == false)
+            thread::sleep(time_span(5));
+    }
+
+    void test ()
+    {
+        atomic_int_t    count = 0;
+        atomic_int_t    early = 0;
+
+        //  Driven by advance(), as from an event loop.
+        {
+            timer_wheel wheel((time_span(1)));
+            record_fire fire = { &count, timestamp().in_msec() + 10, &early };
+            wheel.schedule(time_span(10), fire);
+            fire.m_due += 10;
+            wheel.schedule(time_span(20), fire);
+            timer_wheel::handle far = wheel.schedule(time_span(3600 * 1000), fire);
+            assert(wheel.pending() == 3);
+            assert(wheel.cancel(far));
+            assert(wheel.cancel(far) == false);
+            assert(wheel.cancel(timer_wheel::handle()) == false);
+            assert(wheel.next_due() <= time_span(10));
+
+            timestamp   timer(time_span(10 * 1000));
+            while (wheel.pending() && timer.expired() == false)
+            {
+                thread::sleep(wheel.next_due());
+                wheel.advance();
+            }
+            assert(count == 2);
+            assert(wheel.pending() == 0);
+
+            //  Pending timers are discarded on destruction.
+            wheel.schedule(time_span(3600 * 1000), fire);
+        }
+
+        //  Driven by its own thread, across cascades of level one.
+        {
+            count = 0;
+            timer_wheel wheel((time_span(1)));
+            wheel.start();
+            const int   timer_cnt = 1000;
+            int idx = 0;
+            for (; idx < timer_cnt; ++idx)
+            {
+                uint64_t    delay = (idx * 7919) % 600;
+                record_fire fire = { &count, timestamp().in_msec() + delay, &early };
+                wheel.schedule(time_span(delay), fire);
+            }
+            wait_count(count, timer_cnt);
+            assert(count == timer_cnt);
+            wheel.stop();
+        }
+
+        //  Dispatched onto an executor.
+        {
+            count = 0;
+            thread_pool pool(2);
+            timer_wheel wheel((time_span(1)));
+            wheel.start();
+            record_fire fire = { &count, timestamp().in_msec() + 15, &early };
+            wheel.schedule(time_span(15), fire, pool);
+            wait_count(count, 1);
+            assert(count == 1);
+        }
+
+        assert(early == 0);
+        cout << "Test of timer_wheel passed." << endl;
+    }
+
+}   //  namespace test_timer_wheel
+
+#include <k2/fiber.h>
+
+namespace test_fiber
+{
+
+    struct counting_fiber
+    {
+        fiber_mutex*    m_pmtx;
+        size_t*         m_pcount;
+
+        void operator() () const
+        {
+            size_t  idx = 0;
+            for (; idx < 10; ++idx)
+            {
+                {
+                    fiber_mutex::scoped_guard   guard(*m_pmtx);
+                    size_t  count = *m_pcount;
+                    //  Switches inside the critical section.
+                    fiber::yield();
+                    *m_pcount = count + 1;
+                }
+                fiber::yield();
+            }
+            fiber::sleep(time_span(1));
+        }
+    };
+
+    struct channel
+    {
+        fiber_mutex     m_mtx;
+        fiber_cond_var  m_cv;
+        size_t          m_value;
+        bool            m_full;
+
+        channel ()
+        :   m_cv(m_mtx)
+        ,   m_value(0)
+        ,   m_full(false)
+        {
+        }
+    };
+
+    struct producer
+    {
+        channel*    m_pchannel;
+        size_t      m_cnt;
+
+        void operator() () const
+        {
+            size_t  idx = 1;
+            for (; idx <= m_cnt; ++idx)
+            {
+                fiber_mutex::scoped_guard   guard(m_pchannel->m_mtx);
+                while (m_pchannel->m_full)
+                    m_pchannel->m_cv.wait();
+                m_pchannel->m_value = idx;
+                m_pchannel->m_full = true;
+                m_pchannel->m_cv.broadcast();
+            }
+        }
+    };
+
+    struct consumer
+    {
+        channel*    m_pchannel;
+        size_t      m_cnt;
+        size_t*     m_psum;
+
+        void operator() () const
+        {
+            size_t  idx = 0;
+            for (; idx < m_cnt; ++idx)
+            {
+                fiber_mutex::scoped_guard   guard(m_pchannel->m_mtx);
+                while (m_pchannel->m_full == false)
+                    m_pchannel->m_cv.wait();
+                *m_psum += m_pchannel->m_value;
+                m_pchannel->m_full = false;
+                m_pchannel->m_cv.broadcast();
+            }
+        }
+    };
+
+    struct timed_waiter
+    {
+        atomic_int_t*   m_presult;
+
+        void operator() () const
+        {
+            fiber_mutex     mtx;
+            fiber_cond_var  cv(mtx);
+            fiber_mutex::scoped_guard   guard(mtx);
+            timestamp   timer(time_span(20));
+            bool signalled = cv.wait(timer);
+            atomic_store(*m_presult, signalled ? 1 : 2);
+        }
+    };
+
+    void test ()
+    {
+        const size_t    fiber_cnt = 1000;
+        size_t          count = 0;
+        {
+            fiber_scheduler sched(2, 16 * 1024);
+            assert(sched.size() == 2);
+            fiber_mutex     mtx;
+            counting_fiber  entry = { &mtx, &count };
+            size_t  idx = 0;
+            for (; idx < fiber_cnt; ++idx)
+                assert(sched.spawn(entry));
+
+            //  A thread running no fiber shares the mutex.
+            for (idx = 0; idx < 100; ++idx)
+            {
+                fiber_mutex::scoped_guard   guard(mtx);
+                ++count;
+            }
+            sched.shutdown();
+            assert(sched.fiber_count() == 0);
+            assert(sched.spawn(entry) == false);
+        }
+        assert(count == fiber_cnt * 10 + 100);
+
+        {
+            const size_t    item_cnt = 1000;
+            size_t          sum = 0;
+            atomic_int_t    timed = 0;
+            channel         chan;
+            fiber_scheduler sched(3);
+            producer    prod = { &chan, item_cnt };
+            consumer    cons = { &chan, item_cnt, &sum };
+            timed_waiter    waiter = { &timed };
+            sched.spawn(cons);
+            sched.spawn(prod);
+            sched.spawn(waiter);
+            sched.shutdown();
+            assert(sum == item_cnt * (item_cnt + 1) / 2);
+            assert(timed == 2);
+        }
+
+        assert(fiber::on_fiber() == false);
+        cout << "Test of fiber passed." << endl;
+    }
+
+}   //  namespace test_fiber
+
+#include <k2/event_loop.h>
+#include <k2/coroutine.h>
+
+namespace test_event_loop
+{
+
+    struct flag_handler
+    {
+        static void on_event (void* arg, bool ready)
+        {
+            *static_cast<int*>(arg) = ready ? 1 : -1;
+        }
+    };
+
+    struct stopper
+    {
+        event_loop* m_ploop;
+        int*        m_pposted;
+
+        void operator() () const
+        {
+            ++*m_pposted;
+            m_ploop->stop();
+        }
+    };
+    struct remote_poster
+    {
+        event_loop* m_ploop;
+        int*        m_pposted;
+
+        void operator() () const
+        {
+            thread::sleep(time_span(50));
+            stopper task = { m_ploop, m_pposted };
+            m_ploop->post(task);
+        }
+    };
+
+#if defined(K2_HAS_COROUTINES)
+    task<size_t> echo_once (event_loop& loop, ipv4::tcp_listener& listener)
+    {
+        std::unique_ptr<ipv4::tcp_transport>    peer =
+            co_await async_accept(loop, listener);
+        char    buf[64];
+        size_t  bytes = co_await async_read(loop, *peer, buf, sizeof(buf));
+        co_await async_write(loop, *peer, buf, bytes);
+        co_return   bytes;
+    }
+    task<bool> ask (event_loop& loop, const ipv4::transport_addr& addr)
+    {
+        std::unique_ptr<ipv4::tcp_transport>    active_end =
+            co_await async_connect(loop, addr);
+        const char  msg[] = "a message string";
+        char        buf[sizeof(msg)] = "";
+        co_await async_write(loop, *active_end, msg, sizeof(msg));
+        size_t  bytes = 0;
+        while (bytes < sizeof(buf))
+        {
+            size_t  res = co_await async_read(
+                loop, *active_end, buf + bytes, sizeof(buf) - bytes);
+            if (res == 0)
+                break;
+            bytes += res;
+        }
+        co_return   strcmp(buf, msg) == 0;
+    }
+    task<size_t> receive (event_loop& loop, ipv4::udp_transport& udp)
+    {
+        char    buf[64];
+        ipv4::transport_addr    from;
+        co_return   co_await async_recvfrom(loop, udp, buf, sizeof(buf), from);
+    }
+    task<bool> echo_both (event_loop& loop, ipv4::tcp_listener& listener)
+    {
+        spawn(echo_once(loop, listener));
+        co_return   co_await ask(loop, listener.local_addr());
+    }
+#endif  //  K2_HAS_COROUTINES
+
+    void test ()
+    {
+        using namespace ipv4;
+
+        event_loop  loop;
+        transport_addr  addr(interface_addr::loopback, 7790);
+        tcp_listener    listener(addr);
+
+        int accepted = 0;
+        assert(loop.watch(listener.get_desc(), false, flag_handler::on_event, &accepted));
+        assert(loop.watch(listener.get_desc(), false, flag_handler::on_event, &accepted) == false);
+
+        tcp_transport   active_end(addr, tcp_transport::connect_deferred);
+        int connected = 0;
+        loop.watch(active_end.get_desc(), true, flag_handler::on_event, &connected);
+        assert(loop.watches() == 2);
+        while (accepted == 0 || connected == 0)
+            loop.run_once(time_span(1000));
+        assert(accepted == 1 && connected == 1);
+        assert(loop.watches() == 0);
+        active_end.finish_connect();
+
+        std::auto_ptr<tcp_transport>    passive_end = listener.try_accept();
+        assert(passive_end.get() != 0);
+        assert(listener.try_accept().get() == 0);
+
+        char    buf[64];
+        assert(passive_end->try_read(buf, sizeof(buf)) == tcp_transport::would_block);
+        int readable = 0;
+        loop.watch(passive_end->get_desc(), false, flag_handler::on_event, &readable);
+        const char  msg[] = "a message string";
+        assert(active_end.try_write(msg, sizeof(msg)) == sizeof(msg));
+        while (readable == 0)
+            loop.run_once(time_span(1000));
+        assert(readable == 1);
+        assert(passive_end->try_read(buf, sizeof(buf)) == sizeof(msg));
+        assert(strcmp(buf, msg) == 0);
+        cout << "Test of event_loop watch passed." << endl;
+
+        int timedout = 0;
+        timestamp   timer(time_span(20));
+        loop.watch(passive_end->get_desc(), false, flag_handler::on_event, &timedout, &timer);
+        while (timedout == 0)
+            loop.run_once(time_span(1000));
+        assert(timedout == -1);
+        assert(loop.watches() == 0);
+
+        int unwatched = 0;
+        loop.watch(passive_end->get_desc(), false, flag_handler::on_event, &unwatched);
+        assert(loop.unwatch(passive_end->get_desc(), false));
+        assert(loop.unwatch(passive_end->get_desc(), false) == false);
+        active_end.write_all(msg, sizeof(msg));
+        loop.run_once(time_span(50));
+        assert(unwatched == 0);
+        cout << "Test of event_loop timed watch passed." << endl;
+
+        int posted = 0;
+        {
+            remote_poster   poster = { &loop, &posted };
+            thread  th(poster);
+            loop.run();
+        }
+        assert(posted == 1);
+        cout << "Test of event_loop post passed." << endl;
+
+#if defined(K2_HAS_COROUTINES)
+        transport_addr  echo_addr(interface_addr::loopback, 7791);
+        tcp_listener    echo_listener(echo_addr);
+        assert(sync_wait(loop, echo_both(loop, echo_listener)));
+
+        transport_addr  udp_addr(interface_addr::loopback, 7792);
+        udp_transport   udp(udp_addr);
+        udp_transport   sender;
+        sender.write(msg, sizeof(msg), udp_addr);
+        assert(sync_wait(loop, receive(loop, udp)) == sizeof(msg));
+        cout << "Test of coroutine transports passed." << endl;
+#endif  //  K2_HAS_COROUTINES
+    }
+
+}   //  namespace test_event_loop
+
+#include <k2/tls_ptr.h>
+
+namespace test_static_tls
+{
+
+    atomic_int_t    destroyed = 0;
+
+    struct counted
+    {
+        ~counted ()
+        {
+            atomic_increase(destroyed);
+        }
+    };
+    struct singleton_tag;
+    typedef thread_local_singleton<counted, singleton_tag>  counted_singleton;
+
+    struct tls_user
+    {
+        counted**   m_pinstance;
+
+        void operator() () const
+        {
+            assert(static_tls_ptr<counted>::get() == 0);
+            static_tls_ptr<counted>::reset(new counted);
+            assert(static_tls_ptr<counted>::get() != 0);
+
+            counted*    p = static_tls_ptr<counted>::release();
+            assert(static_tls_ptr<counted>::get() == 0);
+            static_tls_ptr<counted>::reset(p);
+
+            *m_pinstance = &counted_singleton::instance();
+            assert(*m_pinstance == &counted_singleton::instance());
+        }
+    };
+
+    void test ()
+    {
+        counted*    main_instance = &counted_singleton::instance();
+        counted*    thread_instance = 0;
+        {
+            tls_user    user = { &thread_instance };
+            thread  th(user);
+        }
+        assert(thread_instance != 0 && thread_instance != main_instance);
+        assert(main_instance == &counted_singleton::instance());
+        //  Both objects of the thread deleted on its exit.
+        assert(atomic_load(destroyed) == 2);
+        assert(static_tls_ptr<counted>::get() == 0);
+        cout << "Test of static_tls_ptr<> and thread_local_singleton<> passed." << endl;
+    }
+
+}   //  namespace test_static_tls
+
+#include <k2/actor.h>
+#include <string>
+
+namespace test_actor
+{
+
+    atomic_int_t    destroyed = 0;
+
+    class summer
+    :   public actor<long>
+    {
+    public:
+        explicit summer (actor_system& system)
+        :   actor<long>(system)
+        ,   m_sum(0)
+        ,   m_cnt(0)
+        {
+        }
+        ~summer ()
+        {
+            atomic_increase(destroyed);
+        }
+
+        long    m_sum;
+        long    m_cnt;
+
+    private:
+        virtual void receive (long& value)
+        {
+            if (value < 0)
+                throw   std::runtime_error("negative");
+            m_sum += value;
+            ++m_cnt;
+        }
+    };
+
+    struct sender
+    {
+        actor_ptr<summer>   m_ptarget;
+
+        void operator() () const
+        {
+            long    value = 1;
+            for (; value <= 1000; ++value)
+                m_ptarget->send(value);
+        }
+    };
+
+    //  Bounces a count between two actors down to zero.
+    struct ball
+    {
+        class player*   m_pfrom;
+        long            m_count;
+    };
+    class player
+    :   public actor<ball>
+    {
+    public:
+        explicit player (actor_system& system)
+        :   actor<ball>(system)
+        ,   m_hits(0)
+        {
+        }
+
+        long    m_hits;
+
+    private:
+        virtual void receive (ball& msg)
+        {
+            ++m_hits;
+            if (msg.m_count == 0)
+                return;
+            ball    back = { this, msg.m_count - 1 };
+            msg.m_pfrom->send(back);
+        }
+    };
+
+    struct big_message
+    {
+        char    m_bytes[1000];
+    };
+    class big_receiver
+    :   public actor<big_message>
+    {
+    public:
+        explicit big_receiver (actor_system& system)
+        :   actor<big_message>(system)
+        ,   m_last(0)
+        {
+        }
+
+        char    m_last;
+
+    private:
+        virtual void receive (big_message& msg)
+        {
+            m_last = msg.m_bytes[999];
+        }
+    };
+
+    //  Owns the transport, writes each message received to it.
+    class line_writer
+    :   public actor<std::string>
+    {
+    public:
+        line_writer (actor_system& system, const ipv4::transport_addr& addr)
+        :   actor<std::string>(system)
+        ,   m_transport(addr)
+        {
+        }
+
+    private:
+        virtual void receive (std::string& line)
+        {
+            m_transport.write_all(line.data(), line.size());
+        }
+
+        ipv4::tcp_transport m_transport;
+    };
+
+    void test ()
+    {
+        {
+            actor_system    system(4, 16);
+            assert(system.size() == 4);
+            actor_ptr<summer>   ptarget(new summer(system));
+            {
+                sender  s = { ptarget };
+                thread  th0(s);
+                thread  th1(s);
+                thread  th2(s);
+                s();
+            }
+            ptarget->send(-1);
+            system.shutdown();
+            assert(ptarget->m_sum == 4 * 500500);
+            assert(ptarget->m_cnt == 4000);
+            cout << "Test of actor<> fan-in passed." << endl;
+        }
+        assert(atomic_load(destroyed) == 1);
+
+        {
+            actor_system    system(2);
+            actor_ptr<player>   pping(new player(system));
+            actor_ptr<player>   ppong(new player(system));
+            ball    serve = { ppong.get(), 10001 };
+            pping->send(serve);
+            system.shutdown();
+            assert(pping->m_hits == 5001 && ppong->m_hits == 5001);
+            cout << "Test of actor<> ping-pong passed." << endl;
+        }
+
+        {
+            actor_system    system(1);
+            actor_ptr<summer>   powner(new summer(system));
+            actor_ptr<actor<long> > phandle(powner);
+            powner.reset();
+            phandle->send(1);
+            phandle.reset();
+            system.shutdown();
+            //  Deleted once idle, with its last handle gone.
+            assert(atomic_load(destroyed) == 2);
+
+            actor_ptr<summer>   pidle(new summer(system));
+            pidle->send(1);
+            pidle.reset();
+            assert(atomic_load(destroyed) == 2);
+        }
+        //  Undelivered after shutdown, deleted with the system.
+        assert(atomic_load(destroyed) == 3);
+
+        {
+            actor_system    system(1);
+            actor_ptr<big_receiver> preceiver(new big_receiver(system));
+            big_message msg;
+            msg.m_bytes[999] = 'z';
+            preceiver->send(msg);
+            system.shutdown();
+            assert(preceiver->m_last == 'z');
+        }
+        cout << "Test of actor<> lifetime passed." << endl;
+
+        {
+            using namespace ipv4;
+
+            transport_addr  addr(interface_addr::loopback, 7793);
+            tcp_listener    listener(addr);
+            actor_system    system(2);
+            actor_ptr<line_writer>  pwriter(new line_writer(system, addr));
+            std::auto_ptr<tcp_transport>    ppeer = listener.accept();
+            pwriter->send("first ");
+            pwriter->send("second");
+            system.shutdown();
+
+            char    buf[16];
+            assert(ppeer->read_all(buf, 12) == 12);
+            assert(std::string(buf, 12) == "first second");
+            cout << "Test of actor<> owning a transport passed." << endl;
+        }
+    }
+
+}   //  namespace test_actor
+
+#include <k2/pipeline.h>
+#include <sstream>
+
+namespace test_pipeline
+{
+
+    atomic_long_t   sink_sum = 0;
+
+    //  Emits each odd value twice, drops even ones, throws on 13.
+    struct duplicate_odd
+    {
+        typedef int     input_type;
+        typedef long    output_type;
+
+        void operator() (int& in, pipeline_output<long>& out)
+        {
+            if (in == 13)
+                throw   std::runtime_error("13");
+            if (in % 2 == 0)
+                return;
+            out.push(in);
+            out.push(in);
+        }
+    };
+    struct square
+    {
+        typedef long    input_type;
+        typedef long    output_type;
+
+        void operator() (long& in, pipeline_output<long>& out)
+        {
+            out.push(in * in);
+        }
+    };
+    struct summer
+    {
+        typedef long    input_type;
+
+        void operator() (long& in)
+        {
+            atomic_add(sink_sum, in);
+        }
+    };
+
+    //  Holds each value until the gate opens.
+    struct gated
+    {
+        typedef int     input_type;
+        typedef int     output_type;
+
+        event*  m_pgate;
+
+        void operator() (int& in, pipeline_output<int>& out)
+        {
+            m_pgate->wait();
+            out.push(in);
+        }
+    };
+
+    void test ()
+    {
+        long    expected = 0;
+        {
+            pipeline    pipe(64, 8);
+            pipeline_port<int>  in = pipe.input<int>();
+            pipeline_port<long> odd = pipe.stage(in, duplicate_odd(), 2, "odd");
+            pipeline_port<long> squared = pipe.stage(odd, square(), 3, "square");
+            pipe.sink(squared, summer(), 2, "sum");
+
+            int value = 0;
+            for (; value < 10000; ++value)
+            {
+                in.push(value);
+                if (value % 2 && value != 13)
+                    expected += 2L * value * value;
+            }
+            pipe.close();
+            pipe.wait();
+            assert(atomic_load(sink_sum) == expected);
+
+            std::vector<pipeline_stage_stats>   stats;
+            pipe.stats(stats);
+            assert(stats.size() == 3);
+            assert(strcmp(stats[0].name, "odd") == 0 && stats[0].workers == 2);
+            assert(stats[0].items_in == 10000 && stats[0].errors == 1);
+            assert(stats[0].items_out == 2 * 4999);
+            assert(stats[1].items_in == 2 * 4999 && stats[1].items_out == 2 * 4999);
+            assert(stats[2].items_in == 2 * 4999 && stats[2].workers == 2);
+            assert(stats[2].queue_depth == 0 && stats[2].queue_capacity == 64);
+
+            std::ostringstream  os;
+            pipe.report(os);
+            assert(os.str().find("square") != std::string::npos);
+        }
+        cout << "Test of pipeline stages passed." << endl;
+
+        {
+            event   gate;
+            pipeline    pipe(4, 1);
+            pipeline_port<int>  in = pipe.input<int>();
+            gated   g = { &gate };
+            pipeline_port<int>  out = pipe.stage(in, g, 1, "gated");
+
+            //  One value held by the stage, four queued.
+            int pushed = 0;
+            timestamp   timer(time_span(5000));
+            while (pushed < 5)
+            {
+                if (in.try_push(pushed))
+                    ++pushed;
+                else
+                    assert(timestamp::now < timer);
+            }
+            assert(in.try_push(pushed) == false);
+            assert(in.size() == in.capacity());
+            gate.set();
+            pipe.close();
+
+            int value;
+            int cnt = 0;
+            while (out.pop(value))
+                assert(value == cnt++);
+            assert(cnt == pushed);
+            pipe.wait();
+        }
+        cout << "Test of pipeline backpressure passed." << endl;
+    }
+
+}   //  namespace test_pipeline
+
+namespace test_thread_options
+{
+
+    //  Records where its stack is, touching some of it.
+    struct stack_probe
+    {
+        char**  m_plocal;
+
+        void operator() () const
+        {
+            char    buf[8192];
+            memset(buf, 1, sizeof(buf));
+            *m_plocal = buf;
+        }
+    };
+
+    void test ()
+    {
+        char*   local = 0;
+        {
+            thread::spawn_options   options;
+            options.stack_size = 64 * 1024;
+            options.guard_size = 0;
+            stack_probe probe = { &local };
+            thread  th(probe, options);
+        }
+        assert(local != 0);
+
+        thread_stack_pool   pool(64 * 1024, 2);
+        assert(pool.stack_size() >= 64 * 1024);
+        pool.reserve(4);
+#if !defined(WIN32)
+        assert(pool.free_stacks() == 2);
+        {
+            thread::spawn_options   options;
+            options.stack_pool = &pool;
+            stack_probe probe0 = { &local };
+            thread  th0(probe0, options);
+            char*   local1 = 0;
+            stack_probe probe1 = { &local1 };
+            thread  th1(probe1, options);
+            char*   local2 = 0;
+            stack_probe probe2 = { &local2 };
+            thread  th2(probe2, options);
+            th0.join();
+            th1.join();
+            th2.join();
+            assert(pool.free_stacks() == 0);
+        }
+        //  Back on join, the one beyond capacity unmapped.
+        assert(pool.free_stacks() == 2);
+
+        static union
+        {
+            char        bytes[256 * 1024];
+            long double align_long_double;
+            void*       align_pointer;
+        }   given;
+        {
+            thread::spawn_options   options;
+            options.stack = given.bytes;
+            options.stack_size = sizeof(given.bytes);
+            stack_probe probe = { &local };
+            thread  th(probe, options);
+        }
+        assert(local > given.bytes && local < given.bytes + sizeof(given.bytes));
+#endif  //  !WIN32
+
+        {
+            thread::spawn_options   options;
+            options.policy = thread::spawn_options::sched_other;
+            stack_probe probe = { &local };
+            thread  th(probe, options);
+        }
+        cout << "Test of thread::spawn_options passed." << endl;
+    }
+
+}   //  namespace test_thread_options
+
+#include <k2/inplace_function.h>
+
+namespace test_inplace_function
+{
+
+    //  Counts live copies, and calls.
+    template <size_t Size>
+    struct counted
+    {
+        static atomic_int_t s_live;
+
+        atomic_int_t*   m_pcalls;
+        char    m_pad[Size];
+
+        explicit counted (atomic_int_t* pcalls)
+        :   m_pcalls(pcalls)
+        {
+            atomic_increase(s_live);
+        }
+        counted (const counted& rhs)
+        :   m_pcalls(rhs.m_pcalls)
+        {
+            atomic_increase(s_live);
+        }
+        ~counted ()
+        {
+            atomic_decrease(s_live);
+        }
+
+        void operator() () const
+        {
+            atomic_increase(*m_pcalls);
+        }
+    };
+    template <size_t Size>
+    atomic_int_t counted<Size>::s_live = 0;
+
+    typedef counted<8>      small_type;
+    typedef counted<256>    large_type;
+
+    //  The n-th copy throws if bit n of s_fail_mask is set.
+    struct fragile
+    {
+        static atomic_int_t s_live;
+        static int          s_copies;
+        static int          s_fail_mask;
+
+        atomic_int_t*   m_pcalls;
+
+        explicit fragile (atomic_int_t* pcalls)
+        :   m_pcalls(pcalls)
+        {
+            atomic_increase(s_live);
+        }
+        fragile (const fragile& rhs)
+        :   m_pcalls(rhs.m_pcalls)
+        {
+            if (s_fail_mask & (1 << ++s_copies))
+                throw   std::runtime_error("copy");
+            atomic_increase(s_live);
+        }
+        ~fragile ()
+        {
+            atomic_decrease(s_live);
+        }
+
+        void operator() () const
+        {
+            atomic_increase(*m_pcalls);
+        }
+    };
+    atomic_int_t    fragile::s_live = 0;
+    int             fragile::s_copies = 0;
+    int             fragile::s_fail_mask = 0;
+
+#if defined(__GNUC__)
+    struct over_aligned
+    {
+        void operator() () const
+        {
+        }
+    }   __attribute__((aligned(64)));
+#endif
+
+    struct pool_tag;
+
+    int answer ()
+    {
+        return  42;
+    }
+
+    void test ()
+    {
+        typedef inplace_function<void ()>   function_type;
+
+        assert((function_type::fits<small_type>::value));
+        assert((function_type::fits<large_type>::value == false));
+
+        atomic_int_t    calls = 0;
+        {
+            function_type   empty;
+            assert(empty.empty());
+            bool    thrown = false;
+            try
+            {
+                empty();
+            }
+            catch (k2::runtime_error&)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+
+            function_type   small_fn = small_type(&calls);
+            function_type   large_fn = large_type(&calls);
+            assert(small_type::s_live == 1);
+            assert(large_type::s_live == 1);
+            small_fn();
+            large_fn();
+            assert(calls == 2);
+
+            function_type   copy(large_fn);
+            assert(large_type::s_live == 2);
+            copy = small_fn;
+            assert(large_type::s_live == 1);
+            assert(small_type::s_live == 2);
+            copy();
+            assert(calls == 3);
+
+            small_fn.reset();
+            assert(small_fn.empty());
+            assert(small_type::s_live == 1);
+            small_fn = large_fn;
+            small_fn();
+            assert(calls == 4);
+
+            function_type   swapped = small_type(&calls);
+            swapped.swap(large_fn);
+            assert(small_type::s_live == 2);
+            assert(large_type::s_live == 2);
+            swapped();
+            large_fn();
+            assert(calls == 6);
+        }
+        assert(small_type::s_live == 0);
+        assert(large_type::s_live == 0);
+
+        //  A throwing copy leaves both sides of swap() as they were.
+        calls = 0;
+        {
+            assert((function_type::fits<fragile>::value));
+            function_type   lhs = fragile(&calls);
+            function_type   rhs = small_type(&calls);
+            int round = 0;
+            for (; round < 2; ++round)
+            {
+                //  Fails the last relocation, then the middle one.
+                fragile::s_copies = 0;
+                fragile::s_fail_mask = round ? 1 << 1 : 1 << 2;
+                bool    thrown = false;
+                try
+                {
+                    round ? rhs.swap(lhs) : lhs.swap(rhs);
+                }
+                catch (std::runtime_error&)
+                {
+                    thrown = true;
+                }
+                assert(thrown);
+                assert(fragile::s_live == 1);
+                assert(small_type::s_live == 1);
+                lhs();
+                rhs();
+                assert(calls == 2 * (round + 1));
+            }
+
+            //  The fragile functor is lost if putting it back throws.
+            fragile::s_copies = 0;
+            fragile::s_fail_mask = 1 << 2 | 1 << 3;
+            bool    thrown = false;
+            try
+            {
+                lhs.swap(rhs);
+            }
+            catch (std::runtime_error&)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(lhs.empty());
+            assert(fragile::s_live == 0);
+            rhs();
+            assert(calls == 5);
+        }
+        assert(small_type::s_live == 0);
+        fragile::s_fail_mask = 0;
+
+#if defined(__GNUC__)
+        typedef inplace_function<void (), 128>  wide_type;
+        assert((wide_type::fits<counted<64> >::value));
+        assert((wide_type::fits<over_aligned>::value == false));
+        wide_type   aligned_fn = over_aligned();
+        aligned_fn();
+#endif
+
+        inplace_function<int (), sizeof(void*)> pfn(&answer);
+        assert(pfn() == 42);
+
+        //  Entries are destroyed by the thread, before it is joined.
+        calls = 0;
+        {
+            const small_type    small_entry(&calls);
+            const large_type    large_entry(&calls);
+            {
+                thread  small_th(small_entry);
+                thread  large_th(large_entry);
+                small_th.join();
+                large_th.join();
+                assert(small_type::s_live == 1);
+                assert(large_type::s_live == 1);
+            }
+            {
+                pooled_thread<4, pool_tag>  small_th(small_entry);
+                pooled_thread<4, pool_tag>  large_th(large_entry);
+            }
+        }
+        assert(calls == 4);
+        assert(small_type::s_live == 0);
+        assert(large_type::s_live == 0);
+
+        calls = 0;
+        {
+            thread_pool pool(2);
+            size_t  idx = 0;
+            const small_type    small_task(&calls);
+            const large_type    large_task(&calls);
+            for (; idx < 1000; ++idx)
+            {
+                pool.submit(small_task);
+                pool.submit(large_task);
+            }
+            pool.shutdown();
+        }
+        assert(calls == 2000);
+        assert(small_type::s_live == 0);
+        assert(large_type::s_live == 0);
+
+        cout << "Test of inplace_function passed." << endl;
+    }
+
+}   //  namespace test_inplace_function
+
 #include <k2/memory.h>
 #include <k2/allocator.h>
 
@@ -633,6 +3296,30 @@ int main ()
         test_process_singleton::test();
         test_tcp::test();
         test_threading::test();
+        test_lock_profile::test();
+        test_reclaim::test();
+        test_mpmc_queue::test();
+        test_spsc_ring::test();
+        test_concurrent_hash_map::test();
+        test_sync::test();
+        test_sharded_counter::test();
+        test_thread_once::test();
+        test_flat_combining::test();
+        test_snapshot_ptr::test();
+        test_thread_pool::test();
+        test_pooled_thread::test();
+        test_future::test();
+        test_parallel::test();
+        test_cpu_topology::test();
+        test_cancellation::test();
+        test_timer_wheel::test();
+        test_fiber::test();
+        test_event_loop::test();
+        test_static_tls::test();
+        test_actor::test();
+        test_pipeline::test();
+        test_thread_options::test();
+        test_inplace_function::test();
     }
 
     return  0;
@@ -38,19 +38,20 @@
 #include <k2/timing.h>
 #include <k2/type_manip.h>
 #include <k2/allocator.h>
+#include <k2/mpmc_queue.h>
+#include <k2/cancellation.h>
 
 #include <iostream>
 #include <cassert>
-#include <queue>
 
 using namespace std;
 using namespace k2;
 using namespace k2::ipv4;
 
-queue<tcp_transport*>   tcp_queue;
-mutex                   tq_mtx;
-cond_var                tq_cv(tq_mtx);
+mpmc_queue<tcp_transport*>  tcp_queue(128);
 time_span               timeout(1000);
+//  Accepting is woken by cancellation, needs no short timeout.
+time_span               accept_timeout(60 * 1000);
 mutex                   cout_mtx;
 int	objs = 0;
 int ctor = 0;
@@ -90,31 +91,27 @@ struct tcp_sink_service
             {
                 auto_ptr<tcp_transport> ptcp;
                 {
-                    mutex::scoped_guard guard(tq_mtx);
+                    tcp_transport*  p = 0;
 
-                    while (tcp_queue.empty())
+                    while (tcp_queue.pop(p, timestamp(timeout)) == false)
                     {
-                        timestamp   timer(timeout);
-                        if (tq_cv.wait(timer) == false)
-                        {
-                            mutex::scoped_guard guard(cout_mtx);
-                            cout << "Service " << (int)m_id << ": pending for connection." << endl;
-                        }
-
                         thread::test_cancel();
+
+                        mutex::scoped_guard guard(cout_mtx);
+                        cout << "Service " << (int)m_id << ": pending for connection." << endl;
                     }
 
-                    ptcp.reset(tcp_queue.front());
-                    tcp_queue.pop();
+                    ptcp.reset(p);
                 }
                 {
                     char      buf[128] = "";
+                    cancel_token    token = thread::this_cancel_token();
 
                     try
                     {
                         for (size_t cnt = 0; cnt < 1000; ++cnt)
                         {
-                            if (ptcp->read(buf, sizeof(buf)) == 0)
+                            if (ptcp->read(buf, sizeof(buf), token) == 0)
                             {
                                 mutex::scoped_guard guard(cout_mtx);
                                 cout << "Service " << (int)m_id << ": connection closed by " << ptcp->get_desc() << "!!!" << endl;
@@ -135,6 +132,10 @@ struct tcp_sink_service
                         mutex::scoped_guard guard(cout_mtx);
                         cout << "Service " << (int)m_id << ": connection to " << ptcp->get_desc() << " is lost!!!" << endl;
                     }
+                    catch (cancelled_error&)
+                    {
+                        thread::test_cancel();
+                    }
                 }
             }
         }
@@ -193,16 +194,21 @@ struct service_mgr
             {
                timestamp       timer(time_span(600* 1000));
                on_mgr_cancelled on_cancel(service_pool, m_service_cnt);
+               cancel_token     token = thread::this_cancel_token();
 
                 while (1)
                 {
                     thread::test_cancel(on_cancel);
-                    auto_ptr<tcp_transport>  ptcp = listener.accept(timeout);
+                    auto_ptr<tcp_transport>  ptcp = listener.accept(accept_timeout, token);
 
                     if (ptcp.get())
                     {
-                        mutex::scoped_guard guard(cout_mtx);
-                        cout << "Mgr : new client " << ptcp->get_desc() << " accepted!!!" << endl;
+                        {
+                            mutex::scoped_guard guard(cout_mtx);
+                            cout << "Mgr : new client " << ptcp->get_desc() << " accepted!!!" << endl;
+                        }
+                        //  Blocks while the queue is full, services print
+                        //  under cout_mtx before they pop.
                         tcp_queue.push(ptcp.release());
                     }
                     else